@@ -0,0 +1,1235 @@
+/* Micro benchmarks for vkal.
+
+   Usage: GLFW_Benchmark <mode>
+
+   Modes:
+     upload    Throughput of the staging upload path in GB/s for different chunk sizes.
+     mapped    Uploads a file read into the heap vs. memory mapped vs. imported with VK_EXT_external_memory_host.
+     readback  Pipelined GPU->CPU copies of a 1080p image through the readback ring.
+     textures  Loads the example textures many times with 1..N decode threads, see texture_loader.h.
+     hostcopy  Creates 2048x2048 textures through the staging ring vs. VK_EXT_host_image_copy.
+     threads   Records a frame with tens of thousands of draws into secondaries on 1..N threads.
+     drawcost  CPU time per vkal_draw_indexed / vkal_draw_indexed2 with and without the state cache.
+     indirect  The same draws issued one by one vs. from an indirect buffer in one call.
+     culling   Frustum culling of 100k bounding spheres on the CPU vs. in a compute pass feeding indirect draws.
+     async     Frame times of a draw heavy frame and a compute load, recorded into the frame vs. on the async compute queue.
+     graph     Barrier count and transient memory of a deferred frame in the render graph, with and without aliasing.
+     pipelines Pipeline count and creation time of baked material state permutations vs. one pipeline with extended dynamic state.
+     indices   Index memory and frame time of meshes with 32 bit indices vs. narrowed to 16 bit where they fit.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+#include <GLFW/glfw3.h>
+
+#include <vkal.h>
+
+#include "platform.h"
+#include "texture_loader.h"
+#include "frustum_cull.h"
+#include "glslcompile.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+
+#define SCREEN_WIDTH  1280
+#define SCREEN_HEIGHT 768
+
+static GLFWwindow * window;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static bool device_supports_extension(VkPhysicalDevice device, char const * name)
+{
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &count, NULL);
+    VkExtensionProperties * properties = (VkExtensionProperties*)malloc(count * sizeof(VkExtensionProperties));
+    vkEnumerateDeviceExtensionProperties(device, NULL, &count, properties);
+    bool found = false;
+    for (uint32_t i = 0; i < count && !found; ++i) {
+        found = !strcmp(properties[i].extensionName, name);
+    }
+    free(properties);
+    return found;
+}
+
+/* Runs job(thread_index) on thread_count threads, the calling thread being index 0, and returns when all
+   of them are done. The threads live as long as the pool so thread creation does not end up in the timings. */
+struct WorkerPool
+{
+    std::vector<std::thread>      threads;
+    std::mutex                    mutex;
+    std::condition_variable       start_cv;
+    std::condition_variable       done_cv;
+    std::function<void(uint32_t)> job;
+    uint64_t                      generation = 0;
+    uint32_t                      pending = 0;
+    bool                          quit = false;
+
+    explicit WorkerPool(uint32_t thread_count)
+    {
+        for (uint32_t i = 1; i < thread_count; ++i) {
+            threads.push_back(std::thread([this, i]() {
+                uint64_t seen = 0;
+                for (;;) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    start_cv.wait(lock, [&]() { return quit || generation != seen; });
+                    if (quit) return;
+                    seen = generation;
+                    lock.unlock();
+                    job(i);
+                    lock.lock();
+                    if (--pending == 0) done_cv.notify_one();
+                }
+            }));
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        start_cv.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    }
+
+    void run(std::function<void(uint32_t)> const & new_job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = new_job;
+            pending = (uint32_t)threads.size();
+            ++generation;
+        }
+        start_cv.notify_all();
+        job(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return pending == 0; });
+    }
+};
+
+/* A tiny triangle drawn over and over. Every draw rebinds its vertex buffer, like a scene with many small meshes. */
+struct DrawScene
+{
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorSet       descriptor_set;
+    VkPipelineLayout      pipeline_layout;
+    VkPipeline            pipeline;
+    uint64_t              offset_vertices;
+    uint64_t              offset_indices;
+};
+
+static DrawScene create_draw_scene(VkalInfo * vkal_info)
+{
+    DrawScene scene = {};
+    uint8_t * vertex_byte_code = 0;
+    int vertex_code_size;
+    read_file("/../../src/examples/assets/shaders/hello_triangle_vert.spv", &vertex_byte_code, &vertex_code_size);
+    uint8_t * fragment_byte_code = 0;
+    int fragment_code_size;
+    read_file("/../../src/examples/assets/shaders/hello_triangle_frag.spv", &fragment_byte_code, &fragment_code_size);
+    ShaderStageSetup shader_setup = vkal_create_shaders(vertex_byte_code, vertex_code_size, fragment_byte_code, fragment_code_size, NULL, 0);
+
+    VkVertexInputBindingDescription vertex_input_bindings[] = {
+        { 0, 8 * sizeof(float), VK_VERTEX_INPUT_RATE_VERTEX }
+    };
+    VkVertexInputAttributeDescription vertex_attributes[] = {
+        { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 },
+        { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, 3 * sizeof(float) },
+        { 2, 0, VK_FORMAT_R32G32_SFLOAT,    6 * sizeof(float) },
+    };
+    VkDescriptorSetLayoutBinding set_layout[] = {
+        { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, 0 }
+    };
+    scene.descriptor_set_layout = vkal_create_descriptor_set_layout(set_layout, 1);
+    VkDescriptorSet * descriptor_sets = &scene.descriptor_set;
+    vkal_allocate_descriptor_sets(vkal_info->default_descriptor_pool, &scene.descriptor_set_layout, 1, &descriptor_sets);
+    scene.pipeline_layout = vkal_create_pipeline_layout(&scene.descriptor_set_layout, 1, NULL, 0);
+    scene.pipeline = vkal_create_graphics_pipeline(
+        vertex_input_bindings, 1,
+        vertex_attributes, VKAL_ARRAY_LENGTH(vertex_attributes),
+        shader_setup, VK_FALSE, VK_COMPARE_OP_LESS_OR_EQUAL, VK_CULL_MODE_NONE, VK_POLYGON_MODE_FILL,
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        VK_FRONT_FACE_CLOCKWISE,
+        vkal_info->render_pass, scene.pipeline_layout);
+
+    float vertices[] = {
+        -0.01f, -0.01f, 0,  1, 0, 0,  0, 0,
+         0.00f,  0.01f, 0,  0, 1, 0,  1, 0,
+         0.01f, -0.01f, 0,  0, 0, 1,  0, 1
+    };
+    uint16_t indices[] = { 0, 1, 2 };
+    scene.offset_vertices = vkal_vertex_buffer_add(vertices, 8 * sizeof(float), 3);
+    scene.offset_indices = vkal_index_buffer_add(indices, 3);
+
+    // View and projection are identity, the triangle is given in NDC.
+    float view_proj[32] = { 0 };
+    for (uint32_t i = 0; i < 4; ++i) {
+        view_proj[i * 5] = 1.0f;
+        view_proj[16 + i * 5] = 1.0f;
+    }
+    UniformBuffer view_proj_ub = vkal_create_uniform_buffer(sizeof(view_proj), 1, 0);
+    vkal_update_descriptor_set_uniform(scene.descriptor_set, view_proj_ub, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    vkal_update_uniform(&view_proj_ub, view_proj);
+
+    free(vertex_byte_code);
+    free(fragment_byte_code);
+    return scene;
+}
+
+static void destroy_draw_scene(DrawScene * scene)
+{
+    vkal_destroy_graphics_pipeline(scene->pipeline);
+}
+
+void init_window()
+{
+    glfwInit();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "VKAL Benchmark", 0, 0);
+}
+
+/* Uploads the same payload a couple of times per chunk size and waits for the GPU after each round. */
+void benchmark_upload(void)
+{
+    VkDeviceSize const buffer_size = 256 * VKAL_MB;
+    uint32_t const rounds = 8;
+
+    uint8_t * data = (uint8_t*)malloc(buffer_size);
+    for (VkDeviceSize i = 0; i < buffer_size; ++i) {
+        data[i] = (uint8_t)i;
+    }
+
+    DeviceMemory memory = vkal_allocate_devicememory(buffer_size + VKAL_MB,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    VkalBuffer buffer = vkal_create_buffer(buffer_size, &memory, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    uint32_t const image_dim = 8192;
+    uint32_t image;
+    create_image(image_dim, image_dim, 1, 1, 0, VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, &image);
+    bind_image_memory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkDeviceSize chunk_sizes[] = { 256 * 1024, VKAL_MB, 4 * VKAL_MB, 16 * VKAL_MB, STAGING_BUFFER_SIZE / 2, STAGING_BUFFER_SIZE };
+    printf("%-12s %14s %14s\n", "chunk size", "buffer GB/s", "image GB/s");
+    for (uint32_t c = 0; c < VKAL_ARRAY_LENGTH(chunk_sizes); ++c) {
+        vkal_set_upload_chunk_size(chunk_sizes[c]);
+
+        Clock::time_point start = Clock::now();
+        for (uint32_t r = 0; r < rounds; ++r) {
+            vkal_upload_wait(vkal_upload_buffer_async(buffer.buffer, 0, data, buffer_size));
+        }
+        double buffer_gbs = (double)(rounds * buffer_size) / seconds_since(start) / 1e9;
+
+        VkDeviceSize image_size = (VkDeviceSize)image_dim * image_dim * 4;
+        start = Clock::now();
+        for (uint32_t r = 0; r < rounds; ++r) {
+            vkal_upload_wait(upload_texture(get_image(image), image_dim, image_dim, 4, 1, data));
+        }
+        double image_gbs = (double)(rounds * image_size) / seconds_since(start) / 1e9;
+
+        printf("%9llu KB %14.2f %14.2f\n", (unsigned long long)(chunk_sizes[c] / 1024), buffer_gbs, image_gbs);
+    }
+
+    vkal_destroy_image(image);
+    vkal_destroy_buffer(&buffer);
+    vkal_free_devicememory(&memory);
+    free(data);
+}
+
+/* Writes a file next to the executable and uploads it three ways. The file is in the page cache after the first
+   round, so this measures the copies, not the disk. */
+void benchmark_mapped(VkalInfo * vkal_info)
+{
+    VkDeviceSize const file_size = 256 * VKAL_MB;
+    uint32_t const rounds = 4;
+    char const * filename = "/benchmark_mapped.bin";
+
+    {
+        char exe_path[256];
+        get_exe_path(exe_path, 256);
+        FILE * file = fopen(concat_paths(exe_path, filename).c_str(), "wb");
+        assert(file);
+        uint8_t * data = (uint8_t*)malloc(VKAL_MB);
+        for (uint32_t i = 0; i < VKAL_MB; ++i) data[i] = (uint8_t)i;
+        for (VkDeviceSize i = 0; i < file_size / VKAL_MB; ++i) fwrite(data, 1, VKAL_MB, file);
+        fclose(file);
+        free(data);
+    }
+
+    DeviceMemory memory = vkal_allocate_devicememory2(file_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VKAL_MEMORY_USAGE_GPU_ONLY, 0);
+    VkalBuffer buffer = vkal_create_buffer(file_size, &memory, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    printf("Host memory import: %s\n", vkal_info->host_import_alignment ? "yes" : "no");
+    printf("%-20s %10s\n", "path", "GB/s");
+    for (uint32_t path = 0; path < 3; ++path) {
+        Clock::time_point start = Clock::now();
+        for (uint32_t r = 0; r < rounds; ++r) {
+            if (path == 0) {
+                uint8_t * data = NULL;
+                int size = 0;
+                read_file(filename, &data, &size);
+                vkal_upload_wait(vkal_upload_buffer(buffer.buffer, 0, data, size));
+                free(data);
+            }
+            else {
+                MappedFile file;
+                map_file(filename, &file);
+                VkalUploadTicket ticket = path == 1 ?
+                    vkal_upload_buffer(buffer.buffer, 0, file.data, file.size) :
+                    vkal_upload_buffer_host(buffer.buffer, 0, file.data, file.size);
+                // The mapping has to outlive the copies.
+                vkal_upload_wait(ticket);
+                unmap_file(&file);
+            }
+        }
+        char const * names[] = { "read_file + staging", "mmap + staging", "mmap + import" };
+        printf("%-20s %10.2f\n", names[path], (double)(rounds * file_size) / seconds_since(start) / 1e9);
+    }
+
+    vkal_destroy_buffer(&buffer);
+    vkal_free_devicememory(&memory);
+}
+
+/* Keeps several readbacks in flight and consumes the oldest one, like a server that streams out every frame. */
+void benchmark_readback(void)
+{
+    uint32_t const width = 1920;
+    uint32_t const height = 1080;
+    uint32_t const frames = 240;
+
+    uint32_t image;
+    create_image(width, height, 1, 1, 0, VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, &image);
+    bind_image_memory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    uint8_t * pixels = (uint8_t*)malloc(width * height * 4);
+    memset(pixels, 0x7F, width * height * 4);
+    vkal_upload_wait(upload_texture(get_image(image), width, height, 4, 1, pixels));
+
+    printf("%-10s %12s %12s\n", "in flight", "frames/s", "GB/s");
+    for (uint32_t in_flight = 1; in_flight < VKAL_MAX_READBACKS; in_flight *= 2) {
+        VkalReadback pending[VKAL_MAX_READBACKS] = { 0 };
+        uint64_t checksum = 0;
+        Clock::time_point start = Clock::now();
+        for (uint32_t f = 0; f < frames + in_flight; ++f) {
+            uint32_t slot = f % in_flight;
+            if (pending[slot]) {
+                VkDeviceSize size;
+                uint8_t const * data = (uint8_t const *)vkal_readback_map(pending[slot], &size);
+                checksum += data[size - 1];
+                vkal_readback_release(pending[slot]);
+                pending[slot] = 0;
+            }
+            if (f < frames) {
+                pending[slot] = vkal_readback_image(get_image(image), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_IMAGE_ASPECT_COLOR_BIT, VK_FORMAT_R8G8B8A8_UNORM, 0, 0, width, height);
+            }
+        }
+        double seconds = seconds_since(start);
+        printf("%-10u %12.1f %12.2f\n", in_flight, frames / seconds, (double)frames * width * height * 4 / seconds / 1e9);
+        assert(checksum == (uint64_t)frames * 0x7F);
+    }
+
+    vkal_destroy_image(image);
+    free(pixels);
+}
+
+/* Loads the same handful of files over and over to simulate a scene with hundreds of textures. */
+void benchmark_textures(void)
+{
+    char const * files[] = {
+        "/../../src/examples/assets/textures/vklogo.jpg",
+        "/../../src/examples/assets/textures/brucelee.jpg",
+        "/../../src/examples/assets/textures/hk.jpg",
+        "/../../src/examples/assets/textures/sand_diffuse.jpg",
+        "/../../src/examples/assets/textures/knight.png",
+        "/../../src/examples/assets/textures/asteroidsheet.png"
+    };
+    uint32_t const texture_count = 240;
+
+    TextureLoadRequest * requests = (TextureLoadRequest*)malloc(texture_count * sizeof(TextureLoadRequest));
+    VkalTexture * textures = (VkalTexture*)malloc(texture_count * sizeof(VkalTexture));
+    for (uint32_t i = 0; i < texture_count; ++i) {
+        TextureLoadRequest request = {};
+        request.filename = files[i % VKAL_ARRAY_LENGTH(files)];
+        request.min_filter = VK_FILTER_LINEAR;
+        request.mag_filter = VK_FILTER_LINEAR;
+        request.address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        request.mip_level_count = 1;
+        requests[i] = request;
+    }
+
+    uint32_t max_threads = VKAL_MAX(std::thread::hardware_concurrency(), 1u);
+    printf("%-8s %10s %10s %10s %10s %10s\n", "threads", "read s", "decode s", "upload s", "wait s", "total s");
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        TextureLoadTimings timings;
+        vkal_upload_wait(load_textures(requests, texture_count, textures, threads, &timings));
+        printf("%-8u %10.3f %10.3f %10.3f %10.3f %10.3f\n", threads,
+            timings.read_seconds, timings.decode_seconds, timings.upload_seconds,
+            timings.wait_seconds, timings.total_seconds);
+        for (uint32_t i = 0; i < texture_count; ++i) {
+            if (textures[i].sampler != VK_NULL_HANDLE) {
+                vkal_destroy_texture(&textures[i]);
+            }
+        }
+    }
+
+    free(textures);
+    free(requests);
+}
+
+/* Time until the textures can be sampled, including the wait for the staging copies. */
+void benchmark_hostcopy(VkalInfo * vkal_info)
+{
+    uint32_t const size = 2048;
+    uint32_t const texture_count = 32;
+
+    uint8_t * pixels = (uint8_t*)malloc(size * size * 4);
+    for (uint32_t i = 0; i < size * size * 4; ++i) pixels[i] = (uint8_t)i;
+    VkalTexture * textures = (VkalTexture*)malloc(texture_count * sizeof(VkalTexture));
+
+    printf("Host image copy: %s\n", vkal_info->host_image_copy_supported ? "yes" : "no");
+    printf("%-10s %10s %10s\n", "path", "ms", "GB/s");
+    for (uint32_t host = 0; host <= vkal_info->host_image_copy_supported; ++host) {
+        vkal_use_host_image_copy(host);
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < texture_count; ++i) {
+            textures[i] = vkal_create_texture(0, pixels, size, size, 4, 0, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+                0, 1, 0, 1, VK_FILTER_LINEAR, VK_FILTER_LINEAR,
+                VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT);
+        }
+        vkal_upload_wait(vkal_upload_flush());
+        double seconds = seconds_since(start);
+        printf("%-10s %10.2f %10.2f\n", host ? "host copy" : "staging", seconds * 1000.0,
+            (double)texture_count * size * size * 4 / seconds / 1e9);
+        for (uint32_t i = 0; i < texture_count; ++i) {
+            vkal_destroy_texture(&textures[i]);
+        }
+    }
+    vkal_use_host_image_copy(1);
+
+    free(textures);
+    free(pixels);
+}
+
+/* CPU time to record a frame of draw_count draws split evenly across secondaries on 1..N threads. */
+void benchmark_threads(VkalInfo * vkal_info)
+{
+    uint32_t const draw_count = 50000;
+    uint32_t const frames = 100;
+    DrawScene scene = create_draw_scene(vkal_info);
+
+    uint32_t max_threads = VKAL_MIN(VKAL_MAX(std::thread::hardware_concurrency(), 1u), (uint32_t)VKAL_MAX_RECORD_THREADS);
+    printf("%-8s %12s %12s %14s\n", "threads", "record ms", "frame ms", "draws/ms");
+    for (uint32_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        WorkerPool pool(thread_count);
+        double record_seconds = 0.0;
+        uint32_t recorded_frames = 0;
+        Clock::time_point frames_start = Clock::now();
+        for (uint32_t f = 0; f < frames; ++f) {
+            VkalFrameContext * frame = vkal_begin_frame();
+            if (!frame) continue;
+
+            Clock::time_point start = Clock::now();
+            vkal_begin2(frame->image_id, frame->command_buffer, vkal_info->render_pass, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            VkFramebuffer framebuffer = vkal_info->framebuffers[frame->image_id];
+            pool.run([&](uint32_t t) {
+                VkCommandBuffer command_buffer = vkal_begin_secondary(frame, t, vkal_info->render_pass, framebuffer);
+                vkal_viewport(command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+                vkal_scissor(command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+                vkal_bind_descriptor_set2(command_buffer, 0, &scene.descriptor_set, 1, scene.pipeline_layout);
+                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scene.pipeline);
+                vkCmdBindIndexBuffer(command_buffer, vkal_info->default_index_buffer.buffer, scene.offset_indices, VK_INDEX_TYPE_UINT16);
+                uint32_t first = t * draw_count / thread_count;
+                uint32_t last = (t + 1) * draw_count / thread_count;
+                for (uint32_t d = first; d < last; ++d) {
+                    VkDeviceSize offset = scene.offset_vertices;
+                    vkCmdBindVertexBuffers(command_buffer, 0, 1, &vkal_info->default_vertex_buffer.buffer, &offset);
+                    vkCmdDrawIndexed(command_buffer, 3, 1, 0, 0, 0);
+                }
+                vkal_end_secondary(command_buffer);
+            });
+            vkal_execute_secondaries(frame);
+            vkal_end(frame->command_buffer);
+            record_seconds += seconds_since(start);
+            ++recorded_frames;
+
+            vkal_end_frame(frame);
+        }
+        vkDeviceWaitIdle(vkal_info->device);
+        double record_ms = record_seconds * 1000.0 / recorded_frames;
+        printf("%-8u %12.3f %12.3f %14.1f\n", thread_count, record_ms,
+            seconds_since(frames_start) * 1000.0 / recorded_frames, draw_count / record_ms);
+    }
+
+    destroy_draw_scene(&scene);
+}
+
+/* Draws the same mesh with the same pipeline and descriptor set through the helpers, which is what a naive
+   render loop does. With the state cache everything but the first bind of each kind is skipped. */
+void benchmark_drawcost(VkalInfo * vkal_info)
+{
+    uint32_t const draw_count = 20000;
+    uint32_t const frames = 50;
+    DrawScene scene = create_draw_scene(vkal_info);
+
+    printf("%-16s %-6s %12s\n", "helper", "cache", "ns/draw");
+    for (uint32_t helper = 0; helper < 2; ++helper) {
+        for (int cache = 0; cache < 2; ++cache) {
+            vkal_use_state_cache(cache);
+            double record_seconds = 0.0;
+            uint32_t recorded_frames = 0;
+            for (uint32_t f = 0; f < frames; ++f) {
+                VkalFrameContext * frame = vkal_begin_frame();
+                if (!frame) continue;
+                uint32_t image_id = frame->image_id;
+
+                Clock::time_point start = Clock::now();
+                vkal_begin(image_id, frame->command_buffer, vkal_info->render_pass);
+                vkal_viewport(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+                vkal_scissor(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+                for (uint32_t d = 0; d < draw_count; ++d) {
+                    vkal_bind_descriptor_set(image_id, &scene.descriptor_set, scene.pipeline_layout);
+                    if (helper == 0) {
+                        vkal_draw_indexed(image_id, scene.pipeline, scene.offset_indices, 3, scene.offset_vertices, 1);
+                    }
+                    else {
+                        vkal_draw_indexed2(frame->command_buffer, scene.pipeline, scene.offset_indices, 3, scene.offset_vertices);
+                    }
+                }
+                vkal_end(frame->command_buffer);
+                record_seconds += seconds_since(start);
+                ++recorded_frames;
+
+                vkal_end_frame(frame);
+            }
+            printf("%-16s %-6s %12.1f\n", helper == 0 ? "draw_indexed" : "draw_indexed2", cache ? "on" : "off",
+                record_seconds * 1e9 / ((double)recorded_frames * draw_count));
+        }
+    }
+    vkal_use_state_cache(1);
+    vkDeviceWaitIdle(vkal_info->device);
+
+    destroy_draw_scene(&scene);
+}
+
+void benchmark_indirect(VkalInfo * vkal_info)
+{
+    uint32_t const draw_count = 20000;
+    uint32_t const frames = 100;
+    DrawScene scene = create_draw_scene(vkal_info);
+
+    DeviceMemory memory = vkal_allocate_devicememory2(vkal_indirect_buffer_size(draw_count) + VKAL_MB,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VKAL_MEMORY_USAGE_GPU_ONLY, 0);
+    VkalIndirectBuffer indirect_buffer = vkal_create_indirect_buffer(&memory, draw_count);
+    std::vector<VkalDrawRecord> records(draw_count);
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        VkalDrawRecord record = {};
+        record.index_buffer_offset = scene.offset_indices;
+        record.index_count = 3;
+        record.vertex_buffer_offset = scene.offset_vertices;
+        record.vertex_size = 8 * sizeof(float);
+        record.instance_count = 1;
+        records[i] = record;
+    }
+    vkal_upload_wait(vkal_update_indirect_buffer(&indirect_buffer, records.data(), draw_count));
+
+    printf("multiDrawIndirect: %s, drawIndirectCount: %s\n",
+        vkal_info->multi_draw_indirect_supported ? "yes" : "no", vkal_info->draw_indirect_count_supported ? "yes" : "no");
+    printf("%-14s %12s %12s\n", "path", "record ms", "frame ms");
+    for (uint32_t path = 0; path < 3; ++path) {
+        double record_seconds = 0.0;
+        uint32_t recorded_frames = 0;
+        Clock::time_point frames_start = Clock::now();
+        for (uint32_t f = 0; f < frames; ++f) {
+            VkalFrameContext * frame = vkal_begin_frame();
+            if (!frame) continue;
+            uint32_t image_id = frame->image_id;
+
+            Clock::time_point start = Clock::now();
+            vkal_begin(image_id, frame->command_buffer, vkal_info->render_pass);
+            vkal_viewport(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+            vkal_scissor(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+            vkal_bind_descriptor_set(image_id, &scene.descriptor_set, scene.pipeline_layout);
+            if (path == 0) {
+                for (uint32_t d = 0; d < draw_count; ++d) {
+                    vkal_draw_indexed(image_id, scene.pipeline, scene.offset_indices, 3, scene.offset_vertices, 1);
+                }
+            }
+            else if (path == 1) {
+                vkal_draw_indexed_indirect(image_id, scene.pipeline, &indirect_buffer, 0, draw_count);
+            }
+            else {
+                vkal_draw_indirect_count(image_id, scene.pipeline, &indirect_buffer);
+            }
+            vkal_end(frame->command_buffer);
+            record_seconds += seconds_since(start);
+            ++recorded_frames;
+
+            vkal_end_frame(frame);
+        }
+        vkDeviceWaitIdle(vkal_info->device);
+        char const * names[] = { "direct", "indirect", "indirect count" };
+        printf("%-14s %12.3f %12.3f\n", names[path], record_seconds * 1000.0 / recorded_frames,
+            seconds_since(frames_start) * 1000.0 / recorded_frames);
+    }
+
+    vkal_destroy_indirect_buffer(&indirect_buffer);
+    vkal_free_devicememory(&memory);
+    destroy_draw_scene(&scene);
+}
+
+void benchmark_culling(VkalInfo * vkal_info)
+{
+    uint32_t const draw_count = 64;
+    uint32_t const instance_count = 100000;
+    uint32_t const frames = 100;
+    if (!vkal_info->draw_indirect_first_instance_supported) {
+        printf("drawIndirectFirstInstance is not supported\n");
+        return;
+    }
+    DrawScene scene = create_draw_scene(vkal_info);
+
+    std::vector<VkalDrawRecord> records(draw_count);
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        VkalDrawRecord record = {};
+        record.index_buffer_offset = scene.offset_indices;
+        record.index_count = 3;
+        record.vertex_buffer_offset = scene.offset_vertices;
+        record.vertex_size = 8 * sizeof(float);
+        records[i] = record;
+    }
+    std::vector<CullInstance> instances(instance_count);
+    srand(42);
+    for (uint32_t i = 0; i < instance_count; ++i) {
+        glm::vec3 center(rand() % 2001 - 1000, rand() % 201 - 100, rand() % 2001 - 1000);
+        CullInstance instance = {};
+        instance.sphere = glm::vec4(0.1f * center, 0.5f + (rand() % 100) / 100.0f);
+        instance.draw_index = i % draw_count;
+        instances[i] = instance;
+    }
+    FrustumCuller culler = create_frustum_culler(vkal_info, records.data(), draw_count, instances.data(), instance_count);
+    vkal_upload_wait(vkal_upload_flush());
+
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 200.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0, 10, 0), glm::vec3(1, 10, 1), glm::vec3(0, 1, 0));
+    glm::mat4 view_proj = proj * view;
+
+    // CPU: the same sphere test, compacting the visible instances per draw.
+    glm::mat4 m = glm::transpose(view_proj);
+    glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2], m[3] - m[2] };
+    for (uint32_t i = 0; i < 6; ++i) planes[i] /= glm::length(glm::vec3(planes[i]));
+    std::vector<uint32_t> visible(instance_count);
+    std::vector<uint32_t> draw_visible(draw_count);
+    uint32_t cpu_visible = 0;
+    Clock::time_point cpu_start = Clock::now();
+    for (uint32_t f = 0; f < frames; ++f) {
+        cpu_visible = 0;
+        for (uint32_t d = 0; d < draw_count; ++d) draw_visible[d] = 0;
+        for (uint32_t i = 0; i < instance_count; ++i) {
+            glm::vec4 sphere = instances[i].sphere;
+            bool inside = true;
+            for (uint32_t p = 0; p < 6 && inside; ++p) {
+                inside = glm::dot(glm::vec3(planes[p]), glm::vec3(sphere)) + planes[p].w >= -sphere.w;
+            }
+            if (inside) {
+                visible[cpu_visible++] = i;
+                draw_visible[instances[i].draw_index]++;
+            }
+        }
+    }
+    double cpu_ms = seconds_since(cpu_start) * 1000.0 / frames;
+
+    // GPU: cull in the frame's command buffer right before the render pass.
+    double record_seconds = 0.0;
+    uint32_t recorded_frames = 0;
+    Clock::time_point frames_start = Clock::now();
+    for (uint32_t f = 0; f < frames; ++f) {
+        VkalFrameContext * frame = vkal_begin_frame();
+        if (!frame) continue;
+        uint32_t image_id = frame->image_id;
+
+        Clock::time_point start = Clock::now();
+        vkal_begin_command_buffer(image_id);
+        record_frustum_cull(&culler, frame->command_buffer, view_proj);
+        vkal_begin_render_pass(image_id, vkal_info->render_pass);
+        vkal_viewport(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+        vkal_scissor(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+        vkal_bind_descriptor_set(image_id, &scene.descriptor_set, scene.pipeline_layout);
+        vkal_draw_indexed_indirect(image_id, scene.pipeline, &culler.draws, 0, draw_count);
+        vkal_end(frame->command_buffer);
+        record_seconds += seconds_since(start);
+        ++recorded_frames;
+
+        vkal_end_frame(frame);
+    }
+    vkDeviceWaitIdle(vkal_info->device);
+    double gpu_frame_ms = seconds_since(frames_start) * 1000.0 / recorded_frames;
+
+    // The instance counts the last pass wrote have to add up to what the CPU found.
+    VkalReadback readback = vkal_readback_buffer(culler.draws.buffer.buffer, VKAL_INDIRECT_COMMANDS_OFFSET,
+        draw_count * sizeof(VkDrawIndexedIndirectCommand));
+    vkal_readback_wait(readback);
+    VkDrawIndexedIndirectCommand const * commands = (VkDrawIndexedIndirectCommand const *)vkal_readback_map(readback, NULL);
+    uint32_t gpu_visible = 0;
+    for (uint32_t d = 0; d < draw_count; ++d) gpu_visible += commands[d].instanceCount;
+    vkal_readback_release(readback);
+
+    printf("%u instances in %u draws, visible: CPU %u, GPU %u\n", instance_count, draw_count, cpu_visible, gpu_visible);
+    printf("CPU cull: %.3f ms, GPU path record: %.3f ms, frame: %.3f ms\n", cpu_ms,
+        record_seconds * 1000.0 / recorded_frames, gpu_frame_ms);
+
+    destroy_frustum_culler(&culler);
+    destroy_draw_scene(&scene);
+}
+
+void benchmark_async(VkalInfo * vkal_info)
+{
+    uint32_t const draw_count = 20000;
+    uint32_t const value_count = 1024 * 1024;
+    uint32_t const frames = 100;
+    DrawScene scene = create_draw_scene(vkal_info);
+
+    DeviceMemory memory = vkal_allocate_devicememory2(vkal_indirect_buffer_size(draw_count) + value_count * 4 * sizeof(float) + VKAL_MB,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VKAL_MEMORY_USAGE_GPU_ONLY, 0);
+    VkalIndirectBuffer indirect_buffer = vkal_create_indirect_buffer(&memory, draw_count);
+    std::vector<VkalDrawRecord> records(draw_count);
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        VkalDrawRecord record = {};
+        record.index_buffer_offset = scene.offset_indices;
+        record.index_count = 3;
+        record.vertex_buffer_offset = scene.offset_vertices;
+        record.vertex_size = 8 * sizeof(float);
+        record.instance_count = 1;
+        records[i] = record;
+    }
+    vkal_upload_wait(vkal_update_indirect_buffer(&indirect_buffer, records.data(), draw_count));
+
+    // Only the compute work touches the values, so they never change queue family ownership.
+    VkalBuffer values = vkal_create_buffer(value_count * 4 * sizeof(float), &memory, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    VkDescriptorSetLayoutBinding set_layout[] = {
+        { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0 }
+    };
+    VkDescriptorSetLayout compute_set_layout = vkal_create_descriptor_set_layout(set_layout, 1);
+    VkDescriptorSet compute_set;
+    VkDescriptorSet * descriptor_sets = &compute_set;
+    vkal_allocate_descriptor_sets(vkal_info->default_descriptor_pool, &compute_set_layout, 1, &descriptor_sets);
+    vkal_update_descriptor_set_bufferarray(compute_set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, 0, values);
+    VkPushConstantRange push_constant_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, 2 * sizeof(uint32_t) };
+    VkPipelineLayout compute_layout = vkal_create_pipeline_layout(&compute_set_layout, 1, &push_constant_range, 1);
+    uint8_t * shader_code = NULL;
+    int shader_code_size = 0;
+    load_glsl_and_compile("../../src/examples/assets/shaders/compute_load.comp", &shader_code, &shader_code_size, SHADER_TYPE_COMPUTE);
+    SingleShaderStageSetup shader_setup = vkal_create_shader(shader_code, shader_code_size, VK_SHADER_STAGE_COMPUTE_BIT);
+    VkPipeline compute_pipeline = vkal_create_compute_pipeline(shader_setup, compute_layout);
+    free(shader_code);
+    uint32_t params[2] = { value_count, 256 };
+
+    printf("Dedicated compute queue: %s\n", vkal_info->compute_queue != VK_NULL_HANDLE ? "yes" : "no, async falls back to the graphics queue");
+    printf("%-16s %12s\n", "path", "frame ms");
+    for (uint32_t path = 0; path < 4; ++path) {
+        bool draw = path != 1;
+        bool compute = path != 0;
+        bool async = path == 3;
+        uint32_t recorded_frames = 0;
+        Clock::time_point frames_start = Clock::now();
+        for (uint32_t f = 0; f < frames; ++f) {
+            VkalFrameContext * frame = vkal_begin_frame();
+            if (!frame) continue;
+            uint32_t image_id = frame->image_id;
+
+            VkCommandBuffer compute_command_buffer = VK_NULL_HANDLE;
+            if (compute) {
+                compute_command_buffer = async ? vkal_begin_compute() : frame->command_buffer;
+            }
+            vkal_begin_command_buffer(image_id);
+            if (compute) {
+                vkal_bind_compute_descriptor_sets(compute_command_buffer, compute_layout, 0, &compute_set, 1);
+                vkCmdPushConstants(compute_command_buffer, compute_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), params);
+                vkal_dispatch(compute_command_buffer, compute_pipeline, (value_count + 63) / 64, 1, 1);
+                // Nothing in the frame reads the values, waiting in the compute stage lets all of the draws overlap.
+                if (async) vkal_compute_submit(compute_command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+            }
+            vkal_begin_render_pass(image_id, vkal_info->render_pass);
+            if (draw) {
+                vkal_viewport(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+                vkal_scissor(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+                vkal_bind_descriptor_set(image_id, &scene.descriptor_set, scene.pipeline_layout);
+                vkal_draw_indexed_indirect(image_id, scene.pipeline, &indirect_buffer, 0, draw_count);
+            }
+            vkal_end(frame->command_buffer);
+            ++recorded_frames;
+
+            vkal_end_frame(frame);
+        }
+        vkDeviceWaitIdle(vkal_info->device);
+        char const * names[] = { "draws", "compute", "both, one queue", "both, async" };
+        printf("%-16s %12.3f\n", names[path], seconds_since(frames_start) * 1000.0 / recorded_frames);
+    }
+
+    vkal_destroy_compute_pipeline(compute_pipeline);
+    destroy_shader_module(shader_setup.module);
+    vkal_destroy_buffer(&values);
+    vkal_destroy_indirect_buffer(&indirect_buffer);
+    vkal_free_devicememory(&memory);
+    destroy_draw_scene(&scene);
+}
+
+static void graph_count_pass(VkCommandBuffer command_buffer, VkalGraph * graph, void * user_data)
+{
+    // The passes only exist for their barriers, a real pass would draw or dispatch here.
+    ++*(uint32_t*)user_data;
+}
+
+// Returns false if the compiled graph does not match what the frame below is expected to compile to.
+bool benchmark_graph(VkalInfo * vkal_info)
+{
+    uint32_t const frames = 200;
+    uint32_t const width = vkal_info->swapchain_extent.width;
+    uint32_t const height = vkal_info->swapchain_extent.height;
+    VkPipelineStageFlags const fragment = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    VkPipelineStageFlags const compute = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    uint32_t executed_passes = 0;
+
+    // A deferred frame: gbuffer -> ssao (compute) -> lighting -> bloom (compute) -> tonemap into the swapchain image.
+    // The debug view of the normals is never read and gets culled.
+    VkalGraph * graph = (VkalGraph*)malloc(sizeof(VkalGraph));
+    vkal_graph_begin(graph);
+    uint32_t albedo = vkal_graph_create_image(graph, width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+    uint32_t normals = vkal_graph_create_image(graph, width, height, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+    uint32_t depth = vkal_graph_create_image(graph, width, height, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT);
+    uint32_t ao = vkal_graph_create_image(graph, width, height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+    uint32_t hdr = vkal_graph_create_image(graph, width, height, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+    uint32_t bloom = vkal_graph_create_image(graph, width / 2, height / 2, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+    uint32_t debug = vkal_graph_create_image(graph, width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+    uint32_t backbuffer = vkal_graph_import_image(graph, vkal_info->swapchain_images[0], vkal_info->swapchain_image_views[0],
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+    uint32_t gbuffer_pass = vkal_graph_add_pass(graph, "gbuffer", graph_count_pass, &executed_passes);
+    vkal_graph_use(graph, gbuffer_pass, albedo, VKAL_GRAPH_USAGE_COLOR_ATTACHMENT, 0);
+    vkal_graph_use(graph, gbuffer_pass, normals, VKAL_GRAPH_USAGE_COLOR_ATTACHMENT, 0);
+    vkal_graph_use(graph, gbuffer_pass, depth, VKAL_GRAPH_USAGE_DEPTH_ATTACHMENT, 0);
+    uint32_t debug_pass = vkal_graph_add_pass(graph, "debug normals", graph_count_pass, &executed_passes);
+    vkal_graph_use(graph, debug_pass, normals, VKAL_GRAPH_USAGE_SAMPLED, fragment);
+    vkal_graph_use(graph, debug_pass, debug, VKAL_GRAPH_USAGE_COLOR_ATTACHMENT, 0);
+    uint32_t ssao_pass = vkal_graph_add_pass(graph, "ssao", graph_count_pass, &executed_passes);
+    vkal_graph_use(graph, ssao_pass, depth, VKAL_GRAPH_USAGE_SAMPLED, compute);
+    vkal_graph_use(graph, ssao_pass, normals, VKAL_GRAPH_USAGE_SAMPLED, compute);
+    vkal_graph_use(graph, ssao_pass, ao, VKAL_GRAPH_USAGE_STORAGE_WRITE, compute);
+    uint32_t lighting_pass = vkal_graph_add_pass(graph, "lighting", graph_count_pass, &executed_passes);
+    vkal_graph_use(graph, lighting_pass, albedo, VKAL_GRAPH_USAGE_SAMPLED, fragment);
+    vkal_graph_use(graph, lighting_pass, normals, VKAL_GRAPH_USAGE_SAMPLED, fragment);
+    vkal_graph_use(graph, lighting_pass, depth, VKAL_GRAPH_USAGE_SAMPLED, fragment);
+    vkal_graph_use(graph, lighting_pass, ao, VKAL_GRAPH_USAGE_STORAGE_READ, fragment);
+    vkal_graph_use(graph, lighting_pass, hdr, VKAL_GRAPH_USAGE_COLOR_ATTACHMENT, 0);
+    uint32_t bloom_pass = vkal_graph_add_pass(graph, "bloom", graph_count_pass, &executed_passes);
+    vkal_graph_use(graph, bloom_pass, hdr, VKAL_GRAPH_USAGE_SAMPLED, compute);
+    vkal_graph_use(graph, bloom_pass, bloom, VKAL_GRAPH_USAGE_STORAGE_WRITE, compute);
+    uint32_t tonemap_pass = vkal_graph_add_pass(graph, "tonemap", graph_count_pass, &executed_passes);
+    vkal_graph_use(graph, tonemap_pass, hdr, VKAL_GRAPH_USAGE_SAMPLED, fragment);
+    vkal_graph_use(graph, tonemap_pass, bloom, VKAL_GRAPH_USAGE_SAMPLED, fragment);
+    vkal_graph_use(graph, tonemap_pass, backbuffer, VKAL_GRAPH_USAGE_COLOR_ATTACHMENT, 0);
+
+    Clock::time_point compile_start = Clock::now();
+    vkal_graph_compile(graph);
+    double compile_ms = seconds_since(compile_start) * 1000.0;
+
+    uint32_t use_count = 0;
+    for (uint32_t p = 0; p < graph->pass_count; ++p) {
+        use_count += graph->passes[p].access_count;
+    }
+    printf("passes: %u, culled: %u, compile %.3f ms\n", graph->pass_count, graph->culled_pass_count, compile_ms);
+    for (uint32_t p = 0; p < graph->pass_count; ++p) {
+        VkalGraphPass * pass = &graph->passes[p];
+        printf("  %-14s %s, %u barriers\n", pass->name, pass->culled ? "culled" : "kept  ", pass->barrier_count);
+    }
+    printf("barriers: %u in %u vkCmdPipelineBarrier calls (a barrier per use would be %u calls)\n",
+        graph->barrier_count, graph->barrier_batch_count, use_count);
+    printf("transient memory: %.2f MB aliased, %.2f MB without aliasing\n",
+        graph->transient_memory_size / (1024.0 * 1024.0), graph->unaliased_memory_size / (1024.0 * 1024.0));
+
+    // gbuffer 3, ssao 3, lighting 5, bloom 2, tonemap 3 and the present transition, one batch each.
+    bool valid = true;
+    if (graph->culled_pass_count != 1 || !graph->passes[debug_pass].culled) {
+        printf("graph check failed: only the debug normals pass should be culled\n");
+        valid = false;
+    }
+    if (graph->barrier_count != 17 || graph->barrier_batch_count != 6) {
+        printf("graph check failed: expected 17 barriers in 6 batches\n");
+        valid = false;
+    }
+    if (graph->transient_memory_size >= graph->unaliased_memory_size) {
+        printf("graph check failed: bloom should alias the gbuffer images\n");
+        valid = false;
+    }
+
+    uint32_t recorded_frames = 0;
+    double record_seconds = 0.0;
+    for (uint32_t f = 0; f < frames; ++f) {
+        VkalFrameContext * frame = vkal_begin_frame();
+        if (!frame) continue;
+        uint32_t image_id = frame->image_id;
+        vkal_graph_set_image(graph, backbuffer, vkal_info->swapchain_images[image_id], vkal_info->swapchain_image_views[image_id]);
+        vkal_begin_command_buffer(image_id);
+        Clock::time_point record_start = Clock::now();
+        vkal_graph_execute(graph, frame->command_buffer);
+        record_seconds += seconds_since(record_start);
+        vkal_end_command_buffer(image_id);
+        ++recorded_frames;
+        vkal_end_frame(frame);
+    }
+    vkDeviceWaitIdle(vkal_info->device);
+    printf("%u frames, %.2f us to record the graph, %u pass callbacks per frame\n", recorded_frames,
+        recorded_frames ? record_seconds * 1000000.0 / recorded_frames : 0.0, recorded_frames ? executed_passes / recorded_frames : 0);
+
+    vkal_graph_destroy(graph);
+    free(graph);
+    return valid;
+}
+
+void benchmark_pipelines(VkalInfo * vkal_info)
+{
+    VkalDynamicStateFlags const dynamic_states = VKAL_DYNAMIC_STATE_CULL_MODE | VKAL_DYNAMIC_STATE_FRONT_FACE |
+        VKAL_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY | VKAL_DYNAMIC_STATE_DEPTH_TEST;
+    if ((vkal_info->dynamic_state_support & dynamic_states) != dynamic_states) {
+        printf("Extended dynamic state is not supported\n");
+        return;
+    }
+    DrawScene scene = create_draw_scene(vkal_info);
+    uint8_t * vertex_byte_code = 0;
+    int vertex_code_size;
+    read_file("/../../src/examples/assets/shaders/hello_triangle_vert.spv", &vertex_byte_code, &vertex_code_size);
+    uint8_t * fragment_byte_code = 0;
+    int fragment_code_size;
+    read_file("/../../src/examples/assets/shaders/hello_triangle_frag.spv", &fragment_byte_code, &fragment_code_size);
+    ShaderStageSetup shader_setup = vkal_create_shaders(vertex_byte_code, vertex_code_size, fragment_byte_code, fragment_code_size, NULL, 0);
+    free(vertex_byte_code);
+    free(fragment_byte_code);
+    VkVertexInputBindingDescription vertex_input_bindings[] = {
+        { 0, 8 * sizeof(float), VK_VERTEX_INPUT_RATE_VERTEX }
+    };
+    VkVertexInputAttributeDescription vertex_attributes[] = {
+        { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 },
+        { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, 3 * sizeof(float) },
+        { 2, 0, VK_FORMAT_R32G32_SFLOAT,    6 * sizeof(float) },
+    };
+
+    // The state a material system picks per material, every combination is its own pipeline without dynamic state.
+    struct Material
+    {
+        VkCullModeFlags     cull_mode;
+        VkFrontFace         front_face;
+        VkBool32            depth_test;
+        VkCompareOp         compare_op;
+        VkPrimitiveTopology topology;
+    };
+    VkCullModeFlags const cull_modes[] = { VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT };
+    VkFrontFace const front_faces[] = { VK_FRONT_FACE_CLOCKWISE, VK_FRONT_FACE_COUNTER_CLOCKWISE };
+    VkCompareOp const compare_ops[] = { VK_COMPARE_OP_LESS, VK_COMPARE_OP_LESS_OR_EQUAL, VK_COMPARE_OP_ALWAYS };
+    VkPrimitiveTopology const topologies[] = { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP };
+    std::vector<Material> materials;
+    for (VkCullModeFlags cull_mode : cull_modes)
+        for (VkFrontFace front_face : front_faces)
+            for (VkCompareOp compare_op : compare_ops)
+                for (VkPrimitiveTopology topology : topologies)
+                    materials.push_back({ cull_mode, front_face, compare_op != VK_COMPARE_OP_ALWAYS, compare_op, topology });
+
+    std::vector<VkPipeline> static_pipelines;
+    Clock::time_point static_start = Clock::now();
+    for (Material const & material : materials) {
+        static_pipelines.push_back(vkal_create_graphics_pipeline(
+            vertex_input_bindings, 1, vertex_attributes, VKAL_ARRAY_LENGTH(vertex_attributes),
+            shader_setup, material.depth_test, material.compare_op, material.cull_mode, VK_POLYGON_MODE_FILL,
+            material.topology, material.front_face, vkal_info->render_pass, scene.pipeline_layout));
+    }
+    double static_ms = seconds_since(static_start) * 1000.0;
+
+    Clock::time_point dynamic_start = Clock::now();
+    VkPipeline dynamic_pipeline = vkal_create_graphics_pipeline2(
+        vertex_input_bindings, 1, vertex_attributes, VKAL_ARRAY_LENGTH(vertex_attributes),
+        shader_setup, VK_TRUE, VK_COMPARE_OP_LESS, VK_CULL_MODE_NONE, VK_POLYGON_MODE_FILL,
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FRONT_FACE_CLOCKWISE, vkal_info->render_pass, scene.pipeline_layout,
+        dynamic_states);
+    double dynamic_ms = seconds_since(dynamic_start) * 1000.0;
+
+    printf("%-10s %10s %12s\n", "states", "pipelines", "create ms");
+    printf("%-10s %10zu %12.3f\n", "baked", static_pipelines.size(), static_ms);
+    printf("%-10s %10u %12.3f\n", "dynamic", 1u, dynamic_ms);
+
+    // One frame per path that draws every material once, so both paths are exercised by the driver.
+    printf("%-10s %12s\n", "path", "record us");
+    for (uint32_t path = 0; path < 2; ++path) {
+        bool dynamic = path == 1;
+        VkalFrameContext * frame = vkal_begin_frame();
+        if (!frame) continue;
+        uint32_t image_id = frame->image_id;
+        vkal_begin_command_buffer(image_id);
+        vkal_begin_render_pass(image_id, vkal_info->render_pass);
+        Clock::time_point record_start = Clock::now();
+        vkal_viewport(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+        vkal_scissor(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+        vkal_bind_descriptor_set(image_id, &scene.descriptor_set, scene.pipeline_layout);
+        for (size_t m = 0; m < materials.size(); ++m) {
+            Material const & material = materials[m];
+            VkPipeline pipeline = static_pipelines[m];
+            if (dynamic) {
+                // Dynamic state set before the bind stays valid, vkal_draw_indexed only binds the pipeline once.
+                pipeline = dynamic_pipeline;
+                vkal_set_cull_mode(frame->command_buffer, material.cull_mode);
+                vkal_set_front_face(frame->command_buffer, material.front_face);
+                vkal_set_primitive_topology(frame->command_buffer, material.topology);
+                vkal_set_depth_test(frame->command_buffer, material.depth_test, material.depth_test, material.compare_op);
+            }
+            vkal_draw_indexed(image_id, pipeline, scene.offset_indices, 3, scene.offset_vertices, 1);
+        }
+        double record_us = seconds_since(record_start) * 1000000.0;
+        vkal_end(frame->command_buffer);
+        vkal_end_frame(frame);
+        printf("%-10s %12.2f\n", dynamic ? "dynamic" : "baked", record_us);
+    }
+    vkDeviceWaitIdle(vkal_info->device);
+
+    for (VkPipeline pipeline : static_pipelines) {
+        vkal_destroy_graphics_pipeline(pipeline);
+    }
+    vkal_destroy_graphics_pipeline(dynamic_pipeline);
+    destroy_draw_scene(&scene);
+}
+
+/* Index memory and frame time of grid meshes with 32 bit indices vs. narrowed to 16 bit by vkal_index_buffer_add32
+   where they fit. The last mesh has more than 64k vertices and keeps 32 bit indices either way. */
+void benchmark_indices(VkalInfo * vkal_info)
+{
+    uint32_t const frames = 100;
+    uint32_t const small_count = 64;
+    uint32_t const small_side = 64;  // 4096 vertices
+    uint32_t const large_side = 320; // 102400 vertices
+    DrawScene scene = create_draw_scene(vkal_info);
+
+    struct Mesh
+    {
+        uint64_t    offset_vertices;
+        uint32_t    index_count;
+        uint64_t    offset_indices[2]; // narrowed, 32 bit
+        VkIndexType index_types[2];
+    };
+    std::vector<Mesh> meshes;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    VkDeviceSize index_bytes[2] = { 0, 0 };
+    for (uint32_t m = 0; m <= small_count; ++m) {
+        uint32_t side = m < small_count ? small_side : large_side;
+        vertices.clear();
+        for (uint32_t y = 0; y < side; ++y) {
+            for (uint32_t x = 0; x < side; ++x) {
+                float u = (float)x / (side - 1);
+                float v = (float)y / (side - 1);
+                float vertex[8] = { u * 0.2f - 0.1f, v * 0.2f - 0.1f, 0,  u, v, 1,  u, v };
+                vertices.insert(vertices.end(), vertex, vertex + 8);
+            }
+        }
+        indices.clear();
+        for (uint32_t y = 0; y + 1 < side; ++y) {
+            for (uint32_t x = 0; x + 1 < side; ++x) {
+                uint32_t i = y * side + x;
+                uint32_t quad[6] = { i, i + side, i + 1, i + 1, i + side, i + side + 1 };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+        Mesh mesh = {};
+        mesh.offset_vertices = vkal_vertex_buffer_add(vertices.data(), 8 * sizeof(float), side * side);
+        mesh.index_count = (uint32_t)indices.size();
+        for (uint32_t variant = 0; variant < 2; ++variant) {
+            mesh.offset_indices[variant] = vkal_index_buffer_add32(indices.data(), mesh.index_count, variant == 0, &mesh.index_types[variant]);
+            index_bytes[variant] += (VkDeviceSize)mesh.index_count * (mesh.index_types[variant] == VK_INDEX_TYPE_UINT32 ? 4 : 2);
+        }
+        meshes.push_back(mesh);
+    }
+    vkal_upload_wait(vkal_upload_current_ticket());
+
+    printf("%-10s %12s %12s\n", "indices", "index MB", "frame ms");
+    for (uint32_t variant = 0; variant < 2; ++variant) {
+        uint32_t rendered_frames = 0;
+        Clock::time_point frames_start = Clock::now();
+        for (uint32_t f = 0; f < frames; ++f) {
+            VkalFrameContext * frame = vkal_begin_frame();
+            if (!frame) continue;
+            uint32_t image_id = frame->image_id;
+            vkal_begin(image_id, frame->command_buffer, vkal_info->render_pass);
+            vkal_viewport(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+            vkal_scissor(frame->command_buffer, 0, 0, (float)vkal_info->swapchain_extent.width, (float)vkal_info->swapchain_extent.height);
+            vkal_bind_descriptor_set(image_id, &scene.descriptor_set, scene.pipeline_layout);
+            for (Mesh const & mesh : meshes) {
+                vkal_draw_indexed_typed(image_id, scene.pipeline, mesh.offset_indices[variant], mesh.index_count, mesh.index_types[variant],
+                    mesh.offset_vertices, 1);
+            }
+            vkal_end(frame->command_buffer);
+            vkal_end_frame(frame);
+            ++rendered_frames;
+        }
+        vkDeviceWaitIdle(vkal_info->device);
+        printf("%-10s %12.2f %12.3f\n", variant == 0 ? "narrowed" : "32 bit", index_bytes[variant] / (1024.0 * 1024.0),
+            seconds_since(frames_start) * 1000.0 / rendered_frames);
+    }
+
+    destroy_draw_scene(&scene);
+}
+
+int main(int argc, char ** argv)
+{
+    char const * mode = argc > 1 ? argv[1] : "upload";
+
+    init_window();
+    
+    // Optional extensions are appended below if the selected device supports them.
+    char * device_extensions[10] = {
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+	VK_KHR_MAINTENANCE3_EXTENSION_NAME
+    };
+    uint32_t device_extension_count = 2;
+
+    char* instance_extensions[] = {
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
+        #ifdef __APPLE__
+            ,VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME
+        #endif
+        #ifdef _DEBUG
+            ,VK_EXT_DEBUG_UTILS_EXTENSION_NAME
+        #endif
+    };
+    uint32_t instance_extension_count = sizeof(instance_extensions) / sizeof(*instance_extensions);
+
+    char* instance_layers[] = {
+        "VK_LAYER_KHRONOS_validation"
+    };
+    uint32_t instance_layer_count = 0;
+#ifdef _DEBUG
+    instance_layer_count = sizeof(instance_layers) / sizeof(*instance_layers);    
+#endif
+   
+    vkal_create_instance_glfw(window,
+			 instance_extensions, instance_extension_count,
+ 			 instance_layers, instance_layer_count);
+    
+    VkalPhysicalDevice * devices = 0;
+    uint32_t device_count;
+    vkal_find_suitable_devices(device_extensions, device_extension_count,
+			       &devices, &device_count);
+    assert(device_count > 0);
+    vkal_select_physical_device(&devices[0]);
+    printf("Device: %s\n", devices[0].property.deviceName);
+#ifdef VK_EXT_external_memory_host
+    if (device_supports_extension(devices[0].device, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+        device_extensions[device_extension_count++] = (char*)VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+    }
+#endif
+#ifdef VK_EXT_host_image_copy
+    if (device_supports_extension(devices[0].device, VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME)) {
+        // Below Vulkan 1.3 (the instance is 1.2 on MoltenVK) host image copy depends on two extensions that are core in 1.3.
+        int below_1_3 = devices[0].property.apiVersion < VK_API_VERSION_1_3;
+    #ifdef __APPLE__
+        below_1_3 = 1;
+    #endif
+        int dependencies_met = 1;
+        if (below_1_3) {
+            dependencies_met = device_supports_extension(devices[0].device, VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME) &&
+                device_supports_extension(devices[0].device, VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME);
+            if (dependencies_met) {
+                device_extensions[device_extension_count++] = (char*)VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME;
+                device_extensions[device_extension_count++] = (char*)VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME;
+            }
+        }
+        if (dependencies_met) {
+            device_extensions[device_extension_count++] = (char*)VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME;
+        }
+    }
+#endif
+#ifdef VK_EXT_extended_dynamic_state
+    // Only used below Vulkan 1.3, eg. on MoltenVK.
+    if (device_supports_extension(devices[0].device, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+        device_extensions[device_extension_count++] = (char*)VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME;
+    }
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+    if (device_supports_extension(devices[0].device, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        device_extensions[device_extension_count++] = (char*)VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME;
+    }
+#endif
+
+    VkalWantedFeatures vulkan_features{};
+    VkalInfo* vkal_info = vkal_init(device_extensions, device_extension_count, vulkan_features);
+    printf("Dedicated transfer queue: %s\n", vkal_info->transfer_queue != VK_NULL_HANDLE ? "yes" : "no");
+    int exit_code = 0;
+
+    if (!strcmp(mode, "upload")) {
+        benchmark_upload();
+    }
+    else if (!strcmp(mode, "mapped")) {
+        benchmark_mapped(vkal_info);
+    }
+    else if (!strcmp(mode, "readback")) {
+        benchmark_readback();
+    }
+    else if (!strcmp(mode, "textures")) {
+        benchmark_textures();
+    }
+    else if (!strcmp(mode, "hostcopy")) {
+        benchmark_hostcopy(vkal_info);
+    }
+    else if (!strcmp(mode, "threads")) {
+        benchmark_threads(vkal_info);
+    }
+    else if (!strcmp(mode, "drawcost")) {
+        benchmark_drawcost(vkal_info);
+    }
+    else if (!strcmp(mode, "indirect")) {
+        benchmark_indirect(vkal_info);
+    }
+    else if (!strcmp(mode, "culling")) {
+        benchmark_culling(vkal_info);
+    }
+    else if (!strcmp(mode, "async")) {
+        benchmark_async(vkal_info);
+    }
+    else if (!strcmp(mode, "graph")) {
+        if (!benchmark_graph(vkal_info)) exit_code = 1;
+    }
+    else if (!strcmp(mode, "pipelines")) {
+        benchmark_pipelines(vkal_info);
+    }
+    else if (!strcmp(mode, "indices")) {
+        benchmark_indices(vkal_info);
+    }
+    else {
+        printf("Unknown mode: %s\n", mode);
+    }
+
+    vkDeviceWaitIdle(vkal_info->device);
+    vkal_cleanup();
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    
+    return exit_code;
+}
@@ -1,11 +1,14 @@
 /* Michael Eggers, 10/22/2020
 
    Draw some simple shapes.
+
+   Pass --dynamic-rendering to draw without render pass and framebuffer objects (Vulkan 1.3 or VK_KHR_dynamic_rendering).
 */
 
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include <vector>
@@ -64,13 +67,15 @@ void init_window()
 
 int main(int argc, char** argv)
 {
+    bool dynamic_rendering = argc > 1 && !strcmp(argv[1], "--dynamic-rendering");
+
     init_window();
 
-    char* device_extensions[] = {
+    char* device_extensions[3] = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_KHR_MAINTENANCE3_EXTENSION_NAME
     };
-    uint32_t device_extension_count = sizeof(device_extensions) / sizeof(*device_extensions);
+    uint32_t device_extension_count = 2;
 
     char* instance_extensions[] = {
         VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
@@ -107,7 +112,21 @@ int main(int argc, char** argv)
     vkal_select_physical_device(&devices[0]);
     
     VkalWantedFeatures vulkan_features{};
+    if (dynamic_rendering) {
+        // The same draw code works in both modes, vkal_begin_render_pass begins a dynamic rendering instead.
+        vulkan_features.features13.dynamicRendering = VK_TRUE;
+        bool core = devices[0].property.apiVersion >= VK_API_VERSION_1_3;
+#ifdef __APPLE__
+        core = false; // the instance is created for Vulkan 1.2
+#endif
+#ifdef VK_KHR_dynamic_rendering
+        if (!core) {
+            device_extensions[device_extension_count++] = (char*)VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+        }
+#endif
+    }
     VkalInfo* vkal_info = vkal_init(device_extensions, device_extension_count, vulkan_features);
+    printf("Dynamic rendering: %s\n", vkal_info->dynamic_rendering ? "yes" : "no");
 
     /* Shader Setup */
     uint8_t* vertex_byte_code = 0;
@@ -115,8 +134,8 @@ int main(int argc, char** argv)
     read_file("../../src/examples/assets/shaders/hello_triangle_vert.spv", &vertex_byte_code, &vertex_code_size);
     uint8_t* fragment_byte_code = 0;
     int fragment_code_size;
-    read_file("/../../src/examples/assets/shaders/hello_triangle_frag.spv", &fragment_byte_code, &fragment_code_size);
-    ShaderStageSetup shader_setup = vkal_create_shaders(vertex_byte_code, vertex_code_size, fragment_byte_code, fragment_code_size);
+    read_file("../../src/examples/assets/shaders/hello_triangle_frag.spv", &fragment_byte_code, &fragment_code_size);
+    ShaderStageSetup shader_setup = vkal_create_shaders(vertex_byte_code, vertex_code_size, fragment_byte_code, fragment_code_size, NULL, 0);
     
     /* Vertex Input Assembly */
     VkVertexInputBindingDescription vertex_input_bindings[] =
@@ -132,7 +132,6 @@ void create_storage_image(VkalInfo* vkal_info)
     // If the view port size has changed, we need to recreate the storage image
     vkal_destroy_image_view(g_storage_image.image_view);
     vkal_destroy_image(g_storage_image.image);
-    vkal_destroy_device_memory(g_storage_image.device_memory);
 
     g_storage_image = create_vkal_image(width, height,
         VK_FORMAT_B8G8R8A8_UNORM, // TODO: Why is it in raytracing shaders BGR not RGB?
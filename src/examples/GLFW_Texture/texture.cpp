@@ -257,15 +257,16 @@ int main(int argc, char ** argv)
 	    view_proj_data.proj = perspective( tr_radians(45.f), (float)width/(float)height, 0.1f, 100.f );
 	    vkal_update_uniform(&view_proj_ubo, &view_proj_data);
 
-		{
-			uint32_t image_id = vkal_get_image();
+		VkalFrameContext * frame = vkal_begin_frame();
+		if (frame) {
+			uint32_t image_id = frame->image_id;
 
 			vkal_begin_command_buffer(image_id);
 			vkal_begin_render_pass(image_id, vkal_info->render_pass);
-			vkal_viewport(vkal_info->default_command_buffers[image_id],
+			vkal_viewport(frame->command_buffer,
 				  0, 0,
 				  width, height);
-			vkal_scissor(vkal_info->default_command_buffers[image_id],
+			vkal_scissor(frame->command_buffer,
 				 0, 0,
 				 width, height);
 			vkal_bind_descriptor_set(image_id, &descriptor_set[0], pipeline_layout);
@@ -274,10 +275,8 @@ int main(int argc, char ** argv)
 					  offset_vertices, 1);
 			vkal_end_renderpass(image_id);
 			vkal_end_command_buffer(image_id);
-			VkCommandBuffer command_buffers1[] = { vkal_info->default_command_buffers[image_id] };
-			vkal_queue_submit(command_buffers1, 1);
 
-			vkal_present(image_id);
+			vkal_end_frame(frame);
 		}
     }
     
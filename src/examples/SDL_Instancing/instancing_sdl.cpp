@@ -317,21 +317,23 @@ int main(int argc, char** argv)
     uint64_t offset_vertices = vkal_vertex_buffer_add(vertices, sizeof(Vertex), 4); // 4 vertices
 
     /* Storage Buffer Spritedata (texture ID and frameIndex) per quad (= per InstanceID) */
-    /* Firstly, get the memory on GPU */
-    DeviceMemory gpuSpriteDeviceMem = vkal_allocate_devicememory(
+    /* Firstly, get the memory on GPU. The sprites change every frame: vkal puts them into VRAM the CPU can
+       write to if there is (resizable BAR), otherwise they are copied over through staging memory. */
+    DeviceMemory gpuSpriteDeviceMem = vkal_allocate_devicememory2(
         numSprites * sizeof(GPUSprite), 
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VKAL_MEMORY_USAGE_DYNAMIC,
         0);
-    VkalBuffer gpuSpriteBuffer = vkal_create_buffer(numSprites * sizeof(GPUSprite), &gpuSpriteDeviceMem, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    VkalBuffer gpuSpriteBuffer = vkal_create_buffer(numSprites * sizeof(GPUSprite), &gpuSpriteDeviceMem, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    printf("Sprite buffer is %s\n", vkal_buffer_is_host_visible(&gpuSpriteBuffer) ? "host visible VRAM" : "updated through staging");
 
-    /* Storage buffer for Frame Data: Stores a sequence of frames */
-    DeviceMemory gpuFrameDeviceMem = vkal_allocate_devicememory(
+    /* Storage buffer for Frame Data: Stores a sequence of frames. Written once. */
+    DeviceMemory gpuFrameDeviceMem = vkal_allocate_devicememory2(
         MAX_GPU_FRAMES * sizeof(GPUFrame),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VKAL_MEMORY_USAGE_GPU_ONLY,
         0);
-    VkalBuffer gpuFrameBuffer = vkal_create_buffer(MAX_GPU_FRAMES * sizeof(GPUFrame), &gpuFrameDeviceMem, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    VkalBuffer gpuFrameBuffer = vkal_create_buffer(MAX_GPU_FRAMES * sizeof(GPUFrame), &gpuFrameDeviceMem, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
 
     /* Create a sequence, that holds all the frames the sprites need to cycle through */
     Sequence asteroidSequence{};
@@ -373,10 +375,10 @@ int main(int argc, char** argv)
     }
 
     /* Secondly, upload GPU sprite-data to the GPU */
+    /* The sprites are built on the CPU and written to the GPU in one go per frame. */
+    std::vector<GPUSprite> gpuSprites(numSprites);
     GPUSprite gpuSpriteData[1]; 
     //gpuSpriteData[1] = { transform1 };
-    vkal_map_buffer(&gpuSpriteBuffer);
-    GPUSprite* gpuSpritePtr = (GPUSprite*)gpuSpriteBuffer.mapped;
     for (size_t i = 0; i < numSprites; i++) {    
         glm::vec3 pos = sprites[i].pos;
         uint32_t textureID = sprites[i].textureID;
@@ -389,14 +391,14 @@ int main(int argc, char** argv)
         metaData[0].z = sprites[i].size;
         gpuSpriteData[0] = { transform, metaData };
         //vkal_update_buffer_offset(&gpuSpriteBuffer, (uint8_t*)gpuSpriteData, sizeof(GPUSprite), i*sizeof(GPUSprite));
-        memcpy(gpuSpritePtr + i, gpuSpriteData, sizeof(GPUSprite));
+        gpuSprites[i] = gpuSpriteData[0];
     }        
+    vkal_update_buffer(&gpuSpriteBuffer, (uint8_t*)gpuSprites.data(), numSprites * sizeof(GPUSprite));
     //map_memory(&gpuSpriteBuffer, numSprites * sizeof(GPUSprite), 0);
 
     /* Also upload per-frame data onto the GPU */
     /* We will use the asteroid spritesheet in this example */
-    vkal_map_buffer(&gpuFrameBuffer);
-    GPUFrame* gpuFramePtr = (GPUFrame*)gpuFrameBuffer.mapped;
+    std::vector<GPUFrame> gpuFrames(asteroidSequence.frames.size());
     for (size_t i = 0; i < asteroidSequence.frames.size(); i++) {
         Frame* frame = &asteroidSequence.frames[i];
         float s = (float)frame->x / (float)asteroidsImage.width;
@@ -405,9 +407,9 @@ int main(int argc, char** argv)
         float height = (float)frame->height / (float)asteroidsImage.height;
         GPUFrame gpuFrame = { glm::vec2(s, t), glm::vec2(width, height) };
         //vkal_update_buffer_offset(&gpuFrameBuffer, (uint8_t*)&gpuFrame, sizeof(GPUFrame), i * sizeof(GPUFrame));
-        memcpy(gpuFramePtr + i, &gpuFrame, sizeof(GPUFrame));
+        gpuFrames[i] = gpuFrame;
     }
-    vkal_unmap_buffer(&gpuFrameBuffer);
+    vkal_update_buffer(&gpuFrameBuffer, (uint8_t*)gpuFrames.data(), gpuFrames.size() * sizeof(GPUFrame));
     //map_memory(&gpuFrameBuffer, asteroidSequence.frames.size() * sizeof(GPUFrame), 0);
 
     /* Update Descriptor Set */
@@ -482,7 +484,7 @@ int main(int argc, char** argv)
         uint64_t startUpdateFrameTime = SDL_GetTicks64();
         for (size_t i = 0; i < numSprites; i++) {
             Sprite* sprite = &sprites[i];
-            GPUSprite* gpuSprite = (GPUSprite*)gpuSpriteBuffer.mapped + i;
+            GPUSprite* gpuSprite = &gpuSprites[i];
             
             if (sprite->pos.x >= width || sprite->pos.x < 0.0) sprite->velocity.x *= -1.0;
             if (sprite->pos.y >= height || sprite->pos.y < 0.0) sprite->velocity.y *= -1.0;
@@ -506,6 +508,7 @@ int main(int argc, char** argv)
                 gpuSprite->metaData = metaData;
             }
         }        
+        vkal_update_buffer(&gpuSpriteBuffer, (uint8_t*)gpuSprites.data(), numSprites * sizeof(GPUSprite));
         uint64_t endUpdateFrameTime = SDL_GetTicks64();
         timeUpdateFrame = endUpdateFrameTime - startUpdateFrameTime;
 
@@ -0,0 +1,152 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "glslcompile.h"
+#include "frustum_cull.h"
+
+struct FrustumPushConstants
+{
+	glm::vec4 planes[6];
+	uint32_t  instance_count;
+};
+
+/* Planes of the clip space volume -w <= x,y <= w, 0 <= z <= w pulled back into world space. */
+static void extract_frustum_planes(glm::mat4 const & m, glm::vec4 out_planes[6])
+{
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+	out_planes[0] = row3 + row0;
+	out_planes[1] = row3 - row0;
+	out_planes[2] = row3 + row1;
+	out_planes[3] = row3 - row1;
+	out_planes[4] = row2;
+	out_planes[5] = row3 - row2;
+	for (uint32_t i = 0; i < 6; ++i) {
+		out_planes[i] /= glm::length(glm::vec3(out_planes[i]));
+	}
+}
+
+glm::vec4 bounding_sphere(glm::vec3 box_min, glm::vec3 box_max, glm::mat4 const & model_matrix)
+{
+	glm::vec3 center = glm::vec3(model_matrix * glm::vec4(0.5f * (box_min + box_max), 1.0f));
+	float scale = glm::max(glm::length(glm::vec3(model_matrix[0])),
+		glm::max(glm::length(glm::vec3(model_matrix[1])), glm::length(glm::vec3(model_matrix[2]))));
+	return glm::vec4(center, 0.5f * glm::length(box_max - box_min) * scale);
+}
+
+FrustumCuller create_frustum_culler(VkalInfo * vkal_info, VkalDrawRecord const * records, uint32_t draw_count,
+	CullInstance const * instances, uint32_t instance_count)
+{
+	FrustumCuller culler = {};
+	culler.draw_count = draw_count;
+	culler.instance_count = instance_count;
+
+	// Every draw gets room for all of its instances in the visible list.
+	std::vector<VkalDrawRecord> template_records(records, records + draw_count);
+	for (uint32_t i = 0; i < draw_count; ++i) {
+		template_records[i].instance_count = 0;
+		template_records[i].first_instance = 0;
+	}
+	for (uint32_t i = 0; i < instance_count; ++i) {
+		assert(instances[i].draw_index < draw_count);
+		template_records[instances[i].draw_index].first_instance++;
+	}
+	uint32_t first_instance = 0;
+	for (uint32_t i = 0; i < draw_count; ++i) {
+		uint32_t count = template_records[i].first_instance;
+		template_records[i].first_instance = first_instance;
+		first_instance += count;
+	}
+
+	VkDeviceSize instances_size = (VkDeviceSize)instance_count * sizeof(CullInstance);
+	VkDeviceSize visible_size = (VkDeviceSize)VKAL_MAX(instance_count, 1u) * sizeof(uint32_t);
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	culler.memory = vkal_allocate_devicememory2(2 * vkal_indirect_buffer_size(draw_count) + instances_size + visible_size + 4 * 1024,
+		usage, VKAL_MEMORY_USAGE_GPU_ONLY, 0);
+	culler.draws = vkal_create_indirect_buffer(&culler.memory, draw_count);
+	culler.draws_template = vkal_create_indirect_buffer(&culler.memory, draw_count);
+	culler.instances = vkal_create_buffer(instances_size, &culler.memory, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	culler.visible_instances = vkal_create_buffer(visible_size, &culler.memory, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	vkal_update_indirect_buffer(&culler.draws_template, template_records.data(), draw_count);
+	culler.draws.index_type = culler.draws_template.index_type; // the draws are copies of the template
+	update_cull_instances(&culler, instances);
+
+	VkDescriptorSetLayoutBinding set_layout[] = {
+		{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0 },
+		{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0 },
+		{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0 }
+	};
+	culler.descriptor_set_layout = vkal_create_descriptor_set_layout(set_layout, VKAL_ARRAY_LENGTH(set_layout));
+	VkDescriptorSet * descriptor_sets = &culler.descriptor_set;
+	vkal_allocate_descriptor_sets(vkal_info->default_descriptor_pool, &culler.descriptor_set_layout, 1, &descriptor_sets);
+	vkal_update_descriptor_set_bufferarray(culler.descriptor_set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, 0, culler.instances);
+	vkal_update_descriptor_set_bufferarray(culler.descriptor_set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, 0, culler.draws.buffer);
+	vkal_update_descriptor_set_bufferarray(culler.descriptor_set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, 0, culler.visible_instances);
+
+	VkPushConstantRange push_constant_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FrustumPushConstants) };
+	culler.pipeline_layout = vkal_create_pipeline_layout(&culler.descriptor_set_layout, 1, &push_constant_range, 1);
+
+	uint8_t * shader_code = NULL;
+	int shader_code_size = 0;
+	load_glsl_and_compile("../../src/examples/assets/shaders/frustum_cull.comp", &shader_code, &shader_code_size, SHADER_TYPE_COMPUTE);
+	SingleShaderStageSetup shader_setup = vkal_create_shader(shader_code, shader_code_size, VK_SHADER_STAGE_COMPUTE_BIT);
+	culler.shader_module = shader_setup.module;
+	culler.pipeline = vkal_create_compute_pipeline(shader_setup, culler.pipeline_layout);
+	free(shader_code);
+
+	return culler;
+}
+
+void update_cull_instances(FrustumCuller * culler, CullInstance const * instances)
+{
+	if (culler->instance_count > 0) {
+		vkal_upload_buffer(culler->instances.buffer, 0, instances, (VkDeviceSize)culler->instance_count * sizeof(CullInstance));
+	}
+}
+
+void record_frustum_cull(FrustumCuller * culler, VkCommandBuffer command_buffer, glm::mat4 const & view_proj)
+{
+	// Start from zero instances per draw. The previous frame's draws have to be done reading the commands,
+	// and its vertex shaders the visible list, which the chain of barriers up to the dispatch takes care of.
+	VkDeviceSize draws_size = vkal_indirect_buffer_size(culler->draw_count);
+	vkal_buffer_barrier(command_buffer, culler->draws.buffer.buffer, 0, draws_size,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	VkBufferCopy region = {};
+	region.size = draws_size;
+	vkCmdCopyBuffer(command_buffer, culler->draws_template.buffer.buffer, culler->draws.buffer.buffer, 1, &region);
+	vkal_buffer_barrier(command_buffer, culler->draws.buffer.buffer, 0, draws_size,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	FrustumPushConstants push_constants;
+	extract_frustum_planes(view_proj, push_constants.planes);
+	push_constants.instance_count = culler->instance_count;
+	vkal_bind_compute_descriptor_sets(command_buffer, culler->pipeline_layout, 0, &culler->descriptor_set, 1);
+	vkCmdPushConstants(command_buffer, culler->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FrustumPushConstants), &push_constants);
+	vkal_dispatch(command_buffer, culler->pipeline, (culler->instance_count + 63) / 64, 1, 1);
+
+	vkal_buffer_barrier(command_buffer, culler->draws.buffer.buffer, 0, draws_size,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	vkal_buffer_barrier(command_buffer, culler->visible_instances.buffer, 0, VK_WHOLE_SIZE,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void destroy_frustum_culler(FrustumCuller * culler)
+{
+	vkal_destroy_compute_pipeline(culler->pipeline);
+	destroy_shader_module(culler->shader_module);
+	vkal_destroy_buffer(&culler->visible_instances);
+	vkal_destroy_buffer(&culler->instances);
+	vkal_destroy_indirect_buffer(&culler->draws_template);
+	vkal_destroy_indirect_buffer(&culler->draws);
+	vkal_free_devicememory(&culler->memory);
+}
@@ -0,0 +1,58 @@
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+
+#include <stdint.h>
+
+#include <vkal.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+/* GPU frustum culling. A compute pass tests the bounding sphere of every instance against the frustum
+   and compacts the survivors into per draw ranges of a visible instance list. Every draw gets a segment
+   of that list big enough for all of its instances, starting at the command's firstInstance, so the
+   vertex shader finds its instance with visible_instances[gl_InstanceIndex]. The CPU only uploads the
+   instances once (or when they move) and the view projection matrix every frame.
+
+   Needs drawIndirectFirstInstance. The command count is always the number of draws, fully culled
+   draws have an instanceCount of 0, so the result works with or without drawIndirectCount. */
+
+/* One object to cull. Matches the Instance struct in frustum_cull.comp. */
+struct CullInstance
+{
+	glm::vec4 sphere;     /* xyz: world space center, w: radius */
+	uint32_t  draw_index; /* record the instance is drawn with */
+	uint32_t  pad[3];
+};
+
+struct FrustumCuller
+{
+	DeviceMemory          memory;
+	VkalIndirectBuffer    draws;             /* what to draw with vkal_draw_indexed_indirect after culling */
+	VkalIndirectBuffer    draws_template;    /* the commands with instanceCount 0, copied over draws before every pass */
+	VkalBuffer            instances;
+	VkalBuffer            visible_instances; /* uint32_t indices into the instances */
+	uint32_t              draw_count;
+	uint32_t              instance_count;
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorSet       descriptor_set;
+	VkPipelineLayout      pipeline_layout;
+	VkPipeline            pipeline;
+	uint32_t              shader_module;
+};
+
+/* Bounding sphere of an object space AABB (eg. BoundingBox of model_v2) in world space. */
+glm::vec4     bounding_sphere(glm::vec3 box_min, glm::vec3 box_max, glm::mat4 const & model_matrix);
+/* The instance_count and first_instance of the records are ignored, they come from the instances. */
+FrustumCuller create_frustum_culler(VkalInfo * vkal_info, VkalDrawRecord const * records, uint32_t draw_count,
+	CullInstance const * instances, uint32_t instance_count);
+/* Replaces the instances, eg. after objects moved. The number of instances per draw must not change. */
+void          update_cull_instances(FrustumCuller * culler, CullInstance const * instances);
+/* Records the pass. Has to be outside of a render pass, the results are ready for indirect draws
+   and vertex shader reads afterwards. */
+void          record_frustum_cull(FrustumCuller * culler, VkCommandBuffer command_buffer, glm::mat4 const & view_proj);
+void          destroy_frustum_culler(FrustumCuller * culler);
+
+#endif
@@ -21,7 +21,9 @@ void load_glsl_and_compile(char const* glsl_source_file, uint8_t** out_spirv, in
 
 	shaderc_compiler_t compiler = shaderc_compiler_initialize();
 	
-	shaderc_shader_kind shader_kind = shader_type == SHADER_TYPE_VERTEX ? shaderc_glsl_vertex_shader : shaderc_glsl_fragment_shader;
+	shaderc_shader_kind shader_kind = shaderc_glsl_vertex_shader;
+	if (shader_type == SHADER_TYPE_FRAGMENT) shader_kind = shaderc_glsl_fragment_shader;
+	else if (shader_type == SHADER_TYPE_COMPUTE) shader_kind = shaderc_glsl_compute_shader;
 	shaderc_compilation_result_t result = shaderc_compile_into_spv(
 			compiler, glsl_source.c_str(), glsl_source_size, shader_kind,
 			glsl_source_file, "main", NULL);
@@ -6,7 +6,8 @@
 typedef enum ShaderType
 {
 	SHADER_TYPE_VERTEX,
-	SHADER_TYPE_FRAGMENT
+	SHADER_TYPE_FRAGMENT,
+	SHADER_TYPE_COMPUTE
 } ShaderType;
 
 #ifdef __cplusplus
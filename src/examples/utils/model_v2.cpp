@@ -31,6 +31,7 @@ Model create_model_from_file_indexed(char const* file)
 	}
 	model.vertices = (Vertex*)malloc(model.vertex_count * sizeof(Vertex));
 	model.indices = (uint32_t*)malloc(model.index_count * sizeof(uint32_t));
+	model.index_type = VK_INDEX_TYPE_UINT32;
 
 	/* Go through all faces of meshes and copy. */
 	uint32_t indices_copied = 0;
@@ -92,4 +93,10 @@ void assign_texture_to_model(Model * model, VkalTexture texture, uint32_t id, Te
 		model->normal_map = texture;
 		model->material.has_normal_map = 1;
 	}
+}
+
+/* Puts the indices into the default index buffer, as 16 bit indices if narrow is set and they fit. */
+void add_model_indices(Model * model, int narrow)
+{
+	model->index_buffer_offset = vkal_index_buffer_add32(model->indices, model->index_count, narrow, &model->index_type);
 }
\ No newline at end of file
@@ -52,7 +52,6 @@ enum TextureType
 
 struct Texture
 {
-	uint32_t  device_memory_id;
 	VkSampler sampler;
 	uint32_t  image;
 	uint32_t  image_view;
@@ -86,12 +85,14 @@ struct Model
 
 	uint32_t * indices;
 	uint32_t index_count;
-	uint32_t index_buffer_offset;
+	uint64_t index_buffer_offset; /* set by add_model_indices, draw with vkal_draw_indexed_typed */
+	VkIndexType index_type;
 };
 
 
 Model create_model_from_file(char const* file);
 Model create_model_from_file_indexed(char const* file);
 void  assign_texture_to_model(Model* model, VkalTexture texture, uint32_t id, TextureType texture_type);
+void  add_model_indices(Model* model, int narrow);
 
 #endif
\ No newline at end of file
@@ -52,6 +52,46 @@ static std::string g_shaders_dir;
 		//}
 	}
 
+	bool map_file(char const * filename, MappedFile * out_file)
+	{
+		char exe_path[256];
+		get_exe_path(exe_path, 256 * sizeof(char));
+		std::string abs_path = concat_paths(std::string(exe_path), std::string(filename));
+
+		*out_file = MappedFile{};
+		HANDLE file = CreateFileA(abs_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			fprintf(stderr, "Failed to map file: %s\n", abs_path.c_str());
+			return false;
+		}
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+		HANDLE mapping = size.QuadPart ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		CloseHandle(file);
+		if (!mapping) {
+			fprintf(stderr, "Failed to map file: %s\n", abs_path.c_str());
+			return false;
+		}
+		out_file->data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!out_file->data) {
+			CloseHandle(mapping);
+			return false;
+		}
+		out_file->size = (uint64_t)size.QuadPart;
+		out_file->handle = mapping;
+		return true;
+	}
+
+	void unmap_file(MappedFile * file)
+	{
+		if (file->data) {
+			UnmapViewOfFile(file->data);
+			CloseHandle((HANDLE)file->handle);
+		}
+		*file = MappedFile{};
+	}
+
 #elif __APPLE__
 
 	#include <mach-o/dyld.h>
@@ -83,6 +123,51 @@ static std::string g_shaders_dir;
 	}
 #endif 
 
+#if defined(__APPLE__) || defined(__linux__)
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+
+	bool map_file(char const * filename, MappedFile * out_file)
+	{
+		char exe_path[256];
+		get_exe_path(exe_path, 256 * sizeof(char));
+		std::string abs_path = concat_paths(std::string(exe_path), std::string(filename));
+
+		*out_file = MappedFile{};
+		int fd = open(abs_path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to map file: %s\n", abs_path.c_str());
+			return false;
+		}
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		void * data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // the mapping keeps the file alive
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "Failed to map file: %s\n", abs_path.c_str());
+			return false;
+		}
+		// Uploads read the file front to back.
+		madvise(data, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+		out_file->data = (uint8_t*)data;
+		out_file->size = (uint64_t)file_stat.st_size;
+		return true;
+	}
+
+	void unmap_file(MappedFile * file)
+	{
+		if (file->data) {
+			munmap(file->data, (size_t)file->size);
+		}
+		*file = MappedFile{};
+	}
+#endif
+
 
 
 
@@ -5,7 +5,18 @@
 #include <string>
 
 
+/* A read-only memory mapping of a whole file. */
+struct MappedFile
+{
+	uint8_t	* data;
+	uint64_t  size;
+	void	* handle; /* Windows: the file mapping object */
+};
+
 void		read_file(char const * filename, uint8_t ** out_buffer, int * out_size);
+/* Maps a file relative to the executable, like read_file, but without copying it to the heap. */
+bool		map_file(char const * filename, MappedFile * out_file);
+void		unmap_file(MappedFile * file);
 std::string read_text_file(char const* filename);
 void		get_exe_path(char * out_buffer, int buffer_size);
 std::string concat_paths(std::string a, std::string b);
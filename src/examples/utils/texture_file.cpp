@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "texture_file.h"
+#include "platform.h"
+
+static uint32_t read_u32(uint8_t const * p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t read_u64(uint8_t const * p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static bool parse_ktx2(uint8_t * file_data, VkDeviceSize file_size, TextureFile * out_texture)
+{
+	static uint8_t const identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	// identifier, 9 header fields, index (4 * u32 + 2 * u64)
+	VkDeviceSize const header_size = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+	if (file_size < header_size || memcmp(file_data, identifier, sizeof(identifier))) {
+		return false;
+	}
+
+	uint8_t const * header = file_data + 12;
+	VkFormat format         = (VkFormat)read_u32(header + 0);
+	uint32_t width          = read_u32(header + 8);
+	uint32_t height         = read_u32(header + 12);
+	uint32_t depth          = read_u32(header + 16);
+	uint32_t layer_count    = read_u32(header + 20);
+	uint32_t face_count     = read_u32(header + 24);
+	uint32_t level_count    = read_u32(header + 28);
+	uint32_t supercompression = read_u32(header + 32);
+
+	if (format == VK_FORMAT_UNDEFINED || supercompression != 0) {
+		printf("[texture_file] KTX2: Basis Universal and supercompressed files are not supported.\n");
+		return false;
+	}
+	if (depth > 1) {
+		printf("[texture_file] KTX2: 3D textures are not supported.\n");
+		return false;
+	}
+	layer_count = (layer_count ? layer_count : 1) * face_count;
+	level_count = level_count ? level_count : 1;
+	if (level_count > TEXTURE_FILE_MAX_LEVELS || file_size < header_size + level_count * 3 * 8) {
+		return false;
+	}
+
+	// The level index follows the header. Levels are already level-major with all layers and faces per level.
+	uint8_t const * level_index = file_data + header_size;
+	for (uint32_t level = 0; level < level_count; ++level) {
+		uint64_t offset = read_u64(level_index + level * 24 + 0);
+		uint64_t length = read_u64(level_index + level * 24 + 8);
+		VkDeviceSize expected = vkal_image_level_size(format, width, height, level) * layer_count;
+		if (offset + length > file_size || length < expected) {
+			printf("[texture_file] KTX2: level %u is truncated.\n", level);
+			return false;
+		}
+		out_texture->level_offsets[level] = offset;
+	}
+
+	out_texture->format = format;
+	out_texture->width = width;
+	out_texture->height = height;
+	out_texture->layer_count = layer_count;
+	out_texture->level_count = level_count;
+	out_texture->is_cube = face_count == 6;
+	out_texture->data = file_data;
+	out_texture->data_size = file_size;
+	return true;
+}
+
+static VkFormat dxgi_to_vk_format(uint32_t dxgi_format)
+{
+	switch (dxgi_format) {
+	case 2:  return VK_FORMAT_R32G32B32A32_SFLOAT;
+	case 10: return VK_FORMAT_R16G16B16A16_SFLOAT;
+	case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+	case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+	case 41: return VK_FORMAT_R32_SFLOAT;
+	case 61: return VK_FORMAT_R8_UNORM;
+	case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+	case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+	case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+	case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+#define DDS_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static bool parse_dds(uint8_t * file_data, VkDeviceSize file_size, TextureFile * out_texture)
+{
+	// magic + DDS_HEADER
+	if (file_size < 4 + 124 || read_u32(file_data) != DDS_FOURCC('D', 'D', 'S', ' ')) {
+		return false;
+	}
+	uint8_t const * header = file_data + 4;
+	uint32_t height      = read_u32(header + 8);
+	uint32_t width       = read_u32(header + 12);
+	uint32_t level_count = read_u32(header + 24);
+	uint8_t const * pixel_format = header + 72;
+	uint32_t pf_flags    = read_u32(pixel_format + 4);
+	uint32_t four_cc     = read_u32(pixel_format + 8);
+	uint32_t bit_count   = read_u32(pixel_format + 12);
+	uint32_t r_mask      = read_u32(pixel_format + 16);
+	uint32_t caps2       = read_u32(header + 108);
+
+	VkDeviceSize data_offset = 4 + 124;
+	uint32_t layer_count = 1;
+	bool is_cube = (caps2 & 0x200) != 0; // DDSCAPS2_CUBEMAP
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	if ((pf_flags & 0x4) && four_cc == DDS_FOURCC('D', 'X', '1', '0')) {
+		if (file_size < data_offset + 20) {
+			return false;
+		}
+		uint8_t const * dx10 = file_data + data_offset;
+		format = dxgi_to_vk_format(read_u32(dx10));
+		is_cube = (read_u32(dx10 + 8) & 0x4) != 0; // RESOURCE_MISC_TEXTURECUBE
+		layer_count = VKAL_MAX(read_u32(dx10 + 12), 1u);
+		data_offset += 20;
+	}
+	else if (pf_flags & 0x4) {
+		switch (four_cc) {
+		case DDS_FOURCC('D', 'X', 'T', '1'): format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+		case DDS_FOURCC('D', 'X', 'T', '3'): format = VK_FORMAT_BC2_UNORM_BLOCK; break;
+		case DDS_FOURCC('D', 'X', 'T', '5'): format = VK_FORMAT_BC3_UNORM_BLOCK; break;
+		case DDS_FOURCC('A', 'T', 'I', '1'):
+		case DDS_FOURCC('B', 'C', '4', 'U'): format = VK_FORMAT_BC4_UNORM_BLOCK; break;
+		case DDS_FOURCC('A', 'T', 'I', '2'):
+		case DDS_FOURCC('B', 'C', '5', 'U'): format = VK_FORMAT_BC5_UNORM_BLOCK; break;
+		}
+	}
+	else if ((pf_flags & 0x40) && bit_count == 32) {
+		format = r_mask == 0x000000FF ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_B8G8R8A8_UNORM;
+	}
+	if (format == VK_FORMAT_UNDEFINED) {
+		printf("[texture_file] DDS: unsupported pixel format.\n");
+		return false;
+	}
+	if (is_cube) {
+		layer_count *= 6;
+	}
+	level_count = level_count ? level_count : 1;
+	if (level_count > TEXTURE_FILE_MAX_LEVELS) {
+		return false;
+	}
+
+	// DDS stores every layer with its full mip chain. Repack into level-major order.
+	VkDeviceSize layer_chain_size = 0;
+	for (uint32_t level = 0; level < level_count; ++level) {
+		layer_chain_size += vkal_image_level_size(format, width, height, level);
+	}
+	if (file_size < data_offset + layer_chain_size * layer_count) {
+		printf("[texture_file] DDS: file is truncated.\n");
+		return false;
+	}
+	uint8_t * data = (uint8_t*)malloc(layer_chain_size * layer_count);
+	VkDeviceSize dst = 0;
+	for (uint32_t level = 0; level < level_count; ++level) {
+		VkDeviceSize level_size = vkal_image_level_size(format, width, height, level);
+		VkDeviceSize level_in_chain = 0;
+		for (uint32_t l = 0; l < level; ++l) {
+			level_in_chain += vkal_image_level_size(format, width, height, l);
+		}
+		out_texture->level_offsets[level] = dst;
+		for (uint32_t layer = 0; layer < layer_count; ++layer) {
+			memcpy(data + dst, file_data + data_offset + layer * layer_chain_size + level_in_chain, level_size);
+			dst += level_size;
+		}
+	}
+	free(file_data);
+
+	out_texture->format = format;
+	out_texture->width = width;
+	out_texture->height = height;
+	out_texture->layer_count = layer_count;
+	out_texture->level_count = level_count;
+	out_texture->is_cube = is_cube;
+	out_texture->data = data;
+	out_texture->data_size = dst;
+	return true;
+}
+
+bool parse_texture_file(uint8_t * file_data, VkDeviceSize file_size, TextureFile * out_texture)
+{
+	*out_texture = TextureFile{};
+	if (parse_ktx2(file_data, file_size, out_texture)) {
+		return true;
+	}
+	return parse_dds(file_data, file_size, out_texture);
+}
+
+bool read_texture_file(char const * filename, TextureFile * out_texture)
+{
+	uint8_t * file_data = NULL;
+	int file_size = 0;
+	read_file(filename, &file_data, &file_size);
+	if (!file_data) {
+		return false;
+	}
+	if (!parse_texture_file(file_data, (VkDeviceSize)file_size, out_texture)) {
+		printf("[texture_file] %s is not a supported KTX2 or DDS file.\n", filename);
+		free(file_data);
+		return false;
+	}
+	return true;
+}
+
+void free_texture_file(TextureFile * texture)
+{
+	free(texture->data);
+	*texture = TextureFile{};
+}
+
+VkalTexture create_texture_from_file(TextureFile const * texture, uint32_t binding,
+	VkFilter min_filter, VkFilter mag_filter, VkSamplerAddressMode address_mode)
+{
+	VkImageViewType view_type = VK_IMAGE_VIEW_TYPE_2D;
+	VkImageCreateFlags flags = 0;
+	if (texture->is_cube) {
+		view_type = texture->layer_count > 6 ? VK_IMAGE_VIEW_TYPE_CUBE_ARRAY : VK_IMAGE_VIEW_TYPE_CUBE;
+		flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+	}
+	else if (texture->layer_count > 1) {
+		view_type = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	}
+	return vkal_create_texture_from_levels(binding,
+		texture->data, texture->level_offsets,
+		texture->width, texture->height, texture->format,
+		texture->level_count, texture->layer_count,
+		flags, view_type,
+		min_filter, mag_filter,
+		address_mode, address_mode, address_mode);
+}
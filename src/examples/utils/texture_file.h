@@ -0,0 +1,34 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include <stdint.h>
+
+#include <vkal.h>
+
+#define TEXTURE_FILE_MAX_LEVELS 16
+
+/* Pre-baked texture data from a KTX2 or DDS file. The data is level-major: level_offsets[i] points to
+   mip level i, which holds layer_count tightly packed layers. This is what vkal_create_texture_from_levels
+   expects, so no decoding or copying is needed on upload. */
+struct TextureFile
+{
+	VkFormat     format;
+	uint32_t     width;
+	uint32_t     height;
+	uint32_t     layer_count; /* array layers * faces */
+	uint32_t     level_count;
+	bool         is_cube;
+	uint8_t    * data;
+	VkDeviceSize data_size;
+	VkDeviceSize level_offsets[TEXTURE_FILE_MAX_LEVELS];
+};
+
+/* Parses a KTX2 or DDS file in memory. Takes ownership of file_data (malloc'd) on success. */
+bool        parse_texture_file(uint8_t * file_data, VkDeviceSize file_size, TextureFile * out_texture);
+/* Reads a KTX2 or DDS file relative to the executable, see read_file. */
+bool        read_texture_file(char const * filename, TextureFile * out_texture);
+void        free_texture_file(TextureFile * texture);
+VkalTexture create_texture_from_file(TextureFile const * texture, uint32_t binding,
+	VkFilter min_filter, VkFilter mag_filter, VkSamplerAddressMode address_mode);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stb/stb_image.h"
+
+#include "texture_loader.h"
+#include "texture_file.h"
+#include "platform.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct DecodedTexture
+{
+	uint32_t      request_index;
+	bool          is_texture_file;
+	TextureFile   file;   /* .ktx2 / .dds */
+	unsigned char * pixels; /* stb_image, always RGBA8 */
+	int           width;
+	int           height;
+};
+
+struct TextureLoadQueue
+{
+	std::mutex                 mutex;
+	std::condition_variable    ready;
+	std::deque<DecodedTexture> decoded;
+	std::atomic<uint32_t>      next_request;
+	double                     read_seconds;
+	double                     decode_seconds;
+};
+
+static bool has_extension(char const * filename, char const * extension)
+{
+	size_t name_length = strlen(filename);
+	size_t extension_length = strlen(extension);
+	if (name_length < extension_length) return false;
+	char const * tail = filename + name_length - extension_length;
+	for (size_t i = 0; i < extension_length; ++i) {
+		char c = tail[i];
+		if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+		if (c != extension[i]) return false;
+	}
+	return true;
+}
+
+static void decode_worker(TextureLoadQueue * queue, TextureLoadRequest const * requests, uint32_t request_count)
+{
+	double read_seconds = 0.0;
+	double decode_seconds = 0.0;
+	for (;;) {
+		uint32_t index = queue->next_request.fetch_add(1);
+		if (index >= request_count) {
+			break;
+		}
+		char const * filename = requests[index].filename;
+
+		Clock::time_point start = Clock::now();
+		uint8_t * file_data = NULL;
+		int file_size = 0;
+		read_file(filename, &file_data, &file_size);
+		read_seconds += seconds_since(start);
+
+		start = Clock::now();
+		DecodedTexture decoded = {};
+		decoded.request_index = index;
+		if (file_data) {
+			if (has_extension(filename, ".ktx2") || has_extension(filename, ".dds")) {
+				decoded.is_texture_file = true;
+				if (!parse_texture_file(file_data, (VkDeviceSize)file_size, &decoded.file)) {
+					printf("[texture_loader] %s is not a supported KTX2 or DDS file.\n", filename);
+					free(file_data);
+				}
+			}
+			else {
+				int channels;
+				decoded.pixels = stbi_load_from_memory(file_data, file_size, &decoded.width, &decoded.height, &channels, 4);
+				if (!decoded.pixels) {
+					printf("[texture_loader] Failed to decode %s: %s\n", filename, stbi_failure_reason());
+				}
+				free(file_data);
+			}
+		}
+		decode_seconds += seconds_since(start);
+
+		{
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->decoded.push_back(decoded);
+		}
+		queue->ready.notify_one();
+	}
+
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	queue->read_seconds += read_seconds;
+	queue->decode_seconds += decode_seconds;
+}
+
+VkalUploadTicket load_textures(TextureLoadRequest const * requests, uint32_t request_count,
+	VkalTexture * out_textures, uint32_t thread_count, TextureLoadTimings * out_timings)
+{
+	Clock::time_point total_start = Clock::now();
+	TextureLoadTimings timings = {};
+
+	if (thread_count == 0) {
+		thread_count = VKAL_MAX(std::thread::hardware_concurrency(), 1u);
+	}
+	thread_count = VKAL_MIN(thread_count, VKAL_MAX(request_count, 1u));
+
+	TextureLoadQueue queue;
+	queue.next_request = 0;
+	queue.read_seconds = 0.0;
+	queue.decode_seconds = 0.0;
+
+	std::vector<std::thread> workers;
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		workers.push_back(std::thread(decode_worker, &queue, requests, request_count));
+	}
+
+	VkalUploadTicket ticket = vkal_upload_current_ticket();
+	for (uint32_t done = 0; done < request_count; ++done) {
+		Clock::time_point start = Clock::now();
+		DecodedTexture decoded;
+		{
+			std::unique_lock<std::mutex> lock(queue.mutex);
+			queue.ready.wait(lock, [&queue] { return !queue.decoded.empty(); });
+			decoded = queue.decoded.front();
+			queue.decoded.pop_front();
+		}
+		timings.wait_seconds += seconds_since(start);
+
+		TextureLoadRequest const & request = requests[decoded.request_index];
+		VkalTexture & texture = out_textures[decoded.request_index];
+		texture = VkalTexture{};
+
+		start = Clock::now();
+		if (decoded.is_texture_file && decoded.file.data) {
+			texture = create_texture_from_file(&decoded.file, request.binding,
+				request.min_filter, request.mag_filter, request.address_mode);
+			timings.bytes_uploaded += decoded.file.data_size;
+			free_texture_file(&decoded.file);
+		}
+		else if (decoded.pixels) {
+			texture = vkal_create_texture(request.binding,
+				decoded.pixels, decoded.width, decoded.height, 4, 0,
+				VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+				0, request.mip_level_count ? request.mip_level_count : 1, 0, 1,
+				request.min_filter, request.mag_filter,
+				request.address_mode, request.address_mode, request.address_mode);
+			timings.bytes_uploaded += (uint64_t)decoded.width * decoded.height * 4;
+			stbi_image_free(decoded.pixels);
+		}
+		else {
+			timings.failed_count++;
+		}
+		// The pixels are in staging memory now. Submit in batches so the GPU copies while we wait for the next decode.
+		ticket = vkal_upload_flush();
+		timings.upload_seconds += seconds_since(start);
+	}
+
+	for (uint32_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+
+	timings.read_seconds = queue.read_seconds;
+	timings.decode_seconds = queue.decode_seconds;
+	timings.total_seconds = seconds_since(total_start);
+	if (out_timings) {
+		*out_timings = timings;
+	}
+	return ticket;
+}
@@ -0,0 +1,44 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <stdint.h>
+
+#include <vkal.h>
+
+/* Loads many textures at once. Files are read and decoded on a pool of worker threads; the main
+   thread creates each texture as soon as its pixels are ready, so decoding overlaps with the copies
+   into staging memory. Vulkan is only touched from the calling thread.
+
+   PNG/JPG/... go through stb_image (the example has to provide STB_IMAGE_IMPLEMENTATION),
+   .ktx2 and .dds go through texture_file.h and keep their pre-baked mips. */
+
+struct TextureLoadRequest
+{
+	char const *         filename;      /* relative to the executable, see read_file */
+	uint32_t             binding;
+	VkFilter             min_filter;
+	VkFilter             mag_filter;
+	VkSamplerAddressMode address_mode;
+	uint32_t             mip_level_count; /* for stb_image files, VKAL_MIP_LEVELS_ALL for a full chain */
+};
+
+struct TextureLoadTimings
+{
+	/* Summed over all workers. */
+	double read_seconds;
+	double decode_seconds;
+	/* Spent on the calling thread in vkal_create_texture* */
+	double upload_seconds;
+	/* Time the calling thread waited for workers to hand over a texture. */
+	double wait_seconds;
+	double total_seconds;
+	uint64_t bytes_uploaded;
+	uint32_t failed_count;
+};
+
+/* Fills out_textures[i] for requests[i]. Textures that failed to load are zero-initialized (sampler is VK_NULL_HANDLE).
+   thread_count 0 uses std::thread::hardware_concurrency. Returns the ticket of the last upload. */
+VkalUploadTicket load_textures(TextureLoadRequest const * requests, uint32_t request_count,
+	VkalTexture * out_textures, uint32_t thread_count, TextureLoadTimings * out_timings);
+
+#endif
@@ -35,6 +35,30 @@ PFN_vkCreateRayTracingPipelinesKHR                    vkCreateRayTracingPipeline
 PFN_vkGetRayTracingShaderGroupHandlesKHR              vkGetRayTracingShaderGroupHandles;
 PFN_vkCmdTraceRaysKHR                                 vkCmdTraceRays;
 //PFN_vkGetBufferDeviceAddressKHR                       vkGetBufferDeviceAddress;
+#ifdef VK_EXT_external_memory_host
+PFN_vkGetMemoryHostPointerPropertiesEXT               vkGetMemoryHostPointerProperties;
+#endif
+#ifdef VK_EXT_host_image_copy
+PFN_vkCopyMemoryToImageEXT                            vkCopyMemoryToImage;
+PFN_vkTransitionImageLayoutEXT                        vkTransitionImageLayout;
+#define VKAL_IMAGE_USAGE_HOST_TRANSFER VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT
+#else
+#define VKAL_IMAGE_USAGE_HOST_TRANSFER 0
+#endif
+
+/* vkCmdBeginRendering or vkCmdBeginRenderingKHR, whichever the device has, see create_logical_device. */
+static PFN_vkCmdBeginRendering                        cmd_begin_rendering;
+static PFN_vkCmdEndRendering                          cmd_end_rendering;
+/* Extended dynamic state, core in 1.3, VK_EXT_extended_dynamic_state(3) otherwise. */
+static PFN_vkCmdSetCullMode                           cmd_set_cull_mode;
+static PFN_vkCmdSetFrontFace                          cmd_set_front_face;
+static PFN_vkCmdSetPrimitiveTopology                  cmd_set_primitive_topology;
+static PFN_vkCmdSetDepthTestEnable                    cmd_set_depth_test_enable;
+static PFN_vkCmdSetDepthWriteEnable                   cmd_set_depth_write_enable;
+static PFN_vkCmdSetDepthCompareOp                     cmd_set_depth_compare_op;
+#ifdef VK_EXT_extended_dynamic_state3
+static PFN_vkCmdSetPolygonModeEXT                     cmd_set_polygon_mode;
+#endif
 
 static VkalInfo vkal_info;
 
@@ -80,8 +104,14 @@ VkalInfo * vkal_init(char ** extensions, uint32_t extension_count, VkalWantedFea
     create_default_index_buffer(INDEX_BUFFER_SIZE);
     allocate_default_device_memory_index();
     create_staging_buffer(STAGING_BUFFER_SIZE);
+    create_timelines();
+    create_upload_batches();
+    create_readback_slots();
     create_default_semaphores();
     vkal_info.frames_rendered = 0;
+    create_frame_contexts(VKAL_DEFAULT_FRAMES_IN_FLIGHT);
+    create_compute_submits();
+    vkal_info.state_cache_enabled = 1;
 
     // Setup some flags required for feature enable/disable
     vkal_info.raytracing_enabled = 0;
@@ -215,6 +245,7 @@ void vkal_create_instance_glfw(
     
         VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
 		VKAL_ASSERT(result && "failed to create VkInstance");
+        vkal_info.instance_api_version = app_info.apiVersion;
 
 		for (uint32_t i = 0; i < total_instance_ext_count; ++i) {
 			free(all_instance_extensions[i]);
@@ -320,6 +351,7 @@ void vkal_create_instance_win32(
 
         VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
 		VKAL_ASSERT(result && "failed to create VkInstance");
+        vkal_info.instance_api_version = app_info.apiVersion;
 
 		for (uint32_t i = 0; i < total_instance_ext_count; ++i) {
 			free(all_instance_extensions[i]);
@@ -426,6 +458,7 @@ void vkal_create_instance_sdl(
 
         VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
         VKAL_ASSERT(result && "failed to create VkInstance");
+        vkal_info.instance_api_version = app_info.apiVersion;
     }
 
     create_sdl_surface();
@@ -507,6 +540,12 @@ void set_image_layout(
 	    // Make sure any shader reads from the image have been finished
 	    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	    break;
+
+        case VK_IMAGE_LAYOUT_GENERAL:
+	    // Image is a storage image
+	    // Make sure any shader writes to the image have been finished
+	    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	    break;
         default:
 	    // Other source layouts aren't handled (yet)
 	    break;
@@ -549,6 +588,12 @@ void set_image_layout(
 	    }
 	    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	    break;
+
+        case VK_IMAGE_LAYOUT_GENERAL:
+	    // Image will be used as a storage image
+	    // Make sure any writes to the image have been finished
+	    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	    break;
         default:
 	    // Other source layouts aren't handled (yet)
 	    break;
@@ -565,6 +610,132 @@ void set_image_layout(
 	1, &barrier);
 }
 
+static void create_timeline(VkalTimeline * timeline)
+{
+    VkSemaphoreTypeCreateInfo type_info = { 0 };
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+    VkSemaphoreCreateInfo sem_info = { 0 };
+    sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    sem_info.pNext = &type_info;
+    VkResult result = vkCreateSemaphore(vkal_info.device, &sem_info, 0, &timeline->semaphore);
+    VKAL_ASSERT(result && "failed to create timeline semaphore");
+    timeline->submitted = 0;
+    timeline->completed = 0;
+}
+
+void create_timelines(void)
+{
+    create_timeline(&vkal_info.graphics_timeline);
+    if (vkal_info.compute_queue != VK_NULL_HANDLE) {
+        create_timeline(&vkal_info.compute_timeline);
+    }
+    if (vkal_info.transfer_queue != VK_NULL_HANDLE) {
+        create_timeline(&vkal_info.transfer_timeline);
+    }
+}
+
+void destroy_timelines(void)
+{
+    vkDestroySemaphore(vkal_info.device, vkal_info.graphics_timeline.semaphore, NULL);
+    if (vkal_info.compute_timeline.semaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(vkal_info.device, vkal_info.compute_timeline.semaphore, NULL);
+    }
+    if (vkal_info.transfer_timeline.semaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(vkal_info.device, vkal_info.transfer_timeline.semaphore, NULL);
+    }
+    memset(&vkal_info.graphics_timeline, 0, sizeof(VkalTimeline));
+    memset(&vkal_info.compute_timeline, 0, sizeof(VkalTimeline));
+    memset(&vkal_info.transfer_timeline, 0, sizeof(VkalTimeline));
+}
+
+/* The timeline of a queue vkal created, NULL for others. */
+static VkalTimeline * queue_timeline(VkQueue queue)
+{
+    if (queue == vkal_info.graphics_queue) return &vkal_info.graphics_timeline;
+    if (queue == vkal_info.compute_queue) return &vkal_info.compute_timeline;
+    if (queue == vkal_info.transfer_queue) return &vkal_info.transfer_timeline;
+    return NULL;
+}
+
+/* Submits command buffers to the queue of timeline and signals its next value, which is returned. The waits can mix
+   timeline semaphores and binary ones, the value of a binary wait is ignored. binary_signal is optional, eg. for present. */
+static uint64_t timeline_submit(VkalTimeline * timeline, VkQueue queue,
+    VkCommandBuffer const * command_buffers, uint32_t command_buffer_count,
+    VkSemaphore const * wait_semaphores, uint64_t const * wait_values, VkPipelineStageFlags const * wait_stages, uint32_t wait_count,
+    VkSemaphore binary_signal)
+{
+    uint64_t value = ++timeline->submitted;
+    VkSemaphore signal_semaphores[2] = { timeline->semaphore, binary_signal };
+    uint64_t signal_values[2] = { value, 0 };
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = { 0 };
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = wait_count;
+    timeline_info.pWaitSemaphoreValues = wait_values;
+    timeline_info.signalSemaphoreValueCount = binary_signal != VK_NULL_HANDLE ? 2 : 1;
+    timeline_info.pSignalSemaphoreValues = signal_values;
+
+    VkSubmitInfo submit_info = { 0 };
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = wait_count;
+    submit_info.pWaitSemaphores = wait_semaphores;
+    submit_info.pWaitDstStageMask = wait_stages;
+    submit_info.commandBufferCount = command_buffer_count;
+    submit_info.pCommandBuffers = command_buffers;
+    submit_info.signalSemaphoreCount = timeline_info.signalSemaphoreValueCount;
+    submit_info.pSignalSemaphores = signal_semaphores;
+    VkResult result = vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+    VKAL_ASSERT(result && "failed to submit to queue");
+    return value;
+}
+
+static int timeline_reached(VkalTimeline * timeline, uint64_t value)
+{
+    if (value <= timeline->completed) {
+        return 1;
+    }
+    uint64_t counter = 0;
+    VkResult result = vkGetSemaphoreCounterValue(vkal_info.device, timeline->semaphore, &counter);
+    VKAL_ASSERT(result && "failed to query timeline semaphore");
+    timeline->completed = VKAL_MAX(timeline->completed, counter);
+    return value <= timeline->completed;
+}
+
+static void timeline_wait(VkalTimeline * timeline, uint64_t value)
+{
+    if (timeline_reached(timeline, value)) {
+        return;
+    }
+    VkSemaphoreWaitInfo wait_info = { 0 };
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &timeline->semaphore;
+    wait_info.pValues = &value;
+    VkResult result = vkWaitSemaphores(vkal_info.device, &wait_info, UINT64_MAX);
+    VKAL_ASSERT(result && "failed waiting on timeline semaphore");
+    timeline->completed = VKAL_MAX(timeline->completed, value);
+}
+
+/* Value of the graphics timeline the most recent submit signals. Frames, uploads and readbacks all go through the
+   graphics queue, so vkal_wait(vkal_submitted_value()) waits for everything vkal submitted so far. */
+uint64_t vkal_submitted_value(void)
+{
+    return vkal_info.graphics_timeline.submitted;
+}
+
+int vkal_is_complete(uint64_t value)
+{
+    return timeline_reached(&vkal_info.graphics_timeline, value);
+}
+
+void vkal_wait(uint64_t value)
+{
+    timeline_wait(&vkal_info.graphics_timeline, value);
+}
+
 void vkal_flush_command_buffer(VkCommandBuffer command_buffer, VkQueue queue, int free)
 {
     if (command_buffer == VK_NULL_HANDLE)
@@ -575,27 +746,24 @@ void vkal_flush_command_buffer(VkCommandBuffer command_buffer, VkQueue queue, in
     VkResult result = vkEndCommandBuffer(command_buffer);
     VKAL_ASSERT(result && "failed to end command buffer");
 
-    VkSubmitInfo submit_info = {0};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
-
-    // Create fence to ensure that the command buffer has finished executing
-    VkFenceCreateInfo fence_info = {0};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = 0;
+    // The command buffer might use resources that have uploads pending.
+    vkal_upload_flush();
 
-    VkFence fence = VK_NULL_HANDLE;
-    result = vkCreateFence(vkal_info.device, &fence_info, NULL, &fence);
-    VKAL_ASSERT(result && "failed to create fence");
-
-    // Submit to the queue
-    result = vkQueueSubmit(queue, 1, &submit_info, fence);
-    // Wait for the fence to signal that command buffer has finished executing
-    result = vkWaitForFences(vkal_info.device, 1, &fence, VK_TRUE, UINT64_MAX);
-    VKAL_ASSERT(result && "failed waiting on fence");
-
-    vkDestroyFence(vkal_info.device, fence, NULL);
+    // Wait on the queue's timeline until the command buffer has finished executing
+    VkalTimeline * timeline = queue_timeline(queue);
+    if (timeline) {
+        timeline_wait(timeline, timeline_submit(timeline, queue, &command_buffer, 1, NULL, NULL, NULL, 0, VK_NULL_HANDLE));
+    }
+    else {
+        VkSubmitInfo submit_info = {0};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &command_buffer;
+        result = vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+        VKAL_ASSERT(result && "failed to submit command buffer");
+        result = vkQueueWaitIdle(queue);
+        VKAL_ASSERT(result && "failed waiting on queue");
+    }
 
     if (vkal_info.default_command_pools[0] && free)
     {
@@ -623,19 +791,7 @@ VkalImage create_vkal_image(
 			&vkal_image.image);			
 
 		// Back the image with actual memory:
-		VkMemoryRequirements image_memory_requirements = { 0 };
-		vkGetImageMemoryRequirements(
-			vkal_info.device,
-			get_image(vkal_image.image),
-			&image_memory_requirements);
-		uint32_t mem_type_bits = check_memory_type_index(
-			image_memory_requirements.memoryTypeBits,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		create_device_memory(image_memory_requirements.size, mem_type_bits, &vkal_image.device_memory);
-		VkResult result = vkBindImageMemory(
-			vkal_info.device, get_image(vkal_image.image),
-			get_device_memory(vkal_image.device_memory), 0);
-		VKAL_ASSERT(result && "failed to bind texture image memory!");
+		bind_image_memory(vkal_image.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     }
 
     // Image View
@@ -708,7 +864,7 @@ RenderImage create_render_image(uint32_t width, uint32_t height)
 		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
     for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
-		render_image.framebuffers[i] = create_render_image_framebuffer(render_image, width, height);
+		render_image.framebuffers[i] = vkal_info.dynamic_rendering ? VKAL_INVALID_ID : create_render_image_framebuffer(render_image, width, height);
     }
     render_image.width = width;
     render_image.height = height;
@@ -717,10 +873,20 @@ RenderImage create_render_image(uint32_t width, uint32_t height)
 
 void vkal_unmap_buffer(VkalBuffer * buffer)
 {
-    if (buffer->mapped) {
+    if (!buffer->mapped) {
+		return;
+    }
+    DeviceMemory * memory = buffer->vkal_device_memory;
+    if (memory) {
+		if (--memory->map_count == 0) {
+			vkUnmapMemory(vkal_info.device, memory->vk_device_memory);
+			memory->mapped = NULL;
+		}
+    }
+    else {
 		vkUnmapMemory(vkal_info.device, buffer->device_memory);
-		buffer->mapped = NULL;
     }
+    buffer->mapped = NULL;
 }
 
 
@@ -911,6 +1077,8 @@ void cleanup_swapchain(void)
 void recreate_swapchain(void)
 {
     vkDeviceWaitIdle(vkal_info.device);
+    // The image count might change and nothing is in flight anymore.
+    memset(vkal_info.image_in_flight_values, 0, sizeof(vkal_info.image_in_flight_values));
     
     cleanup_swapchain();
     
@@ -918,8 +1086,7 @@ void recreate_swapchain(void)
     create_image_views();
 
     vkal_destroy_image_view( vkal_info.depth_stencil_image_view );
-    vkal_destroy_image( vkal_info.depth_stencil_image );
-    vkal_destroy_device_memory( vkal_info.device_memory_depth_stencil ); // TODO: Is this smart to destroy the whole memory object?
+    vkal_destroy_image( vkal_info.depth_stencil_image ); // gives the memory back to its image heap
     create_default_depth_buffer();
     create_default_framebuffers();
     // TODO: Maybe we need to recreate the default command buffers (if client uses them)
@@ -949,6 +1116,8 @@ void create_swapchain(void)
     create_info.imageExtent = extent;
     create_info.imageArrayLayers = 1;
     create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    // Allows vkal_readback_image on swapchain images.
+    create_info.imageUsage |= swap_chain_support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
     
     QueueFamilyIndicies indices = find_queue_families(vkal_info.physical_device, vkal_info.surface);
     uint32_t queue_family_indices[2];
@@ -975,6 +1144,7 @@ void create_swapchain(void)
     VKAL_ASSERT(result && "failed to create swapchain!");
     
     vkGetSwapchainImagesKHR(vkal_info.device, vkal_info.swapchain, &image_count, 0);
+    assert(image_count <= VKAL_MAX_SWAPCHAIN_IMAGES && "swapchain has more images than VKAL_MAX_SWAPCHAIN_IMAGES!");
     vkal_info.swapchain_image_count = image_count;
     vkGetSwapchainImagesKHR(vkal_info.device, vkal_info.swapchain, &image_count, vkal_info.swapchain_images);
     
@@ -1036,6 +1206,8 @@ void create_image(uint32_t width, uint32_t height, uint32_t mip_levels, uint32_t
     VkResult result = vkCreateImage(vkal_info.device, &image_info, 0, &vkal_info.user_images[ free_image_index ].image);
     VKAL_ASSERT(result && "failed to create VkImage!");
     vkal_info.user_images[free_image_index].used = 1;
+    vkal_info.user_images[free_image_index].heap = VKAL_INVALID_ID;
+    vkal_info.user_images[free_image_index].offset = 0;
     *out_image_id = free_image_index;
 }
 
@@ -1043,6 +1215,10 @@ void vkal_destroy_image(uint32_t id)
 {
     if (vkal_info.user_images[id].used) {
 		vkDestroyImage(vkal_info.device, get_image(id), 0);
+		if (vkal_info.user_images[id].heap != VKAL_INVALID_ID) {
+			free_image_memory(vkal_info.user_images[id].heap, vkal_info.user_images[id].offset);
+		}
+		vkal_info.user_images[id].heap = VKAL_INVALID_ID;
 		vkal_info.user_images[id].used = 0;
     }
 }
@@ -1076,7 +1252,7 @@ void vkal_create_image_view(VkImage image,
     view_info.subresourceRange.layerCount = array_layer_count;
 
     uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKDEVICEMEMORY; ++free_index) {
+    for (free_index = 0; free_index < VKAL_MAX_VKIMAGEVIEW; ++free_index) {
 	    if (vkal_info.user_image_views[free_index].used) {
 	        continue;
 	    }
@@ -1109,6 +1285,13 @@ VkImageView get_image_view(uint32_t id)
 // TODO: Too view options!
 VkSampler create_sampler(VkFilter min_filter, VkFilter mag_filter, VkSamplerAddressMode u,
 			 VkSamplerAddressMode v, VkSamplerAddressMode w)
+{
+    return create_sampler2(min_filter, mag_filter, u, v, w, VK_SAMPLER_MIPMAP_MODE_NEAREST, 0.f);
+}
+
+VkSampler create_sampler2(VkFilter min_filter, VkFilter mag_filter, VkSamplerAddressMode u,
+			 VkSamplerAddressMode v, VkSamplerAddressMode w,
+			 VkSamplerMipmapMode mipmap_mode, float max_lod)
 {
     VkSamplerCreateInfo sampler_info = { 0 };
     sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1122,12 +1305,12 @@ VkSampler create_sampler(VkFilter min_filter, VkFilter mag_filter, VkSamplerAddr
     sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
     sampler_info.minFilter = min_filter;
     sampler_info.magFilter = mag_filter;
-    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.mipmapMode = mipmap_mode;
     sampler_info.mipLodBias = 0.f;
     sampler_info.anisotropyEnable = VK_FALSE;
     sampler_info.maxAnisotropy = 1.f;
     sampler_info.minLod = 0.f;
-    sampler_info.maxLod = 0.f;
+    sampler_info.maxLod = max_lod;
     sampler_info.unnormalizedCoordinates = VK_FALSE;
     uint32_t id;
     internal_create_sampler(sampler_info, &id);
@@ -1136,15 +1319,34 @@ VkSampler create_sampler(VkFilter min_filter, VkFilter mag_filter, VkSamplerAddr
 
 static void internal_create_sampler(VkSamplerCreateInfo create_info, uint32_t * out_sampler)
 {
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKSAMPLER; ++free_index) {
-		if (vkal_info.user_samplers[free_index].used) {
+    // Scenes with many textures mostly use a handful of distinct samplers, so share them.
+    uint32_t free_index = VKAL_MAX_VKSAMPLER;
+    for (uint32_t i = 0; i < VKAL_MAX_VKSAMPLER; ++i) {
+		VkalSamplerHandle * handle = &vkal_info.user_samplers[i];
+		if (!handle->used) {
+			if (free_index == VKAL_MAX_VKSAMPLER) free_index = i;
 			continue;
 		}
-		break;
+		VkSamplerCreateInfo const * info = &handle->create_info;
+		if (!create_info.pNext && !info->pNext && info->flags == create_info.flags &&
+			info->magFilter == create_info.magFilter && info->minFilter == create_info.minFilter &&
+			info->mipmapMode == create_info.mipmapMode &&
+			info->addressModeU == create_info.addressModeU && info->addressModeV == create_info.addressModeV &&
+			info->addressModeW == create_info.addressModeW && info->mipLodBias == create_info.mipLodBias &&
+			info->anisotropyEnable == create_info.anisotropyEnable && info->maxAnisotropy == create_info.maxAnisotropy &&
+			info->compareEnable == create_info.compareEnable && info->compareOp == create_info.compareOp &&
+			info->minLod == create_info.minLod && info->maxLod == create_info.maxLod &&
+			info->borderColor == create_info.borderColor &&
+			info->unnormalizedCoordinates == create_info.unnormalizedCoordinates) {
+			handle->used++;
+			*out_sampler = i;
+			return;
+		}
     }
+    assert(free_index < VKAL_MAX_VKSAMPLER && "too many samplers!");
     VkResult result = vkCreateSampler(vkal_info.device, &create_info, 0, &vkal_info.user_samplers[free_index].sampler);
     VKAL_ASSERT(result && "failed to create VkSampler!");
+    vkal_info.user_samplers[free_index].create_info = create_info;
     vkal_info.user_samplers[free_index].used = 1;
     *out_sampler = free_index;
 }
@@ -1158,9 +1360,11 @@ VkSampler get_sampler(uint32_t id)
 
 void destroy_sampler(uint32_t id)
 {
-    if (vkal_info.user_samplers[id].used) {
+    if (vkal_info.user_samplers[id].used == 1) {
 	    vkDestroySampler(vkal_info.device, get_sampler(id), 0);
-	    vkal_info.user_samplers[id].used = 0;
+    }
+    if (vkal_info.user_samplers[id].used) {
+	    vkal_info.user_samplers[id].used--;
     }
 }
 
@@ -1233,35 +1437,228 @@ VkalTexture vkal_create_texture(
     texture.width = width;
     texture.height = height;
     texture.channels = channels;
+    texture.format = format;
+    texture.array_layer_count = array_layer_count;
+
+    // Mip levels > 0 are generated on the GPU by blitting from level 0. That needs blit support and
+    // linear filtering for the format, otherwise fall back to nearest filtering or to a single level.
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    int host_copy = texture_use_host_image_copy(format);
+    if (host_copy) {
+        usage |= VKAL_IMAGE_USAGE_HOST_TRANSFER;
+    }
+    VkFilter mip_filter = VK_FILTER_LINEAR;
+    if (mip_level_count == VKAL_MIP_LEVELS_ALL) {
+        mip_level_count = vkal_mip_level_count(width, height);
+    }
+    if (mip_level_count > 1) {
+        VkFormatProperties format_properties;
+        vkGetPhysicalDeviceFormatProperties(vkal_info.physical_device, format, &format_properties);
+        VkFormatFeatureFlags features = format_properties.optimalTilingFeatures;
+        if (!(features & VK_FORMAT_FEATURE_BLIT_SRC_BIT) || !(features & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+            printf("[VKAL] vkal_create_texture: format %d does not support blits, mip levels are not generated.\n", format);
+            mip_level_count = 1;
+        }
+        else {
+            usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            if (!(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+                mip_filter = VK_FILTER_NEAREST;
+            }
+        }
+    }
+
+    texture.mip_level_count = mip_level_count;
+
     create_image(width, height, mip_level_count, array_layer_count, flags, format,
-		 VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		 usage,
 		 &texture.image);
     
     // Back the image with actual memory:	
-    VkMemoryRequirements image_memory_requirements = { 0 };
-    vkGetImageMemoryRequirements(vkal_info.device, get_image(texture.image), &image_memory_requirements);
-    uint32_t mem_type_bits = check_memory_type_index(image_memory_requirements.memoryTypeBits,
-						     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    create_device_memory(image_memory_requirements.size, mem_type_bits, &texture.device_memory_id);
-    VkResult result = vkBindImageMemory(vkal_info.device,
-					get_image(texture.image), get_device_memory(texture.device_memory_id), 0);
-    VKAL_ASSERT(result && "failed to bind texture image memory!");
+    bind_image_memory(texture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     
     vkal_create_image_view(get_image(texture.image), view_type,
 		      format, VK_IMAGE_ASPECT_COLOR_BIT,
 		      base_mip_level, mip_level_count, 
 		      base_array_layer, array_layer_count,
 		      &texture.image_view);
-    texture.sampler = create_sampler(min_filter, mag_filter, 
+    texture.sampler = create_sampler2(min_filter, mag_filter, 
 				     sampler_u, sampler_v,
-				     sampler_w);
+				     sampler_w,
+				     mip_filter == VK_FILTER_LINEAR ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST,
+				     (float)mip_level_count);
     texture.binding = binding;
 	
-    upload_texture(get_image(texture.image), width, height, channels, array_layer_count, texture_data);
+    if (host_copy) {
+        VkalFormatInfo format_info = { 1, 1, channels };
+        upload_texture_levels_host(get_image(texture.image), width, height, format_info, array_layer_count, 1, texture_data, NULL);
+    }
+    else {
+        upload_texture(get_image(texture.image), width, height, channels, array_layer_count, texture_data);
+    }
+    if (mip_level_count > 1) {
+        generate_mipmaps(get_image(texture.image), width, height, array_layer_count, mip_level_count, mip_filter);
+    }
     
     return texture;
 }
 
+/* Creates a texture from data that already contains all mip levels, eg. block-compressed data from a KTX2 or
+   DDS file. See upload_texture_levels for the expected layout. */
+VkalTexture vkal_create_texture_from_levels(
+	uint32_t binding,
+    unsigned char * texture_data,
+	VkDeviceSize const * level_offsets,
+	uint32_t width, 
+	uint32_t height, 
+	VkFormat format,
+	uint32_t mip_level_count, 
+	uint32_t array_layer_count,
+	VkImageCreateFlags flags, 
+	VkImageViewType view_type, 
+    VkFilter min_filter, 
+	VkFilter mag_filter,
+	VkSamplerAddressMode sampler_u, 
+	VkSamplerAddressMode sampler_v, 
+	VkSamplerAddressMode sampler_w)
+{
+    VkalFormatInfo format_info = vkal_format_info(format);
+    if (format_info.block_size == 0) {
+        printf("[VKAL] vkal_create_texture_from_levels: unknown format %d!\n", format);
+        abort();
+    }
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(vkal_info.physical_device, format, &format_properties);
+    if (!(format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        printf("[VKAL] vkal_create_texture_from_levels: format %d cannot be sampled on this device!\n", format);
+        abort();
+    }
+    VkFilter filter = (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+    VkalTexture texture = { 0 };
+    texture.width = width;
+    texture.height = height;
+    texture.channels = 0;
+    texture.format = format;
+    texture.mip_level_count = mip_level_count;
+    texture.array_layer_count = array_layer_count;
+    int host_copy = texture_use_host_image_copy(format);
+    create_image(width, height, mip_level_count, array_layer_count, flags, format,
+		 VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | (host_copy ? VKAL_IMAGE_USAGE_HOST_TRANSFER : 0),
+		 &texture.image);
+    bind_image_memory(texture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    vkal_create_image_view(get_image(texture.image), view_type,
+		      format, VK_IMAGE_ASPECT_COLOR_BIT,
+		      0, mip_level_count, 
+		      0, array_layer_count,
+		      &texture.image_view);
+    texture.sampler = create_sampler2(filter == VK_FILTER_LINEAR ? min_filter : VK_FILTER_NEAREST,
+				     filter == VK_FILTER_LINEAR ? mag_filter : VK_FILTER_NEAREST,
+				     sampler_u, sampler_v, sampler_w,
+				     filter == VK_FILTER_LINEAR ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST,
+				     (float)mip_level_count);
+    texture.binding = binding;
+
+    if (host_copy) {
+        upload_texture_levels_host(get_image(texture.image), width, height, format_info,
+            array_layer_count, mip_level_count, texture_data, level_offsets);
+    }
+    else {
+        upload_texture_levels(get_image(texture.image), width, height, format_info,
+            array_layer_count, mip_level_count, texture_data, level_offsets);
+    }
+
+    return texture;
+}
+
+/* The texture's sampler may be shared with other textures, it is only destroyed with its last user.
+   The caller has to make sure the GPU is done with the texture. */
+void vkal_destroy_texture(VkalTexture * texture)
+{
+    vkal_destroy_image_view(texture->image_view);
+    vkal_destroy_image(texture->image);
+    for (uint32_t i = 0; i < VKAL_MAX_VKSAMPLER; ++i) {
+		if (vkal_info.user_samplers[i].used && vkal_info.user_samplers[i].sampler == texture->sampler) {
+			destroy_sampler(i);
+			break;
+		}
+    }
+    memset(texture, 0, sizeof(VkalTexture));
+}
+
+VkalFormatInfo vkal_format_info(VkFormat format)
+{
+    VkalFormatInfo info = { 1, 1, 0 };
+    switch (format) {
+    case VK_FORMAT_R8_UNORM: case VK_FORMAT_R8_SNORM: case VK_FORMAT_R8_UINT: case VK_FORMAT_R8_SINT: case VK_FORMAT_R8_SRGB:
+        info.block_size = 1; break;
+    case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R8G8_SNORM: case VK_FORMAT_R8G8_UINT: case VK_FORMAT_R8G8_SINT: case VK_FORMAT_R8G8_SRGB:
+    case VK_FORMAT_R16_UNORM: case VK_FORMAT_R16_SFLOAT: case VK_FORMAT_R16_UINT: case VK_FORMAT_R16_SINT:
+    case VK_FORMAT_R5G6B5_UNORM_PACK16: case VK_FORMAT_B5G6R5_UNORM_PACK16: case VK_FORMAT_D16_UNORM:
+        info.block_size = 2; break;
+    case VK_FORMAT_R8G8B8_UNORM: case VK_FORMAT_R8G8B8_SRGB: case VK_FORMAT_B8G8R8_UNORM: case VK_FORMAT_B8G8R8_SRGB:
+        info.block_size = 3; break;
+    case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SNORM: case VK_FORMAT_R8G8B8A8_UINT: case VK_FORMAT_R8G8B8A8_SINT:
+    case VK_FORMAT_R8G8B8A8_SRGB: case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32: case VK_FORMAT_B10G11R11_UFLOAT_PACK32: case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+    case VK_FORMAT_R16G16_UNORM: case VK_FORMAT_R16G16_SFLOAT: case VK_FORMAT_R32_SFLOAT: case VK_FORMAT_R32_UINT:
+    case VK_FORMAT_R32_SINT: case VK_FORMAT_D32_SFLOAT: case VK_FORMAT_D24_UNORM_S8_UINT:
+        info.block_size = 4; break;
+    case VK_FORMAT_R16G16B16A16_UNORM: case VK_FORMAT_R16G16B16A16_SFLOAT: case VK_FORMAT_R16G16B16A16_UINT:
+    case VK_FORMAT_R32G32_SFLOAT: case VK_FORMAT_R32G32_UINT: case VK_FORMAT_R32G32_SINT:
+        info.block_size = 8; break;
+    case VK_FORMAT_R32G32B32_SFLOAT: case VK_FORMAT_R32G32B32_UINT: case VK_FORMAT_R32G32B32_SINT:
+        info.block_size = 12; break;
+    case VK_FORMAT_R32G32B32A32_SFLOAT: case VK_FORMAT_R32G32B32A32_UINT: case VK_FORMAT_R32G32B32A32_SINT:
+        info.block_size = 16; break;
+
+    /* BC1 and BC4 store a 4x4 block in 8 bytes, the others in 16 bytes */
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGB_SRGB_BLOCK: case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: case VK_FORMAT_BC4_UNORM_BLOCK: case VK_FORMAT_BC4_SNORM_BLOCK:
+        info.block_width = 4; info.block_height = 4; info.block_size = 8; break;
+    case VK_FORMAT_BC2_UNORM_BLOCK: case VK_FORMAT_BC2_SRGB_BLOCK: case VK_FORMAT_BC3_UNORM_BLOCK: case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK: case VK_FORMAT_BC5_SNORM_BLOCK: case VK_FORMAT_BC6H_UFLOAT_BLOCK: case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK:
+        info.block_width = 4; info.block_height = 4; info.block_size = 16; break;
+
+    /* ETC2/EAC */
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK: case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK: case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK: case VK_FORMAT_EAC_R11_UNORM_BLOCK: case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+        info.block_width = 4; info.block_height = 4; info.block_size = 8; break;
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK: case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK: case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+        info.block_width = 4; info.block_height = 4; info.block_size = 16; break;
+
+    /* ASTC blocks are always 16 bytes */
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:   case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:   info.block_width = 4;  info.block_height = 4;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_5x4_UNORM_BLOCK:   case VK_FORMAT_ASTC_5x4_SRGB_BLOCK:   info.block_width = 5;  info.block_height = 4;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:   case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:   info.block_width = 5;  info.block_height = 5;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_6x5_UNORM_BLOCK:   case VK_FORMAT_ASTC_6x5_SRGB_BLOCK:   info.block_width = 6;  info.block_height = 5;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:   case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:   info.block_width = 6;  info.block_height = 6;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_8x5_UNORM_BLOCK:   case VK_FORMAT_ASTC_8x5_SRGB_BLOCK:   info.block_width = 8;  info.block_height = 5;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_8x6_UNORM_BLOCK:   case VK_FORMAT_ASTC_8x6_SRGB_BLOCK:   info.block_width = 8;  info.block_height = 6;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:   case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:   info.block_width = 8;  info.block_height = 8;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_10x5_UNORM_BLOCK:  case VK_FORMAT_ASTC_10x5_SRGB_BLOCK:  info.block_width = 10; info.block_height = 5;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_10x6_UNORM_BLOCK:  case VK_FORMAT_ASTC_10x6_SRGB_BLOCK:  info.block_width = 10; info.block_height = 6;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_10x8_UNORM_BLOCK:  case VK_FORMAT_ASTC_10x8_SRGB_BLOCK:  info.block_width = 10; info.block_height = 8;  info.block_size = 16; break;
+    case VK_FORMAT_ASTC_10x10_UNORM_BLOCK: case VK_FORMAT_ASTC_10x10_SRGB_BLOCK: info.block_width = 10; info.block_height = 10; info.block_size = 16; break;
+    case VK_FORMAT_ASTC_12x10_UNORM_BLOCK: case VK_FORMAT_ASTC_12x10_SRGB_BLOCK: info.block_width = 12; info.block_height = 10; info.block_size = 16; break;
+    case VK_FORMAT_ASTC_12x12_UNORM_BLOCK: case VK_FORMAT_ASTC_12x12_SRGB_BLOCK: info.block_width = 12; info.block_height = 12; info.block_size = 16; break;
+    default: break;
+    }
+    return info;
+}
+
+/* Bytes of one layer of the given mip level, rows padded to whole blocks. */
+VkDeviceSize vkal_image_level_size(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+    VkalFormatInfo info = vkal_format_info(format);
+    uint32_t level_w = VKAL_MAX(width >> level, 1);
+    uint32_t level_h = VKAL_MAX(height >> level, 1);
+    VkDeviceSize blocks_x = (level_w + info.block_width - 1) / info.block_width;
+    VkDeviceSize blocks_y = (level_h + info.block_height - 1) / info.block_height;
+    return blocks_x * blocks_y * info.block_size;
+}
+
 // TODO: can we use this buffer for any kind of data to stage??
 // TODO: Should this also be called the default_staging_buffer?
 void create_staging_buffer(uint32_t size) 
@@ -1275,684 +1672,2348 @@ void create_staging_buffer(uint32_t size)
     vkal_info.device_memory_staging = allocate_memory(buffer_memory_requirements.size, mem_type_bits);
     VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.staging_buffer.buffer, vkal_info.device_memory_staging, 0);
     VKAL_ASSERT(result &&  "failed to bind memory");
+
+    // The staging memory stays mapped for the lifetime of vkal.
+    void * mapped = NULL;
+    result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, VK_WHOLE_SIZE, 0, &mapped);
+    VKAL_ASSERT(result && "failed to map staging memory");
+    vkal_info.staging_ring.mapped = (uint8_t*)mapped;
+    vkal_info.staging_ring.size = size;
+    vkal_info.staging_ring.head = 0;
+    vkal_info.staging_ring.tail = 0;
 }
 
-DeviceMemory vkal_allocate_devicememory(uint32_t size,
-					VkBufferUsageFlags buffer_usage_flags,
-					VkMemoryPropertyFlags memory_property_flags,
-                    VkFlags mem_alloc_flags)
+void create_upload_batches(void)
 {
-    /* Create a dummy buffer so we can select the best possible memory for this type
-       of buffer via vkGetBufferMemoryRequirements 
-    */
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
-    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
-
-    VkBuffer buffer = create_buffer(aligned_size, buffer_usage_flags).buffer;
-    VkMemoryRequirements buffer_memory_requirements = { 0 };
-    vkGetBufferMemoryRequirements(vkal_info.device, buffer, &buffer_memory_requirements);
-    uint32_t mem_type_bits = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, memory_property_flags);
-    vkDestroyBuffer(vkal_info.device, buffer, NULL);
+    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    VkCommandPoolCreateInfo cmdpool_info = { 0 };
+    cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    cmdpool_info.queueFamilyIndex = indicies.graphics_family;
+    VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.upload_command_pool);
+    VKAL_ASSERT(result && "failed to create upload command pool");
+
+    for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+        VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+        VkCommandBufferAllocateInfo alloc_info = { 0 };
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = vkal_info.upload_command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &batch->command_buffer);
+        VKAL_ASSERT(result && "failed to allocate upload command buffer");
+
+        batch->timeline_value = 0;
+        batch->recording = 0;
+        batch->transfer_recording = 0;
+        batch->in_flight = 0;
+        batch->range_count = 0;
+        batch->import_count = 0;
+    }
 
-    VkMemoryAllocateFlagsInfo mem_alloc_flags_info = { 0 };
-    mem_alloc_flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    mem_alloc_flags_info.flags = mem_alloc_flags;    
+    // Uploads into fresh resources go through the dedicated transfer queue if there is one.
+    if (vkal_info.transfer_queue != VK_NULL_HANDLE) {
+        cmdpool_info.queueFamilyIndex = indicies.transfer_family;
+        result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.upload_transfer_command_pool);
+        VKAL_ASSERT(result && "failed to create upload transfer command pool");
+
+        for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+            VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+            VkCommandBufferAllocateInfo alloc_info = { 0 };
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.commandPool = vkal_info.upload_transfer_command_pool;
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            alloc_info.commandBufferCount = 1;
+            result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &batch->transfer_command_buffer);
+            VKAL_ASSERT(result && "failed to allocate upload transfer command buffer");
+        }
+    }
+    vkal_info.upload_batch_current = 0;
+    vkal_info.upload_chunk_size = vkal_info.staging_ring.size / 4;
+    vkal_info.upload_ticket_submitted = 0;
+    vkal_info.upload_ticket_completed = 0;
+}
 
-    VkDeviceMemory memory = VK_NULL_HANDLE;
-    VkMemoryAllocateInfo memory_info = { 0 };
-    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memory_info.allocationSize = buffer_memory_requirements.size;
-    memory_info.memoryTypeIndex = mem_type_bits;
-    memory_info.pNext = (mem_alloc_flags == 0 ? 0 : &mem_alloc_flags_info);
-    VkResult result = vkAllocateMemory(vkal_info.device, &memory_info, 0, &memory);
-    VKAL_ASSERT(result && "failed to allocate device memory.");
+static void free_upload_imports(VkalUploadBatch * batch)
+{
+    for (uint32_t i = 0; i < batch->import_count; ++i) {
+        vkDestroyBuffer(vkal_info.device, batch->imports[i].buffer, NULL);
+        vkFreeMemory(vkal_info.device, batch->imports[i].memory, NULL);
+    }
+    batch->import_count = 0;
+}
 
-    DeviceMemory device_memory = { 0 };
-    device_memory.vk_device_memory = memory;
-    device_memory.size = buffer_memory_requirements.size;
-    device_memory.alignment = buffer_memory_requirements.alignment;
-    device_memory.free = 0;
-    device_memory.mem_type_index = mem_type_bits;
-    return device_memory;
+void destroy_upload_batches(void)
+{
+    for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+        free_upload_imports(&vkal_info.upload_batches[i]);
+    }
+    vkDestroyCommandPool(vkal_info.device, vkal_info.upload_command_pool, 0);
+    if (vkal_info.upload_transfer_command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(vkal_info.device, vkal_info.upload_transfer_command_pool, 0);
+    }
+    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
+    vkal_info.staging_ring.mapped = NULL;
 }
 
-VkalBuffer vkal_create_buffer(VkDeviceSize size, DeviceMemory * device_memory, VkBufferUsageFlags buffer_usage_flags)
+/* Retires submitted batches oldest first. Batches with a ticket <= wait_ticket are waited on, younger ones are
+   only retired if the graphics timeline already reached them. */
+static void retire_upload_batches(VkalUploadTicket wait_ticket)
 {
-    VkalBuffer buffer0 = create_buffer(size, buffer_usage_flags);
-    VkMemoryRequirements buffer_memory_requirements = { 0 };
-    vkGetBufferMemoryRequirements(vkal_info.device, buffer0.buffer, &buffer_memory_requirements);
+    for (;;) {
+        VkalUploadBatch * oldest = NULL;
+        for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+            VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+            if (batch->in_flight && (!oldest || batch->ticket < oldest->ticket)) {
+                oldest = batch;
+            }
+        }
+        if (!oldest) {
+            return;
+        }
+        if (oldest->ticket <= wait_ticket) {
+            timeline_wait(&vkal_info.graphics_timeline, oldest->timeline_value);
+        }
+        else if (!timeline_reached(&vkal_info.graphics_timeline, oldest->timeline_value)) {
+            return;
+        }
+        oldest->in_flight = 0;
+        free_upload_imports(oldest);
+        vkal_info.staging_ring.tail = oldest->staging_end;
+        vkal_info.upload_ticket_completed = oldest->ticket;
+    }
+}
 
-    uint64_t alignment = buffer_memory_requirements.alignment;
-    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+/* Returns the batch that upload commands get recorded into. Opens a new one if needed. */
+static VkalUploadBatch * upload_batch_begin(void)
+{
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_current];
+    if (batch->recording) {
+        return batch;
+    }
+    if (batch->in_flight) {
+        retire_upload_batches(batch->ticket);
+    }
 
-    assert(size <= device_memory->size && "vkal_create_buffer: Requested Buffer size exceeds Device Memory size!");
+    VkResult result = vkResetCommandBuffer(batch->command_buffer, 0);
+    VKAL_ASSERT(result && "failed to reset upload command buffer");
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(batch->command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin upload command buffer");
+
+    // Copies must not overwrite data that previously submitted work still uses.
+    VkMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &barrier, 0, 0, 0, 0);
+
+    batch->ticket = vkal_info.upload_ticket_submitted + 1;
+    batch->range_count = 0;
+    batch->recording = 1;
+    batch->transfer_recording = 0;
+    return batch;
+}
+
+/* Returns the transfer command buffer of an open batch, VK_NULL_HANDLE if there is no dedicated transfer queue. */
+static VkCommandBuffer upload_batch_begin_transfer(VkalUploadBatch * batch)
+{
+    assert(batch->recording);
+    if (vkal_info.transfer_queue == VK_NULL_HANDLE) {
+        return VK_NULL_HANDLE;
+    }
+    if (!batch->transfer_recording) {
+        VkResult result = vkResetCommandBuffer(batch->transfer_command_buffer, 0);
+        VKAL_ASSERT(result && "failed to reset upload transfer command buffer");
+        VkCommandBufferBeginInfo begin_info = { 0 };
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        result = vkBeginCommandBuffer(batch->transfer_command_buffer, &begin_info);
+        VKAL_ASSERT(result && "failed to begin upload transfer command buffer");
+        batch->transfer_recording = 1;
+    }
+    return batch->transfer_command_buffer;
+}
+
+/* Moves a buffer range that was written on the transfer queue over to the graphics family. The release
+   is recorded on the transfer queue, the matching acquire on the graphics queue. */
+static void upload_batch_transfer_buffer_ownership(VkalUploadBatch * batch, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkBufferMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = vkal_info.queue_families.transfer_family;
+    barrier.dstQueueFamilyIndex = vkal_info.queue_families.graphics_family;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(batch->transfer_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, 0, 1, &barrier, 0, 0);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 0, 0, 1, &barrier, 0, 0);
+}
+
+/* Copies inside of one batch may execute in any order. If a destination is written twice
+   within the same batch the second copy has to wait for the first one. */
+static void upload_batch_track(VkalUploadBatch * batch, VkCommandBuffer command_buffer, VkBuffer buffer, VkImage image, VkDeviceSize offset, VkDeviceSize size)
+{
+    int overlaps = (batch->range_count == VKAL_MAX_UPLOAD_RANGES);
+    for (uint32_t i = 0; i < batch->range_count && !overlaps; ++i) {
+        VkalUploadRange * range = &batch->ranges[i];
+        // Images are tracked by the byte range of the source data that a copy writes.
+        if (range->buffer == buffer && range->image == image &&
+            offset < range->offset + range->size && range->offset < offset + size) {
+            overlaps = 1;
+        }
+    }
+    if (overlaps) {
+        VkMemoryBarrier barrier = { 0 };
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &barrier, 0, 0, 0, 0);
+        batch->range_count = 0;
+    }
+    VkalUploadRange * range = &batch->ranges[batch->range_count++];
+    range->buffer = buffer;
+    range->image = image;
+    range->offset = offset;
+    range->size = size;
+}
+
+/* Hands out size bytes of staging memory. If the ring is full the recorded uploads are submitted
+   and the oldest batch in flight is waited on. Returns the offset into the staging buffer. */
+static VkDeviceSize staging_ring_alloc(VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkalStagingRing * ring = &vkal_info.staging_ring;
+    assert(size <= ring->size && "staging_ring_alloc: upload does not fit into the staging buffer!");
+    alignment = VKAL_MAX(alignment, 1);
+
+    for (;;) {
+        uint64_t     head = ring->head;
+        VkDeviceSize position = head % ring->size;
+        VkDeviceSize aligned_position = ((position + alignment - 1) / alignment) * alignment;
+        if (aligned_position + size > ring->size) {
+            // Not enough room until the end of the buffer, continue at the start.
+            head += ring->size - position;
+            aligned_position = 0;
+            position = 0;
+        }
+        uint64_t new_head = head + (aligned_position - position) + size;
+        if (new_head - ring->tail <= ring->size) {
+            ring->head = new_head;
+            return aligned_position;
+        }
 
-    VkBuffer vk_buffer = VK_NULL_HANDLE;
-    VkBufferCreateInfo buffer_info = { 0 };
-    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_info.size = size;
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
-    buffer_info.pQueueFamilyIndices = &indicies.graphics_family;
-    buffer_info.queueFamilyIndexCount = 1;
-    buffer_info.usage = buffer_usage_flags;
-    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    VkResult result = vkCreateBuffer(vkal_info.device, &buffer_info, 0, &vk_buffer);
-    VKAL_ASSERT( result && "Failed to create VkBuffer" );
-    result = vkBindBufferMemory(vkal_info.device, vk_buffer, device_memory->vk_device_memory, device_memory->free);
-    VKAL_ASSERT( result && "Failed to bind VkBuffer to VkDeviceMemory" );
-    /* NOTE: the offset in vkBindBufferMemory must be a multiple of alignment returend by vkGetBufferMemoryRequirements and denotes the
-       offset into VkDeviceMemory.
-    */	
-    VkalBuffer buffer = { 0 };
-    buffer.size = size;
-    buffer.offset = device_memory->free;
-    buffer.device_memory = device_memory->vk_device_memory;
-    buffer.vkal_device_memory = device_memory;
-    buffer.usage = buffer_usage_flags;
-    buffer.buffer = vk_buffer;
-    buffer.mapped = NULL;
+        int in_flight = 0;
+        for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+            in_flight |= vkal_info.upload_batches[i].in_flight;
+        }
+        if (vkal_info.upload_batches[vkal_info.upload_batch_current].recording) {
+            vkal_upload_flush();
+        }
+        else if (in_flight) {
+            retire_upload_batches(vkal_info.upload_ticket_completed + 1);
+        }
+        else {
+            // Nothing references the staging memory anymore.
+            ring->head = 0;
+            ring->tail = 0;
+        }
+    }
+}
 
-    VkDeviceSize device_memory_alignment = device_memory->alignment;
-    VkDeviceSize next_offset = device_memory->free + (aligned_size / device_memory_alignment) * device_memory_alignment;
-    next_offset += aligned_size % device_memory_alignment ? device_memory_alignment : 0;
-    device_memory->free = next_offset;
+static void staging_ring_write(VkDeviceSize position, void const * data, VkDeviceSize size)
+{
+    VkalStagingRing * ring = &vkal_info.staging_ring;
+    memcpy(ring->mapped + position, data, size);
 
-    return buffer;
+    VkDeviceSize atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    VkDeviceSize begin = (position / atom) * atom;
+    VkDeviceSize end = VKAL_MIN(((position + size + atom - 1) / atom) * atom, ring->size);
+    VkMappedMemoryRange flush_range = { 0 };
+    flush_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    flush_range.memory = vkal_info.device_memory_staging;
+    flush_range.offset = begin;
+    flush_range.size = (end == ring->size) ? VK_WHOLE_SIZE : end - begin;
+    VkResult result = vkFlushMappedMemoryRanges(vkal_info.device, 1, &flush_range);
+    VKAL_ASSERT(result && "failed to flush staging memory");
+}
+
+/* Splits the upload into chunks of at most upload_chunk_size bytes. Every chunk gets its own piece of the
+   staging ring, so a full ring submits the chunks recorded so far and keeps going once space is retired. */
+static VkalUploadTicket upload_buffer_chunked(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size, int async)
+{
+    VkalUploadBatch * batch = NULL;
+    VkDeviceSize chunk_size = vkal_info.upload_chunk_size;
+    for (VkDeviceSize done = 0; done < size; done += chunk_size) {
+        VkDeviceSize chunk = VKAL_MIN(chunk_size, size - done);
+        VkDeviceSize staging_offset = staging_ring_alloc(chunk, 4);
+        staging_ring_write(staging_offset, (uint8_t const *)data + done, chunk);
+
+        batch = upload_batch_begin();
+        VkCommandBuffer command_buffer = async ? upload_batch_begin_transfer(batch) : batch->command_buffer;
+        upload_batch_track(batch, command_buffer, buffer, VK_NULL_HANDLE, offset + done, chunk);
+        VkBufferCopy buffer_copy = { 0 };
+        buffer_copy.srcOffset = staging_offset;
+        buffer_copy.dstOffset = offset + done;
+        buffer_copy.size = chunk;
+        vkCmdCopyBuffer(command_buffer, vkal_info.staging_buffer.buffer, buffer, 1, &buffer_copy);
+        if (async) {
+            upload_batch_transfer_buffer_ownership(batch, buffer, offset + done, chunk);
+        }
+    }
+    return batch ? batch->ticket : vkal_upload_current_ticket();
 }
 
-void vkal_map_buffer(VkalBuffer* buffer) 
+/* Records a copy of data into buffer at offset. The copy runs with the next vkal_upload_flush, which
+   vkal_queue_submit does implicitly. */
+VkalUploadTicket vkal_upload_buffer(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size)
 {
-    uint64_t alignment = vkal_info.physical_device_properties.limits.minMemoryMapAlignment;
+    return upload_buffer_chunked(buffer, offset, data, size, 0);
+}
 
-    VkResult result = vkMapMemory(
-        vkal_info.device, buffer->device_memory,
-        buffer->offset, buffer->size,
-        0,
-        &buffer->mapped);
-    VKAL_ASSERT(result && "Failed to map memory!");
+/* Like vkal_upload_buffer, but for ranges that no submitted work uses. Those copies run on the dedicated
+   transfer queue (if any) in parallel with graphics work. */
+VkalUploadTicket vkal_upload_buffer_async(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size)
+{
+    return upload_buffer_chunked(buffer, offset, data, size, vkal_info.transfer_queue != VK_NULL_HANDLE);
 }
 
-// TODO: Fix offset into device memory (must be multiple of nonCoherentAtomSize)
-//       Buffer updating must be fixed!!!!
-void vkal_update_buffer_offset(VkalBuffer* buffer, uint8_t* data, uint32_t byte_count, uint32_t offset)
+/* Imports the pages around data as host memory and wraps them in a transfer source buffer. Returns 0 if the
+   driver cannot import this memory. out_offset is where data starts inside of the buffer. */
+static int import_host_memory(void const * data, VkDeviceSize size, VkalUploadImport * out_import, VkDeviceSize * out_offset)
 {
-    assert(byte_count <= buffer->size && "Byte-count is larger than available buffer-size");
-    assert(offset <= buffer->size && "Offset is beyond buffer-size!");
+#ifdef VK_EXT_external_memory_host
+    VkDeviceSize alignment = vkal_info.host_import_alignment;
+    uintptr_t begin = ((uintptr_t)data / alignment) * alignment;
+    uintptr_t end = (((uintptr_t)data + size + alignment - 1) / alignment) * alignment;
 
-    uint64_t alignment = vkal_info.physical_device_properties.limits.minMemoryMapAlignment;
-    uint64_t aligned_size = (byte_count + alignment - 1) & ~(alignment - 1);
-    uint64_t aligned_offset = (offset + alignment - 1) & ~(alignment - 1);
-    uint64_t test = 0;
-    if (offset > 0) {
-        test = (offset / alignment) * alignment;
-    }
+    // Anonymous memory imports as a host allocation, some drivers want file mappings as foreign memory.
+    VkExternalMemoryHandleTypeFlagBits handle_types[2] = {
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_MAPPED_FOREIGN_MEMORY_BIT_EXT
+    };
+    for (uint32_t h = 0; h < 2; ++h) {
+        VkMemoryHostPointerPropertiesEXT pointer_properties = { 0 };
+        pointer_properties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+        if (vkGetMemoryHostPointerProperties(vkal_info.device, handle_types[h], (void*)begin, &pointer_properties) != VK_SUCCESS) {
+            continue;
+        }
 
-    VkResult result = vkMapMemory(
-        vkal_info.device, buffer->device_memory,
-        buffer->offset, aligned_size,
-        0,
-        &buffer->mapped);
-    VKAL_ASSERT(result && "Failed to map memory!");
+        VkExternalMemoryBufferCreateInfo external_info = { 0 };
+        external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+        external_info.handleTypes = handle_types[h];
+        VkBufferCreateInfo buffer_info = { 0 };
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.pNext = &external_info;
+        buffer_info.size = end - begin;
+        buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        if (vkCreateBuffer(vkal_info.device, &buffer_info, NULL, &buffer) != VK_SUCCESS) {
+            continue;
+        }
+        VkMemoryRequirements memory_requirements = { 0 };
+        vkGetBufferMemoryRequirements(vkal_info.device, buffer, &memory_requirements);
+        uint32_t mem_type_index = find_memory_type_index(memory_requirements.memoryTypeBits & pointer_properties.memoryTypeBits, 0, 0);
+
+        VkImportMemoryHostPointerInfoEXT import_info = { 0 };
+        import_info.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+        import_info.handleType = handle_types[h];
+        import_info.pHostPointer = (void*)begin;
+        VkMemoryAllocateInfo memory_info = { 0 };
+        memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memory_info.pNext = &import_info;
+        memory_info.allocationSize = end - begin;
+        memory_info.memoryTypeIndex = mem_type_index;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        if (mem_type_index == UINT32_MAX || vkAllocateMemory(vkal_info.device, &memory_info, NULL, &memory) != VK_SUCCESS) {
+            vkDestroyBuffer(vkal_info.device, buffer, NULL);
+            continue;
+        }
+        VkResult result = vkBindBufferMemory(vkal_info.device, buffer, memory, 0);
+        VKAL_ASSERT(result && "failed to bind imported host memory");
 
-    memcpy((uint8_t*)buffer->mapped + offset, data, byte_count);
+        out_import->buffer = buffer;
+        out_import->memory = memory;
+        *out_offset = (uintptr_t)data - begin;
+        return 1;
+    }
+#endif
+    return 0;
+}
 
-    // FLUSH IF VK_MEMORY_PROPERTY_HOST_COHERENT_BIT is not set!
-    //
-    alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
-    aligned_size = (byte_count + alignment - 1) & ~(alignment - 1);
-    aligned_offset = (offset + alignment - 1) & ~(alignment - 1);
-    VkMappedMemoryRange memory_range = { 0 };
-    memory_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    memory_range.memory = buffer->device_memory;
-    memory_range.offset = buffer->offset + aligned_offset;
-    memory_range.size = aligned_size; // TODO: figure out how much we need to flush, really.
-    result = vkFlushMappedMemoryRanges(vkal_info.device, 1, &memory_range);
-    VKAL_ASSERT(result && "Failed to flush mapped memory!");
+/* Uploads from host memory that stays valid and unchanged until the returned ticket is complete, eg. a memory
+   mapped file. With VK_EXT_external_memory_host enabled, large uploads import the memory and the GPU copies
+   straight out of it, skipping the staging ring. Otherwise (or if the import fails) this is vkal_upload_buffer,
+   which still copies straight from the mapping into staging memory. */
+VkalUploadTicket vkal_upload_buffer_host(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size)
+{
+    if (vkal_info.host_import_alignment == 0 || size < VKAL_HOST_IMPORT_MIN_SIZE) {
+        return vkal_upload_buffer(buffer, offset, data, size);
+    }
+    VkalUploadBatch * batch = upload_batch_begin();
+    if (batch->import_count == VKAL_MAX_UPLOAD_IMPORTS) {
+        vkal_upload_flush();
+        batch = upload_batch_begin();
+    }
+    VkalUploadImport import = { 0 };
+    VkDeviceSize src_offset = 0;
+    if (!import_host_memory(data, size, &import, &src_offset)) {
+        return vkal_upload_buffer(buffer, offset, data, size);
+    }
+    batch->imports[batch->import_count++] = import;
+
+    upload_batch_track(batch, batch->command_buffer, buffer, VK_NULL_HANDLE, offset, size);
+    VkBufferCopy buffer_copy = { 0 };
+    buffer_copy.srcOffset = src_offset;
+    buffer_copy.dstOffset = offset;
+    buffer_copy.size = size;
+    vkCmdCopyBuffer(batch->command_buffer, import.buffer, buffer, 1, &buffer_copy);
+    return batch->ticket;
 }
 
-// TODO: Call vkal_update_buffer_offset with buffer.offset
-// TODO: Make sure buffer mapping, flushing does not violate vulkan spec! (see function above).
-void vkal_update_buffer(VkalBuffer* buffer, uint8_t* data, uint32_t byte_count)
+/* Upper bound for a single copy. Large uploads are split into chunks of this size. Smaller chunks
+   let the copies of a big upload start earlier, bigger chunks mean fewer commands. */
+void vkal_set_upload_chunk_size(VkDeviceSize chunk_size)
 {
-    vkal_update_buffer_offset(buffer, data, byte_count, 0);
+    chunk_size = VKAL_MAX(chunk_size, vkal_info.physical_device_properties.limits.nonCoherentAtomSize);
+    vkal_info.upload_chunk_size = VKAL_MIN(chunk_size, vkal_info.staging_ring.size);
 }
 
-void upload_texture(VkImage const image,
-		    uint32_t w, uint32_t h, uint32_t n,
-		    uint32_t array_layer_count,
-		    unsigned char * texture_data)
+/* Submits all recorded uploads in one go. Returns the ticket of the submitted batch. */
+VkalUploadTicket vkal_upload_flush(void)
 {
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
-    uint64_t size = array_layer_count * w * h * n;
-    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_current];
+    if (!batch->recording) {
+        return vkal_info.upload_ticket_submitted;
+    }
 
-    // Copy image data to staging buffer
-    void * staging_buffer;
-    vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, aligned_size, 0, &staging_buffer);
-    memcpy(staging_buffer, texture_data, size);
-    VkMappedMemoryRange flush_range = { 0 };
-    flush_range.memory = vkal_info.device_memory_staging;
-    flush_range.offset = 0;
-    flush_range.size = aligned_size;
-    flush_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    vkFlushMappedMemoryRanges(vkal_info.device, 1, &flush_range);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-    
-    //////////////////////////////////
-    //////////////////////////////////
-    
-    // Actual upload to GPU
-    VkCommandBufferBeginInfo begin_info = { 0 };
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    for (uint32_t i = 0; i < vkal_info.default_command_buffer_count; ++i) {
-	    vkBeginCommandBuffer(vkal_info.default_command_buffers[i], &begin_info);
-        
-	    VkImageSubresourceRange image_subresource_range = { 0 };
-	    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	    image_subresource_range.layerCount = array_layer_count;
-	    image_subresource_range.baseArrayLayer = 0;
-	    image_subresource_range.levelCount = 1;
-	    image_subresource_range.baseMipLevel = 0;
-        
-	    VkImageMemoryBarrier image_memory_barrier_undef_to_transfer = { 0 };
-	    image_memory_barrier_undef_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	    image_memory_barrier_undef_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	    image_memory_barrier_undef_to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	    image_memory_barrier_undef_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	    image_memory_barrier_undef_to_transfer.image = image;
-	    image_memory_barrier_undef_to_transfer.subresourceRange = image_subresource_range;
-	    vkCmdPipelineBarrier(vkal_info.default_command_buffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_undef_to_transfer);
-        
-	    VkBufferImageCopy copy_info = { 0 };
-	    copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	    copy_info.imageSubresource.baseArrayLayer = 0;
-	    copy_info.imageSubresource.layerCount = array_layer_count;
-	    copy_info.imageSubresource.mipLevel = 0;
-	    copy_info.bufferOffset = 0;
-	    copy_info.bufferImageHeight = 0;
-	    copy_info.bufferRowLength = 0;
-	    copy_info.imageOffset = (VkOffset3D){ 0, 0, 0 };
-	    copy_info.imageExtent.width  = w;
-	    copy_info.imageExtent.height = h;
-	    copy_info.imageExtent.depth  = 1;
-	    vkCmdCopyBufferToImage(vkal_info.default_command_buffers[i], vkal_info.staging_buffer.buffer, image,
-                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_info);
-        
-	    VkImageMemoryBarrier image_memory_barrier_transfer_to_shader_read = { 0 };
-	    image_memory_barrier_transfer_to_shader_read.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	    image_memory_barrier_transfer_to_shader_read.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	    image_memory_barrier_transfer_to_shader_read.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	    image_memory_barrier_transfer_to_shader_read.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	    image_memory_barrier_transfer_to_shader_read.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	    image_memory_barrier_transfer_to_shader_read.image = image;
-	    image_memory_barrier_transfer_to_shader_read.subresourceRange = image_subresource_range;
-	    vkCmdPipelineBarrier(vkal_info.default_command_buffers[i], VK_PIPELINE_STAGE_TRANSFER_BIT,
-                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_transfer_to_shader_read);
-        
-	    vkEndCommandBuffer(vkal_info.default_command_buffers[i]);        
+    VkResult result;
+    uint64_t transfer_value = 0;
+    if (batch->transfer_recording) {
+        result = vkEndCommandBuffer(batch->transfer_command_buffer);
+        VKAL_ASSERT(result && "failed to end upload transfer command buffer");
+        transfer_value = timeline_submit(&vkal_info.transfer_timeline, vkal_info.transfer_queue,
+            &batch->transfer_command_buffer, 1, NULL, NULL, NULL, 0, VK_NULL_HANDLE);
     }
 
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = vkal_info.default_command_buffer_count;
-    submit_info.pCommandBuffers = vkal_info.default_command_buffers;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);	
+    // Make the copies visible to everything that is submitted afterwards.
+    VkMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 1, &barrier, 0, 0, 0, 0);
+    result = vkEndCommandBuffer(batch->command_buffer);
+    VKAL_ASSERT(result && "failed to end upload command buffer");
+
+    // The acquire barriers in the graphics command buffer must not run before the transfer queue is done.
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    batch->timeline_value = timeline_submit(&vkal_info.graphics_timeline, vkal_info.graphics_queue, &batch->command_buffer, 1,
+        &vkal_info.transfer_timeline.semaphore, &transfer_value, &wait_stage, batch->transfer_recording ? 1 : 0, VK_NULL_HANDLE);
+    if (vkal_info.compute_queue != VK_NULL_HANDLE) {
+        vkal_compute_wait_graphics(batch->timeline_value, VKAL_COMPUTE_CONSUME_STAGES);
+    }
+
+    batch->staging_end = vkal_info.staging_ring.head;
+    batch->recording = 0;
+    batch->transfer_recording = 0;
+    batch->in_flight = 1;
+    vkal_info.upload_ticket_submitted = batch->ticket;
+    vkal_info.upload_batch_current = (vkal_info.upload_batch_current + 1) % VKAL_MAX_UPLOAD_BATCHES;
+    return batch->ticket;
 }
 
-void create_default_depth_buffer(void)
+/* Ticket of the most recent upload request. */
+VkalUploadTicket vkal_upload_current_ticket(void)
 {
-    {
-	    create_image(
-	        vkal_info.swapchain_extent.width, vkal_info.swapchain_extent.height,
-	        1, 1, 0,
-	        VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-	        &vkal_info.depth_stencil_image);
-    }
-    
-    {
-		// Check how much size is required for this image. Calculating by hand _might_ work, but who knows what
-		// the GPU is doing behind the scenes with an OPTIMAL TILING set! Alignment stuff might blow up the whole thing when done manually!
-		VkMemoryRequirements image_memory_requirements;
-		vkGetImageMemoryRequirements(vkal_info.device, get_image(vkal_info.depth_stencil_image), &image_memory_requirements);
-        
-		// TODO: check if I am doing this property query correctly!!!!!!!
-		// Check what LunarG is doing in their samples!
-		uint32_t mem_type_index = check_memory_type_index(image_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		create_device_memory(image_memory_requirements.size, mem_type_index, &vkal_info.device_memory_depth_stencil);
-		vkBindImageMemory(vkal_info.device, get_image(vkal_info.depth_stencil_image), get_device_memory(vkal_info.device_memory_depth_stencil), 0);
-    }
-    
-    {
-		// depth stencil image view
-        vkal_create_image_view(
-			get_image(vkal_info.depth_stencil_image), 
-			 VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT,
-			0, 1,
-			0, 1,
-			&vkal_info.depth_stencil_image_view);
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_current];
+    return batch->recording ? batch->ticket : vkal_info.upload_ticket_submitted;
+}
+
+void vkal_upload_wait(VkalUploadTicket ticket)
+{
+    if (ticket > vkal_info.upload_ticket_submitted) {
+        vkal_upload_flush();
     }
+    retire_upload_batches(ticket);
 }
 
-uint32_t check_memory_type_index(uint32_t const memory_requirement_bits, VkMemoryPropertyFlags const wanted_property)
+int vkal_upload_is_complete(VkalUploadTicket ticket)
+{
+    retire_upload_batches(0);
+    return vkal_info.upload_ticket_completed >= ticket;
+}
+
+void create_readback_slots(void)
 {
+    // Only the memory type is picked here, the buffers are created on first use and grow on demand.
+    VkalBuffer probe = create_buffer(1024, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    VkMemoryRequirements memory_requirements = { 0 };
+    vkGetBufferMemoryRequirements(vkal_info.device, probe.buffer, &memory_requirements);
+    vkDestroyBuffer(vkal_info.device, probe.buffer, NULL);
+
+    vkal_info.readback_memory_type = find_memory_type_index(memory_requirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    assert(vkal_info.readback_memory_type != UINT32_MAX && "no host visible memory for readbacks!");
     VkPhysicalDeviceMemoryProperties memory_properties;
     vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &memory_properties);
-    uint32_t mem_type_index      = 0;
-    uint32_t best_mem_type_index = 0;
-    uint32_t found               = 0;
-    uint32_t type_bits           = memory_requirement_bits;
-    for (; mem_type_index < memory_properties.memoryTypeCount; ++mem_type_index) {
-	    if (type_bits & 1) {
-	        if ((memory_properties.memoryTypes[mem_type_index].propertyFlags & wanted_property) == wanted_property) {
-		        found = 1;
-		        best_mem_type_index = mem_type_index;
-		        break;		
-	        }
-	        found = 1;
-	        best_mem_type_index = mem_type_index;
-	    }
-	    type_bits >>= 1;
+    vkal_info.readback_memory_coherent = (memory_properties.memoryTypes[vkal_info.readback_memory_type].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+    for (uint32_t i = 0; i < VKAL_MAX_READBACKS; ++i) {
+        VkalReadbackSlot * slot = &vkal_info.readback_slots[i];
+        memset(slot, 0, sizeof(VkalReadbackSlot));
+        VkCommandBufferAllocateInfo alloc_info = { 0 };
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = vkal_info.upload_command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        VkResult result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &slot->command_buffer);
+        VKAL_ASSERT(result && "failed to allocate readback command buffer");
     }
-    assert(found == 1);
-    
-    return best_mem_type_index;
+    vkal_info.readback_serial = 0;
 }
 
-int rate_device(VkPhysicalDevice device)
+void destroy_readback_slots(void)
 {
-    VkPhysicalDeviceProperties device_properties;
-    vkGetPhysicalDeviceProperties(device, &device_properties);
-    
-    switch (device_properties.deviceType)
-    {
-        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
-        {
-	        return 1000;
-        } break;
-        
-        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
-        {
-	        return 500;
-        } break;
-        
-        default: return 0;
+    for (uint32_t i = 0; i < VKAL_MAX_READBACKS; ++i) {
+        VkalReadbackSlot * slot = &vkal_info.readback_slots[i];
+        if (slot->buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(vkal_info.device, slot->buffer, NULL);
+            vkUnmapMemory(vkal_info.device, slot->memory);
+            vkFreeMemory(vkal_info.device, slot->memory, NULL);
+        }
     }
 }
 
-int check_device_extension_support(VkPhysicalDevice device, char ** extensions, uint32_t extension_count)
+static VkalReadbackSlot * get_readback_slot(VkalReadback readback)
 {
-    int* extensions_left = NULL;
-    VKAL_MALLOC(extensions_left, extension_count);
-    memset(extensions_left, 1, extension_count * sizeof(int));
+    assert(readback != 0);
+    VkalReadbackSlot * slot = &vkal_info.readback_slots[readback % VKAL_MAX_READBACKS];
+    assert(slot->readback == readback && "readback was released!");
+    return slot;
+}
 
-    printf("\n[VKAL] query device extensions:\n");
-    uint32_t supported_extension_count = 0;
-    vkEnumerateDeviceExtensionProperties(device, 0, &supported_extension_count, 0);
-    VkExtensionProperties* available_extensions = NULL;
-    VKAL_MALLOC(available_extensions, supported_extension_count);
-    vkEnumerateDeviceExtensionProperties(device, 0, &supported_extension_count, available_extensions);
-    
-    uint32_t extensions_found = 0;
-    for (uint32_t i = 0; i < supported_extension_count; ++i) {
-	    for (uint32_t k = 0; k < extension_count; ++k) {
-	        if (!strcmp(available_extensions[i].extensionName, extensions[k])) {
-		        printf("[VKAL] requested device extension: %s found!\n", extensions[k]);
-		        extensions_found++;
-		        extensions_left[k] = 0;
-		        goto gt_next_extension;
-	        }
-	    }
-        gt_next_extension:;
+/* Takes the next free slot of the ring, makes sure its buffer holds size bytes and begins its command buffer.
+   Serials of slots that are still held are skipped, so a long lived readback does not get recycled. */
+static VkalReadbackSlot * readback_begin(VkDeviceSize size)
+{
+    VkalReadback readback = vkal_info.readback_serial;
+    VkalReadbackSlot * slot = NULL;
+    for (uint32_t i = 0; i < VKAL_MAX_READBACKS; ++i) {
+        slot = &vkal_info.readback_slots[++readback % VKAL_MAX_READBACKS];
+        if (slot->readback == 0) break;
     }
-    
-    for (uint32_t i = 0; i < extension_count; ++i) {
-	    if (extensions_left[i]) {
-	        printf("[VKAL] requested extension %s not available!\n", extensions[i]);
-	    }
+    assert(slot->readback == 0 && "more than VKAL_MAX_READBACKS readbacks are alive, release some first!");
+    vkal_info.readback_serial = readback;
+    if (slot->in_flight) {
+        timeline_wait(&vkal_info.graphics_timeline, slot->timeline_value);
+        slot->in_flight = 0;
     }
-    VKAL_FREE(extensions_left);
-    VKAL_FREE(available_extensions);
-    return extension_count == extensions_found;
+
+    if (slot->capacity < size) {
+        if (slot->buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(vkal_info.device, slot->buffer, NULL);
+            vkUnmapMemory(vkal_info.device, slot->memory);
+            vkFreeMemory(vkal_info.device, slot->memory, NULL);
+        }
+        VkBufferCreateInfo buffer_info = { 0 };
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.size = size;
+        buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkResult result = vkCreateBuffer(vkal_info.device, &buffer_info, NULL, &slot->buffer);
+        VKAL_ASSERT(result && "failed to create readback buffer");
+        VkMemoryRequirements memory_requirements = { 0 };
+        vkGetBufferMemoryRequirements(vkal_info.device, slot->buffer, &memory_requirements);
+        slot->memory = allocate_memory(memory_requirements.size, vkal_info.readback_memory_type);
+        result = vkBindBufferMemory(vkal_info.device, slot->buffer, slot->memory, 0);
+        VKAL_ASSERT(result && "failed to bind readback memory");
+        void * mapped = NULL;
+        result = vkMapMemory(vkal_info.device, slot->memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        VKAL_ASSERT(result && "failed to map readback memory");
+        slot->mapped = (uint8_t*)mapped;
+        slot->capacity = size;
+    }
+
+    slot->readback = readback;
+    slot->size = size;
+    slot->invalidated = 0;
+
+    VkResult result = vkResetCommandBuffer(slot->command_buffer, 0);
+    VKAL_ASSERT(result && "failed to reset readback command buffer");
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(slot->command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin readback command buffer");
+    return slot;
+}
+
+/* Submits the copy on the graphics queue right behind the work that produced the data. If a frame was submitted
+   but not presented yet (between vkal_submit_frame and vkal_present_frame, or vkal_queue_submit and vkal_present),
+   the copy is chained between the frame and the present through the frame's render finished semaphore, so swapchain
+   images can be read back before they are handed to the presentation engine. */
+static VkalReadback readback_submit(VkalReadbackSlot * slot)
+{
+    // Make the copy visible to the host.
+    VkMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(slot->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &barrier, 0, 0, 0, 0);
+    VkResult result = vkEndCommandBuffer(slot->command_buffer);
+    VKAL_ASSERT(result && "failed to end readback command buffer");
+
+    // Uploads recorded before the readback have to land first.
+    vkal_upload_flush();
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    uint64_t wait_value = 0;
+    if (vkal_info.frame_submitted) {
+        slot->timeline_value = timeline_submit(&vkal_info.graphics_timeline, vkal_info.graphics_queue, &slot->command_buffer, 1,
+            &vkal_info.frame_render_finished, &wait_value, &wait_stage, 1, vkal_info.frame_render_finished);
+    }
+    else {
+        slot->timeline_value = timeline_submit(&vkal_info.graphics_timeline, vkal_info.graphics_queue, &slot->command_buffer, 1,
+            NULL, NULL, NULL, 0, VK_NULL_HANDLE);
+    }
+    slot->in_flight = 1;
+    return slot->readback;
 }
 
-int is_device_suitable(VkPhysicalDevice device, char ** extensions, uint32_t extension_count)
+/* Copies a region of image into host memory. layout is the layout the image is in when previously submitted
+   work is done with it, the image is returned to that layout afterwards. The pixels are tightly packed rows of format. */
+VkalReadback vkal_readback_image(VkImage image, VkImageLayout layout, VkImageAspectFlags aspect, VkFormat format,
+    int32_t x, int32_t y, uint32_t width, uint32_t height)
 {
-    VkPhysicalDeviceProperties device_properties;
-    vkGetPhysicalDeviceProperties(device, &device_properties);
-    VkPhysicalDeviceFeatures device_features;
-    vkGetPhysicalDeviceFeatures(device, &device_features);
-    SwapChainSupportDetails swapchain_support = query_swapchain_support(device);
-    int swapchain_adequate = 1;
-	
-    if (!swapchain_support.formats || !swapchain_support.present_modes) {
-	    swapchain_adequate = 0;
+    assert(layout != VK_IMAGE_LAYOUT_UNDEFINED && "vkal_readback_image: image has no defined content!");
+    VkalFormatInfo format_info = vkal_format_info(format);
+    assert(format_info.block_size && "vkal_readback_image: unknown format!");
+    VkDeviceSize size = ((width + format_info.block_width - 1) / format_info.block_width) *
+        ((height + format_info.block_height - 1) / format_info.block_height) * format_info.block_size;
+    VkalReadbackSlot * slot = readback_begin(size);
+
+    VkImageMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = aspect;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.oldLayout = layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(slot->command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, 0, 0, 0, 1, &barrier);
+
+    VkBufferImageCopy region = { 0 };
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = aspect;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset.x = x;
+    region.imageOffset.y = y;
+    region.imageExtent.width = width;
+    region.imageExtent.height = height;
+    region.imageExtent.depth = 1;
+    vkCmdCopyImageToBuffer(slot->command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = layout;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(slot->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, 0, 0, 0, 1, &barrier);
+
+    return readback_submit(slot);
+}
+
+VkalReadback vkal_readback_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkalReadbackSlot * slot = readback_begin(size);
+
+    VkMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(slot->command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &barrier, 0, 0, 0, 0);
+
+    VkBufferCopy region = { 0 };
+    region.srcOffset = offset;
+    region.dstOffset = 0;
+    region.size = size;
+    vkCmdCopyBuffer(slot->command_buffer, buffer, slot->buffer, 1, &region);
+
+    return readback_submit(slot);
+}
+
+int vkal_readback_is_ready(VkalReadback readback)
+{
+    VkalReadbackSlot * slot = get_readback_slot(readback);
+    if (slot->in_flight && timeline_reached(&vkal_info.graphics_timeline, slot->timeline_value)) {
+        slot->in_flight = 0;
     }
-    // NOTE: only test for swapchain support after the extension support has been checked!
-    return check_device_extension_support(device, extensions, extension_count) && swapchain_adequate;
+    return !slot->in_flight;
 }
 
-QueueFamilyIndicies find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface)
+void vkal_readback_wait(VkalReadback readback)
 {
-    // Just look for a queue family that can do graphics for now
-    QueueFamilyIndicies indicies;
-    uint32_t queue_family_count = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, 0);
-   
-    VkQueueFamilyProperties* queue_families = NULL;
-    VKAL_MALLOC(queue_families, queue_family_count);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families);
-    indicies.has_graphics_family = 0;
-    for (uint32_t i = 0; i < queue_family_count; ++i) {
-	    if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-	        indicies.graphics_family = i;
-	        indicies.has_graphics_family = 1;
-	        break;
-	    }
-    }
-    for (uint32_t i = 0; i < queue_family_count; ++i) {
-	    VkBool32 present_support = VK_FALSE;
-	    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
-	    if (present_support) {
-	        indicies.has_present_family = 1;
-	        indicies.present_family = i;
-	        break;
-	    }
+    VkalReadbackSlot * slot = get_readback_slot(readback);
+    if (slot->in_flight) {
+        timeline_wait(&vkal_info.graphics_timeline, slot->timeline_value);
+        slot->in_flight = 0;
     }
-    return indicies;
 }
 
-void vkal_find_suitable_devices(char ** extensions, uint32_t extension_count,
-				VkalPhysicalDevice ** out_devices, uint32_t * out_device_count)
+/* Waits for the readback and returns its data. The pointer stays valid until the readback is released. */
+void const * vkal_readback_map(VkalReadback readback, VkDeviceSize * out_size)
 {
-	if (vkal_info.instance == NULL) {
-		printf("[VKAL] Error: VkInstance is null!\n");
-        system("pause");
-		exit(-1);
-	}
-    vkal_info.physical_device_count = 0;
-    vkEnumeratePhysicalDevices(vkal_info.instance, &vkal_info.physical_device_count, 0);
-    if (!vkal_info.physical_device_count) {
-	    printf("[VKAL] No GPU with Vulkan support found\n");
-        system("pause");
-	    exit(-1);
+    vkal_readback_wait(readback);
+    VkalReadbackSlot * slot = get_readback_slot(readback);
+    if (!vkal_info.readback_memory_coherent && !slot->invalidated) {
+        VkMappedMemoryRange range = { 0 };
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = slot->memory;
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        VkResult result = vkInvalidateMappedMemoryRanges(vkal_info.device, 1, &range);
+        VKAL_ASSERT(result && "failed to invalidate readback memory");
     }
-    
-    VKAL_MALLOC(vkal_info.physical_devices, vkal_info.physical_device_count);
-    VKAL_MALLOC(vkal_info.suitable_devices, vkal_info.physical_device_count);
-    vkal_info.suitable_device_count = 0;
-    vkEnumeratePhysicalDevices(vkal_info.instance, &vkal_info.physical_device_count, vkal_info.physical_devices);
-    
-    for (uint32_t i = 0; i < vkal_info.physical_device_count; ++i) {
-	    VkPhysicalDeviceProperties physical_device_property = { 0 };
-	    vkGetPhysicalDeviceProperties(vkal_info.physical_devices[i], &physical_device_property);
-	    printf("[VKAL] physical device found: %s\n", physical_device_property.deviceName);
-	    if ( is_device_suitable(vkal_info.physical_devices[i], extensions, extension_count) ) {
-	        QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_devices[i], vkal_info.surface);
-	        if (indicies.has_graphics_family && indicies.has_present_family) {
-		        vkal_info.suitable_devices[i].device = vkal_info.physical_devices[i];
-		        vkal_info.suitable_devices[i].property = physical_device_property;
-		        vkal_info.suitable_device_count++;
-	        }
-	    }
+    slot->invalidated = 1;
+    if (out_size) {
+        *out_size = slot->size;
     }
-
-    *out_devices = vkal_info.suitable_devices;
-    *out_device_count = vkal_info.suitable_device_count;
+    return slot->mapped;
 }
 
-void vkal_select_physical_device(VkalPhysicalDevice * physical_device)
+void vkal_readback_release(VkalReadback readback)
 {
-    vkal_info.physical_device = physical_device->device;
-    vkal_info.physical_device_properties = physical_device->property;
-    printf("[VKAL] physcial device limits: nonCoherentAtomSize: %llu\n", vkal_info.physical_device_properties.limits.nonCoherentAtomSize);
+    VkalReadbackSlot * slot = get_readback_slot(readback);
+    vkal_readback_wait(readback);
+    slot->readback = 0;
 }
 
-void create_logical_device(char** extensions, uint32_t extension_count, VkalWantedFeatures vulkan_features)
+DeviceMemory vkal_allocate_devicememory(VkDeviceSize size,
+					VkBufferUsageFlags buffer_usage_flags,
+					VkMemoryPropertyFlags memory_property_flags,
+                    VkFlags mem_alloc_flags)
 {
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
-    uint32_t unique_queue_families[2];
-    unique_queue_families[0] = indicies.graphics_family;
-    unique_queue_families[1] = indicies.present_family;
-    VkDeviceQueueCreateInfo queue_create_infos[2] = { 0 };
-    uint32_t info_count = 0;
-    if (indicies.graphics_family != indicies.present_family) {
-        info_count = 2;
-    }
-    else {
-        info_count = 1;
-    }
-    float queue_prio = 1.f;
-    for (uint32_t i = 0; i < info_count; ++i) {
-        queue_create_infos[i] = (VkDeviceQueueCreateInfo){ 0 };
-        queue_create_infos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queue_create_infos[i].queueFamilyIndex = unique_queue_families[i];
-        queue_create_infos[i].queueCount = 1;
-        queue_create_infos[i].pQueuePriorities = &queue_prio;
-    }
+    /* Create a dummy buffer so we can select the best possible memory for this type
+       of buffer via vkGetBufferMemoryRequirements 
+    */
+    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
 
-    /* Complete the wanted features struct and chain them */
-    vulkan_features.features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
-    vulkan_features.features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
-    vulkan_features.rayTracingPipelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
-    vulkan_features.accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
-    vulkan_features.features11.pNext = &vulkan_features.features12;
-    if (vkal_info.raytracing_enabled) {
-        vulkan_features.features12.pNext = &vulkan_features.rayTracingPipelineFeatures;
-        vulkan_features.rayTracingPipelineFeatures.pNext = &vulkan_features.accelerationStructureFeatures;
-    }
-
-    /* Query what features are supported for the selected device */
-    VkPhysicalDeviceVulkan11Features device_features11 = { 0 };
-    device_features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
-    VkPhysicalDeviceVulkan12Features device_features12 = { 0 };
-    device_features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
-    device_features12.pNext = &device_features11;
-
-    /* Raytracing */
-    VkPhysicalDeviceRayTracingPipelineFeaturesKHR ray_tracing_features = { 0 };
-    ray_tracing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
-    ray_tracing_features.pNext = &device_features12;
-    VkPhysicalDeviceAccelerationStructureFeaturesKHR acceleration_structure_features = { 0 };
-    acceleration_structure_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
-    acceleration_structure_features.pNext = &ray_tracing_features;
-    
-    VkPhysicalDeviceFeatures2 available_features2 = { 0 };
-    available_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    if (vkal_info.raytracing_enabled) {
-        available_features2.pNext = &acceleration_structure_features;
-    }
-    else {
-        available_features2.pNext = &device_features12;
-    }
-    vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &available_features2);
+    VkBuffer buffer = create_buffer(aligned_size, buffer_usage_flags).buffer;
+    VkMemoryRequirements buffer_memory_requirements = { 0 };
+    vkGetBufferMemoryRequirements(vkal_info.device, buffer, &buffer_memory_requirements);
+    uint32_t mem_type_bits = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, memory_property_flags);
+    vkDestroyBuffer(vkal_info.device, buffer, NULL);
 
-    /* TODO: Complete feature-checking */
+    VkMemoryAllocateFlagsInfo mem_alloc_flags_info = { 0 };
+    mem_alloc_flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    mem_alloc_flags_info.flags = mem_alloc_flags;    
 
-    /* Check Features2 (which now contains VkalPhysicalDeviceFeatures). For now, just check, what we need */
-    VKAL_CHECK_FEATURE(vulkan_features.features2.features.fillModeNonSolid, available_features2.features.fillModeNonSolid);
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkMemoryAllocateInfo memory_info = { 0 };
+    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_info.allocationSize = buffer_memory_requirements.size;
+    memory_info.memoryTypeIndex = mem_type_bits;
+    memory_info.pNext = (mem_alloc_flags == 0 ? 0 : &mem_alloc_flags_info);
+    VkResult result = vkAllocateMemory(vkal_info.device, &memory_info, 0, &memory);
+    VKAL_ASSERT(result && "failed to allocate device memory.");
 
-    /* Check Features 1_1 */
-    VKAL_CHECK_FEATURE(vulkan_features.features11.multiview, device_features11.multiview);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.multiviewGeometryShader, device_features11.multiviewGeometryShader);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.multiviewTessellationShader, device_features11.multiviewTessellationShader);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.protectedMemory, device_features11.protectedMemory);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.samplerYcbcrConversion, device_features11.samplerYcbcrConversion);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.shaderDrawParameters, device_features11.shaderDrawParameters);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.storageBuffer16BitAccess, device_features11.storageBuffer16BitAccess);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.storageInputOutput16, device_features11.storageInputOutput16);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.storagePushConstant16, device_features11.storagePushConstant16);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.uniformAndStorageBuffer16BitAccess, device_features11.uniformAndStorageBuffer16BitAccess);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.variablePointers, device_features11.variablePointers);
-    VKAL_CHECK_FEATURE(vulkan_features.features11.variablePointersStorageBuffer, device_features11.variablePointersStorageBuffer);
+    DeviceMemory device_memory = { 0 };
+    init_device_memory(&device_memory, memory, buffer_memory_requirements.size, buffer_memory_requirements.alignment, mem_type_bits);
+    return device_memory;
+}
 
-    /* Check Features 1_2. For now, just check for the ones that are actually being used often by examples. (There are many!) */
-    VKAL_CHECK_FEATURE(vulkan_features.features12.bufferDeviceAddress, device_features12.bufferDeviceAddress);
-    VKAL_CHECK_FEATURE(vulkan_features.features12.uniformAndStorageBuffer8BitAccess, device_features12.uniformAndStorageBuffer8BitAccess);
-    VKAL_CHECK_FEATURE(vulkan_features.features12.runtimeDescriptorArray, device_features12.runtimeDescriptorArray);
-    VKAL_CHECK_FEATURE(vulkan_features.features12.shaderStorageImageArrayNonUniformIndexing, device_features12.shaderStorageImageArrayNonUniformIndexing);
-    VKAL_CHECK_FEATURE(vulkan_features.features12.shaderSampledImageArrayNonUniformIndexing, device_features12.shaderSampledImageArrayNonUniformIndexing);
-    VKAL_CHECK_FEATURE(vulkan_features.features12.descriptorIndexing, device_features12.descriptorIndexing);
+/* Picks the memory type from what the memory is used for instead of from property flags:
+   GPU_ONLY  device local memory that is not host visible, so it does not take up host visible VRAM.
+   DYNAMIC   device local and host visible memory (resizable BAR / UMA) if that heap has room for it, so the GPU
+             does not read the data over PCIe every frame. Otherwise it falls back to GPU_ONLY and
+             vkal_update_buffer goes through the staging ring.
+   READBACK  host visible memory, host cached if possible.
+   Buffers created from GPU_ONLY or DYNAMIC memory need VK_BUFFER_USAGE_TRANSFER_DST_BIT for the staging path. */
+DeviceMemory vkal_allocate_devicememory2(VkDeviceSize size,
+					VkBufferUsageFlags buffer_usage_flags,
+					VkalMemoryUsage memory_usage,
+                    VkFlags mem_alloc_flags)
+{
+    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
 
-    /* Check Raytracing features */
-    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipeline, ray_tracing_features.rayTracingPipeline);
-    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipelineShaderGroupHandleCaptureReplay, ray_tracing_features.rayTracingPipelineShaderGroupHandleCaptureReplay);
-    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipelineShaderGroupHandleCaptureReplayMixed, ray_tracing_features.rayTracingPipelineShaderGroupHandleCaptureReplayMixed);
-    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipelineTraceRaysIndirect, ray_tracing_features.rayTracingPipelineTraceRaysIndirect);
-    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTraversalPrimitiveCulling, ray_tracing_features.rayTraversalPrimitiveCulling);
+    VkBuffer buffer = create_buffer(aligned_size, buffer_usage_flags).buffer;
+    VkMemoryRequirements buffer_memory_requirements = { 0 };
+    vkGetBufferMemoryRequirements(vkal_info.device, buffer, &buffer_memory_requirements);
+    vkDestroyBuffer(vkal_info.device, buffer, NULL);
+    uint32_t type_bits = buffer_memory_requirements.memoryTypeBits;
 
-    /* Check Acceleration Structure Features */
-    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructure, acceleration_structure_features.accelerationStructure);
-    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructureCaptureReplay, acceleration_structure_features.accelerationStructureCaptureReplay);
-    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructureHostCommands, acceleration_structure_features.accelerationStructureHostCommands);
-    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructureIndirectBuild, acceleration_structure_features.accelerationStructureIndirectBuild);
-    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.descriptorBindingAccelerationStructureUpdateAfterBind, acceleration_structure_features.descriptorBindingAccelerationStructureUpdateAfterBind);
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &memory_properties);
 
-    vulkan_features.features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    vulkan_features.features2.pNext = &vulkan_features.features11;
+    uint32_t mem_type_index = UINT32_MAX;
+    if (memory_usage == VKAL_MEMORY_USAGE_DYNAMIC) {
+        uint32_t bar_type = find_memory_type_index(type_bits,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if (bar_type != UINT32_MAX) {
+            // Without resizable BAR this heap is only 256MB and the driver needs some of it too, use at most half.
+            VkDeviceSize heap_size = memory_properties.memoryHeaps[memory_properties.memoryTypes[bar_type].heapIndex].size;
+            if (vkal_info.dynamic_device_local_bytes + buffer_memory_requirements.size <= heap_size / 2) {
+                mem_type_index = bar_type;
+            }
+        }
+    }
+    else if (memory_usage == VKAL_MEMORY_USAGE_READBACK) {
+        mem_type_index = find_memory_type_index(type_bits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    }
+    if (mem_type_index == UINT32_MAX) {
+        // GPU_ONLY, or DYNAMIC without room in host visible VRAM. Prefer a type that is not host visible.
+        for (uint32_t i = 0; i < memory_properties.memoryTypeCount && mem_type_index == UINT32_MAX; ++i) {
+            VkMemoryPropertyFlags flags = memory_properties.memoryTypes[i].propertyFlags;
+            if ((type_bits & (1u << i)) && (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+                mem_type_index = i;
+            }
+        }
+        if (mem_type_index == UINT32_MAX) {
+            mem_type_index = find_memory_type_index(type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+        }
+    }
+    assert(mem_type_index != UINT32_MAX && "vkal_allocate_devicememory2: no suitable memory type!");
 
-    VkDeviceCreateInfo create_info = { 0 };
-    create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    create_info.pNext = &vulkan_features.features2;
-    create_info.pQueueCreateInfos = queue_create_infos;
-    create_info.queueCreateInfoCount = info_count;
-    create_info.pEnabledFeatures = VKAL_NULL;
-    create_info.enabledExtensionCount = extension_count;
-    create_info.ppEnabledExtensionNames = (const char* const*)extensions;
+    VkMemoryAllocateFlagsInfo mem_alloc_flags_info = { 0 };
+    mem_alloc_flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    mem_alloc_flags_info.flags = mem_alloc_flags;
 
-    VKAL_ASSERT(vkCreateDevice(vkal_info.physical_device, &create_info, 0, &vkal_info.device));
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkMemoryAllocateInfo memory_info = { 0 };
+    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_info.allocationSize = buffer_memory_requirements.size;
+    memory_info.memoryTypeIndex = mem_type_index;
+    memory_info.pNext = (mem_alloc_flags == 0 ? 0 : &mem_alloc_flags_info);
+    VkResult result = vkAllocateMemory(vkal_info.device, &memory_info, 0, &memory);
+    VKAL_ASSERT(result && "failed to allocate device memory.");
 
-    vkGetDeviceQueue(vkal_info.device, indicies.graphics_family, 0, &vkal_info.graphics_queue);
-    vkGetDeviceQueue(vkal_info.device, indicies.present_family, 0, &vkal_info.present_queue);
+    DeviceMemory device_memory = { 0 };
+    init_device_memory(&device_memory, memory, buffer_memory_requirements.size, buffer_memory_requirements.alignment, mem_type_index);
+    device_memory.usage = memory_usage;
+    if (memory_usage == VKAL_MEMORY_USAGE_DYNAMIC && (device_memory.property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        vkal_info.dynamic_device_local_bytes += device_memory.size;
+    }
+    return device_memory;
 }
 
-void create_shader_module(uint8_t const * shader_byte_code, int size, uint32_t * out_shader_module)
+/* Sets up the free-list of a DeviceMemory so that the whole VkDeviceMemory is one free block. */
+void init_device_memory(DeviceMemory * device_memory, VkDeviceMemory memory, VkDeviceSize size, VkDeviceSize alignment, uint32_t mem_type_index)
 {
-    VkShaderModuleCreateInfo create_info = { 0 };
-    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.codeSize = size;
-    create_info.pCode = (uint32_t*)shader_byte_code;
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKSHADERMODULE; ++free_index) {
-		if (vkal_info.user_shader_modules[free_index].used) {
-		} 
-		else break;
-	}
-    VkResult result = vkCreateShaderModule(vkal_info.device, &create_info, 0, &vkal_info.user_shader_modules[free_index].shader_module);
-    VKAL_ASSERT(result && "failed to create shader module!");
-    vkal_info.user_shader_modules[free_index].used = 1;
-    *out_shader_module = free_index;
+    device_memory->vk_device_memory = memory;
+    device_memory->size = size;
+    device_memory->alignment = alignment;
+    device_memory->free = size;
+    device_memory->granularity = vkal_info.physical_device_properties.limits.bufferImageGranularity;
+    device_memory->mem_type_index = mem_type_index;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &memory_properties);
+    device_memory->property_flags = memory_properties.memoryTypes[mem_type_index].propertyFlags;
+    device_memory->usage = VKAL_MEMORY_USAGE_GPU_ONLY;
+    device_memory->mapped = NULL;
+    device_memory->map_count = 0;
+    device_memory->blocks[0].offset = 0;
+    device_memory->blocks[0].size = size;
+    device_memory->blocks[0].used = 0;
+    device_memory->blocks[0].linear = 0;
+    device_memory->block_count = 1;
 }
 
-VkShaderModule get_shader_module(uint32_t id)
+void vkal_free_devicememory(DeviceMemory * device_memory)
 {
-    assert(id < VKAL_MAX_VKSHADERMODULE);
-    assert(vkal_info.user_shader_modules[id].used);
-    return vkal_info.user_shader_modules[id].shader_module;
+    if (device_memory->vk_device_memory != VK_NULL_HANDLE) {
+        vkFreeMemory(vkal_info.device, device_memory->vk_device_memory, 0);
+    }
+    if (device_memory->usage == VKAL_MEMORY_USAGE_DYNAMIC && (device_memory->property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        vkal_info.dynamic_device_local_bytes -= device_memory->size;
+    }
+    *device_memory = (DeviceMemory){ 0 };
 }
 
-void destroy_shader_module(uint32_t id)
+static void device_memory_insert_block(DeviceMemory * device_memory, uint32_t index, DeviceMemoryBlock block)
 {
-    if (vkal_info.user_shader_modules[id].used) {
-	vkDestroyShaderModule(vkal_info.device, get_shader_module(id), 0);
-	vkal_info.user_shader_modules[id].used = 0;
-    }
+    memmove(&device_memory->blocks[index + 1], &device_memory->blocks[index],
+        (device_memory->block_count - index) * sizeof(DeviceMemoryBlock));
+    device_memory->blocks[index] = block;
+    device_memory->block_count++;
 }
 
-void create_default_descriptor_pool(void)
+static void device_memory_remove_block(DeviceMemory * device_memory, uint32_t index)
 {
-    VkDescriptorPoolSize pool_sizes[] =
-	{
-	    {
-		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,     // type of the resource
-		1024							           // number of descriptors of that type to be stored in the pool. This is per set maybe?
-	    },
-	    {
-		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-		1024
-	    },
-	    {
-		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		1024 // TODO(Michael): figure out why we must have one additional available even if we're only using two textures!
-	    },
-	    { // for sampling the shadow map
-		VK_DESCRIPTOR_TYPE_SAMPLER,
-		1024
-	    }
-	};
-    
-    VkDescriptorPoolCreateInfo descriptor_pool_info = { 0 };
-    descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptor_pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-    descriptor_pool_info.maxSets = 20; // NOTE: This is an arbitrary number at the moment. We don't _have_ to use all of them.
-    descriptor_pool_info.poolSizeCount = sizeof(pool_sizes)/sizeof(*pool_sizes);
-    descriptor_pool_info.pPoolSizes = pool_sizes;
-    
-    VkResult  result = vkCreateDescriptorPool(vkal_info.device, &descriptor_pool_info, 0, &vkal_info.default_descriptor_pool);
-    VKAL_ASSERT(result && "failed to create descriptor pool!");
+    memmove(&device_memory->blocks[index], &device_memory->blocks[index + 1],
+        (device_memory->block_count - index - 1) * sizeof(DeviceMemoryBlock));
+    device_memory->block_count--;
 }
 
+/* Buffers (and linearly tiled images) must not share a bufferImageGranularity-sized page with optimally tiled
+   images. Returns 1 if the block and the given range land on the same page and are of a different kind. */
+static int device_memory_granularity_conflict(DeviceMemory const * device_memory, DeviceMemoryBlock const * block,
+    VkDeviceSize offset, VkDeviceSize size, uint32_t linear)
+{
+    VkDeviceSize page = device_memory->granularity;
+    if (page <= 1 || !block->used || block->linear == linear) {
+        return 0;
+    }
+    if (block->offset < offset) {
+        return ((block->offset + block->size - 1) / page) == (offset / page);
+    }
+    return ((offset + size - 1) / page) == (block->offset / page);
+}
 
-void create_render_to_image_render_pass(void)
+/* Best-fit sub-allocation from a free-list. Returns 0 if there is no free range that can hold the allocation. */
+int vkal_device_memory_alloc(DeviceMemory * device_memory, VkDeviceSize size, VkDeviceSize alignment, uint32_t linear, VkDeviceSize * out_offset)
 {
-    VkAttachmentDescription attachments[2];
-    // Color Attachment
-    attachments[0].flags          = 0;
-    attachments[0].format         = vkal_info.swapchain_image_format;
-    attachments[0].samples        = VK_SAMPLE_COUNT_1_BIT;
-    attachments[0].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[0].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[0].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[0].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[0].finalLayout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    // Depth Stencil Attachment
-    attachments[1].flags          = 0;
-    attachments[1].format         = VK_FORMAT_D32_SFLOAT;
-    attachments[1].samples        = VK_SAMPLE_COUNT_1_BIT;
-    attachments[1].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[1].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[1].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[1].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[1].finalLayout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    alignment = VKAL_MAX(alignment, device_memory->alignment);
+    alignment = VKAL_MAX(alignment, 1);
 
-    VkAttachmentReference color_attachment_refs[] =
-	{
-	    {
-		0, // This is the index into the above array of color_attachments
-		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL // translate layout into a layout so that the GPU can use efficient memory access.
-	    }
-	};
+    uint32_t     best_index  = UINT32_MAX;
+    VkDeviceSize best_offset = 0;
+    VkDeviceSize best_size   = UINT64_MAX;
+    for (uint32_t i = 0; i < device_memory->block_count; ++i) {
+        DeviceMemoryBlock * block = &device_memory->blocks[i];
+        if (block->used || block->size < size || block->size >= best_size) {
+            continue;
+        }
+        VkDeviceSize offset = ((block->offset + alignment - 1) / alignment) * alignment;
+        if (i > 0 && device_memory_granularity_conflict(device_memory, &device_memory->blocks[i - 1], offset, size, linear)) {
+            VkDeviceSize page = device_memory->granularity;
+            offset = ((offset + page - 1) / page) * page;
+        }
+        if (offset + size > block->offset + block->size) {
+            continue;
+        }
+        if (i + 1 < device_memory->block_count && device_memory_granularity_conflict(device_memory, &device_memory->blocks[i + 1], offset, size, linear)) {
+            continue;
+        }
+        best_index  = i;
+        best_offset = offset;
+        best_size   = block->size;
+    }
 
-    VkAttachmentReference depth_attachment_ref =
-	{
-	    1,
-	    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-	};
+    if (best_index == UINT32_MAX || device_memory->block_count + 2 > VKAL_MAX_DEVICEMEMORY_BLOCKS) {
+        return 0;
+    }
 
-    VkSubpassDescription subpasses[1];
-    subpasses[0].flags = 0;
-    subpasses[0].pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpasses[0].inputAttachmentCount    = 0;
-    subpasses[0].pInputAttachments       = 0;
-    subpasses[0].colorAttachmentCount    = 1;
-    subpasses[0].pColorAttachments       = color_attachment_refs;
-    subpasses[0].pResolveAttachments     = 0;
-    subpasses[0].pDepthStencilAttachment = &depth_attachment_ref;
-    subpasses[0].preserveAttachmentCount = 0;
-    subpasses[0].pPreserveAttachments    = 0;
+    DeviceMemoryBlock free_block = device_memory->blocks[best_index];
+    VkDeviceSize padding = best_offset - free_block.offset;
+    VkDeviceSize rest    = free_block.size - padding - size;
 
+    uint32_t index = best_index;
+    device_memory_remove_block(device_memory, index);
+    if (padding > 0) {
+        DeviceMemoryBlock padding_block = { free_block.offset, padding, 0, 0 };
+        device_memory_insert_block(device_memory, index++, padding_block);
+    }
+    DeviceMemoryBlock used_block = { best_offset, size, 1, (uint8_t)linear };
+    device_memory_insert_block(device_memory, index++, used_block);
+    if (rest > 0) {
+        DeviceMemoryBlock rest_block = { best_offset + size, rest, 0, 0 };
+        device_memory_insert_block(device_memory, index, rest_block);
+    }
 
-    VkSubpassDependency dependency = { 0 };
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // refers to implicit subpass before/after renderpass
-    dependency.dstSubpass = 0; // index into the (only) subpass created above
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    device_memory->free -= size;
+    *out_offset = best_offset;
+    return 1;
+}
 
+void vkal_device_memory_free(DeviceMemory * device_memory, VkDeviceSize offset)
+{
+    uint32_t index;
+    for (index = 0; index < device_memory->block_count; ++index) {
+        if (device_memory->blocks[index].used && device_memory->blocks[index].offset == offset) {
+            break;
+        }
+    }
+    assert(index < device_memory->block_count && "vkal_device_memory_free: no allocation at this offset!");
+    if (index == device_memory->block_count) {
+        return;
+    }
+
+    device_memory->free += device_memory->blocks[index].size;
+    device_memory->blocks[index].used = 0;
+
+    // Coalesce with the next and the previous block if they are free.
+    if (index + 1 < device_memory->block_count && !device_memory->blocks[index + 1].used) {
+        device_memory->blocks[index].size += device_memory->blocks[index + 1].size;
+        device_memory_remove_block(device_memory, index + 1);
+    }
+    if (index > 0 && !device_memory->blocks[index - 1].used) {
+        device_memory->blocks[index - 1].size += device_memory->blocks[index].size;
+        device_memory_remove_block(device_memory, index);
+    }
+}
+
+DeviceMemoryStats vkal_device_memory_stats(DeviceMemory const * device_memory)
+{
+    DeviceMemoryStats stats = { 0 };
+    stats.size = device_memory->size;
+    for (uint32_t i = 0; i < device_memory->block_count; ++i) {
+        DeviceMemoryBlock const * block = &device_memory->blocks[i];
+        if (block->used) {
+            stats.used += block->size;
+            stats.allocation_count++;
+        }
+        else {
+            stats.free += block->size;
+            stats.free_block_count++;
+            stats.largest_free_block = VKAL_MAX(stats.largest_free_block, block->size);
+        }
+    }
+    if (stats.free > 0) {
+        stats.fragmentation = 1.0f - (float)stats.largest_free_block / (float)stats.free;
+    }
+    return stats;
+}
+
+VkalBuffer vkal_create_buffer(VkDeviceSize size, DeviceMemory * device_memory, VkBufferUsageFlags buffer_usage_flags)
+{
+    assert(size <= device_memory->size && "vkal_create_buffer: Requested Buffer size exceeds Device Memory size!");
+
+    VkBuffer vk_buffer = VK_NULL_HANDLE;
+    VkBufferCreateInfo buffer_info = { 0 };
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    buffer_info.pQueueFamilyIndices = &indicies.graphics_family;
+    buffer_info.queueFamilyIndexCount = 1;
+    buffer_info.usage = buffer_usage_flags;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult result = vkCreateBuffer(vkal_info.device, &buffer_info, 0, &vk_buffer);
+    VKAL_ASSERT( result && "Failed to create VkBuffer" );
+
+    VkMemoryRequirements buffer_memory_requirements = { 0 };
+    vkGetBufferMemoryRequirements(vkal_info.device, vk_buffer, &buffer_memory_requirements);
+    assert((buffer_memory_requirements.memoryTypeBits & (1 << device_memory->mem_type_index)) &&
+        "vkal_create_buffer: Device Memory has a memory type that cannot back this buffer!");
+
+    VkDeviceSize offset = 0;
+    if (!vkal_device_memory_alloc(device_memory, buffer_memory_requirements.size, buffer_memory_requirements.alignment, 1, &offset)) {
+        DeviceMemoryStats stats = vkal_device_memory_stats(device_memory);
+        printf("[VKAL] vkal_create_buffer: out of Device Memory. Requested: %llu, free: %llu, largest free block: %llu\n",
+            (unsigned long long)buffer_memory_requirements.size, (unsigned long long)stats.free, (unsigned long long)stats.largest_free_block);
+        VKAL_ASSERT(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    }
+    /* NOTE: the offset in vkBindBufferMemory must be a multiple of alignment returend by vkGetBufferMemoryRequirements and denotes the
+       offset into VkDeviceMemory.
+    */	
+    result = vkBindBufferMemory(vkal_info.device, vk_buffer, device_memory->vk_device_memory, offset);
+    VKAL_ASSERT( result && "Failed to bind VkBuffer to VkDeviceMemory" );
+
+    VkalBuffer buffer = { 0 };
+    buffer.size = size;
+    buffer.offset = offset;
+    buffer.device_memory = device_memory->vk_device_memory;
+    buffer.vkal_device_memory = device_memory;
+    buffer.usage = buffer_usage_flags;
+    buffer.buffer = vk_buffer;
+    buffer.mapped = NULL;
+
+    return buffer;
+}
+
+/* Destroys the VkBuffer and gives its range back to the DeviceMemory it was created from, so it can be reused. */
+void vkal_destroy_buffer(VkalBuffer * buffer)
+{
+    if (buffer->buffer == VK_NULL_HANDLE) {
+        return;
+    }
+    vkal_unmap_buffer(buffer);
+    vkDestroyBuffer(vkal_info.device, buffer->buffer, 0);
+    if (buffer->vkal_device_memory) {
+        vkal_device_memory_free(buffer->vkal_device_memory, buffer->offset);
+    }
+    *buffer = (VkalBuffer){ 0 };
+}
+
+/* A VkDeviceMemory can only be mapped once, so buffers that share a DeviceMemory share one mapping of all of it. */
+void vkal_map_buffer(VkalBuffer* buffer) 
+{
+    if (buffer->mapped) {
+        return;
+    }
+    DeviceMemory * memory = buffer->vkal_device_memory;
+    if (memory) {
+        assert((memory->property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && "vkal_map_buffer: memory is not host visible!");
+        if (memory->map_count == 0) {
+            VkResult result = vkMapMemory(vkal_info.device, memory->vk_device_memory, 0, VK_WHOLE_SIZE, 0, &memory->mapped);
+            VKAL_ASSERT(result && "Failed to map memory!");
+        }
+        memory->map_count++;
+        buffer->mapped = (uint8_t*)memory->mapped + buffer->offset;
+        return;
+    }
+
+    VkResult result = vkMapMemory(
+        vkal_info.device, buffer->device_memory,
+        buffer->offset, buffer->size,
+        0,
+        &buffer->mapped);
+    VKAL_ASSERT(result && "Failed to map memory!");
+}
+
+int vkal_buffer_is_host_visible(VkalBuffer * buffer)
+{
+    return !buffer->vkal_device_memory || (buffer->vkal_device_memory->property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+}
+
+/* Writes byte_count bytes at offset into the buffer. Host visible buffers are mapped (and stay mapped) and written
+   directly, buffers in memory the CPU cannot see are written through the staging ring. */
+void vkal_update_buffer_offset(VkalBuffer* buffer, uint8_t* data, uint32_t byte_count, uint32_t offset)
+{
+    assert((uint64_t)offset + byte_count <= buffer->size && "vkal_update_buffer_offset: range exceeds buffer-size!");
+
+    DeviceMemory * memory = buffer->vkal_device_memory;
+    if (!vkal_buffer_is_host_visible(buffer)) {
+        vkal_upload_buffer(buffer->buffer, offset, data, byte_count);
+        return;
+    }
+
+    vkal_map_buffer(buffer);
+    memcpy((uint8_t*)buffer->mapped + offset, data, byte_count);
+
+    if (memory && (memory->property_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        return;
+    }
+    // Flush ranges are relative to the VkDeviceMemory and must be multiples of nonCoherentAtomSize.
+    VkDeviceSize atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    VkDeviceSize map_offset = memory ? buffer->offset : 0;
+    VkDeviceSize begin = ((map_offset + offset) / atom) * atom;
+    VkDeviceSize end = ((map_offset + offset + byte_count + atom - 1) / atom) * atom;
+    VkMappedMemoryRange memory_range = { 0 };
+    memory_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    memory_range.memory = buffer->device_memory;
+    memory_range.offset = memory ? begin : buffer->offset;
+    memory_range.size = (memory && end < memory->size) ? end - begin : VK_WHOLE_SIZE;
+    VkResult result = vkFlushMappedMemoryRanges(vkal_info.device, 1, &memory_range);
+    VKAL_ASSERT(result && "Failed to flush mapped memory!");
+}
+
+// TODO: Call vkal_update_buffer_offset with buffer.offset
+// TODO: Make sure buffer mapping, flushing does not violate vulkan spec! (see function above).
+void vkal_update_buffer(VkalBuffer* buffer, uint8_t* data, uint32_t byte_count)
+{
+    vkal_update_buffer_offset(buffer, data, byte_count, 0);
+}
+
+VkalUploadTicket upload_texture(VkImage const image,
+		    uint32_t w, uint32_t h, uint32_t n,
+		    uint32_t array_layer_count,
+		    unsigned char * texture_data)
+{
+    VkalFormatInfo format_info = { 1, 1, n };
+    return upload_texture_levels(image, w, h, format_info, array_layer_count, 1, texture_data, NULL);
+}
+
+/* Uploads mip levels 0..mip_level_count-1 of an image. The data is level-major: level_offsets[i] is where level i
+   starts and every level holds array_layer_count tightly packed layers. Rows are counted in blocks, so this
+   works for block-compressed formats as well. If level_offsets is NULL the levels are assumed to be packed
+   back to back. */
+VkalUploadTicket upload_texture_levels(VkImage const image,
+		    uint32_t w, uint32_t h, VkalFormatInfo format_info,
+		    uint32_t array_layer_count, uint32_t mip_level_count,
+		    unsigned char * texture_data, VkDeviceSize const * level_offsets)
+{
+    assert(w > 0 && h > 0 && array_layer_count > 0 && mip_level_count > 0);
+    VkExtent3D granularity = vkal_info.transfer_image_granularity;
+    int transfer_partial_copies = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
+
+    VkImageSubresourceRange image_subresource_range = { 0 };
+    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_subresource_range.layerCount = array_layer_count;
+    image_subresource_range.baseArrayLayer = 0;
+    image_subresource_range.levelCount = mip_level_count;
+    image_subresource_range.baseMipLevel = 0;
+
+    // Partial copies on the transfer queue must respect its image transfer granularity. If any level has to be
+    // split by rows and the granularity does not allow it, the graphics queue does all copies.
+    int use_transfer = vkal_info.transfer_queue != VK_NULL_HANDLE;
+    for (uint32_t level = 0; level < mip_level_count && !transfer_partial_copies; ++level) {
+        uint32_t level_w = VKAL_MAX(w >> level, 1);
+        uint32_t level_h = VKAL_MAX(h >> level, 1);
+        VkDeviceSize row_size = (VkDeviceSize)((level_w + format_info.block_width - 1) / format_info.block_width) * format_info.block_size;
+        VkDeviceSize layer_size = row_size * ((level_h + format_info.block_height - 1) / format_info.block_height);
+        if (layer_size > VKAL_MAX(vkal_info.upload_chunk_size, row_size)) {
+            use_transfer = 0;
+        }
+    }
+
+    VkalUploadBatch * batch = NULL;
+    VkCommandBuffer transfer_command_buffer = VK_NULL_HANDLE;
+    VkDeviceSize level_offset = 0;
+    for (uint32_t level = 0; level < mip_level_count; ++level) {
+        uint32_t level_w = VKAL_MAX(w >> level, 1);
+        uint32_t level_h = VKAL_MAX(h >> level, 1);
+        uint32_t block_rows = (level_h + format_info.block_height - 1) / format_info.block_height;
+        VkDeviceSize row_size = (VkDeviceSize)((level_w + format_info.block_width - 1) / format_info.block_width) * format_info.block_size;
+        VkDeviceSize layer_size = row_size * block_rows;
+        VkDeviceSize chunk_size = VKAL_MAX(vkal_info.upload_chunk_size, row_size);
+        assert(row_size <= vkal_info.staging_ring.size && "upload_texture_levels: a single row does not fit into the staging buffer!");
+        if (level_offsets) {
+            level_offset = level_offsets[level];
+        }
+
+        // Levels that do not fit into one chunk are split by layers first and then by rows of blocks.
+        int split_rows = layer_size > chunk_size;
+        uint32_t layers_per_chunk = split_rows ? 1 : (uint32_t)VKAL_MIN(chunk_size / layer_size, array_layer_count);
+        uint32_t rows_per_chunk = split_rows ? (uint32_t)(chunk_size / row_size) : block_rows;
+
+        for (uint32_t layer = 0; layer < array_layer_count; layer += layers_per_chunk) {
+            uint32_t layer_count = VKAL_MIN(layers_per_chunk, array_layer_count - layer);
+            for (uint32_t row = 0; row < block_rows; row += rows_per_chunk) {
+                uint32_t row_count = VKAL_MIN(rows_per_chunk, block_rows - row);
+                VkDeviceSize src_offset = level_offset + layer * layer_size + row * row_size;
+                VkDeviceSize size = layer_count * row_count * row_size;
+
+                // Copy image data to staging buffer. bufferOffset must be a multiple of the texel block size and of 4.
+                VkDeviceSize staging_offset = staging_ring_alloc(size, 4 * format_info.block_size);
+                staging_ring_write(staging_offset, texture_data + src_offset, size);
+
+                // Record the upload to GPU. The image is new, so the copy can go to the transfer queue.
+                batch = upload_batch_begin();
+                transfer_command_buffer = use_transfer ? upload_batch_begin_transfer(batch) : VK_NULL_HANDLE;
+                VkCommandBuffer command_buffer = transfer_command_buffer ? transfer_command_buffer : batch->command_buffer;
+
+                if (level == 0 && layer == 0 && row == 0) {
+                    VkImageMemoryBarrier image_memory_barrier_undef_to_transfer = { 0 };
+                    image_memory_barrier_undef_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                    image_memory_barrier_undef_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                    image_memory_barrier_undef_to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                    image_memory_barrier_undef_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+                    image_memory_barrier_undef_to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    image_memory_barrier_undef_to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    image_memory_barrier_undef_to_transfer.image = image;
+                    image_memory_barrier_undef_to_transfer.subresourceRange = image_subresource_range;
+                    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_undef_to_transfer);
+                }
+                upload_batch_track(batch, command_buffer, VK_NULL_HANDLE, image, src_offset, size);
+
+                VkBufferImageCopy copy_info = { 0 };
+                copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                copy_info.imageSubresource.baseArrayLayer = layer;
+                copy_info.imageSubresource.layerCount = layer_count;
+                copy_info.imageSubresource.mipLevel = level;
+                copy_info.bufferOffset = staging_offset;
+                copy_info.bufferImageHeight = 0;
+                copy_info.bufferRowLength = 0;
+                copy_info.imageOffset = (VkOffset3D){ 0, (int32_t)(row * format_info.block_height), 0 };
+                copy_info.imageExtent.width  = level_w;
+                copy_info.imageExtent.height = VKAL_MIN(row_count * format_info.block_height, level_h - row * format_info.block_height);
+                copy_info.imageExtent.depth  = 1;
+                vkCmdCopyBufferToImage(command_buffer, vkal_info.staging_buffer.buffer, image,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_info);
+            }
+        }
+        level_offset += layer_size * array_layer_count;
+    }
+
+    VkImageMemoryBarrier image_memory_barrier_transfer_to_shader_read = { 0 };
+    image_memory_barrier_transfer_to_shader_read.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_memory_barrier_transfer_to_shader_read.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_memory_barrier_transfer_to_shader_read.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    image_memory_barrier_transfer_to_shader_read.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barrier_transfer_to_shader_read.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    image_memory_barrier_transfer_to_shader_read.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier_transfer_to_shader_read.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier_transfer_to_shader_read.image = image;
+    image_memory_barrier_transfer_to_shader_read.subresourceRange = image_subresource_range;
+    if (transfer_command_buffer) {
+        // Release on the transfer queue and acquire on the graphics queue. Both do the same layout transition.
+        image_memory_barrier_transfer_to_shader_read.srcQueueFamilyIndex = vkal_info.queue_families.transfer_family;
+        image_memory_barrier_transfer_to_shader_read.dstQueueFamilyIndex = vkal_info.queue_families.graphics_family;
+        image_memory_barrier_transfer_to_shader_read.dstAccessMask = 0;
+        vkCmdPipelineBarrier(transfer_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_transfer_to_shader_read);
+
+        image_memory_barrier_transfer_to_shader_read.srcAccessMask = 0;
+        image_memory_barrier_transfer_to_shader_read.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_transfer_to_shader_read);
+    }
+    else {
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_transfer_to_shader_read);
+    }
+
+    return batch->ticket;
+}
+
+/* Overwrites a rectangle of one layer and mip level and keeps the rest of the texture. data holds tightly packed rows
+   of the rectangle. For block-compressed formats the rectangle has to be aligned to blocks. Other mip levels
+   are not regenerated. The copy is recorded on the graphics queue so it is ordered after frames that still sample
+   the texture, and becomes visible to everything submitted after the next vkal_upload_flush. */
+VkalUploadTicket vkal_update_texture_region(VkalTexture * texture,
+    int32_t x, int32_t y, uint32_t width, uint32_t height,
+    uint32_t array_layer, uint32_t mip_level, unsigned char * data)
+{
+    VkalFormatInfo format_info = vkal_format_info(texture->format);
+    if (format_info.block_size == 0) {
+        // vkal_create_texture treats channels as bytes per texel.
+        format_info.block_width = 1;
+        format_info.block_height = 1;
+        format_info.block_size = texture->channels;
+    }
+    uint32_t level_w = VKAL_MAX(texture->width >> mip_level, 1);
+    uint32_t level_h = VKAL_MAX(texture->height >> mip_level, 1);
+    assert(mip_level < VKAL_MAX(texture->mip_level_count, 1) && array_layer < VKAL_MAX(texture->array_layer_count, 1));
+    assert(x >= 0 && y >= 0 && x + width <= level_w && y + height <= level_h && "vkal_update_texture_region: rectangle out of bounds!");
+    assert(x % format_info.block_width == 0 && y % format_info.block_height == 0 && "vkal_update_texture_region: rectangle not block aligned!");
+    if (width == 0 || height == 0) {
+        return vkal_upload_current_ticket();
+    }
+
+    VkImage image = get_image(texture->image);
+    uint32_t block_rows = (height + format_info.block_height - 1) / format_info.block_height;
+    VkDeviceSize row_size = (VkDeviceSize)((width + format_info.block_width - 1) / format_info.block_width) * format_info.block_size;
+    uint32_t rows_per_chunk = (uint32_t)(VKAL_MAX(vkal_info.upload_chunk_size, row_size) / row_size);
+    assert(row_size <= vkal_info.staging_ring.size && "vkal_update_texture_region: a single row does not fit into the staging buffer!");
+
+    VkImageMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = mip_level;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = array_layer;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkalUploadBatch * batch = NULL;
+    for (uint32_t row = 0; row < block_rows; row += rows_per_chunk) {
+        uint32_t row_count = VKAL_MIN(rows_per_chunk, block_rows - row);
+        VkDeviceSize size = row_count * row_size;
+        VkDeviceSize staging_offset = staging_ring_alloc(size, 4 * format_info.block_size);
+        staging_ring_write(staging_offset, data + row * row_size, size);
+
+        // A full staging ring submits the open batch, so the layout transition is recorded per batch.
+        VkalUploadBatch * current = upload_batch_begin();
+        if (current != batch) {
+            if (batch) {
+                barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+                barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, 0, 0, 0, 1, &barrier);
+            }
+            barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(current->command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &barrier);
+            batch = current;
+        }
+
+        VkBufferImageCopy copy_info = { 0 };
+        copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy_info.imageSubresource.baseArrayLayer = array_layer;
+        copy_info.imageSubresource.layerCount = 1;
+        copy_info.imageSubresource.mipLevel = mip_level;
+        copy_info.bufferOffset = staging_offset;
+        copy_info.bufferRowLength = 0;
+        copy_info.bufferImageHeight = 0;
+        copy_info.imageOffset = (VkOffset3D){ x, y + (int32_t)(row * format_info.block_height), 0 };
+        copy_info.imageExtent.width = width;
+        copy_info.imageExtent.height = VKAL_MIN(row_count * format_info.block_height, height - row * format_info.block_height);
+        copy_info.imageExtent.depth = 1;
+        vkCmdCopyBufferToImage(batch->command_buffer, vkal_info.staging_buffer.buffer, image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_info);
+    }
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, 0, 0, 0, 1, &barrier);
+    return batch->ticket;
+}
+
+/* Host image copies need VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT on the image, so this has to be decided before it is created. */
+int texture_use_host_image_copy(VkFormat format)
+{
+#ifdef VK_EXT_host_image_copy
+    if (!vkal_info.host_image_copy_active) {
+        return 0;
+    }
+    VkFormatProperties3 format_properties3 = { 0 };
+    format_properties3.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3;
+    VkFormatProperties2 format_properties = { 0 };
+    format_properties.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
+    format_properties.pNext = &format_properties3;
+    vkGetPhysicalDeviceFormatProperties2(vkal_info.physical_device, format, &format_properties);
+    return (format_properties3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT) != 0;
+#else
+    return 0;
+#endif
+}
+
+/* Same data layout as upload_texture_levels, but the CPU writes the image directly: no staging memory, command
+   buffer or submit. The image must be new and created with VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT. The levels are
+   in SHADER_READ_ONLY_OPTIMAL and usable by any work submitted after this returns. Levels >= mip_level_count stay
+   UNDEFINED, so generate_mipmaps can fill them. */
+void upload_texture_levels_host(VkImage const image,
+		    uint32_t w, uint32_t h, VkalFormatInfo format_info,
+		    uint32_t array_layer_count, uint32_t mip_level_count,
+		    unsigned char * texture_data, VkDeviceSize const * level_offsets)
+{
+#ifdef VK_EXT_host_image_copy
+    assert(mip_level_count <= 32);
+    VkHostImageLayoutTransitionInfoEXT transition = { 0 };
+    transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+    transition.image = image;
+    transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    transition.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    transition.subresourceRange.baseMipLevel = 0;
+    transition.subresourceRange.levelCount = mip_level_count;
+    transition.subresourceRange.baseArrayLayer = 0;
+    transition.subresourceRange.layerCount = array_layer_count;
+    VkResult result = vkTransitionImageLayout(vkal_info.device, 1, &transition);
+    VKAL_ASSERT(result && "failed to transition image layout on the host");
+
+    VkMemoryToImageCopyEXT regions[32] = { 0 };
+    VkDeviceSize level_offset = 0;
+    for (uint32_t level = 0; level < mip_level_count; ++level) {
+        uint32_t level_w = VKAL_MAX(w >> level, 1);
+        uint32_t level_h = VKAL_MAX(h >> level, 1);
+        if (level_offsets) {
+            level_offset = level_offsets[level];
+        }
+        regions[level].sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+        regions[level].pHostPointer = texture_data + level_offset;
+        regions[level].memoryRowLength = 0;
+        regions[level].memoryImageHeight = 0;
+        regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[level].imageSubresource.mipLevel = level;
+        regions[level].imageSubresource.baseArrayLayer = 0;
+        regions[level].imageSubresource.layerCount = array_layer_count;
+        regions[level].imageExtent.width = level_w;
+        regions[level].imageExtent.height = level_h;
+        regions[level].imageExtent.depth = 1;
+        VkDeviceSize row_size = (VkDeviceSize)((level_w + format_info.block_width - 1) / format_info.block_width) * format_info.block_size;
+        level_offset += row_size * ((level_h + format_info.block_height - 1) / format_info.block_height) * array_layer_count;
+    }
+    VkCopyMemoryToImageInfoEXT copy_info = { 0 };
+    copy_info.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+    copy_info.dstImage = image;
+    copy_info.dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    copy_info.regionCount = mip_level_count;
+    copy_info.pRegions = regions;
+    result = vkCopyMemoryToImage(vkal_info.device, &copy_info);
+    VKAL_ASSERT(result && "failed to copy memory to image on the host");
+#else
+    assert(0 && "upload_texture_levels_host: vkal was built without VK_EXT_host_image_copy!");
+#endif
+}
+
+/* Switches texture creation between host image copies and the staging ring. Has no effect if the device cannot do host copies. */
+void vkal_use_host_image_copy(int enable)
+{
+    vkal_info.host_image_copy_active = enable && vkal_info.host_image_copy_supported;
+}
+
+uint32_t vkal_mip_level_count(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    for (uint32_t dim = VKAL_MAX(width, height); dim > 1; dim >>= 1) {
+        levels++;
+    }
+    return levels;
+}
+
+/* Fills mip levels 1..mip_level_count-1 by successively blitting each level into the next one. Level 0 must
+   have been uploaded and be in SHADER_READ_ONLY_OPTIMAL. Blits need a graphics queue, so this is recorded into
+   the graphics command buffer of the open upload batch. All levels end up in SHADER_READ_ONLY_OPTIMAL. */
+VkalUploadTicket generate_mipmaps(VkImage const image, uint32_t w, uint32_t h, uint32_t array_layer_count, uint32_t mip_level_count, VkFilter filter)
+{
+    VkalUploadBatch * batch = upload_batch_begin();
+    VkCommandBuffer command_buffer = batch->command_buffer;
+
+    VkImageMemoryBarrier barriers[2] = { 0 };
+    for (uint32_t i = 0; i < 2; ++i) {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = image;
+        barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barriers[i].subresourceRange.baseArrayLayer = 0;
+        barriers[i].subresourceRange.layerCount = array_layer_count;
+    }
+
+    // Level 0 becomes the first blit source, all other levels blit destinations.
+    barriers[0].subresourceRange.baseMipLevel = 0;
+    barriers[0].subresourceRange.levelCount = 1;
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[1].subresourceRange.baseMipLevel = 1;
+    barriers[1].subresourceRange.levelCount = mip_level_count - 1;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, 0, 0, 0, 2, barriers);
+
+    int32_t src_w = (int32_t)w;
+    int32_t src_h = (int32_t)h;
+    for (uint32_t level = 1; level < mip_level_count; ++level) {
+        int32_t dst_w = VKAL_MAX(src_w / 2, 1);
+        int32_t dst_h = VKAL_MAX(src_h / 2, 1);
+
+        VkImageBlit blit = { 0 };
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = array_layer_count;
+        blit.srcOffsets[1] = (VkOffset3D){ src_w, src_h, 1 };
+        blit.dstSubresource = blit.srcSubresource;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstOffsets[1] = (VkOffset3D){ dst_w, dst_h, 1 };
+        vkCmdBlitImage(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, filter);
+
+        // The level just written is the source of the next blit.
+        barriers[0].subresourceRange.baseMipLevel = level;
+        barriers[0].subresourceRange.levelCount = 1;
+        barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, 0, 0, 0, 1, barriers);
+
+        src_w = dst_w;
+        src_h = dst_h;
+    }
+
+    barriers[0].subresourceRange.baseMipLevel = 0;
+    barriers[0].subresourceRange.levelCount = mip_level_count;
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 0, 0, 0, 0, 1, barriers);
+
+    return batch->ticket;
+}
+
+void create_default_depth_buffer(void)
+{
+    {
+	    create_image(
+	        vkal_info.swapchain_extent.width, vkal_info.swapchain_extent.height,
+	        1, 1, 0,
+	        VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+	        &vkal_info.depth_stencil_image);
+    }
+    
+    {
+		bind_image_memory(vkal_info.depth_stencil_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    
+    {
+		// depth stencil image view
+        vkal_create_image_view(
+			get_image(vkal_info.depth_stencil_image), 
+			 VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT,
+			0, 1,
+			0, 1,
+			&vkal_info.depth_stencil_image_view);
+    }
+}
+
+uint32_t check_memory_type_index(uint32_t const memory_requirement_bits, VkMemoryPropertyFlags const wanted_property)
+{
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &memory_properties);
+    uint32_t mem_type_index      = 0;
+    uint32_t best_mem_type_index = 0;
+    uint32_t found               = 0;
+    uint32_t type_bits           = memory_requirement_bits;
+    for (; mem_type_index < memory_properties.memoryTypeCount; ++mem_type_index) {
+	    if (type_bits & 1) {
+	        if ((memory_properties.memoryTypes[mem_type_index].propertyFlags & wanted_property) == wanted_property) {
+		        found = 1;
+		        best_mem_type_index = mem_type_index;
+		        break;		
+	        }
+	        found = 1;
+	        best_mem_type_index = mem_type_index;
+	    }
+	    type_bits >>= 1;
+    }
+    assert(found == 1);
+    
+    return best_mem_type_index;
+}
+
+/* Unlike check_memory_type_index this never falls back to a type without the required properties.
+   Returns UINT32_MAX if there is no such type. */
+uint32_t find_memory_type_index(uint32_t memory_requirement_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+{
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &memory_properties);
+    uint32_t found = UINT32_MAX;
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+		VkMemoryPropertyFlags flags = memory_properties.memoryTypes[i].propertyFlags;
+		if (!(memory_requirement_bits & (1u << i)) || (flags & required) != required) {
+			continue;
+		}
+		if ((flags & preferred) == preferred) {
+			return i;
+		}
+		if (found == UINT32_MAX) {
+			found = i;
+		}
+    }
+    return found;
+}
+
+int rate_device(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(device, &device_properties);
+    
+    switch (device_properties.deviceType)
+    {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        {
+	        return 1000;
+        } break;
+        
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        {
+	        return 500;
+        } break;
+        
+        default: return 0;
+    }
+}
+
+int check_device_extension_support(VkPhysicalDevice device, char ** extensions, uint32_t extension_count)
+{
+    int* extensions_left = NULL;
+    VKAL_MALLOC(extensions_left, extension_count);
+    memset(extensions_left, 1, extension_count * sizeof(int));
+
+    printf("\n[VKAL] query device extensions:\n");
+    uint32_t supported_extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(device, 0, &supported_extension_count, 0);
+    VkExtensionProperties* available_extensions = NULL;
+    VKAL_MALLOC(available_extensions, supported_extension_count);
+    vkEnumerateDeviceExtensionProperties(device, 0, &supported_extension_count, available_extensions);
+    
+    uint32_t extensions_found = 0;
+    for (uint32_t i = 0; i < supported_extension_count; ++i) {
+	    for (uint32_t k = 0; k < extension_count; ++k) {
+	        if (!strcmp(available_extensions[i].extensionName, extensions[k])) {
+		        printf("[VKAL] requested device extension: %s found!\n", extensions[k]);
+		        extensions_found++;
+		        extensions_left[k] = 0;
+		        goto gt_next_extension;
+	        }
+	    }
+        gt_next_extension:;
+    }
+    
+    for (uint32_t i = 0; i < extension_count; ++i) {
+	    if (extensions_left[i]) {
+	        printf("[VKAL] requested extension %s not available!\n", extensions[i]);
+	    }
+    }
+    VKAL_FREE(extensions_left);
+    VKAL_FREE(available_extensions);
+    return extension_count == extensions_found;
+}
+
+int is_device_suitable(VkPhysicalDevice device, char ** extensions, uint32_t extension_count)
+{
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(device, &device_properties);
+    VkPhysicalDeviceFeatures device_features;
+    vkGetPhysicalDeviceFeatures(device, &device_features);
+    SwapChainSupportDetails swapchain_support = query_swapchain_support(device);
+    int swapchain_adequate = 1;
+	
+    if (!swapchain_support.formats || !swapchain_support.present_modes) {
+	    swapchain_adequate = 0;
+    }
+    // NOTE: only test for swapchain support after the extension support has been checked!
+    return check_device_extension_support(device, extensions, extension_count) && swapchain_adequate;
+}
+
+QueueFamilyIndicies find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface)
+{
+    // Just look for a queue family that can do graphics for now
+    QueueFamilyIndicies indicies;
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, 0);
+   
+    VkQueueFamilyProperties* queue_families = NULL;
+    VKAL_MALLOC(queue_families, queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families);
+    indicies.has_graphics_family = 0;
+    indicies.has_present_family = 0;
+    indicies.has_transfer_family = 0;
+    indicies.has_compute_family = 0;
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+	    if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+	        indicies.graphics_family = i;
+	        indicies.has_graphics_family = 1;
+	        break;
+	    }
+    }
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+	    VkBool32 present_support = VK_FALSE;
+	    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+	    if (present_support) {
+	        indicies.has_present_family = 1;
+	        indicies.present_family = i;
+	        break;
+	    }
+    }
+    // Transfer only families usually map to the copy engines of the GPU
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+	    VkQueueFlags flags = queue_families[i].queueFlags;
+	    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+	        indicies.has_transfer_family = 1;
+	        indicies.transfer_family = i;
+	        break;
+	    }
+    }
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+	    VkQueueFlags flags = queue_families[i].queueFlags;
+	    if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+	        indicies.has_compute_family = 1;
+	        indicies.compute_family = i;
+	        break;
+	    }
+    }
+    VKAL_FREE(queue_families);
+    return indicies;
+}
+
+void vkal_find_suitable_devices(char ** extensions, uint32_t extension_count,
+				VkalPhysicalDevice ** out_devices, uint32_t * out_device_count)
+{
+	if (vkal_info.instance == NULL) {
+		printf("[VKAL] Error: VkInstance is null!\n");
+        system("pause");
+		exit(-1);
+	}
+    vkal_info.physical_device_count = 0;
+    vkEnumeratePhysicalDevices(vkal_info.instance, &vkal_info.physical_device_count, 0);
+    if (!vkal_info.physical_device_count) {
+	    printf("[VKAL] No GPU with Vulkan support found\n");
+        system("pause");
+	    exit(-1);
+    }
+    
+    VKAL_MALLOC(vkal_info.physical_devices, vkal_info.physical_device_count);
+    VKAL_MALLOC(vkal_info.suitable_devices, vkal_info.physical_device_count);
+    vkal_info.suitable_device_count = 0;
+    vkEnumeratePhysicalDevices(vkal_info.instance, &vkal_info.physical_device_count, vkal_info.physical_devices);
+    
+    for (uint32_t i = 0; i < vkal_info.physical_device_count; ++i) {
+	    VkPhysicalDeviceProperties physical_device_property = { 0 };
+	    vkGetPhysicalDeviceProperties(vkal_info.physical_devices[i], &physical_device_property);
+	    printf("[VKAL] physical device found: %s\n", physical_device_property.deviceName);
+	    if ( is_device_suitable(vkal_info.physical_devices[i], extensions, extension_count) ) {
+	        QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_devices[i], vkal_info.surface);
+	        if (indicies.has_graphics_family && indicies.has_present_family) {
+		        vkal_info.suitable_devices[i].device = vkal_info.physical_devices[i];
+		        vkal_info.suitable_devices[i].property = physical_device_property;
+		        vkal_info.suitable_device_count++;
+	        }
+	    }
+    }
+
+    *out_devices = vkal_info.suitable_devices;
+    *out_device_count = vkal_info.suitable_device_count;
+}
+
+void vkal_select_physical_device(VkalPhysicalDevice * physical_device)
+{
+    vkal_info.physical_device = physical_device->device;
+    vkal_info.physical_device_properties = physical_device->property;
+    vkal_info.api_version = VKAL_MIN(vkal_info.instance_api_version, vkal_info.physical_device_properties.apiVersion);
+    printf("[VKAL] physcial device limits: nonCoherentAtomSize: %llu\n", vkal_info.physical_device_properties.limits.nonCoherentAtomSize);
+}
+
+static int has_extension(char ** extensions, uint32_t extension_count, char const * name)
+{
+    for (uint32_t i = 0; i < extension_count; ++i) {
+        if (!strcmp(extensions[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Loads name, with the suffix of the extension it comes from if it is not core on the device. */
+static PFN_vkVoidFunction get_device_function(char const * name, char const * suffix)
+{
+    char full_name[128];
+    snprintf(full_name, sizeof(full_name), "%s%s", name, suffix);
+    PFN_vkVoidFunction function = vkGetDeviceProcAddr(vkal_info.device, full_name);
+    assert(function && "device function not found");
+    return function;
+}
+
+void create_logical_device(char** extensions, uint32_t extension_count, VkalWantedFeatures vulkan_features)
+{
+    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    uint32_t unique_queue_families[4];
+    uint32_t info_count = 0;
+    unique_queue_families[info_count++] = indicies.graphics_family;
+    if (indicies.present_family != indicies.graphics_family) {
+        unique_queue_families[info_count++] = indicies.present_family;
+    }
+    // The dedicated families never support graphics, so they cannot collide with the graphics family.
+    if (indicies.has_transfer_family && indicies.transfer_family != indicies.present_family) {
+        unique_queue_families[info_count++] = indicies.transfer_family;
+    }
+    if (indicies.has_compute_family && indicies.compute_family != indicies.present_family) {
+        unique_queue_families[info_count++] = indicies.compute_family;
+    }
+    VkDeviceQueueCreateInfo queue_create_infos[4] = { 0 };
+    float queue_prio = 1.f;
+    for (uint32_t i = 0; i < info_count; ++i) {
+        queue_create_infos[i] = (VkDeviceQueueCreateInfo){ 0 };
+        queue_create_infos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_create_infos[i].queueFamilyIndex = unique_queue_families[i];
+        queue_create_infos[i].queueCount = 1;
+        queue_create_infos[i].pQueuePriorities = &queue_prio;
+    }
+
+    /* Complete the wanted features struct and chain them */
+    vulkan_features.features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    vulkan_features.features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan_features.rayTracingPipelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
+    vulkan_features.accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    vulkan_features.features11.pNext = &vulkan_features.features12;
+    if (vkal_info.raytracing_enabled) {
+        vulkan_features.features12.pNext = &vulkan_features.rayTracingPipelineFeatures;
+        vulkan_features.rayTracingPipelineFeatures.pNext = &vulkan_features.accelerationStructureFeatures;
+    }
+
+    /* Query what features are supported for the selected device */
+    VkPhysicalDeviceVulkan11Features device_features11 = { 0 };
+    device_features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    VkPhysicalDeviceVulkan12Features device_features12 = { 0 };
+    device_features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    device_features12.pNext = &device_features11;
+
+    /* Raytracing */
+    VkPhysicalDeviceRayTracingPipelineFeaturesKHR ray_tracing_features = { 0 };
+    ray_tracing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
+    ray_tracing_features.pNext = &device_features12;
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR acceleration_structure_features = { 0 };
+    acceleration_structure_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    acceleration_structure_features.pNext = &ray_tracing_features;
+    
+    VkPhysicalDeviceFeatures2 available_features2 = { 0 };
+    available_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    if (vkal_info.raytracing_enabled) {
+        available_features2.pNext = &acceleration_structure_features;
+    }
+    else {
+        available_features2.pNext = &device_features12;
+    }
+    vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &available_features2);
+
+    /* TODO: Complete feature-checking */
+
+    /* Check Features2 (which now contains VkalPhysicalDeviceFeatures). For now, just check, what we need */
+    VKAL_CHECK_FEATURE(vulkan_features.features2.features.fillModeNonSolid, available_features2.features.fillModeNonSolid);
+
+    /* Check Features 1_1 */
+    VKAL_CHECK_FEATURE(vulkan_features.features11.multiview, device_features11.multiview);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.multiviewGeometryShader, device_features11.multiviewGeometryShader);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.multiviewTessellationShader, device_features11.multiviewTessellationShader);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.protectedMemory, device_features11.protectedMemory);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.samplerYcbcrConversion, device_features11.samplerYcbcrConversion);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.shaderDrawParameters, device_features11.shaderDrawParameters);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.storageBuffer16BitAccess, device_features11.storageBuffer16BitAccess);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.storageInputOutput16, device_features11.storageInputOutput16);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.storagePushConstant16, device_features11.storagePushConstant16);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.uniformAndStorageBuffer16BitAccess, device_features11.uniformAndStorageBuffer16BitAccess);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.variablePointers, device_features11.variablePointers);
+    VKAL_CHECK_FEATURE(vulkan_features.features11.variablePointersStorageBuffer, device_features11.variablePointersStorageBuffer);
+
+    /* Check Features 1_2. For now, just check for the ones that are actually being used often by examples. (There are many!) */
+    VKAL_CHECK_FEATURE(vulkan_features.features12.bufferDeviceAddress, device_features12.bufferDeviceAddress);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.uniformAndStorageBuffer8BitAccess, device_features12.uniformAndStorageBuffer8BitAccess);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.runtimeDescriptorArray, device_features12.runtimeDescriptorArray);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.shaderStorageImageArrayNonUniformIndexing, device_features12.shaderStorageImageArrayNonUniformIndexing);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.shaderSampledImageArrayNonUniformIndexing, device_features12.shaderSampledImageArrayNonUniformIndexing);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.descriptorIndexing, device_features12.descriptorIndexing);
+
+    /* Check Raytracing features */
+    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipeline, ray_tracing_features.rayTracingPipeline);
+    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipelineShaderGroupHandleCaptureReplay, ray_tracing_features.rayTracingPipelineShaderGroupHandleCaptureReplay);
+    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipelineShaderGroupHandleCaptureReplayMixed, ray_tracing_features.rayTracingPipelineShaderGroupHandleCaptureReplayMixed);
+    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipelineTraceRaysIndirect, ray_tracing_features.rayTracingPipelineTraceRaysIndirect);
+    VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTraversalPrimitiveCulling, ray_tracing_features.rayTraversalPrimitiveCulling);
+
+    /* Check Acceleration Structure Features */
+    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructure, acceleration_structure_features.accelerationStructure);
+    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructureCaptureReplay, acceleration_structure_features.accelerationStructureCaptureReplay);
+    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructureHostCommands, acceleration_structure_features.accelerationStructureHostCommands);
+    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.accelerationStructureIndirectBuild, acceleration_structure_features.accelerationStructureIndirectBuild);
+    VKAL_CHECK_FEATURE(vulkan_features.accelerationStructureFeatures.descriptorBindingAccelerationStructureUpdateAfterBind, acceleration_structure_features.descriptorBindingAccelerationStructureUpdateAfterBind);
+
+    vulkan_features.features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    vulkan_features.features2.pNext = &vulkan_features.features11;
+
+    /* Block-compressed formats are enabled as far as the device supports them. The format properties
+       vkal_create_texture_from_levels checks already report them, but creating such images needs the feature. */
+    vulkan_features.features2.features.textureCompressionBC = available_features2.features.textureCompressionBC;
+    vulkan_features.features2.features.textureCompressionETC2 = available_features2.features.textureCompressionETC2;
+    vulkan_features.features2.features.textureCompressionASTC_LDR = available_features2.features.textureCompressionASTC_LDR;
+
+    /* Indirect drawing is enabled as far as the device supports it, vkal_draw_indexed_indirect falls back to one call per draw. */
+    vulkan_features.features2.features.multiDrawIndirect = available_features2.features.multiDrawIndirect;
+    vulkan_features.features2.features.drawIndirectFirstInstance = available_features2.features.drawIndirectFirstInstance;
+    vulkan_features.features12.drawIndirectCount = device_features12.drawIndirectCount;
+    vkal_info.multi_draw_indirect_supported = available_features2.features.multiDrawIndirect &&
+        vkal_info.physical_device_properties.limits.maxDrawIndirectCount > 1;
+    vkal_info.draw_indirect_count_supported = device_features12.drawIndirectCount;
+    vkal_info.draw_indirect_first_instance_supported = available_features2.features.drawIndirectFirstInstance;
+
+    /* Every submit of vkal signals a timeline semaphore. They are core in Vulkan 1.2 and all 1.2 devices support them. */
+    assert(device_features12.timelineSemaphore && "timeline semaphores are not supported!");
+    vulkan_features.features12.timelineSemaphore = VK_TRUE;
+
+    /* Host image copy is enabled whenever the extension is. It is only used if it can write images that are ready to be sampled. */
+    vkal_info.host_image_copy_supported = 0;
+#ifdef VK_EXT_host_image_copy
+    VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy_features = { 0 };
+    host_image_copy_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    /* Below 1.3 the extension needs VK_KHR_copy_commands2 and VK_KHR_format_feature_flags2, which are core in 1.3. */
+    int host_image_copy_requested = has_extension(extensions, extension_count, VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+    if (host_image_copy_requested && vkal_info.api_version < VK_API_VERSION_1_3 &&
+        !(has_extension(extensions, extension_count, VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME) &&
+          has_extension(extensions, extension_count, VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME))) {
+        printf("[VKAL] VK_EXT_host_image_copy needs VK_KHR_copy_commands2 and VK_KHR_format_feature_flags2 below Vulkan 1.3, textures are staged.\n");
+        host_image_copy_requested = 0;
+    }
+    if (host_image_copy_requested) {
+        VkPhysicalDeviceFeatures2 features = { 0 };
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &host_image_copy_features;
+        vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &features);
+        if (host_image_copy_features.hostImageCopy) {
+            host_image_copy_features.pNext = vulkan_features.features2.pNext;
+            vulkan_features.features2.pNext = &host_image_copy_features;
+
+            VkPhysicalDeviceHostImageCopyPropertiesEXT host_image_copy_properties = { 0 };
+            host_image_copy_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2 properties = { 0 };
+            properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties.pNext = &host_image_copy_properties;
+            vkGetPhysicalDeviceProperties2(vkal_info.physical_device, &properties);
+            VkImageLayout * dst_layouts = NULL;
+            VKAL_MALLOC(dst_layouts, host_image_copy_properties.copyDstLayoutCount);
+            host_image_copy_properties.pCopyDstLayouts = dst_layouts;
+            vkGetPhysicalDeviceProperties2(vkal_info.physical_device, &properties);
+            for (uint32_t i = 0; i < host_image_copy_properties.copyDstLayoutCount; ++i) {
+                if (dst_layouts[i] == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+                    vkal_info.host_image_copy_supported = 1;
+                }
+            }
+            VKAL_FREE(dst_layouts);
+        }
+    }
+#endif
+
+    /* Dynamic rendering is only used if it is requested, it replaces the default framebuffers. Core in 1.3,
+       VK_KHR_dynamic_rendering before that (eg. MoltenVK on 1.2). A 1.3 device behind a 1.2 instance is 1.2. */
+    vkal_info.dynamic_rendering = 0;
+    int dynamic_rendering_khr = 0;
+    vulkan_features.features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    if (vkal_info.api_version >= VK_API_VERSION_1_3) {
+        VkPhysicalDeviceVulkan13Features device_features13 = { 0 };
+        device_features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        VkPhysicalDeviceFeatures2 features = { 0 };
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &device_features13;
+        vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &features);
+        VKAL_CHECK_FEATURE(vulkan_features.features13.dynamicRendering, device_features13.dynamicRendering);
+        vulkan_features.features13.pNext = vulkan_features.features2.pNext;
+        vulkan_features.features2.pNext = &vulkan_features.features13;
+        vkal_info.dynamic_rendering = vulkan_features.features13.dynamicRendering ? 1 : 0;
+    }
+#ifdef VK_KHR_dynamic_rendering
+    VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features = { 0 };
+    dynamic_rendering_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+    if (!vkal_info.dynamic_rendering && vulkan_features.features13.dynamicRendering &&
+        has_extension(extensions, extension_count, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features = { 0 };
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &dynamic_rendering_features;
+        vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &features);
+        VKAL_CHECK_FEATURE(vulkan_features.features13.dynamicRendering, dynamic_rendering_features.dynamicRendering);
+        dynamic_rendering_features.pNext = vulkan_features.features2.pNext;
+        vulkan_features.features2.pNext = &dynamic_rendering_features;
+        vkal_info.dynamic_rendering = 1;
+        dynamic_rendering_khr = 1;
+    }
+#endif
+    VKAL_CHECK_FEATURE(vulkan_features.features13.dynamicRendering, vkal_info.dynamic_rendering);
+
+    /* Extended dynamic state is enabled as far as the device supports it, see vkal_create_graphics_pipeline2.
+       Cull mode, front face, topology and the depth test are core in 1.3, VK_EXT_extended_dynamic_state below. */
+    vkal_info.dynamic_state_support = 0;
+    int extended_dynamic_state_ext = 0;
+    if (vkal_info.api_version >= VK_API_VERSION_1_3) {
+        vkal_info.dynamic_state_support |= VKAL_DYNAMIC_STATE_CULL_MODE | VKAL_DYNAMIC_STATE_FRONT_FACE |
+            VKAL_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY | VKAL_DYNAMIC_STATE_DEPTH_TEST;
+    }
+#ifdef VK_EXT_extended_dynamic_state
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extended_dynamic_state_features = { 0 };
+    extended_dynamic_state_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+    if (!vkal_info.dynamic_state_support && has_extension(extensions, extension_count, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features = { 0 };
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &extended_dynamic_state_features;
+        vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &features);
+        if (extended_dynamic_state_features.extendedDynamicState) {
+            extended_dynamic_state_features.pNext = vulkan_features.features2.pNext;
+            vulkan_features.features2.pNext = &extended_dynamic_state_features;
+            vkal_info.dynamic_state_support |= VKAL_DYNAMIC_STATE_CULL_MODE | VKAL_DYNAMIC_STATE_FRONT_FACE |
+                VKAL_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY | VKAL_DYNAMIC_STATE_DEPTH_TEST;
+            extended_dynamic_state_ext = 1;
+        }
+    }
+#endif
+#ifdef VK_EXT_extended_dynamic_state3
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extended_dynamic_state3_features = { 0 };
+    extended_dynamic_state3_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+    if (has_extension(extensions, extension_count, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features = { 0 };
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &extended_dynamic_state3_features;
+        vkGetPhysicalDeviceFeatures2(vkal_info.physical_device, &features);
+        if (extended_dynamic_state3_features.extendedDynamicState3PolygonMode) {
+            extended_dynamic_state3_features.pNext = vulkan_features.features2.pNext;
+            vulkan_features.features2.pNext = &extended_dynamic_state3_features;
+            vkal_info.dynamic_state_support |= VKAL_DYNAMIC_STATE_POLYGON_MODE;
+        }
+    }
+#endif
+
+    VkDeviceCreateInfo create_info = { 0 };
+    create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    create_info.pNext = &vulkan_features.features2;
+    create_info.pQueueCreateInfos = queue_create_infos;
+    create_info.queueCreateInfoCount = info_count;
+    create_info.pEnabledFeatures = VKAL_NULL;
+    create_info.enabledExtensionCount = extension_count;
+    create_info.ppEnabledExtensionNames = (const char* const*)extensions;
+
+    VKAL_ASSERT(vkCreateDevice(vkal_info.physical_device, &create_info, 0, &vkal_info.device));
+
+    if (vkal_info.dynamic_rendering) {
+        char const * suffix = dynamic_rendering_khr ? "KHR" : "";
+        cmd_begin_rendering = (PFN_vkCmdBeginRendering)get_device_function("vkCmdBeginRendering", suffix);
+        cmd_end_rendering = (PFN_vkCmdEndRendering)get_device_function("vkCmdEndRendering", suffix);
+    }
+    if (vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_CULL_MODE) {
+        char const * suffix = extended_dynamic_state_ext ? "EXT" : "";
+        cmd_set_cull_mode = (PFN_vkCmdSetCullMode)get_device_function("vkCmdSetCullMode", suffix);
+        cmd_set_front_face = (PFN_vkCmdSetFrontFace)get_device_function("vkCmdSetFrontFace", suffix);
+        cmd_set_primitive_topology = (PFN_vkCmdSetPrimitiveTopology)get_device_function("vkCmdSetPrimitiveTopology", suffix);
+        cmd_set_depth_test_enable = (PFN_vkCmdSetDepthTestEnable)get_device_function("vkCmdSetDepthTestEnable", suffix);
+        cmd_set_depth_write_enable = (PFN_vkCmdSetDepthWriteEnable)get_device_function("vkCmdSetDepthWriteEnable", suffix);
+        cmd_set_depth_compare_op = (PFN_vkCmdSetDepthCompareOp)get_device_function("vkCmdSetDepthCompareOp", suffix);
+    }
+#ifdef VK_EXT_extended_dynamic_state3
+    if (vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_POLYGON_MODE) {
+        cmd_set_polygon_mode = (PFN_vkCmdSetPolygonModeEXT)get_device_function("vkCmdSetPolygonModeEXT", "");
+    }
+#endif
+
+    vkGetDeviceQueue(vkal_info.device, indicies.graphics_family, 0, &vkal_info.graphics_queue);
+    vkGetDeviceQueue(vkal_info.device, indicies.present_family, 0, &vkal_info.present_queue);
+    vkal_info.transfer_queue = VK_NULL_HANDLE;
+    vkal_info.compute_queue = VK_NULL_HANDLE;
+    if (indicies.has_transfer_family) {
+        vkGetDeviceQueue(vkal_info.device, indicies.transfer_family, 0, &vkal_info.transfer_queue);
+
+        uint32_t queue_family_count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(vkal_info.physical_device, &queue_family_count, 0);
+        VkQueueFamilyProperties * queue_families = NULL;
+        VKAL_MALLOC(queue_families, queue_family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(vkal_info.physical_device, &queue_family_count, queue_families);
+        vkal_info.transfer_image_granularity = queue_families[indicies.transfer_family].minImageTransferGranularity;
+        VKAL_FREE(queue_families);
+    }
+    if (indicies.has_compute_family) {
+        vkGetDeviceQueue(vkal_info.device, indicies.compute_family, 0, &vkal_info.compute_queue);
+    }
+    vkal_info.queue_families = indicies;
+
+    vkal_info.host_import_alignment = 0;
+#ifdef VK_EXT_external_memory_host
+    if (has_extension(extensions, extension_count, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+        vkGetMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(vkal_info.device, "vkGetMemoryHostPointerPropertiesEXT");
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_properties = { 0 };
+        host_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties = { 0 };
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &host_properties;
+        vkGetPhysicalDeviceProperties2(vkal_info.physical_device, &properties);
+        if (vkGetMemoryHostPointerProperties) {
+            vkal_info.host_import_alignment = host_properties.minImportedHostPointerAlignment;
+        }
+    }
+#endif
+
+#ifdef VK_EXT_host_image_copy
+    if (vkal_info.host_image_copy_supported) {
+        vkCopyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(vkal_info.device, "vkCopyMemoryToImageEXT");
+        vkTransitionImageLayout = (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(vkal_info.device, "vkTransitionImageLayoutEXT");
+        vkal_info.host_image_copy_supported = vkCopyMemoryToImage && vkTransitionImageLayout;
+    }
+#endif
+    vkal_info.host_image_copy_active = vkal_info.host_image_copy_supported;
+}
+
+void create_shader_module(uint8_t const * shader_byte_code, int size, uint32_t * out_shader_module)
+{
+    VkShaderModuleCreateInfo create_info = { 0 };
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.codeSize = size;
+    create_info.pCode = (uint32_t*)shader_byte_code;
+    uint32_t free_index;
+    for (free_index = 0; free_index < VKAL_MAX_VKSHADERMODULE; ++free_index) {
+		if (vkal_info.user_shader_modules[free_index].used) {
+		} 
+		else break;
+	}
+    VkResult result = vkCreateShaderModule(vkal_info.device, &create_info, 0, &vkal_info.user_shader_modules[free_index].shader_module);
+    VKAL_ASSERT(result && "failed to create shader module!");
+    vkal_info.user_shader_modules[free_index].used = 1;
+    *out_shader_module = free_index;
+}
+
+VkShaderModule get_shader_module(uint32_t id)
+{
+    assert(id < VKAL_MAX_VKSHADERMODULE);
+    assert(vkal_info.user_shader_modules[id].used);
+    return vkal_info.user_shader_modules[id].shader_module;
+}
+
+void destroy_shader_module(uint32_t id)
+{
+    if (vkal_info.user_shader_modules[id].used) {
+	vkDestroyShaderModule(vkal_info.device, get_shader_module(id), 0);
+	vkal_info.user_shader_modules[id].used = 0;
+    }
+}
+
+void create_default_descriptor_pool(void)
+{
+    VkDescriptorPoolSize pool_sizes[] =
+	{
+	    {
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,     // type of the resource
+		1024							           // number of descriptors of that type to be stored in the pool. This is per set maybe?
+	    },
+	    {
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		1024
+	    },
+	    {
+		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		1024 // TODO(Michael): figure out why we must have one additional available even if we're only using two textures!
+	    },
+	    { // for sampling the shadow map
+		VK_DESCRIPTOR_TYPE_SAMPLER,
+		1024
+	    },
+	    {
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		1024
+	    }
+	};
+    
+    VkDescriptorPoolCreateInfo descriptor_pool_info = { 0 };
+    descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptor_pool_info.maxSets = 20; // NOTE: This is an arbitrary number at the moment. We don't _have_ to use all of them.
+    descriptor_pool_info.poolSizeCount = sizeof(pool_sizes)/sizeof(*pool_sizes);
+    descriptor_pool_info.pPoolSizes = pool_sizes;
+    
+    VkResult  result = vkCreateDescriptorPool(vkal_info.device, &descriptor_pool_info, 0, &vkal_info.default_descriptor_pool);
+    VKAL_ASSERT(result && "failed to create descriptor pool!");
+}
+
+
+void create_render_to_image_render_pass(void)
+{
+    VkAttachmentDescription attachments[2];
+    // Color Attachment
+    attachments[0].flags          = 0;
+    attachments[0].format         = vkal_info.swapchain_image_format;
+    attachments[0].samples        = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    // Depth Stencil Attachment
+    attachments[1].flags          = 0;
+    attachments[1].format         = VK_FORMAT_D32_SFLOAT;
+    attachments[1].samples        = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkAttachmentReference color_attachment_refs[] =
+	{
+	    {
+		0, // This is the index into the above array of color_attachments
+		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL // translate layout into a layout so that the GPU can use efficient memory access.
+	    }
+	};
+
+    VkAttachmentReference depth_attachment_ref =
+	{
+	    1,
+	    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	};
+
+    VkSubpassDescription subpasses[1];
+    subpasses[0].flags = 0;
+    subpasses[0].pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[0].inputAttachmentCount    = 0;
+    subpasses[0].pInputAttachments       = 0;
+    subpasses[0].colorAttachmentCount    = 1;
+    subpasses[0].pColorAttachments       = color_attachment_refs;
+    subpasses[0].pResolveAttachments     = 0;
+    subpasses[0].pDepthStencilAttachment = &depth_attachment_ref;
+    subpasses[0].preserveAttachmentCount = 0;
+    subpasses[0].pPreserveAttachments    = 0;
+
+
+    VkSubpassDependency dependency = { 0 };
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // refers to implicit subpass before/after renderpass
+    dependency.dstSubpass = 0; // index into the (only) subpass created above
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo render_pass_info = { 0 };
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = subpasses;
+    render_pass_info.dependencyCount = 1;
+    render_pass_info.pDependencies = &dependency;
+    VkResult result = vkCreateRenderPass(vkal_info.device, &render_pass_info, 0, &vkal_info.render_to_image_render_pass);
+    VKAL_ASSERT(result && "failed to create render pass!");
+}
+
+void create_default_render_pass(void)
+{
+    VkAttachmentDescription attachments[2];
+    // Color Attachment
+    attachments[0].flags          = 0;
+    attachments[0].format         = vkal_info.swapchain_image_format;
+    attachments[0].samples        = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Depth Stencil Attachment
+    attachments[1].flags          = 0;
+    attachments[1].format         = VK_FORMAT_D32_SFLOAT;
+    attachments[1].samples        = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout    = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    
+    VkAttachmentReference color_attachment_refs[] =
+	{
+	    {
+		0, // This is the index into the above array of color_attachments
+		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL // translate layout into a layout so that the GPU can use efficient memory access.
+	    }
+	};
+    
+    VkAttachmentReference depth_attachment_ref =
+	{
+	    1,
+	    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	};
+    
+    VkSubpassDescription subpasses[1];
+    subpasses[0].flags = 0;
+    subpasses[0].pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[0].inputAttachmentCount    = 0;
+    subpasses[0].pInputAttachments       = 0;
+    subpasses[0].colorAttachmentCount    = 1;
+    subpasses[0].pColorAttachments       = color_attachment_refs;
+    subpasses[0].pResolveAttachments     = 0;
+    subpasses[0].pDepthStencilAttachment = &depth_attachment_ref;
+    subpasses[0].preserveAttachmentCount = 0;
+    subpasses[0].pPreserveAttachments    = 0;
+    
+    VkSubpassDependency dependency = { 0 };
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // refers to implicit subpass before/after renderpass
+    dependency.dstSubpass = 0; // index into the (only) subpass created above
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	
     VkRenderPassCreateInfo render_pass_info = { 0 };
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     render_pass_info.attachmentCount = 2;
@@ -1961,936 +4022,2276 @@ void create_render_to_image_render_pass(void)
     render_pass_info.pSubpasses = subpasses;
     render_pass_info.dependencyCount = 1;
     render_pass_info.pDependencies = &dependency;
-    VkResult result = vkCreateRenderPass(vkal_info.device, &render_pass_info, 0, &vkal_info.render_to_image_render_pass);
+    VkResult result = vkCreateRenderPass(vkal_info.device, &render_pass_info, 0, &vkal_info.render_pass);
     VKAL_ASSERT(result && "failed to create render pass!");
+
+}
+
+void create_default_framebuffers(void)
+{
+    // Dynamic rendering begins on the image views, a resize only recreates those.
+    if (vkal_info.dynamic_rendering) {
+        vkal_info.framebuffers = NULL;
+        vkal_info.framebuffer_count = 0;
+        return;
+    }
+
+    VkImageView attachments[2];
+    // The order matches the order of the VkAttachmentDescriptions of the Renderpass.
+    
+    uint32_t framebuffer_count = 0;
+    VKAL_MALLOC(vkal_info.framebuffers, vkal_info.swapchain_image_count);
+
+    for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
+	    attachments[0] = vkal_info.swapchain_image_views[i]; 
+	    attachments[1] = get_image_view(vkal_info.depth_stencil_image_view);
+	    VkFramebufferCreateInfo framebuffer_info = { 0 };
+	    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	    framebuffer_info.renderPass = vkal_info.render_pass;
+	    framebuffer_info.width = vkal_info.swapchain_extent.width;
+	    framebuffer_info.height = vkal_info.swapchain_extent.height;
+	    framebuffer_info.pAttachments = attachments;
+	    framebuffer_info.attachmentCount = 2; // matches the VkAttachmentDescription array-size in renderpass
+	    framebuffer_info.layers = 1;
+	    VkResult result = vkCreateFramebuffer(vkal_info.device, &framebuffer_info, 0, &vkal_info.framebuffers[i]);
+	    VKAL_ASSERT(result && "failed to create framebuffer!");
+	    framebuffer_count++;
+    }
+    vkal_info.framebuffer_count = framebuffer_count;
+}
+
+
+
+uint32_t create_render_image_framebuffer(RenderImage render_image, uint32_t width, uint32_t height)
+{
+    VkImageView attachments[2];
+    attachments[0] = get_image_view(render_image.color_image.image_view);
+    attachments[1] = get_image_view(render_image.depth_image.image_view);
+    VkFramebufferCreateInfo framebuffer_info = { 0 };
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.renderPass = vkal_info.render_to_image_render_pass;
+    framebuffer_info.width = width;
+    framebuffer_info.height = height;
+    framebuffer_info.pAttachments = attachments;
+    framebuffer_info.attachmentCount = 2; // matches the VkAttachmentDescription array-size in renderpass
+    framebuffer_info.layers = 1;
+    uint32_t id;
+    internal_create_framebuffer(framebuffer_info, &id);
+    return id;
+}
+
+void internal_create_framebuffer(VkFramebufferCreateInfo create_info, uint32_t * out_framebuffer)
+{
+    uint32_t free_index;
+    for (free_index = 0; free_index < VKAL_MAX_VKFRAMEBUFFER; ++free_index) {
+	if (vkal_info.user_framebuffers[free_index].used) {
+	    continue;
+	}
+	break;
+    }
+    VkResult result = vkCreateFramebuffer(vkal_info.device, &create_info, 0, &vkal_info.user_framebuffers[free_index].framebuffer);
+    VKAL_ASSERT(result && "failed to create VkFramebuffer!");
+    vkal_info.user_framebuffers[free_index].used = 1;
+    *out_framebuffer = free_index;
+}
+
+VkFramebuffer get_framebuffer(uint32_t id)
+{
+    assert(id < VKAL_MAX_VKFRAMEBUFFER);
+    assert(vkal_info.user_framebuffers[id].used);
+    return vkal_info.user_framebuffers[id].framebuffer;
+}
+
+void destroy_framebuffer(uint32_t id)
+{
+    if (vkal_info.user_framebuffers[id].used) {
+	vkDestroyFramebuffer(vkal_info.device, get_framebuffer(id), 0);
+	vkal_info.user_framebuffers[id].used = 0;
+    }
+}
+
+RenderImage recreate_render_image(RenderImage render_image, uint32_t width, uint32_t height)
+{
+    vkDeviceWaitIdle(vkal_info.device);
+
+    for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
+		if (render_image.framebuffers[i] != VKAL_INVALID_ID) {
+			destroy_framebuffer(render_image.framebuffers[i]);
+		}
+    }
+
+    vkal_destroy_image(render_image.color_image.image);
+    vkal_destroy_image(render_image.depth_image.image);
+
+    vkal_destroy_image_view(render_image.color_image.image_view);
+    vkal_destroy_image_view(render_image.depth_image.image_view);
+
+    RenderImage new_render_image = create_render_image(width, height);
+    return new_render_image;
+}
+
+VkPipelineLayout vkal_create_pipeline_layout(VkDescriptorSetLayout * descriptor_set_layouts, uint32_t descriptor_set_layout_count, VkPushConstantRange * push_constant_ranges, uint32_t push_constant_range_count)
+{
+    uint32_t id;
+    create_pipeline_layout(descriptor_set_layouts, descriptor_set_layout_count,
+			   push_constant_ranges, push_constant_range_count, &id);
+    return get_pipeline_layout(id);
+}
+
+void create_pipeline_layout(
+    VkDescriptorSetLayout * descriptor_set_layouts, uint32_t descriptor_set_layout_count,
+    VkPushConstantRange * push_constant_ranges, uint32_t push_constant_range_count,
+    uint32_t * out_pipeline_layout)
+{
+    VkPipelineLayoutCreateInfo layout_info = { 0 };
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.pSetLayouts = descriptor_set_layouts;
+    layout_info.setLayoutCount = descriptor_set_layout_count;
+    layout_info.pushConstantRangeCount = push_constant_range_count;
+    layout_info.pPushConstantRanges = push_constant_ranges;
+    uint32_t free_index = 0;
+    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINELAYOUT; ++free_index) {
+		if (vkal_info.user_pipeline_layouts[free_index].used) {
+
+		}
+		else 
+			break;
+    }
+    VkResult result = vkCreatePipelineLayout(vkal_info.device, &layout_info, 0, &vkal_info.user_pipeline_layouts[free_index].pipeline_layout);
+    VKAL_ASSERT(result && "failed to create pipeline layout!");
+    vkal_info.user_pipeline_layouts[free_index].used = 1;
+    *out_pipeline_layout = free_index;
+}
+
+void destroy_pipeline_layout(uint32_t id)
+{
+    if (vkal_info.user_pipeline_layouts[id].used) {
+		vkDestroyPipelineLayout(vkal_info.device, get_pipeline_layout(id), 0);
+		vkal_info.user_pipeline_layouts[id].used = 0;
+    }
+}
+
+VkPipelineLayout get_pipeline_layout(uint32_t id)
+{
+    assert(id < VKAL_MAX_VKPIPELINELAYOUT);
+    assert(vkal_info.user_pipeline_layouts[id].used);
+    return vkal_info.user_pipeline_layouts[id].pipeline_layout;
+}
+
+void vkal_allocate_descriptor_sets(VkDescriptorPool pool,
+				   VkDescriptorSetLayout * layout, uint32_t layout_count,
+				   VkDescriptorSet ** out_descriptor_set)
+{
+    VkDescriptorSetAllocateInfo allocate_info = { 0 };
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = pool;
+    allocate_info.pSetLayouts = layout;
+    allocate_info.descriptorSetCount = layout_count;
+    VkResult result = vkAllocateDescriptorSets(vkal_info.device, &allocate_info, *out_descriptor_set);
+    VKAL_ASSERT(result && "failed to allocate descriptor set(s)!");    
+}
+
+SingleShaderStageSetup vkal_create_shader(const uint8_t* shader_byte_code, uint32_t shader_byte_code_size, VkShaderStageFlagBits shader_stage_flag_bits)
+{
+    SingleShaderStageSetup shader_setup = { 0 };
+    create_shader_module(shader_byte_code, shader_byte_code_size, &shader_setup.module);
+
+    shader_setup.create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_setup.create_info.stage = shader_stage_flag_bits;
+    shader_setup.create_info.module = get_shader_module(shader_setup.module);
+    shader_setup.create_info.pName = "main";
+
+    return shader_setup;
+}
+
+ShaderStageSetup vkal_create_shaders(
+    const uint8_t * vertex_shader_code, uint32_t vertex_shader_code_size, 
+    const uint8_t * fragment_shader_code, uint32_t fragment_shader_code_size,
+    const uint8_t * geometry_shader_code, uint32_t geometry_shader_code_size)
+{
+    ShaderStageSetup shader_setup = { 0 };
+
+    SingleShaderStageSetup vertex_shader_setup   = vkal_create_shader(vertex_shader_code, vertex_shader_code_size, VK_SHADER_STAGE_VERTEX_BIT);
+    shader_setup.vertex_shader_create_info = vertex_shader_setup.create_info;
+    shader_setup.vertex_shader_module = vertex_shader_setup.module;
+
+    SingleShaderStageSetup fragment_shader_setup = vkal_create_shader(fragment_shader_code, fragment_shader_code_size, VK_SHADER_STAGE_FRAGMENT_BIT);
+    shader_setup.fragment_shader_create_info = fragment_shader_setup.create_info;
+    shader_setup.fragment_shader_module = fragment_shader_setup.module;
+    
+
+    if (geometry_shader_code) {
+        SingleShaderStageSetup geometry_shader_setup = vkal_create_shader(geometry_shader_code, geometry_shader_code_size, VK_SHADER_STAGE_GEOMETRY_BIT);
+        shader_setup.geometry_shader_create_info = geometry_shader_setup.create_info;
+        shader_setup.geometry_shader_module = geometry_shader_setup.module;
+    }
+
+    return shader_setup;
+}
+
+VkPipelineShaderStageCreateInfo create_shader_stage_info(VkShaderModule module, VkShaderStageFlagBits shader_stage_flag_bits)
+{
+    VkPipelineShaderStageCreateInfo shader_stage_info = { 0 };
+    shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage_info.stage = shader_stage_flag_bits;
+    shader_stage_info.module = module;
+    shader_stage_info.pName = "main";
+    return shader_stage_info;
+}
+
+VkDescriptorSetLayout vkal_create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count)
+{
+    uint32_t id;
+    create_descriptor_set_layout(layout, binding_count, &id);
+    return get_descriptor_set_layout(id);
+}
+
+void create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count, uint32_t * out_descriptor_set_layout)
+{
+    DescriptorSetLayout set_layout = { 0 };
+    VkDescriptorSetLayoutCreateInfo info = { 0 };
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    info.bindingCount = binding_count;
+    info.pBindings = layout;
+    uint32_t free_index;
+    for (free_index = 0; free_index < VKAL_MAX_VKDESCRIPTORSETLAYOUT; ++free_index) {
+        if (vkal_info.user_descriptor_set_layouts[free_index].used) {
+
+        }
+        else break;
+    }
+    VkResult result = vkCreateDescriptorSetLayout(vkal_info.device, &info, 0, &vkal_info.user_descriptor_set_layouts[free_index].descriptor_set_layout);
+    VKAL_ASSERT(result && "failed to create descriptor set layout(s)!");
+    vkal_info.user_descriptor_set_layouts[free_index].used = 1;
+    *out_descriptor_set_layout = free_index;
+}
+
+VkDescriptorSetLayout get_descriptor_set_layout(uint32_t id)
+{
+    assert(id < VKAL_MAX_VKDESCRIPTORSETLAYOUT);
+    assert(vkal_info.user_descriptor_set_layouts[id].used);
+    return vkal_info.user_descriptor_set_layouts[id].descriptor_set_layout;
+}
+
+void destroy_descriptor_set_layout(uint32_t id)
+{
+    if (vkal_info.user_descriptor_set_layouts[id].used) {
+	vkDestroyDescriptorSetLayout(vkal_info.device, get_descriptor_set_layout(id), 0);
+	vkal_info.user_descriptor_set_layouts[id].used = 0;
+    }
+}
+
+void vkal_destroy_graphics_pipeline(VkPipeline pipeline)
+{
+    vkDestroyPipeline(vkal_info.device, pipeline, 0);
+}
+
+void vkal_set_clear_color(VkClearColorValue value)
+{
+    vkal_info.clear_color_value = value;
+}
+
+VkPipeline vkal_create_graphics_pipeline(
+	VkVertexInputBindingDescription * vertex_input_bindings, 
+	uint32_t vertex_input_binding_count,
+	VkVertexInputAttributeDescription * vertex_attributes, 
+	uint32_t vertex_attribute_count,
+	ShaderStageSetup shader_setup, 
+    VkBool32 depth_test_enable, 
+	VkCompareOp depth_compare_op, 
+    VkCullModeFlags cull_mode,
+    VkPolygonMode polygon_mode,
+    VkPrimitiveTopology primitive_topology,
+    VkFrontFace face_winding, 
+	VkRenderPass render_pass,
+	VkPipelineLayout pipeline_layout)
+{
+    return vkal_create_graphics_pipeline2(vertex_input_bindings, vertex_input_binding_count, vertex_attributes, vertex_attribute_count,
+        shader_setup, depth_test_enable, depth_compare_op, cull_mode, polygon_mode, primitive_topology, face_winding,
+        render_pass, pipeline_layout, 0);
+}
+
+/* Like vkal_create_graphics_pipeline, but the states in dynamic_states are left dynamic. Their values are ignored,
+   except that primitive_topology picks the topology class. One pipeline then replaces all permutations of those
+   states. Set them with the vkal_set_* helpers after binding it. */
+VkPipeline vkal_create_graphics_pipeline2(
+	VkVertexInputBindingDescription * vertex_input_bindings,
+	uint32_t vertex_input_binding_count,
+	VkVertexInputAttributeDescription * vertex_attributes,
+	uint32_t vertex_attribute_count,
+	ShaderStageSetup shader_setup,
+	VkBool32 depth_test_enable,
+	VkCompareOp depth_compare_op,
+	VkCullModeFlags cull_mode,
+	VkPolygonMode polygon_mode,
+	VkPrimitiveTopology primitive_topology,
+	VkFrontFace face_winding,
+	VkRenderPass render_pass,
+	VkPipelineLayout pipeline_layout,
+	VkalDynamicStateFlags dynamic_states)
+{
+    assert((dynamic_states & ~vkal_info.dynamic_state_support) == 0 && "dynamic state not supported by the device");
+    VkPipelineShaderStageCreateInfo shader_stages_infos[3] = { 0 };
+    shader_stages_infos[0] = shader_setup.vertex_shader_create_info;
+    shader_stages_infos[1] = shader_setup.fragment_shader_create_info;
+    uint32_t num_shader_stages = 2;
+    if (shader_setup.geometry_shader_create_info.stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
+        num_shader_stages = 3;
+        shader_stages_infos[2] = shader_setup.geometry_shader_create_info;
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_info = {0};
+    vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_info.vertexBindingDescriptionCount = vertex_input_binding_count;
+    vertex_input_info.pVertexBindingDescriptions = vertex_input_bindings;
+    vertex_input_info.vertexAttributeDescriptionCount = vertex_attribute_count;
+    vertex_input_info.pVertexAttributeDescriptions = vertex_attributes;
+    //
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {0};
+    input_assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly_info.topology = primitive_topology;
+    input_assembly_info.primitiveRestartEnable = VK_FALSE;
+    
+    VkViewport viewport = {0};
+    viewport.x        = 0.f;
+    viewport.y        = 0.f;
+    viewport.width    = (float)vkal_info.swapchain_extent.width;
+    viewport.height   = (float)vkal_info.swapchain_extent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+    VkRect2D scissor = {0};
+    scissor.offset = (VkOffset2D){ 0,0 };
+    scissor.extent = vkal_info.swapchain_extent;
+    VkPipelineViewportStateCreateInfo viewport_state = {0};
+    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.pViewports = &viewport;
+    viewport_state.viewportCount = 1;
+    viewport_state.pScissors = &scissor;
+    viewport_state.scissorCount = 1;
+    
+    VkPipelineRasterizationStateCreateInfo rasterizer_info = {0};
+    rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer_info.frontFace = face_winding;
+    rasterizer_info.cullMode = cull_mode;
+    rasterizer_info.polygonMode = polygon_mode;
+    rasterizer_info.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer_info.depthClampEnable = VK_FALSE;
+    rasterizer_info.depthBiasEnable = VK_FALSE;
+    rasterizer_info.lineWidth = 1.0f;
+    
+    // COME BACK LATER: Set up depth/stencil testing (we need to create a buffer for that as it is
+    // not created with the Swapchain
+    
+    VkPipelineColorBlendAttachmentState color_blend_attachment = {0};
+    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable = VK_TRUE;
+    
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+
+    VkPipelineColorBlendStateCreateInfo color_blending_info = { 0 };
+    color_blending_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blending_info.logicOpEnable = VK_FALSE; // enabling this will set color_blend_attachment.blendEnable to VK_FALSE!    
+    color_blending_info.pAttachments = &color_blend_attachment;
+    color_blending_info.attachmentCount = 1; // must match the attachment count of render subpass!
+    // it affects ALL framebuffers
+    
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_info = { 0 };
+    depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil_info.depthTestEnable = depth_test_enable;
+    depth_stencil_info.depthCompareOp = depth_compare_op;
+    depth_stencil_info.depthWriteEnable = VK_TRUE;
+    depth_stencil_info.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil_info.stencilTestEnable = VK_FALSE;
+    depth_stencil_info.back.failOp = VK_STENCIL_OP_KEEP;
+    depth_stencil_info.back.passOp = VK_STENCIL_OP_KEEP;
+    depth_stencil_info.back.compareOp = depth_compare_op;
+    depth_stencil_info.back.compareMask = 0;
+    depth_stencil_info.back.reference = 0;
+    depth_stencil_info.back.depthFailOp = VK_STENCIL_OP_KEEP;
+    depth_stencil_info.back.writeMask = 0;
+    depth_stencil_info.front = depth_stencil_info.back;
+    
+    VkPipelineMultisampleStateCreateInfo ms_info = { 0 };
+    ms_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    ms_info.sampleShadingEnable = VK_FALSE;
+    ms_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; // must match renderpass's color attachment
+    
+    // dynamic state will force us to provide viewport dimensions and linewidth at drawing-time
+    VkDynamicState vk_dynamic_states[10] = {
+	VK_DYNAMIC_STATE_VIEWPORT,
+	VK_DYNAMIC_STATE_SCISSOR,
+    };
+    uint32_t dynamic_state_count = 2;
+    if (dynamic_states & VKAL_DYNAMIC_STATE_CULL_MODE) {
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_CULL_MODE;
+    }
+    if (dynamic_states & VKAL_DYNAMIC_STATE_FRONT_FACE) {
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_FRONT_FACE;
+    }
+    if (dynamic_states & VKAL_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY) {
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY;
+    }
+    if (dynamic_states & VKAL_DYNAMIC_STATE_DEPTH_TEST) {
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE;
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE;
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_DEPTH_COMPARE_OP;
+    }
+#ifdef VK_EXT_extended_dynamic_state3
+    if (dynamic_states & VKAL_DYNAMIC_STATE_POLYGON_MODE) {
+        vk_dynamic_states[dynamic_state_count++] = VK_DYNAMIC_STATE_POLYGON_MODE_EXT;
+    }
+#endif
+    VkPipelineDynamicStateCreateInfo dynamic_state_info = { 0 };
+    dynamic_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state_info.pDynamicStates = vk_dynamic_states;
+    dynamic_state_info.dynamicStateCount = dynamic_state_count;
+    
+    VkGraphicsPipelineCreateInfo pipeline_info = { 0 };
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.stageCount = num_shader_stages;
+    pipeline_info.pStages = shader_stages_infos;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly_info;
+    pipeline_info.pViewportState = &viewport_state;
+    pipeline_info.pRasterizationState = &rasterizer_info;
+    pipeline_info.pMultisampleState = &ms_info;
+    pipeline_info.pColorBlendState = &color_blending_info;
+    pipeline_info.pDepthStencilState = &depth_stencil_info;
+    pipeline_info.pDynamicState = &dynamic_state_info;
+    pipeline_info.layout = pipeline_layout;
+    pipeline_info.renderPass = render_pass;
+    pipeline_info.subpass = 0;
+
+    // With dynamic rendering the default render passes only stand for their attachment formats. Both have the
+    // same ones, so one pipeline draws into the swapchain image as well as into render images.
+    VkPipelineRenderingCreateInfo rendering_info = { 0 };
+    if (vkal_info.dynamic_rendering && (render_pass == VK_NULL_HANDLE || render_pass == vkal_info.render_pass ||
+        render_pass == vkal_info.render_to_image_render_pass)) {
+        rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        rendering_info.colorAttachmentCount = 1;
+        rendering_info.pColorAttachmentFormats = &vkal_info.swapchain_image_format;
+        rendering_info.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
+        pipeline_info.pNext = &rendering_info;
+        pipeline_info.renderPass = VK_NULL_HANDLE;
+    }
+    
+    uint32_t id;
+    create_graphics_pipeline(pipeline_info, &id);
+    return get_graphics_pipeline(id);
+}
+
+/* The vkal_set_* helpers record state that pipelines of vkal_create_graphics_pipeline2 leave dynamic. */
+void vkal_set_cull_mode(VkCommandBuffer command_buffer, VkCullModeFlags cull_mode)
+{
+    assert((vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_CULL_MODE) && "extended dynamic state is not supported");
+    cmd_set_cull_mode(command_buffer, cull_mode);
+}
+
+void vkal_set_front_face(VkCommandBuffer command_buffer, VkFrontFace face_winding)
+{
+    assert((vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_FRONT_FACE) && "extended dynamic state is not supported");
+    cmd_set_front_face(command_buffer, face_winding);
+}
+
+void vkal_set_primitive_topology(VkCommandBuffer command_buffer, VkPrimitiveTopology primitive_topology)
+{
+    assert((vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY) && "extended dynamic state is not supported");
+    cmd_set_primitive_topology(command_buffer, primitive_topology);
+}
+
+void vkal_set_depth_test(VkCommandBuffer command_buffer, VkBool32 depth_test_enable, VkBool32 depth_write_enable, VkCompareOp depth_compare_op)
+{
+    assert((vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_DEPTH_TEST) && "extended dynamic state is not supported");
+    cmd_set_depth_test_enable(command_buffer, depth_test_enable);
+    cmd_set_depth_write_enable(command_buffer, depth_write_enable);
+    cmd_set_depth_compare_op(command_buffer, depth_compare_op);
+}
+
+void vkal_set_polygon_mode(VkCommandBuffer command_buffer, VkPolygonMode polygon_mode)
+{
+    assert((vkal_info.dynamic_state_support & VKAL_DYNAMIC_STATE_POLYGON_MODE) && "VK_EXT_extended_dynamic_state3 is not enabled");
+#ifdef VK_EXT_extended_dynamic_state3
+    cmd_set_polygon_mode(command_buffer, polygon_mode);
+#else
+    assert(0 && "vkal_set_polygon_mode: vkal was built without VK_EXT_extended_dynamic_state3!");
+    (void)command_buffer;
+    (void)polygon_mode;
+#endif
+}
+
+void create_graphics_pipeline(VkGraphicsPipelineCreateInfo create_info, uint32_t * out_graphics_pipeline)
+{
+    uint32_t free_index;
+    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINE; ++free_index) {
+	if (vkal_info.user_pipelines[free_index].used) {
+
+	}
+	else break;
+    }
+    VkResult result = vkCreateGraphicsPipelines(vkal_info.device, VK_NULL_HANDLE, 1, &create_info, 0, &vkal_info.user_pipelines[free_index].pipeline);
+    VKAL_ASSERT(result && "failed to create graphics pipeline!");
+    vkal_info.user_pipelines[free_index].used = 1;
+    *out_graphics_pipeline = free_index;
+}
+
+VkPipeline get_graphics_pipeline(uint32_t id)
+{
+    assert(id < VKAL_MAX_VKPIPELINE);
+    assert(vkal_info.user_pipelines[id].used);
+    return vkal_info.user_pipelines[id].pipeline;
+}
+
+void destroy_graphics_pipeline(uint32_t id)
+{
+    if (vkal_info.user_pipelines[id].used) {
+		vkDestroyPipeline(vkal_info.device, get_graphics_pipeline(id), 0);
+		vkal_info.user_pipelines[id].used = 0;
+    }
+}
+
+/* Compute pipelines live in the same table as the graphics pipelines and are destroyed with them in vkal_cleanup.
+   The shader module stays alive until then as well, like the ones from vkal_create_shaders. */
+VkPipeline vkal_create_compute_pipeline(SingleShaderStageSetup shader_setup, VkPipelineLayout pipeline_layout)
+{
+    VkComputePipelineCreateInfo pipeline_info = { 0 };
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage = shader_setup.create_info;
+    pipeline_info.layout = pipeline_layout;
+
+    uint32_t id;
+    create_compute_pipeline(pipeline_info, &id);
+    return get_compute_pipeline(id);
+}
+
+void create_compute_pipeline(VkComputePipelineCreateInfo create_info, uint32_t * out_compute_pipeline)
+{
+    uint32_t free_index;
+    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINE; ++free_index) {
+	if (!vkal_info.user_pipelines[free_index].used) break;
+    }
+    assert(free_index < VKAL_MAX_VKPIPELINE && "no free pipeline handle left");
+    VkResult result = vkCreateComputePipelines(vkal_info.device, VK_NULL_HANDLE, 1, &create_info, 0, &vkal_info.user_pipelines[free_index].pipeline);
+    VKAL_ASSERT(result && "failed to create compute pipeline!");
+    vkal_info.user_pipelines[free_index].used = 1;
+    *out_compute_pipeline = free_index;
 }
 
-void create_default_render_pass(void)
+VkPipeline get_compute_pipeline(uint32_t id)
 {
-    VkAttachmentDescription attachments[2];
-    // Color Attachment
-    attachments[0].flags          = 0;
-    attachments[0].format         = vkal_info.swapchain_image_format;
-    attachments[0].samples        = VK_SAMPLE_COUNT_1_BIT;
-    attachments[0].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[0].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[0].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[0].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[0].finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    // Depth Stencil Attachment
-    attachments[1].flags          = 0;
-    attachments[1].format         = VK_FORMAT_D32_SFLOAT;
-    attachments[1].samples        = VK_SAMPLE_COUNT_1_BIT;
-    attachments[1].loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[1].storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[1].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[1].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[1].finalLayout    = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    
-    VkAttachmentReference color_attachment_refs[] =
-	{
-	    {
-		0, // This is the index into the above array of color_attachments
-		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL // translate layout into a layout so that the GPU can use efficient memory access.
-	    }
-	};
-    
-    VkAttachmentReference depth_attachment_ref =
-	{
-	    1,
-	    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-	};
-    
-    VkSubpassDescription subpasses[1];
-    subpasses[0].flags = 0;
-    subpasses[0].pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpasses[0].inputAttachmentCount    = 0;
-    subpasses[0].pInputAttachments       = 0;
-    subpasses[0].colorAttachmentCount    = 1;
-    subpasses[0].pColorAttachments       = color_attachment_refs;
-    subpasses[0].pResolveAttachments     = 0;
-    subpasses[0].pDepthStencilAttachment = &depth_attachment_ref;
-    subpasses[0].preserveAttachmentCount = 0;
-    subpasses[0].pPreserveAttachments    = 0;
-    
-    VkSubpassDependency dependency = { 0 };
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // refers to implicit subpass before/after renderpass
-    dependency.dstSubpass = 0; // index into the (only) subpass created above
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    return get_graphics_pipeline(id);
+}
+
+void destroy_compute_pipeline(uint32_t id)
+{
+    destroy_graphics_pipeline(id);
+}
+
+/* Also frees the handle, so vkal_cleanup does not destroy the pipeline a second time. */
+void vkal_destroy_compute_pipeline(VkPipeline pipeline)
+{
+    for (uint32_t i = 0; i < VKAL_MAX_VKPIPELINE; ++i) {
+	if (vkal_info.user_pipelines[i].used && vkal_info.user_pipelines[i].pipeline == pipeline) {
+	    destroy_compute_pipeline(i);
+	    return;
+	}
+    }
+    vkDestroyPipeline(vkal_info.device, pipeline, 0);
+}
+
+VkWriteDescriptorSet create_write_descriptor_set_image(VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
+                                                       uint32_t count, VkDescriptorType type, VkDescriptorImageInfo * image_info)
+{
+    VkWriteDescriptorSet write_set = { 0 };
+    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_set.dstSet = dst_descriptor_set;
+    write_set.dstBinding = dst_binding;
+    write_set.descriptorCount = count;
+    write_set.descriptorType = type;
+    write_set.pImageInfo = image_info;
 	
-    VkRenderPassCreateInfo render_pass_info = { 0 };
-    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount = 2;
-    render_pass_info.pAttachments = attachments;
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = subpasses;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
-    VkResult result = vkCreateRenderPass(vkal_info.device, &render_pass_info, 0, &vkal_info.render_pass);
-    VKAL_ASSERT(result && "failed to create render pass!");
+    return write_set;
+}
+
+VkWriteDescriptorSet create_write_descriptor_set_image2(VkDescriptorSet dst_descriptor_set,
+							uint32_t dst_binding, uint32_t array_element,
+							uint32_t count,
+							VkDescriptorType type, VkDescriptorImageInfo * image_info)
+{
+    VkWriteDescriptorSet write_set = { 0 };
+    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_set.dstSet = dst_descriptor_set;
+    write_set.dstBinding = dst_binding;
+    write_set.descriptorCount = count;
+    write_set.descriptorType = type;
+    write_set.pImageInfo = image_info;
+    write_set.dstArrayElement = array_element;
 
+    return write_set;
 }
 
-void create_default_framebuffers(void)
+VkWriteDescriptorSet create_write_descriptor_set_buffer(
+	VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
+    uint32_t count, VkDescriptorType type, VkDescriptorBufferInfo * buffer_info)
 {
-    VkImageView attachments[2];
-    // The order matches the order of the VkAttachmentDescriptions of the Renderpass.
+    VkWriteDescriptorSet write_set = { 0 };
+    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_set.dstSet = dst_descriptor_set;
+    write_set.dstBinding = dst_binding;
+    write_set.descriptorCount = count;
+    write_set.descriptorType = type;
+    write_set.pBufferInfo = buffer_info;
     
-    uint32_t framebuffer_count = 0;
-    VKAL_MALLOC(vkal_info.framebuffers, vkal_info.swapchain_image_count);
+    return write_set;
+}
 
-    for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
-	    attachments[0] = vkal_info.swapchain_image_views[i]; 
-	    attachments[1] = get_image_view(vkal_info.depth_stencil_image_view);
-	    VkFramebufferCreateInfo framebuffer_info = { 0 };
-	    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	    framebuffer_info.renderPass = vkal_info.render_pass;
-	    framebuffer_info.width = vkal_info.swapchain_extent.width;
-	    framebuffer_info.height = vkal_info.swapchain_extent.height;
-	    framebuffer_info.pAttachments = attachments;
-	    framebuffer_info.attachmentCount = 2; // matches the VkAttachmentDescription array-size in renderpass
-	    framebuffer_info.layers = 1;
-	    VkResult result = vkCreateFramebuffer(vkal_info.device, &framebuffer_info, 0, &vkal_info.framebuffers[i]);
-	    VKAL_ASSERT(result && "failed to create framebuffer!");
-	    framebuffer_count++;
+VkWriteDescriptorSet create_write_descriptor_set_buffer2(VkDescriptorSet dst_descriptor_set, uint32_t dst_binding, uint32_t dst_array_element,
+							 uint32_t count, VkDescriptorType type, VkDescriptorBufferInfo * buffer_info)
+{
+    VkWriteDescriptorSet write_set = { 0 };
+    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_set.dstSet = dst_descriptor_set;
+    write_set.dstBinding = dst_binding;
+    write_set.dstArrayElement = dst_array_element;
+    write_set.descriptorCount = count;
+    write_set.descriptorType = type;
+    write_set.pBufferInfo = buffer_info;
+
+    return write_set;
+}
+
+void create_default_command_pool(void)
+{
+    VkCommandPoolCreateInfo cmdpool_info = { 0 };
+    cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    
+    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    if (indicies.has_graphics_family && indicies.has_present_family) {
+		if (indicies.graphics_family != indicies.present_family) {
+			cmdpool_info.queueFamilyIndex = indicies.graphics_family;
+			VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.default_command_pools[0]);
+			VKAL_ASSERT(result && "failed to create command pool for graphics family");
+            
+			cmdpool_info.queueFamilyIndex = indicies.present_family;
+			result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.default_command_pools[1]);
+			VKAL_ASSERT(result && "failed to create command pool for present family");
+			vkal_info.default_commandpool_count = 2;
+		}
+		else {
+			cmdpool_info.queueFamilyIndex = indicies.graphics_family;
+			VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.default_command_pools[0]);
+			VKAL_ASSERT(result && "failed to create command pool for both present and graphics families");
+			vkal_info.default_commandpool_count = 1;
+		}
     }
-    vkal_info.framebuffer_count = framebuffer_count;
+	else {
+		printf("[VKAL] no graphics and present queues available!\n");
+		getchar();
+		exit(-1);
+	}
+}
+
+VkCommandBuffer vkal_create_command_buffer(VkCommandBufferLevel cmd_buffer_level, uint32_t begin)
+{
+    VkCommandBufferAllocateInfo alloc_info = { 0 };
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = vkal_info.default_command_pools[0];
+    alloc_info.level = cmd_buffer_level;
+    alloc_info.commandBufferCount = 1;
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkResult result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &command_buffer);
+    VKAL_ASSERT(result && "Failed to allocate command buffer from pool");
+
+    if (begin) {
+		VkCommandBufferBeginInfo begin_info = {0};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        result = vkBeginCommandBuffer(command_buffer, &begin_info);
+		VKAL_ASSERT(result && "Failed to begin command buffer recording");
+    }
+
+    return command_buffer;
+}
+
+/* The command buffer the image_id based helpers record into. While a frame context is active that is
+   the context's command buffer, otherwise the default command buffer of the swapchain image. */
+static VkCommandBuffer image_command_buffer(uint32_t image_id)
+{
+    if (vkal_info.frame_active && vkal_info.frames[vkal_info.frame_index].image_id == image_id) {
+        return vkal_info.frames[vkal_info.frame_index].command_buffer;
+    }
+    return vkal_info.default_command_buffers[image_id];
+}
+
+/* The state cache of command_buffer, NULL if vkal does not know the command buffer. The thread command buffers
+   are created with the frame context and never written while recording, and worker threads only ever find their
+   own secondary's state here, so this is safe to call while recording in parallel. */
+static VkalCommandState * command_state(VkCommandBuffer command_buffer)
+{
+    if (!vkal_info.state_cache_enabled) {
+        return NULL;
+    }
+    if (vkal_info.frame_active) {
+        VkalFrameContext * frame = &vkal_info.frames[vkal_info.frame_index];
+        if (frame->command_buffer == command_buffer) {
+            return &frame->state;
+        }
+        for (uint32_t t = 0; t < VKAL_MAX_RECORD_THREADS; ++t) {
+            if (frame->thread_command_buffers[t] == command_buffer) {
+                return &frame->thread_states[t];
+            }
+        }
+    }
+    uint32_t count = VKAL_MIN(vkal_info.default_command_buffer_count, VKAL_MAX_SWAPCHAIN_IMAGES);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (vkal_info.default_command_buffers[i] == command_buffer) {
+            return &vkal_info.default_command_states[i];
+        }
+    }
+    return NULL;
+}
+
+/* Turns skipping of redundant binds on or off, eg. to measure what it saves. On by default. */
+void vkal_use_state_cache(int enable)
+{
+    vkal_info.state_cache_enabled = enable ? 1 : 0;
+    memset(vkal_info.default_command_states, 0, sizeof(vkal_info.default_command_states));
+    for (uint32_t i = 0; i < vkal_info.frame_count; ++i) {
+        memset(&vkal_info.frames[i].state, 0, sizeof(VkalCommandState));
+        memset(vkal_info.frames[i].thread_states, 0, sizeof(vkal_info.frames[i].thread_states));
+    }
+}
+
+/* Forget what was bound in command_buffer. Needed after binding pipelines, buffers or descriptor sets without
+   the vkal helpers, and after vkCmdExecuteCommands, which leaves the state of the primary undefined. */
+void vkal_invalidate_state(VkCommandBuffer command_buffer)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state) {
+        memset(state, 0, sizeof(VkalCommandState));
+    }
+}
+
+static void bind_pipeline(VkCommandBuffer command_buffer, VkPipeline pipeline)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state) {
+        if (state->pipeline == pipeline) return;
+        state->pipeline = pipeline;
+        // Pipelines without dynamic viewport or scissor overwrite them.
+        state->viewport_valid = 0;
+        state->scissor_valid = 0;
+    }
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+}
+
+static void bind_index_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, VkIndexType index_type)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state) {
+        if (state->index_buffer == buffer && state->index_offset == offset && state->index_type == index_type) return;
+        state->index_buffer = buffer;
+        state->index_offset = offset;
+        state->index_type = index_type;
+    }
+    vkCmdBindIndexBuffer(command_buffer, buffer, offset, index_type);
+}
+
+static void bind_vertex_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state) {
+        if (state->vertex_buffer == buffer && state->vertex_offset == offset) return;
+        state->vertex_buffer = buffer;
+        state->vertex_offset = offset;
+    }
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &buffer, &offset);
+}
+
+/* Sets bound with dynamic offsets are never skipped, the offsets usually change from draw to draw. */
+static void bind_descriptor_sets(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout,
+    uint32_t first_set, uint32_t set_count, VkDescriptorSet const * descriptor_sets,
+    uint32_t dynamic_offset_count, uint32_t const * dynamic_offsets)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state && first_set + set_count <= VKAL_MAX_CACHED_DESCRIPTOR_SETS) {
+        int same = dynamic_offset_count == 0 && state->pipeline_layout == pipeline_layout;
+        for (uint32_t i = 0; i < set_count && same; ++i) {
+            same = state->descriptor_sets[first_set + i] == descriptor_sets[i];
+        }
+        if (same) return;
+        if (state->pipeline_layout != pipeline_layout) {
+            memset(state->descriptor_sets, 0, sizeof(state->descriptor_sets));
+            state->pipeline_layout = pipeline_layout;
+        }
+        for (uint32_t i = 0; i < set_count; ++i) {
+            state->descriptor_sets[first_set + i] = dynamic_offset_count ? VK_NULL_HANDLE : descriptor_sets[i];
+        }
+    }
+    else if (state) {
+        state->pipeline_layout = VK_NULL_HANDLE;
+    }
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout,
+        first_set, set_count, descriptor_sets, dynamic_offset_count, dynamic_offsets);
+}
+
+void create_default_command_buffers(void)
+{
+    // One per swapchain image, there are no default framebuffers with dynamic rendering.
+    VKAL_MALLOC(vkal_info.default_command_buffers, vkal_info.swapchain_image_count);
+	vkal_info.default_command_buffer_count = vkal_info.swapchain_image_count;
+	VkCommandBufferAllocateInfo allocate_info = { 0 };
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.commandBufferCount = vkal_info.default_command_buffer_count;
+	allocate_info.commandPool = vkal_info.default_command_pools[0]; // NOTE: What if present and graphics queue are not from the same family?
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	vkAllocateCommandBuffers(vkal_info.device, &allocate_info, vkal_info.default_command_buffers); 
 }
 
-
-
-uint32_t create_render_image_framebuffer(RenderImage render_image, uint32_t width, uint32_t height)
+/* The rendering scope of command_buffer, a free one if create is set. */
+static VkalRenderingScope * rendering_scope(VkCommandBuffer command_buffer, int create)
 {
-    VkImageView attachments[2];
-    attachments[0] = get_image_view(render_image.color_image.image_view);
-    attachments[1] = get_image_view(render_image.depth_image.image_view);
-    VkFramebufferCreateInfo framebuffer_info = { 0 };
-    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebuffer_info.renderPass = vkal_info.render_to_image_render_pass;
-    framebuffer_info.width = width;
-    framebuffer_info.height = height;
-    framebuffer_info.pAttachments = attachments;
-    framebuffer_info.attachmentCount = 2; // matches the VkAttachmentDescription array-size in renderpass
-    framebuffer_info.layers = 1;
-    uint32_t id;
-    internal_create_framebuffer(framebuffer_info, &id);
-    return id;
+    VkalRenderingScope * free_scope = NULL;
+    for (uint32_t i = 0; i < VKAL_MAX_RENDERING_SCOPES; ++i) {
+        VkalRenderingScope * scope = &vkal_info.rendering_scopes[i];
+        if (scope->command_buffer == command_buffer) {
+            return scope;
+        }
+        if (!free_scope && scope->command_buffer == VK_NULL_HANDLE) {
+            free_scope = scope;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    assert(free_scope && "too many command buffers are rendering at the same time");
+    memset(free_scope, 0, sizeof(VkalRenderingScope));
+    free_scope->command_buffer = command_buffer;
+    return free_scope;
+}
+
+static void begin_rendering(VkCommandBuffer command_buffer, VkImageView * color_views, uint32_t color_view_count, VkImageView depth_view,
+    VkExtent2D extent, VkAttachmentLoadOp load_op, VkRenderingFlags flags)
+{
+    assert(vkal_info.dynamic_rendering && "request features13.dynamicRendering in vkal_init");
+    VkRenderingAttachmentInfo color_attachments[8] = { 0 };
+    assert(color_view_count <= VKAL_ARRAY_LENGTH(color_attachments));
+    for (uint32_t i = 0; i < color_view_count; ++i) {
+        color_attachments[i].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        color_attachments[i].imageView = color_views[i];
+        color_attachments[i].imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        color_attachments[i].loadOp = load_op;
+        color_attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        color_attachments[i].clearValue.color = vkal_info.clear_color_value;
+    }
+    VkRenderingAttachmentInfo depth_attachment = { 0 };
+    depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depth_attachment.imageView = depth_view;
+    depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depth_attachment.loadOp = load_op;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depth_attachment.clearValue.depthStencil = (VkClearDepthStencilValue){ 1.0f, 0 };
+
+    VkRenderingInfo rendering_info = { 0 };
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    rendering_info.flags = flags;
+    rendering_info.renderArea.offset = (VkOffset2D){ 0, 0 };
+    rendering_info.renderArea.extent = extent;
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = color_view_count;
+    rendering_info.pColorAttachments = color_attachments;
+    rendering_info.pDepthAttachment = depth_view != VK_NULL_HANDLE ? &depth_attachment : NULL;
+    cmd_begin_rendering(command_buffer, &rendering_info);
+}
+
+/* Dynamic rendering into the swapchain image and the default depth buffer. The layout transitions are the ones
+   the default render pass does, the acquire semaphore is waited on in COLOR_ATTACHMENT_OUTPUT. */
+static void begin_default_rendering(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderingFlags flags)
+{
+    VkImageSubresourceRange color_range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    VkImageSubresourceRange depth_range = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+    VkImage depth_image = get_image(vkal_info.depth_stencil_image);
+    vkal_image_barrier(command_buffer, vkal_info.swapchain_images[image_id],
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, color_range,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+    vkal_image_barrier(command_buffer, depth_image,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, depth_range,
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+    VkalRenderingScope * scope = rendering_scope(command_buffer, 1);
+    scope->images[0] = vkal_info.swapchain_images[image_id];
+    scope->final_layouts[0] = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    scope->images[1] = depth_image;
+    scope->final_layouts[1] = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImageView color_view = vkal_info.swapchain_image_views[image_id];
+    begin_rendering(command_buffer, &color_view, 1, get_image_view(vkal_info.depth_stencil_image_view),
+        vkal_info.swapchain_extent, VK_ATTACHMENT_LOAD_OP_CLEAR, flags);
+}
+
+/* Ends the dynamic rendering of command_buffer and moves the attachments of vkal_begin* into their final layouts. */
+static void end_rendering(VkCommandBuffer command_buffer)
+{
+    cmd_end_rendering(command_buffer);
+    VkalRenderingScope * scope = rendering_scope(command_buffer, 0);
+    if (!scope) {
+        return;
+    }
+    VkImageSubresourceRange color_range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    VkImageSubresourceRange depth_range = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+    if (scope->final_layouts[0] != VK_IMAGE_LAYOUT_UNDEFINED) {
+        int present = scope->final_layouts[0] == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        vkal_image_barrier(command_buffer, scope->images[0],
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, scope->final_layouts[0], color_range,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            present ? 0 : VK_ACCESS_SHADER_READ_BIT);
+    }
+    if (scope->final_layouts[1] != VK_IMAGE_LAYOUT_UNDEFINED) {
+        vkal_image_barrier(command_buffer, scope->images[1],
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, scope->final_layouts[1], depth_range,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+    scope->command_buffer = VK_NULL_HANDLE;
 }
 
-void internal_create_framebuffer(VkFramebufferCreateInfo create_info, uint32_t * out_framebuffer)
+/* Dynamic rendering into arbitrary attachments, eg. transient images of a render graph. The views have to be in
+   COLOR_ATTACHMENT_OPTIMAL and DEPTH_STENCIL_ATTACHMENT_OPTIMAL already, depth_view may be VK_NULL_HANDLE.
+   Pipelines for other attachment formats than the default ones chain their own VkPipelineRenderingCreateInfo. */
+void vkal_begin_rendering(VkCommandBuffer command_buffer, VkImageView * color_views, uint32_t color_view_count, VkImageView depth_view,
+    VkExtent2D extent, VkAttachmentLoadOp load_op)
 {
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKFRAMEBUFFER; ++free_index) {
-	if (vkal_info.user_framebuffers[free_index].used) {
-	    continue;
-	}
-	break;
-    }
-    VkResult result = vkCreateFramebuffer(vkal_info.device, &create_info, 0, &vkal_info.user_framebuffers[free_index].framebuffer);
-    VKAL_ASSERT(result && "failed to create VkFramebuffer!");
-    vkal_info.user_framebuffers[free_index].used = 1;
-    *out_framebuffer = free_index;
+    begin_rendering(command_buffer, color_views, color_view_count, depth_view, extent, load_op, 0);
 }
 
-VkFramebuffer get_framebuffer(uint32_t id)
+void vkal_end_rendering(VkCommandBuffer command_buffer)
 {
-    assert(id < VKAL_MAX_VKFRAMEBUFFER);
-    assert(vkal_info.user_framebuffers[id].used);
-    return vkal_info.user_framebuffers[id].framebuffer;
+    end_rendering(command_buffer);
 }
 
-void destroy_framebuffer(uint32_t id)
+void vkal_begin(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass render_pass)
 {
-    if (vkal_info.user_framebuffers[id].used) {
-	vkDestroyFramebuffer(vkal_info.device, get_framebuffer(id), 0);
-	vkal_info.user_framebuffers[id].used = 0;
-    }
+    vkal_begin2(image_id, command_buffer, render_pass, VK_SUBPASS_CONTENTS_INLINE);
 }
 
-RenderImage recreate_render_image(RenderImage render_image, uint32_t width, uint32_t height)
+/* Use VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS if the pass is recorded with vkal_begin_secondary. */
+void vkal_begin2(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass render_pass, VkSubpassContents contents)
 {
-    vkDeviceWaitIdle(vkal_info.device);
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    vkal_invalidate_state(command_buffer);
 
-    for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
-		destroy_framebuffer(render_image.framebuffers[i]);
+    if (vkal_info.dynamic_rendering) {
+        begin_default_rendering(image_id, command_buffer,
+            contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0);
+        return;
     }
+    
+    VkRenderPassBeginInfo pass_begin_info = { 0 };
+    pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass_begin_info.renderPass = render_pass;
+    pass_begin_info.framebuffer = vkal_info.framebuffers[image_id];
+    pass_begin_info.renderArea.offset = (VkOffset2D){ 0, 0 };
+    pass_begin_info.renderArea.extent = vkal_info.swapchain_extent;
+    VkClearValue clear_values[2];
+    clear_values[0].color = vkal_info.clear_color_value;
+    clear_values[1].depthStencil  = (VkClearDepthStencilValue){ 1.0f, 0 };
 
-    vkal_destroy_image(render_image.color_image.image);
-    vkal_destroy_image(render_image.depth_image.image);
+    pass_begin_info.clearValueCount = 2;
+    pass_begin_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(command_buffer, &pass_begin_info, contents);
+}
 
-    vkal_destroy_image_view(render_image.color_image.image_view);
-    vkal_destroy_image_view(render_image.depth_image.image_view);
-    vkal_destroy_device_memory(render_image.color_image.device_memory);
-    vkal_destroy_device_memory(render_image.depth_image.device_memory);
+void vkal_begin_render_pass(uint32_t image_id, VkRenderPass render_pass)
+{
+    if (vkal_info.dynamic_rendering) {
+        begin_default_rendering(image_id, image_command_buffer(image_id), 0);
+        return;
+    }
+    VkRenderPassBeginInfo pass_begin_info = {0};
+    pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass_begin_info.renderPass = render_pass;
+    pass_begin_info.framebuffer = vkal_info.framebuffers[image_id];
+    pass_begin_info.renderArea.offset = (VkOffset2D){ 0, 0 };
+    pass_begin_info.renderArea.extent = vkal_info.swapchain_extent;
+    VkClearValue clear_values[2];
+    clear_values[0].color = vkal_info.clear_color_value;
+    clear_values[1].depthStencil  = (VkClearDepthStencilValue){ 1.0f, 0 };
 
-    RenderImage new_render_image = create_render_image(width, height);
-    return new_render_image;
+    pass_begin_info.clearValueCount = 2;
+    pass_begin_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(image_command_buffer(image_id), &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 }
 
-VkPipelineLayout vkal_create_pipeline_layout(VkDescriptorSetLayout * descriptor_set_layouts, uint32_t descriptor_set_layout_count, VkPushConstantRange * push_constant_ranges, uint32_t push_constant_range_count)
+void vkal_begin_command_buffer(uint32_t image_id)
 {
-    uint32_t id;
-    create_pipeline_layout(descriptor_set_layouts, descriptor_set_layout_count,
-			   push_constant_ranges, push_constant_range_count, &id);
-    return get_pipeline_layout(id);
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(image_command_buffer(image_id), &begin_info);
+    vkal_invalidate_state(image_command_buffer(image_id));
 }
 
-void create_pipeline_layout(
-    VkDescriptorSetLayout * descriptor_set_layouts, uint32_t descriptor_set_layout_count,
-    VkPushConstantRange * push_constant_ranges, uint32_t push_constant_range_count,
-    uint32_t * out_pipeline_layout)
+void vkal_begin_render_to_image_render_pass(
+	uint32_t image_id, 
+	VkCommandBuffer command_buffer,
+	VkRenderPass render_pass, 
+	RenderImage render_image)
 {
-    VkPipelineLayoutCreateInfo layout_info = { 0 };
-    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    layout_info.pSetLayouts = descriptor_set_layouts;
-    layout_info.setLayoutCount = descriptor_set_layout_count;
-    layout_info.pushConstantRangeCount = push_constant_range_count;
-    layout_info.pPushConstantRanges = push_constant_ranges;
-    uint32_t free_index = 0;
-    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINELAYOUT; ++free_index) {
-		if (vkal_info.user_pipeline_layouts[free_index].used) {
+    VkExtent2D extent;
+    extent.width  = render_image.width;
+    extent.height = render_image.height;
 
-		}
-		else 
-			break;
+    if (vkal_info.dynamic_rendering) {
+        // Like render_to_image_render_pass: cleared, sampled afterwards.
+        VkImageSubresourceRange color_range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        VkImageSubresourceRange depth_range = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        VkImage color_image = get_image(render_image.color_image.image);
+        VkImage depth_image = get_image(render_image.depth_image.image);
+        vkal_image_barrier(command_buffer, color_image,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, color_range,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+        vkal_image_barrier(command_buffer, depth_image,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, depth_range,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+        VkalRenderingScope * scope = rendering_scope(command_buffer, 1);
+        scope->images[0] = color_image;
+        scope->final_layouts[0] = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        scope->images[1] = depth_image;
+        scope->final_layouts[1] = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkImageView color_view = get_image_view(render_image.color_image.image_view);
+        begin_rendering(command_buffer, &color_view, 1, get_image_view(render_image.depth_image.image_view),
+            extent, VK_ATTACHMENT_LOAD_OP_CLEAR, 0);
+        return;
     }
-    VkResult result = vkCreatePipelineLayout(vkal_info.device, &layout_info, 0, &vkal_info.user_pipeline_layouts[free_index].pipeline_layout);
-    VKAL_ASSERT(result && "failed to create pipeline layout!");
-    vkal_info.user_pipeline_layouts[free_index].used = 1;
-    *out_pipeline_layout = free_index;
+
+    VkRenderPassBeginInfo pass_begin_info = {0};
+    pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass_begin_info.renderPass = render_pass;
+    pass_begin_info.framebuffer = get_framebuffer(render_image.framebuffers[image_id]);
+    pass_begin_info.renderArea.offset = (VkOffset2D){ 0, 0 };
+    pass_begin_info.renderArea.extent = extent;
+    VkClearValue clear_values[2];
+    clear_values[0].color = vkal_info.clear_color_value;
+    clear_values[1].depthStencil  = (VkClearDepthStencilValue){ 1.0f, 0 };
+
+    pass_begin_info.clearValueCount = 2;
+    pass_begin_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(command_buffer, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 }
 
-void destroy_pipeline_layout(uint32_t id)
+void vkal_end_renderpass(uint32_t image_id)
 {
-    if (vkal_info.user_pipeline_layouts[id].used) {
-		vkDestroyPipelineLayout(vkal_info.device, get_pipeline_layout(id), 0);
-		vkal_info.user_pipeline_layouts[id].used = 0;
+    if (vkal_info.dynamic_rendering) {
+        end_rendering(image_command_buffer(image_id));
+        return;
     }
+    vkCmdEndRenderPass(image_command_buffer(image_id));
 }
 
-VkPipelineLayout get_pipeline_layout(uint32_t id)
+void vkal_end_command_buffer(uint32_t image_id)
 {
-    assert(id < VKAL_MAX_VKPIPELINELAYOUT);
-    assert(vkal_info.user_pipeline_layouts[id].used);
-    return vkal_info.user_pipeline_layouts[id].pipeline_layout;
+    VkResult result = vkEndCommandBuffer(image_command_buffer(image_id));
+    VKAL_ASSERT(result && "failed to end command buffer");
 }
 
-void vkal_allocate_descriptor_sets(VkDescriptorPool pool,
-				   VkDescriptorSetLayout * layout, uint32_t layout_count,
-				   VkDescriptorSet ** out_descriptor_set)
+void vkal_end(VkCommandBuffer command_buffer)
 {
-    VkDescriptorSetAllocateInfo allocate_info = { 0 };
-    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocate_info.descriptorPool = pool;
-    allocate_info.pSetLayouts = layout;
-    allocate_info.descriptorSetCount = layout_count;
-    VkResult result = vkAllocateDescriptorSets(vkal_info.device, &allocate_info, *out_descriptor_set);
-    VKAL_ASSERT(result && "failed to allocate descriptor set(s)!");    
+    if (vkal_info.dynamic_rendering) {
+        end_rendering(command_buffer);
+    }
+    else {
+        vkCmdEndRenderPass(command_buffer);
+    }
+    VkResult result = vkEndCommandBuffer(command_buffer);
+    VKAL_ASSERT(result && "failed to end command buffer");
 }
 
-SingleShaderStageSetup vkal_create_shader(const uint8_t* shader_byte_code, uint32_t shader_byte_code_size, VkShaderStageFlagBits shader_stage_flag_bits)
+void vkal_bind_descriptor_set(
+	uint32_t image_id,
+	VkDescriptorSet * descriptor_set,
+	VkPipelineLayout pipeline_layout)
 {
-    SingleShaderStageSetup shader_setup = { 0 };
-    create_shader_module(shader_byte_code, shader_byte_code_size, &shader_setup.module);
-
-    shader_setup.create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shader_setup.create_info.stage = shader_stage_flag_bits;
-    shader_setup.create_info.module = get_shader_module(shader_setup.module);
-    shader_setup.create_info.pName = "main";
+    vkal_bind_descriptor_sets_from_to(image_id, descriptor_set, 0, 1, pipeline_layout);
+}
 
-    return shader_setup;
+void vkal_bind_descriptor_sets_from_to(
+    uint32_t image_id,
+    VkDescriptorSet* descriptor_sets,
+    uint32_t first_set, uint32_t set_count,
+    VkPipelineLayout pipeline_layout)
+{
+    bind_descriptor_sets(image_command_buffer(image_id), pipeline_layout,
+        first_set, set_count, descriptor_sets, 0, NULL);
 }
 
-ShaderStageSetup vkal_create_shaders(
-    const uint8_t * vertex_shader_code, uint32_t vertex_shader_code_size, 
-    const uint8_t * fragment_shader_code, uint32_t fragment_shader_code_size,
-    const uint8_t * geometry_shader_code, uint32_t geometry_shader_code_size)
+void vkal_bind_descriptor_sets(
+	uint32_t image_id,
+	VkDescriptorSet * descriptor_sets, uint32_t descriptor_set_count,
+	uint32_t * dynamic_offsets, uint32_t dynamic_offset_count,
+	VkPipelineLayout pipeline_layout)
 {
-    ShaderStageSetup shader_setup = { 0 };
+    bind_descriptor_sets(image_command_buffer(image_id), pipeline_layout,
+        0, descriptor_set_count, descriptor_sets, dynamic_offset_count, dynamic_offsets);
+}
 
-    SingleShaderStageSetup vertex_shader_setup   = vkal_create_shader(vertex_shader_code, vertex_shader_code_size, VK_SHADER_STAGE_VERTEX_BIT);
-    shader_setup.vertex_shader_create_info = vertex_shader_setup.create_info;
-    shader_setup.vertex_shader_module = vertex_shader_setup.module;
+void vkal_bind_descriptor_set_dynamic(
+	uint32_t image_id,
+	VkDescriptorSet * descriptor_sets,
+	VkPipelineLayout pipeline_layout, uint32_t dynamic_offset)
+{
+    bind_descriptor_sets(image_command_buffer(image_id), pipeline_layout,
+        0, 1, descriptor_sets, 1, &dynamic_offset);
+}
 
-    SingleShaderStageSetup fragment_shader_setup = vkal_create_shader(fragment_shader_code, fragment_shader_code_size, VK_SHADER_STAGE_FRAGMENT_BIT);
-    shader_setup.fragment_shader_create_info = fragment_shader_setup.create_info;
-    shader_setup.fragment_shader_module = fragment_shader_setup.module;
-    
+void vkal_bind_descriptor_set2(
+	VkCommandBuffer command_buffer,
+	uint32_t first_set, VkDescriptorSet * descriptor_sets, uint32_t descriptor_set_count,
+	VkPipelineLayout pipeline_layout)
+{
+    bind_descriptor_sets(command_buffer, pipeline_layout,
+        first_set, descriptor_set_count, descriptor_sets, 0, NULL);
+}
 
-    if (geometry_shader_code) {
-        SingleShaderStageSetup geometry_shader_setup = vkal_create_shader(geometry_shader_code, geometry_shader_code_size, VK_SHADER_STAGE_GEOMETRY_BIT);
-        shader_setup.geometry_shader_create_info = geometry_shader_setup.create_info;
-        shader_setup.geometry_shader_module = geometry_shader_setup.module;
+static void set_viewport(VkCommandBuffer command_buffer, VkViewport const * viewport)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state) {
+        if (state->viewport_valid && !memcmp(&state->viewport, viewport, sizeof(VkViewport))) return;
+        state->viewport = *viewport;
+        state->viewport_valid = 1;
     }
+    vkCmdSetViewport(command_buffer, 0, 1, viewport);
+}
 
-    return shader_setup;
+static void set_scissor(VkCommandBuffer command_buffer, VkRect2D const * scissor)
+{
+    VkalCommandState * state = command_state(command_buffer);
+    if (state) {
+        if (state->scissor_valid && !memcmp(&state->scissor, scissor, sizeof(VkRect2D))) return;
+        state->scissor = *scissor;
+        state->scissor_valid = 1;
+    }
+    vkCmdSetScissor(command_buffer, 0, 1, scissor);
 }
 
-VkPipelineShaderStageCreateInfo create_shader_stage_info(VkShaderModule module, VkShaderStageFlagBits shader_stage_flag_bits)
+void vkal_viewport(VkCommandBuffer command_buffer, float x, float y, float width, float height)
 {
-    VkPipelineShaderStageCreateInfo shader_stage_info = { 0 };
-    shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shader_stage_info.stage = shader_stage_flag_bits;
-    shader_stage_info.module = module;
-    shader_stage_info.pName = "main";
-    return shader_stage_info;
+    VkViewport viewport = { 0 };
+    viewport.x = x;
+    viewport.y = y;
+    viewport.width = width; // (float)vp_width;
+    viewport.height = height; // (float)vp_height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+    set_viewport(command_buffer, &viewport);
 }
 
-VkDescriptorSetLayout vkal_create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count)
+void vkal_scissor(VkCommandBuffer command_buffer, float offset_x, float offset_y, float extent_x, float extent_y)
 {
-    uint32_t id;
-    create_descriptor_set_layout(layout, binding_count, &id);
-    return get_descriptor_set_layout(id);
+    VkRect2D scissor      = { 0 };
+    scissor.offset.x      = (int32_t)offset_x;
+    scissor.offset.y      = (int32_t)offset_y;
+    scissor.extent.width  = (uint32_t)extent_x;
+    scissor.extent.height = (uint32_t)extent_y;
+    set_scissor(command_buffer, &scissor);
+}
+
+
+void vkal_draw_indexed(
+    uint32_t image_id, VkPipeline pipeline,
+    VkDeviceSize index_buffer_offset, uint32_t index_count,
+    VkDeviceSize vertex_buffer_offset, uint32_t instance_count)
+{
+    vkal_draw_indexed_typed(image_id, pipeline, index_buffer_offset, index_count, VK_INDEX_TYPE_UINT16,
+        vertex_buffer_offset, instance_count);
 }
 
-void create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count, uint32_t * out_descriptor_set_layout)
+/* index_type is the one vkal_index_buffer_add32 returned for index_buffer_offset. */
+void vkal_draw_indexed_typed(
+    uint32_t image_id, VkPipeline pipeline,
+    VkDeviceSize index_buffer_offset, uint32_t index_count, VkIndexType index_type,
+    VkDeviceSize vertex_buffer_offset, uint32_t instance_count)
 {
-    DescriptorSetLayout set_layout = { 0 };
-    VkDescriptorSetLayoutCreateInfo info = { 0 };
-    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    info.bindingCount = binding_count;
-    info.pBindings = layout;
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKDESCRIPTORSETLAYOUT; ++free_index) {
-        if (vkal_info.user_descriptor_set_layouts[free_index].used) {
-
-        }
-        else break;
-    }
-    VkResult result = vkCreateDescriptorSetLayout(vkal_info.device, &info, 0, &vkal_info.user_descriptor_set_layouts[free_index].descriptor_set_layout);
-    VKAL_ASSERT(result && "failed to create descriptor set layout(s)!");
-    vkal_info.user_descriptor_set_layouts[free_index].used = 1;
-    *out_descriptor_set_layout = free_index;
+    VkCommandBuffer command_buffer = image_command_buffer(image_id);
+    bind_pipeline(command_buffer, pipeline);
+    bind_index_buffer(command_buffer, vkal_info.default_index_buffer.buffer, index_buffer_offset, index_type);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDrawIndexed(command_buffer, index_count, instance_count, 0, 0, 0);
 }
 
-VkDescriptorSetLayout get_descriptor_set_layout(uint32_t id)
+void vkal_draw_indexed_from_buffers(
+    VkalBuffer index_buffer, uint64_t index_buffer_offset, 
+	uint32_t index_count, 
+	VkalBuffer vertex_buffer, uint64_t vertex_buffer_offset,
+    uint32_t image_id, 
+	VkPipeline pipeline)
 {
-    assert(id < VKAL_MAX_VKDESCRIPTORSETLAYOUT);
-    assert(vkal_info.user_descriptor_set_layouts[id].used);
-    return vkal_info.user_descriptor_set_layouts[id].descriptor_set_layout;
+    vkal_draw_indexed_from_buffers_typed(index_buffer, index_buffer_offset, index_count, VK_INDEX_TYPE_UINT16,
+        vertex_buffer, vertex_buffer_offset, image_id, pipeline);
 }
 
-void destroy_descriptor_set_layout(uint32_t id)
+void vkal_draw_indexed_from_buffers_typed(
+    VkalBuffer index_buffer, uint64_t index_buffer_offset,
+    uint32_t index_count, VkIndexType index_type,
+    VkalBuffer vertex_buffer, uint64_t vertex_buffer_offset,
+    uint32_t image_id,
+    VkPipeline pipeline)
 {
-    if (vkal_info.user_descriptor_set_layouts[id].used) {
-	vkDestroyDescriptorSetLayout(vkal_info.device, get_descriptor_set_layout(id), 0);
-	vkal_info.user_descriptor_set_layouts[id].used = 0;
-    }
+    VkCommandBuffer command_buffer = image_command_buffer(image_id);
+    bind_pipeline(command_buffer, pipeline);
+    bind_index_buffer(command_buffer, index_buffer.buffer, index_buffer_offset, index_type);
+    bind_vertex_buffer(command_buffer, vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDrawIndexed(command_buffer, index_count, 1, 0, 0, 0);
 }
 
-void vkal_destroy_graphics_pipeline(VkPipeline pipeline)
+// TODO: Bind pipeline not here. Let it user do manually?
+void vkal_draw(
+    uint32_t image_id, VkPipeline pipeline,
+    VkDeviceSize vertex_buffer_offset, uint32_t vertex_count)
 {
-    vkDestroyPipeline(vkal_info.device, pipeline, 0);
+    VkCommandBuffer command_buffer = image_command_buffer(image_id);
+    bind_pipeline(command_buffer, pipeline);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDraw(command_buffer, vertex_count, 1, 0, 0);
 }
 
-void vkal_set_clear_color(VkClearColorValue value)
+void vkal_draw_from_buffers(
+    VkalBuffer vertex_buffer,
+    uint32_t image_id, 
+	VkPipeline pipeline,
+    VkDeviceSize vertex_buffer_offset, uint32_t vertex_count)
 {
-    vkal_info.clear_color_value = value;
+    VkCommandBuffer command_buffer = image_command_buffer(image_id);
+    bind_pipeline(command_buffer, pipeline);
+    bind_vertex_buffer(command_buffer, vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDraw(command_buffer, vertex_count, 1, 0, 0);
 }
 
-VkPipeline vkal_create_graphics_pipeline(
-	VkVertexInputBindingDescription * vertex_input_bindings, 
-	uint32_t vertex_input_binding_count,
-	VkVertexInputAttributeDescription * vertex_attributes, 
-	uint32_t vertex_attribute_count,
-	ShaderStageSetup shader_setup, 
-    VkBool32 depth_test_enable, 
-	VkCompareOp depth_compare_op, 
-    VkCullModeFlags cull_mode,
-    VkPolygonMode polygon_mode,
-    VkPrimitiveTopology primitive_topology,
-    VkFrontFace face_winding, 
-	VkRenderPass render_pass,
-	VkPipelineLayout pipeline_layout)
-{        
-    VkPipelineShaderStageCreateInfo shader_stages_infos[3] = { 0 };
-    shader_stages_infos[0] = shader_setup.vertex_shader_create_info;
-    shader_stages_infos[1] = shader_setup.fragment_shader_create_info;
-    uint32_t num_shader_stages = 2;
-    if (shader_setup.geometry_shader_create_info.stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
-        num_shader_stages = 3;
-        shader_stages_infos[2] = shader_setup.geometry_shader_create_info;
-    }
+void vkal_draw_indexed2(
+    VkCommandBuffer command_buffer, 
+	VkPipeline pipeline,
+    VkDeviceSize index_buffer_offset, uint32_t index_count,
+    VkDeviceSize vertex_buffer_offset)
+{
+    vkal_draw_indexed2_typed(command_buffer, pipeline, index_buffer_offset, index_count, VK_INDEX_TYPE_UINT16, vertex_buffer_offset);
+}
 
-    VkPipelineVertexInputStateCreateInfo vertex_input_info = {0};
-    vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount = vertex_input_binding_count;
-    vertex_input_info.pVertexBindingDescriptions = vertex_input_bindings;
-    vertex_input_info.vertexAttributeDescriptionCount = vertex_attribute_count;
-    vertex_input_info.pVertexAttributeDescriptions = vertex_attributes;
-    //
-    VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {0};
-    input_assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly_info.topology = primitive_topology;
-    input_assembly_info.primitiveRestartEnable = VK_FALSE;
+void vkal_draw_indexed2_typed(
+    VkCommandBuffer command_buffer,
+    VkPipeline pipeline,
+    VkDeviceSize index_buffer_offset, uint32_t index_count, VkIndexType index_type,
+    VkDeviceSize vertex_buffer_offset)
+{
+    bind_pipeline(command_buffer, pipeline);
     
-    VkViewport viewport = {0};
-    viewport.x        = 0.f;
-    viewport.y        = 0.f;
-    viewport.width    = (float)vkal_info.swapchain_extent.width;
-    viewport.height   = (float)vkal_info.swapchain_extent.height;
+    VkViewport viewport = { 0 };
+    viewport.x = 0.f;
+    viewport.y = 0.f;
+    viewport.width = (float)vkal_info.swapchain_extent.width; // (float)vp_width;
+    viewport.height = (float)vkal_info.swapchain_extent.height; // (float)vp_height;
     viewport.minDepth = 0.f;
     viewport.maxDepth = 1.f;
-    VkRect2D scissor = {0};
+    set_viewport(command_buffer, &viewport);
+    
+    VkRect2D scissor = { 0 };
     scissor.offset = (VkOffset2D){ 0,0 };
     scissor.extent = vkal_info.swapchain_extent;
-    VkPipelineViewportStateCreateInfo viewport_state = {0};
-    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state.pViewports = &viewport;
-    viewport_state.viewportCount = 1;
-    viewport_state.pScissors = &scissor;
-    viewport_state.scissorCount = 1;
-    
-    VkPipelineRasterizationStateCreateInfo rasterizer_info = {0};
-    rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer_info.frontFace = face_winding;
-    rasterizer_info.cullMode = cull_mode;
-    rasterizer_info.polygonMode = polygon_mode;
-    rasterizer_info.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer_info.depthClampEnable = VK_FALSE;
-    rasterizer_info.depthBiasEnable = VK_FALSE;
-    rasterizer_info.lineWidth = 1.0f;
-    
-    // COME BACK LATER: Set up depth/stencil testing (we need to create a buffer for that as it is
-    // not created with the Swapchain
-    
-    VkPipelineColorBlendAttachmentState color_blend_attachment = {0};
-    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    color_blend_attachment.blendEnable = VK_TRUE;
+    set_scissor(command_buffer, &scissor);
     
-    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
-    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-    
-    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
-    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    bind_index_buffer(command_buffer, vkal_info.default_index_buffer.buffer, index_buffer_offset, index_type);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDrawIndexed(command_buffer, index_count, 1, 0, 0, 0);
+}
 
-    VkPipelineColorBlendStateCreateInfo color_blending_info = { 0 };
-    color_blending_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    color_blending_info.logicOpEnable = VK_FALSE; // enabling this will set color_blend_attachment.blendEnable to VK_FALSE!    
-    color_blending_info.pAttachments = &color_blend_attachment;
-    color_blending_info.attachmentCount = 1; // must match the attachment count of render subpass!
-    // it affects ALL framebuffers
-    
-    VkPipelineDepthStencilStateCreateInfo depth_stencil_info = { 0 };
-    depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depth_stencil_info.depthTestEnable = depth_test_enable;
-    depth_stencil_info.depthCompareOp = depth_compare_op;
-    depth_stencil_info.depthWriteEnable = VK_TRUE;
-    depth_stencil_info.depthBoundsTestEnable = VK_FALSE;
-    depth_stencil_info.stencilTestEnable = VK_FALSE;
-    depth_stencil_info.back.failOp = VK_STENCIL_OP_KEEP;
-    depth_stencil_info.back.passOp = VK_STENCIL_OP_KEEP;
-    depth_stencil_info.back.compareOp = depth_compare_op;
-    depth_stencil_info.back.compareMask = 0;
-    depth_stencil_info.back.reference = 0;
-    depth_stencil_info.back.depthFailOp = VK_STENCIL_OP_KEEP;
-    depth_stencil_info.back.writeMask = 0;
-    depth_stencil_info.front = depth_stencil_info.back;
-    
-    VkPipelineMultisampleStateCreateInfo ms_info = { 0 };
-    ms_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    ms_info.sampleShadingEnable = VK_FALSE;
-    ms_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; // must match renderpass's color attachment
-    
-    // dynamic state will force us to provide viewport dimensions and linewidth at drawing-time
-    VkDynamicState dynamic_states[] = {
-	VK_DYNAMIC_STATE_VIEWPORT,
-	VK_DYNAMIC_STATE_SCISSOR,
-    };
-    VkPipelineDynamicStateCreateInfo dynamic_state_info = { 0 };
-    dynamic_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_state_info.pDynamicStates = dynamic_states;
-    dynamic_state_info.dynamicStateCount = sizeof(dynamic_states) / sizeof(*dynamic_states);
-    
-    VkGraphicsPipelineCreateInfo pipeline_info = { 0 };
-    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = num_shader_stages;
-    pipeline_info.pStages = shader_stages_infos;
-    pipeline_info.pVertexInputState = &vertex_input_info;
-    pipeline_info.pInputAssemblyState = &input_assembly_info;
-    pipeline_info.pViewportState = &viewport_state;
-    pipeline_info.pRasterizationState = &rasterizer_info;
-    pipeline_info.pMultisampleState = &ms_info;
-    pipeline_info.pColorBlendState = &color_blending_info;
-    pipeline_info.pDepthStencilState = &depth_stencil_info;
-    pipeline_info.pDynamicState = &dynamic_state_info;
-    pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = render_pass;
-    pipeline_info.subpass = 0;
-    
-    uint32_t id;
-    create_graphics_pipeline(pipeline_info, &id);
-    return get_graphics_pipeline(id);
+VkDeviceSize vkal_indirect_buffer_size(uint32_t max_draw_count)
+{
+    return VKAL_INDIRECT_COMMANDS_OFFSET + (VkDeviceSize)max_draw_count * sizeof(VkDrawIndexedIndirectCommand);
 }
 
-void create_graphics_pipeline(VkGraphicsPipelineCreateInfo create_info, uint32_t * out_graphics_pipeline)
+/* device_memory should be VKAL_MEMORY_USAGE_GPU_ONLY memory with room for vkal_indirect_buffer_size(max_draw_count). */
+VkalIndirectBuffer vkal_create_indirect_buffer(DeviceMemory * device_memory, uint32_t max_draw_count)
 {
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINE; ++free_index) {
-	if (vkal_info.user_pipelines[free_index].used) {
+    VkalIndirectBuffer indirect_buffer = { 0 };
+    indirect_buffer.buffer = vkal_create_buffer(vkal_indirect_buffer_size(max_draw_count), device_memory,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    indirect_buffer.max_draw_count = max_draw_count;
+    return indirect_buffer;
+}
 
-	}
-	else break;
+void vkal_destroy_indirect_buffer(VkalIndirectBuffer * indirect_buffer)
+{
+    vkal_destroy_buffer(&indirect_buffer->buffer);
+    indirect_buffer->max_draw_count = 0;
+    indirect_buffer->draw_count = 0;
+}
+
+/* Turns records into draw commands and uploads them together with the draw count. The commands after the
+   records are zeroed, so the vkal_draw_indirect_count fallback that draws all max_draw_count commands draws
+   nothing for them. The upload is ordered against graphics work that still reads the previous commands. */
+VkalUploadTicket vkal_update_indirect_buffer(VkalIndirectBuffer * indirect_buffer, VkalDrawRecord const * records, uint32_t record_count)
+{
+    assert(record_count <= indirect_buffer->max_draw_count && "vkal_update_indirect_buffer: too many records!");
+    VkDeviceSize size = vkal_indirect_buffer_size(indirect_buffer->max_draw_count);
+    uint8_t * data = NULL;
+    VKAL_MALLOC(data, size);
+    memset(data, 0, size);
+    memcpy(data, &record_count, sizeof(uint32_t));
+    VkIndexType index_type = record_count ? records[0].index_type : VK_INDEX_TYPE_UINT16;
+    uint32_t index_size = (index_type == VK_INDEX_TYPE_UINT32) ? sizeof(uint32_t) : sizeof(uint16_t);
+    VkDrawIndexedIndirectCommand * commands = (VkDrawIndexedIndirectCommand *)(data + VKAL_INDIRECT_COMMANDS_OFFSET);
+    for (uint32_t i = 0; i < record_count; ++i) {
+        VkalDrawRecord const * record = &records[i];
+        assert(record->vertex_buffer_offset % record->vertex_size == 0 && "vkal_update_indirect_buffer: vertex offset is not a multiple of the vertex size!");
+        assert((record->first_instance == 0 || vkal_info.draw_indirect_first_instance_supported) &&
+            "vkal_update_indirect_buffer: device does not support drawIndirectFirstInstance!");
+        commands[i].indexCount = record->index_count;
+        commands[i].instanceCount = record->instance_count;
+        assert(record->index_type == index_type &&
+            "vkal_update_indirect_buffer: all records must have the same index type, see vkal_index_buffer_add32!");
+        commands[i].firstIndex = (uint32_t)(record->index_buffer_offset / index_size);
+        commands[i].vertexOffset = (int32_t)(record->vertex_buffer_offset / record->vertex_size);
+        commands[i].firstInstance = record->first_instance;
     }
-    VkResult result = vkCreateGraphicsPipelines(vkal_info.device, VK_NULL_HANDLE, 1, &create_info, 0, &vkal_info.user_pipelines[free_index].pipeline);
-    VKAL_ASSERT(result && "failed to create graphics pipeline!");
-    vkal_info.user_pipelines[free_index].used = 1;
-    *out_graphics_pipeline = free_index;
+    VkalUploadTicket ticket = vkal_upload_buffer(indirect_buffer->buffer.buffer, 0, data, size);
+    VKAL_FREE(data);
+    indirect_buffer->draw_count = record_count;
+    indirect_buffer->index_type = index_type;
+    return ticket;
 }
 
-VkPipeline get_graphics_pipeline(uint32_t id)
+/* The commands address meshes relative to the start of the default vertex and index buffers. */
+static void bind_indirect_draw_state(VkCommandBuffer command_buffer, VkPipeline pipeline, VkIndexType index_type)
 {
-    assert(id < VKAL_MAX_VKPIPELINE);
-    assert(vkal_info.user_pipelines[id].used);
-    return vkal_info.user_pipelines[id].pipeline;
+    bind_pipeline(command_buffer, pipeline);
+    bind_index_buffer(command_buffer, vkal_info.default_index_buffer.buffer, 0, index_type);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, 0);
 }
 
-void destroy_graphics_pipeline(uint32_t id)
+void vkal_draw_indexed_indirect(uint32_t image_id, VkPipeline pipeline,
+    VkalIndirectBuffer * indirect_buffer, uint32_t first_draw, uint32_t draw_count)
 {
-    if (vkal_info.user_pipelines[id].used) {
-		vkDestroyPipeline(vkal_info.device, get_graphics_pipeline(id), 0);
-		vkal_info.user_pipelines[id].used = 0;
+    assert(first_draw + draw_count <= indirect_buffer->max_draw_count);
+    VkCommandBuffer command_buffer = image_command_buffer(image_id);
+    bind_indirect_draw_state(command_buffer, pipeline, indirect_buffer->index_type);
+    VkDeviceSize offset = VKAL_INDIRECT_COMMANDS_OFFSET + (VkDeviceSize)first_draw * sizeof(VkDrawIndexedIndirectCommand);
+    if (vkal_info.multi_draw_indirect_supported) {
+        vkCmdDrawIndexedIndirect(command_buffer, indirect_buffer->buffer.buffer, offset, draw_count, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else {
+        for (uint32_t i = 0; i < draw_count; ++i) {
+            vkCmdDrawIndexedIndirect(command_buffer, indirect_buffer->buffer.buffer, offset + i * sizeof(VkDrawIndexedIndirectCommand), 1, 0);
+        }
     }
 }
 
-VkWriteDescriptorSet create_write_descriptor_set_image(VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
-                                                       uint32_t count, VkDescriptorType type, VkDescriptorImageInfo * image_info)
+/* Draws as many commands as the count at the start of the buffer says, which the GPU can write, eg. after culling.
+   Without drawIndirectCount all max_draw_count commands are issued, unused ones must have an instanceCount of 0. */
+void vkal_draw_indirect_count(uint32_t image_id, VkPipeline pipeline, VkalIndirectBuffer * indirect_buffer)
 {
-    VkWriteDescriptorSet write_set = { 0 };
-    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_set.dstSet = dst_descriptor_set;
-    write_set.dstBinding = dst_binding;
-    write_set.descriptorCount = count;
-    write_set.descriptorType = type;
-    write_set.pImageInfo = image_info;
-	
-    return write_set;
+    if (!vkal_info.draw_indirect_count_supported) {
+        vkal_draw_indexed_indirect(image_id, pipeline, indirect_buffer, 0, indirect_buffer->max_draw_count);
+        return;
+    }
+    VkCommandBuffer command_buffer = image_command_buffer(image_id);
+    bind_indirect_draw_state(command_buffer, pipeline, indirect_buffer->index_type);
+    vkCmdDrawIndexedIndirectCount(command_buffer,
+        indirect_buffer->buffer.buffer, VKAL_INDIRECT_COMMANDS_OFFSET,
+        indirect_buffer->buffer.buffer, 0,
+        indirect_buffer->max_draw_count, sizeof(VkDrawIndexedIndirectCommand));
 }
 
-VkWriteDescriptorSet create_write_descriptor_set_image2(VkDescriptorSet dst_descriptor_set,
-							uint32_t dst_binding, uint32_t array_element,
-							uint32_t count,
-							VkDescriptorType type, VkDescriptorImageInfo * image_info)
+/* The compute helpers take the command buffer directly, compute work is often recorded outside of the frame's
+   command buffer. The compute bind point is separate from the graphics one, so they leave the state cache alone. */
+void vkal_bind_compute_descriptor_sets(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout,
+    uint32_t first_set, VkDescriptorSet const * descriptor_sets, uint32_t descriptor_set_count)
 {
-    VkWriteDescriptorSet write_set = { 0 };
-    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_set.dstSet = dst_descriptor_set;
-    write_set.dstBinding = dst_binding;
-    write_set.descriptorCount = count;
-    write_set.descriptorType = type;
-    write_set.pImageInfo = image_info;
-    write_set.dstArrayElement = array_element;
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
+        first_set, descriptor_set_count, descriptor_sets, 0, NULL);
+}
 
-    return write_set;
+void vkal_dispatch(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
+}
+
+/* The group counts are a VkDispatchIndirectCommand at offset, eg. written by a previous dispatch.
+   The buffer needs VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT. */
+void vkal_dispatch_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline, VkBuffer buffer, VkDeviceSize offset)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatchIndirect(command_buffer, buffer, offset);
+}
+
+/* Makes src_access in src_stage visible to dst_access in dst_stage for a range of the buffer,
+   eg. a compute shader's writes to the indirect draws that read them:
+   COMPUTE_SHADER/SHADER_WRITE -> DRAW_INDIRECT/INDIRECT_COMMAND_READ. */
+void vkal_buffer_barrier(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+    VkBufferMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+/* Like vkal_buffer_barrier, with an optional layout change, eg. a storage image written by a compute shader
+   in GENERAL that is sampled afterwards: GENERAL -> SHADER_READ_ONLY_OPTIMAL. See set_image_layout for a variant
+   that derives the access masks from the layouts. */
+void vkal_image_barrier(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+    VkImageSubresourceRange subresource_range,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+    VkImageMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = subresource_range;
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
 }
 
-VkWriteDescriptorSet create_write_descriptor_set_buffer(
-	VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
-    uint32_t count, VkDescriptorType type, VkDescriptorBufferInfo * buffer_info)
+/* Render graph */
+
+#define VKAL_GRAPH_WRITE_ACCESS (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | \
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT)
+
+/* Tracked per resource while vkal_graph_compile walks the kept passes. */
+typedef struct VkalGraphState {
+    VkImageLayout        layout;
+    VkPipelineStageFlags write_stages;   /* last write or layout transition */
+    VkAccessFlags        write_access;
+    VkPipelineStageFlags read_stages;    /* reads since the last write */
+    VkPipelineStageFlags visible_stages; /* stages the last write has been made visible to */
+    VkAccessFlags        visible_access;
+} VkalGraphState;
+
+void vkal_graph_begin(VkalGraph * graph)
 {
-    VkWriteDescriptorSet write_set = { 0 };
-    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_set.dstSet = dst_descriptor_set;
-    write_set.dstBinding = dst_binding;
-    write_set.descriptorCount = count;
-    write_set.descriptorType = type;
-    write_set.pBufferInfo = buffer_info;
-    
-    return write_set;
+    memset(graph, 0, sizeof(VkalGraph));
 }
 
-VkWriteDescriptorSet create_write_descriptor_set_buffer2(VkDescriptorSet dst_descriptor_set, uint32_t dst_binding, uint32_t dst_array_element,
-							 uint32_t count, VkDescriptorType type, VkDescriptorBufferInfo * buffer_info)
+/* Transient image, created by vkal_graph_compile in memory that it shares with other transient images whose
+   lifetimes don't overlap. Contents do not survive between passes that are not connected by a use of the image
+   and are undefined at the start of every execution. */
+uint32_t vkal_graph_create_image(VkalGraph * graph, uint32_t width, uint32_t height, VkFormat format, VkImageAspectFlags aspect)
 {
-    VkWriteDescriptorSet write_set = { 0 };
-    write_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_set.dstSet = dst_descriptor_set;
-    write_set.dstBinding = dst_binding;
-    write_set.dstArrayElement = dst_array_element;
-    write_set.descriptorCount = count;
-    write_set.descriptorType = type;
-    write_set.pBufferInfo = buffer_info;
+    assert(!graph->compiled && graph->resource_count < VKAL_GRAPH_MAX_RESOURCES);
+    uint32_t id = graph->resource_count++;
+    VkalGraphResource * resource = &graph->resources[id];
+    resource->is_image = 1;
+    resource->width = width;
+    resource->height = height;
+    resource->format = format;
+    resource->aspect = aspect;
+    resource->initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource->final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    return id;
+}
 
-    return write_set;
+/* Image that lives outside of the graph, eg. a swapchain image: initial_layout UNDEFINED and
+   final_layout PRESENT_SRC_KHR. Every execution starts from initial_layout. If the graph writes the image, its first
+   use waits for all earlier work, which covers the previous execution. Work outside of the graph that reads or writes
+   an image the graph only reads has to be synchronized by the caller. */
+uint32_t vkal_graph_import_image(VkalGraph * graph, VkImage image, VkImageView image_view, VkImageAspectFlags aspect,
+    VkImageLayout initial_layout, VkImageLayout final_layout)
+{
+    assert(!graph->compiled && graph->resource_count < VKAL_GRAPH_MAX_RESOURCES);
+    uint32_t id = graph->resource_count++;
+    VkalGraphResource * resource = &graph->resources[id];
+    resource->is_image = 1;
+    resource->imported = 1;
+    resource->image = image;
+    resource->image_view = image_view;
+    resource->aspect = aspect;
+    resource->initial_layout = initial_layout;
+    resource->final_layout = final_layout;
+    return id;
 }
 
-void create_default_command_pool(void)
+uint32_t vkal_graph_import_buffer(VkalGraph * graph, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
 {
-    VkCommandPoolCreateInfo cmdpool_info = { 0 };
-    cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    cmdpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
-    if (indicies.has_graphics_family && indicies.has_present_family) {
-		if (indicies.graphics_family != indicies.present_family) {
-			cmdpool_info.queueFamilyIndex = indicies.graphics_family;
-			VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.default_command_pools[0]);
-			VKAL_ASSERT(result && "failed to create command pool for graphics family");
-            
-			cmdpool_info.queueFamilyIndex = indicies.present_family;
-			result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.default_command_pools[1]);
-			VKAL_ASSERT(result && "failed to create command pool for present family");
-			vkal_info.default_commandpool_count = 2;
-		}
-		else {
-			cmdpool_info.queueFamilyIndex = indicies.graphics_family;
-			VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.default_command_pools[0]);
-			VKAL_ASSERT(result && "failed to create command pool for both present and graphics families");
-			vkal_info.default_commandpool_count = 1;
-		}
-    }
-	else {
-		printf("[VKAL] no graphics and present queues available!\n");
-		getchar();
-		exit(-1);
-	}
+    assert(!graph->compiled && graph->resource_count < VKAL_GRAPH_MAX_RESOURCES);
+    uint32_t id = graph->resource_count++;
+    VkalGraphResource * resource = &graph->resources[id];
+    resource->imported = 1;
+    resource->buffer = buffer;
+    resource->offset = offset;
+    resource->size = size;
+    return id;
 }
 
-VkCommandBuffer vkal_create_command_buffer(VkCommandBufferLevel cmd_buffer_level, uint32_t begin)
+/* Swaps the handles of an imported image without compiling the graph again, eg. to the swapchain image of the frame. */
+void vkal_graph_set_image(VkalGraph * graph, uint32_t resource, VkImage image, VkImageView image_view)
 {
-    VkCommandBufferAllocateInfo alloc_info = { 0 };
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = vkal_info.default_command_pools[0];
-    alloc_info.level = cmd_buffer_level;
-    alloc_info.commandBufferCount = 1;
+    assert(resource < graph->resource_count && graph->resources[resource].imported && graph->resources[resource].is_image);
+    graph->resources[resource].image = image;
+    graph->resources[resource].image_view = image_view;
+}
 
-    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
-    VkResult result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &command_buffer);
-    VKAL_ASSERT(result && "Failed to allocate command buffer from pool");
+/* execute is called with the command buffer the graph is recorded into, outside of a render pass. Render passes
+   begun in there should keep their attachments in the layout the graph put them in (initialLayout == finalLayout). */
+uint32_t vkal_graph_add_pass(VkalGraph * graph, char const * name, VkalGraphExecute execute, void * user_data)
+{
+    assert(!graph->compiled && graph->pass_count < VKAL_GRAPH_MAX_PASSES);
+    uint32_t id = graph->pass_count++;
+    VkalGraphPass * pass = &graph->passes[id];
+    pass->name = name;
+    pass->execute = execute;
+    pass->user_data = user_data;
+    return id;
+}
 
-    if (begin) {
-		VkCommandBufferBeginInfo begin_info = {0};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        result = vkBeginCommandBuffer(command_buffer, &begin_info);
-		VKAL_ASSERT(result && "Failed to begin command buffer recording");
+static void graph_usage_info(VkalGraphUsage usage, VkPipelineStageFlags shader_stages, uint8_t is_image,
+    VkalGraphAccess * access, VkImageUsageFlags * image_usage)
+{
+    access->write = 0;
+    access->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    switch (usage)
+    {
+        case VKAL_GRAPH_USAGE_COLOR_ATTACHMENT:
+        {
+            access->stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            access->access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            access->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            access->write = 1;
+            *image_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_DEPTH_ATTACHMENT:
+        {
+            access->stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            access->access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            access->layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+            access->write = 1;
+            *image_usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_DEPTH_READ:
+        {
+            access->stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            access->access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+            access->layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+            *image_usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_SAMPLED:
+        {
+            assert(shader_stages && "shader reads need the shader stages");
+            access->stages = shader_stages;
+            access->access = is_image ? VK_ACCESS_SHADER_READ_BIT : (VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT);
+            access->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            *image_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_STORAGE_READ:
+        {
+            assert(shader_stages && "shader reads need the shader stages");
+            access->stages = shader_stages;
+            access->access = VK_ACCESS_SHADER_READ_BIT;
+            access->layout = VK_IMAGE_LAYOUT_GENERAL;
+            *image_usage = VK_IMAGE_USAGE_STORAGE_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_STORAGE_WRITE:
+        {
+            assert(shader_stages && "shader writes need the shader stages");
+            access->stages = shader_stages;
+            access->access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            access->layout = VK_IMAGE_LAYOUT_GENERAL;
+            access->write = 1;
+            *image_usage = VK_IMAGE_USAGE_STORAGE_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_TRANSFER_SRC:
+        {
+            access->stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            access->access = VK_ACCESS_TRANSFER_READ_BIT;
+            access->layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            *image_usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_TRANSFER_DST:
+        {
+            access->stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            access->access = VK_ACCESS_TRANSFER_WRITE_BIT;
+            access->layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            access->write = 1;
+            *image_usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_INDIRECT:
+        {
+            assert(!is_image);
+            access->stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+            access->access = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        } break;
+        case VKAL_GRAPH_USAGE_VERTEX_INPUT:
+        {
+            assert(!is_image);
+            access->stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+            access->access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        } break;
+        default: assert(0 && "unknown graph usage");
+    }
+    if (!is_image) {
+        access->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        *image_usage = 0;
     }
+}
 
-    return command_buffer;
+/* Declares that pass uses resource. A write makes the pass depend on whoever needs the result, reads make it depend
+   on the passes before that wrote the resource. shader_stages are needed for SAMPLED and STORAGE_* usages.
+   Using the same resource twice in a pass merges the uses, they have to agree on the image layout. */
+void vkal_graph_use(VkalGraph * graph, uint32_t pass, uint32_t resource, VkalGraphUsage usage, VkPipelineStageFlags shader_stages)
+{
+    assert(!graph->compiled && pass < graph->pass_count && resource < graph->resource_count);
+    VkalGraphPass * graph_pass = &graph->passes[pass];
+    VkalGraphResource * graph_resource = &graph->resources[resource];
+    VkalGraphAccess access = { 0 };
+    VkImageUsageFlags image_usage = 0;
+    graph_usage_info(usage, shader_stages, graph_resource->is_image, &access, &image_usage);
+    access.resource = resource;
+    graph_resource->usage |= image_usage;
+
+    for (uint32_t i = 0; i < graph_pass->access_count; ++i) {
+        VkalGraphAccess * existing = &graph_pass->accesses[i];
+        if (existing->resource == resource) {
+            assert(existing->layout == access.layout && "a pass can only use an image in one layout");
+            existing->stages |= access.stages;
+            existing->access |= access.access;
+            existing->write |= access.write;
+            return;
+        }
+    }
+    assert(graph_pass->access_count < VKAL_GRAPH_MAX_PASS_ACCESSES);
+    graph_pass->accesses[graph_pass->access_count++] = access;
 }
 
-void create_default_command_buffers(void)
+static int graph_memory_overlaps(VkalGraphResource * a, VkalGraphResource * b)
 {
-    VKAL_MALLOC(vkal_info.default_command_buffers, vkal_info.framebuffer_count);
-	vkal_info.default_command_buffer_count = vkal_info.framebuffer_count;
-	VkCommandBufferAllocateInfo allocate_info = { 0 };
-	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocate_info.commandBufferCount = vkal_info.default_command_buffer_count;
-	allocate_info.commandPool = vkal_info.default_command_pools[0]; // NOTE: What if present and graphics queue are not from the same family?
-	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	vkAllocateCommandBuffers(vkal_info.device, &allocate_info, vkal_info.default_command_buffers); 
+    return a->memory_offset < b->memory_offset + b->memory_size && b->memory_offset < a->memory_offset + a->memory_size;
 }
 
-void vkal_begin(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass render_pass)
+static int graph_lifetimes_overlap(VkalGraphResource * a, VkalGraphResource * b)
 {
-    VkCommandBufferBeginInfo begin_info = { 0 };
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    vkBeginCommandBuffer(command_buffer, &begin_info);
-    
-    VkRenderPassBeginInfo pass_begin_info = { 0 };
-    pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    pass_begin_info.renderPass = render_pass;
-    pass_begin_info.framebuffer = vkal_info.framebuffers[image_id];
-    pass_begin_info.renderArea.offset = (VkOffset2D){ 0, 0 };
-    pass_begin_info.renderArea.extent = vkal_info.swapchain_extent;
-    VkClearValue clear_values[2];
-    clear_values[0].color = vkal_info.clear_color_value;
-    clear_values[1].depthStencil  = (VkClearDepthStencilValue){ 1.0f, 0 };
-
-    pass_begin_info.clearValueCount = 2;
-    pass_begin_info.pClearValues = clear_values;
-    vkCmdBeginRenderPass(command_buffer, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    return a->first_pass <= b->last_pass && b->first_pass <= a->last_pass;
 }
 
-void vkal_begin_render_pass(uint32_t image_id, VkRenderPass render_pass)
+static void graph_add_barrier(VkalGraphBarrier * barriers, uint32_t * barrier_count, uint32_t resource,
+    VkAccessFlags src_access, VkAccessFlags dst_access, VkImageLayout old_layout, VkImageLayout new_layout)
 {
-    VkRenderPassBeginInfo pass_begin_info = {0};
-    pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    pass_begin_info.renderPass = render_pass;
-    pass_begin_info.framebuffer = vkal_info.framebuffers[image_id];
-    pass_begin_info.renderArea.offset = (VkOffset2D){ 0, 0 };
-    pass_begin_info.renderArea.extent = vkal_info.swapchain_extent;
-    VkClearValue clear_values[2];
-    clear_values[0].color = vkal_info.clear_color_value;
-    clear_values[1].depthStencil  = (VkClearDepthStencilValue){ 1.0f, 0 };
-
-    pass_begin_info.clearValueCount = 2;
-    pass_begin_info.pClearValues = clear_values;
-    vkCmdBeginRenderPass(vkal_info.default_command_buffers[image_id], &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    VkalGraphBarrier * barrier = &barriers[(*barrier_count)++];
+    barrier->resource = resource;
+    barrier->src_access = src_access;
+    barrier->dst_access = dst_access;
+    barrier->old_layout = old_layout;
+    barrier->new_layout = new_layout;
 }
 
-void vkal_begin_command_buffer(uint32_t image_id)
+/* Places the transient images that are used by kept passes into one allocation. Largest first, each at the lowest
+   offset that does not collide with an image already placed whose lifetime overlaps. */
+static void graph_place_transients(VkalGraph * graph)
 {
-    VkCommandBufferBeginInfo begin_info = {0};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    vkBeginCommandBuffer(vkal_info.default_command_buffers[image_id], &begin_info);
+    VkDeviceSize alignments[VKAL_GRAPH_MAX_RESOURCES] = { 0 };
+    uint32_t order[VKAL_GRAPH_MAX_RESOURCES];
+    uint32_t order_count = 0;
+    uint32_t memory_type_bits = UINT32_MAX;
+    for (uint32_t i = 0; i < graph->resource_count; ++i) {
+        VkalGraphResource * resource = &graph->resources[i];
+        if (resource->imported || !resource->is_image || resource->first_pass == UINT32_MAX) {
+            continue;
+        }
+        VkImageCreateInfo image_info = { 0 };
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = resource->format;
+        image_info.extent.width = resource->width;
+        image_info.extent.height = resource->height;
+        image_info.extent.depth = 1;
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = resource->usage;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkResult result = vkCreateImage(vkal_info.device, &image_info, NULL, &resource->image);
+        VKAL_ASSERT(result && "failed to create transient image!");
+
+        VkMemoryRequirements memory_requirements;
+        vkGetImageMemoryRequirements(vkal_info.device, resource->image, &memory_requirements);
+        memory_type_bits &= memory_requirements.memoryTypeBits;
+        alignments[i] = memory_requirements.alignment;
+        resource->memory_size = (memory_requirements.size + alignments[i] - 1) / alignments[i] * alignments[i];
+        graph->unaliased_memory_size += resource->memory_size;
+        order[order_count++] = i;
+    }
+    if (order_count == 0) {
+        return;
+    }
+
+    for (uint32_t i = 1; i < order_count; ++i) {
+        uint32_t id = order[i];
+        uint32_t j = i;
+        while (j > 0 && graph->resources[order[j - 1]].memory_size < graph->resources[id].memory_size) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = id;
+    }
+
+    for (uint32_t i = 0; i < order_count; ++i) {
+        VkalGraphResource * resource = &graph->resources[order[i]];
+        VkDeviceSize alignment = alignments[order[i]];
+        resource->memory_offset = 0;
+        for (uint32_t j = 0; j < i; ++j) {
+            VkalGraphResource * placed = &graph->resources[order[j]];
+            if (graph_lifetimes_overlap(resource, placed) && graph_memory_overlaps(resource, placed)) {
+                // move past it and check all placed images again, the offset only ever grows
+                VkDeviceSize end = placed->memory_offset + placed->memory_size;
+                resource->memory_offset = (end + alignment - 1) / alignment * alignment;
+                j = (uint32_t)-1;
+            }
+        }
+        graph->transient_memory_size = VKAL_MAX(graph->transient_memory_size, resource->memory_offset + resource->memory_size);
+    }
+
+    uint32_t mem_type_index = find_memory_type_index(memory_type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    assert(mem_type_index != UINT32_MAX && "no memory type fits all transient images");
+    graph->transient_memory = allocate_memory(graph->transient_memory_size, mem_type_index);
+
+    for (uint32_t i = 0; i < order_count; ++i) {
+        VkalGraphResource * resource = &graph->resources[order[i]];
+        VkResult result = vkBindImageMemory(vkal_info.device, resource->image, graph->transient_memory, resource->memory_offset);
+        VKAL_ASSERT(result && "failed to bind transient image memory!");
+
+        VkImageViewCreateInfo view_info = { 0 };
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = resource->image;
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = resource->format;
+        view_info.subresourceRange.aspectMask = resource->aspect;
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.layerCount = 1;
+        result = vkCreateImageView(vkal_info.device, &view_info, NULL, &resource->image_view);
+        VKAL_ASSERT(result && "failed to create transient image view!");
+    }
 }
 
-void vkal_begin_render_to_image_render_pass(
-	uint32_t image_id, 
-	VkCommandBuffer command_buffer,
-	VkRenderPass render_pass, 
-	RenderImage render_image)
+/* Culls passes, creates and places the transient images and computes the barriers. Add no passes or resources
+   afterwards, vkal_graph_destroy and vkal_graph_begin start over, eg. after a resize. */
+void vkal_graph_compile(VkalGraph * graph)
 {
-    VkRenderPassBeginInfo pass_begin_info = {0};
-    pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    pass_begin_info.renderPass = render_pass;
-    pass_begin_info.framebuffer = get_framebuffer(render_image.framebuffers[image_id]);
-    pass_begin_info.renderArea.offset = (VkOffset2D){ 0, 0 };
+    assert(!graph->compiled);
 
-    VkExtent2D extent;
-    extent.width  = render_image.width;
-    extent.height = render_image.height;
-    
-    pass_begin_info.renderArea.extent = extent;
-    VkClearValue clear_values[2];
-    clear_values[0].color = vkal_info.clear_color_value;
-    clear_values[1].depthStencil  = (VkClearDepthStencilValue){ 1.0f, 0 };
+    // Walk backwards: a pass is kept if it writes something that is needed, imported resources always are.
+    // Everything a kept pass uses is needed by it.
+    for (uint32_t i = 0; i < graph->resource_count; ++i) {
+        graph->resources[i].needed = graph->resources[i].imported;
+        graph->resources[i].first_pass = UINT32_MAX;
+        graph->resources[i].last_pass = UINT32_MAX;
+    }
+    graph->culled_pass_count = 0;
+    for (uint32_t p = graph->pass_count; p-- > 0; ) {
+        VkalGraphPass * pass = &graph->passes[p];
+        pass->culled = 1;
+        for (uint32_t a = 0; a < pass->access_count; ++a) {
+            if (pass->accesses[a].write && graph->resources[pass->accesses[a].resource].needed) {
+                pass->culled = 0;
+            }
+        }
+        if (pass->culled) {
+            graph->culled_pass_count++;
+            continue;
+        }
+        for (uint32_t a = 0; a < pass->access_count; ++a) {
+            graph->resources[pass->accesses[a].resource].needed = 1;
+        }
+    }
 
-    pass_begin_info.clearValueCount = 2;
-    pass_begin_info.pClearValues = clear_values;
-    vkCmdBeginRenderPass(command_buffer, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    // Lifetimes, and everything that touches a resource for the dependencies of transients on memory they share.
+    VkPipelineStageFlags used_stages[VKAL_GRAPH_MAX_RESOURCES] = { 0 };
+    VkAccessFlags used_writes[VKAL_GRAPH_MAX_RESOURCES] = { 0 };
+    for (uint32_t p = 0; p < graph->pass_count; ++p) {
+        VkalGraphPass * pass = &graph->passes[p];
+        if (pass->culled) {
+            continue;
+        }
+        for (uint32_t a = 0; a < pass->access_count; ++a) {
+            VkalGraphAccess * access = &pass->accesses[a];
+            VkalGraphResource * resource = &graph->resources[access->resource];
+            if (resource->first_pass == UINT32_MAX) {
+                resource->first_pass = p;
+            }
+            resource->last_pass = p;
+            used_stages[access->resource] |= access->stages;
+            used_writes[access->resource] |= access->access & VKAL_GRAPH_WRITE_ACCESS;
+        }
+    }
+
+    graph->transient_memory_size = 0;
+    graph->unaliased_memory_size = 0;
+    graph_place_transients(graph);
+
+    VkalGraphState states[VKAL_GRAPH_MAX_RESOURCES];
+    memset(states, 0, sizeof(states));
+    for (uint32_t i = 0; i < graph->resource_count; ++i) {
+        states[i].layout = graph->resources[i].initial_layout;
+        // An imported resource the graph writes may be read before that in the next execution, or by the passes
+        // of this one before the write: start as if everything before the graph wrote it.
+        if (graph->resources[i].imported && used_writes[i]) {
+            states[i].write_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            states[i].write_access = VK_ACCESS_MEMORY_WRITE_BIT;
+        }
+    }
+
+    graph->barrier_count = 0;
+    graph->barrier_batch_count = 0;
+    for (uint32_t p = 0; p < graph->pass_count; ++p) {
+        VkalGraphPass * pass = &graph->passes[p];
+        pass->barrier_count = 0;
+        pass->src_stages = 0;
+        pass->dst_stages = 0;
+        if (pass->culled) {
+            continue;
+        }
+        for (uint32_t a = 0; a < pass->access_count; ++a) {
+            VkalGraphAccess * access = &pass->accesses[a];
+            VkalGraphResource * resource = &graph->resources[access->resource];
+            VkalGraphState * state = &states[access->resource];
+            int transition = resource->is_image && state->layout != access->layout;
+            VkPipelineStageFlags src_stages = 0;
+            VkAccessFlags src_access = 0;
+
+            if (access->write || transition) {
+                src_stages = state->write_stages | state->read_stages;
+                src_access = state->write_access;
+                if (src_stages == 0) {
+                    if (resource->imported) {
+                        // the graph does not know who used it before
+                        src_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                        src_access = VK_ACCESS_MEMORY_WRITE_BIT;
+                    }
+                    else {
+                        // first use of a transient: wait for the images sharing its memory, including
+                        // itself in the previous execution of the graph
+                        for (uint32_t i = 0; i < graph->resource_count; ++i) {
+                            VkalGraphResource * other = &graph->resources[i];
+                            if (!other->imported && other->is_image && other->first_pass != UINT32_MAX && graph_memory_overlaps(resource, other)) {
+                                src_stages |= used_stages[i];
+                                src_access |= used_writes[i];
+                            }
+                        }
+                    }
+                }
+                if (transition || src_access) {
+                    graph_add_barrier(pass->barriers, &pass->barrier_count, access->resource,
+                        src_access, access->access, state->layout, access->layout);
+                }
+                // a write after reads only needs the execution dependency
+                pass->src_stages |= src_stages;
+                pass->dst_stages |= access->stages;
+
+                state->layout = resource->is_image ? access->layout : VK_IMAGE_LAYOUT_UNDEFINED;
+                state->write_stages = access->stages;
+                state->write_access = access->write ? (access->access & VKAL_GRAPH_WRITE_ACCESS) : 0;
+                state->read_stages = 0;
+                state->visible_stages = access->write ? 0 : access->stages;
+                state->visible_access = access->write ? 0 : access->access;
+            }
+            else {
+                // read in the current layout: only if the last write is not visible to it yet. After a transition
+                // by a read write_access is 0, the writes before it are available already, but they still need
+                // a memory barrier to become visible to the stages of this read.
+                if (state->write_stages && ((access->stages & ~state->visible_stages) || (access->access & ~state->visible_access))) {
+                    graph_add_barrier(pass->barriers, &pass->barrier_count, access->resource,
+                        state->write_access, access->access, state->layout, state->layout);
+                    pass->src_stages |= state->write_stages;
+                    pass->dst_stages |= access->stages;
+                    state->visible_stages |= access->stages;
+                    state->visible_access |= access->access;
+                }
+                state->read_stages |= access->stages;
+            }
+        }
+        if (pass->src_stages) {
+            graph->barrier_count += pass->barrier_count;
+            graph->barrier_batch_count++;
+        }
+    }
+
+    graph->final_barrier_count = 0;
+    graph->final_src_stages = 0;
+    graph->final_dst_stages = 0;
+    for (uint32_t i = 0; i < graph->resource_count; ++i) {
+        VkalGraphResource * resource = &graph->resources[i];
+        VkalGraphState * state = &states[i];
+        if (!resource->imported || !resource->is_image ||
+            resource->final_layout == VK_IMAGE_LAYOUT_UNDEFINED || resource->final_layout == state->layout) {
+            continue;
+        }
+        VkPipelineStageFlags src_stages = state->write_stages | state->read_stages;
+        VkAccessFlags src_access = state->write_access;
+        if (src_stages == 0) {
+            src_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            src_access = VK_ACCESS_MEMORY_WRITE_BIT;
+        }
+        // presentation waits on a semaphore, nothing in the command buffer has to wait on the transition
+        int present = resource->final_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        graph_add_barrier(graph->final_barriers, &graph->final_barrier_count, i, src_access,
+            present ? 0 : (VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT), state->layout, resource->final_layout);
+        graph->final_src_stages |= src_stages;
+        graph->final_dst_stages |= present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+    if (graph->final_barrier_count) {
+        graph->barrier_count += graph->final_barrier_count;
+        graph->barrier_batch_count++;
+    }
+
+    graph->compiled = 1;
+}
+
+static void graph_record_barriers(VkalGraph * graph, VkCommandBuffer command_buffer, VkalGraphBarrier * barriers, uint32_t barrier_count,
+    VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages)
+{
+    VkImageMemoryBarrier image_barriers[VKAL_GRAPH_MAX_RESOURCES];
+    VkBufferMemoryBarrier buffer_barriers[VKAL_GRAPH_MAX_RESOURCES];
+    uint32_t image_barrier_count = 0;
+    uint32_t buffer_barrier_count = 0;
+    for (uint32_t i = 0; i < barrier_count; ++i) {
+        VkalGraphBarrier * barrier = &barriers[i];
+        VkalGraphResource * resource = &graph->resources[barrier->resource];
+        if (resource->is_image) {
+            VkImageMemoryBarrier * image_barrier = &image_barriers[image_barrier_count++];
+            memset(image_barrier, 0, sizeof(VkImageMemoryBarrier));
+            image_barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            image_barrier->srcAccessMask = barrier->src_access;
+            image_barrier->dstAccessMask = barrier->dst_access;
+            image_barrier->oldLayout = barrier->old_layout;
+            image_barrier->newLayout = barrier->new_layout;
+            image_barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_barrier->image = resource->image;
+            image_barrier->subresourceRange.aspectMask = resource->aspect;
+            image_barrier->subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+            image_barrier->subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        }
+        else {
+            VkBufferMemoryBarrier * buffer_barrier = &buffer_barriers[buffer_barrier_count++];
+            memset(buffer_barrier, 0, sizeof(VkBufferMemoryBarrier));
+            buffer_barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            buffer_barrier->srcAccessMask = barrier->src_access;
+            buffer_barrier->dstAccessMask = barrier->dst_access;
+            buffer_barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            buffer_barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            buffer_barrier->buffer = resource->buffer;
+            buffer_barrier->offset = resource->offset;
+            buffer_barrier->size = resource->size;
+        }
+    }
+    vkCmdPipelineBarrier(command_buffer, src_stages, dst_stages, 0, 0, NULL,
+        buffer_barrier_count, buffer_barriers, image_barrier_count, image_barriers);
 }
 
-void vkal_end_renderpass(uint32_t image_id)
+/* Records the kept passes with their barriers into command_buffer, which must not be inside of a render pass. */
+void vkal_graph_execute(VkalGraph * graph, VkCommandBuffer command_buffer)
+{
+    assert(graph->compiled && "compile the graph before executing it");
+    for (uint32_t p = 0; p < graph->pass_count; ++p) {
+        VkalGraphPass * pass = &graph->passes[p];
+        if (pass->culled) {
+            continue;
+        }
+        if (pass->src_stages) {
+            graph_record_barriers(graph, command_buffer, pass->barriers, pass->barrier_count, pass->src_stages, pass->dst_stages);
+        }
+        if (pass->execute) {
+            pass->execute(command_buffer, graph, pass->user_data);
+        }
+    }
+    if (graph->final_barrier_count) {
+        graph_record_barriers(graph, command_buffer, graph->final_barriers, graph->final_barrier_count,
+            graph->final_src_stages, graph->final_dst_stages);
+    }
+}
+
+/* VK_NULL_HANDLE for transient images of culled passes. */
+VkImage vkal_graph_get_image(VkalGraph * graph, uint32_t resource)
 {
-    vkCmdEndRenderPass(vkal_info.default_command_buffers[image_id]);
+    assert(resource < graph->resource_count);
+    return graph->resources[resource].image;
 }
 
-void vkal_end_command_buffer(uint32_t image_id)
+VkImageView vkal_graph_get_image_view(VkalGraph * graph, uint32_t resource)
 {
-    VkResult result = vkEndCommandBuffer(vkal_info.default_command_buffers[image_id]);
-    VKAL_ASSERT(result && "failed to end command buffer");
+    assert(resource < graph->resource_count);
+    return graph->resources[resource].image_view;
 }
 
-void vkal_end(VkCommandBuffer command_buffer)
+/* Destroys the transient images. The graph must not be in use by the device anymore. */
+void vkal_graph_destroy(VkalGraph * graph)
 {
-    vkCmdEndRenderPass(command_buffer);
-    VkResult result = vkEndCommandBuffer(command_buffer);
-    VKAL_ASSERT(result && "failed to end command buffer");
+    for (uint32_t i = 0; i < graph->resource_count; ++i) {
+        VkalGraphResource * resource = &graph->resources[i];
+        if (resource->imported) {
+            continue;
+        }
+        if (resource->image_view != VK_NULL_HANDLE) {
+            vkDestroyImageView(vkal_info.device, resource->image_view, NULL);
+            resource->image_view = VK_NULL_HANDLE;
+        }
+        if (resource->image != VK_NULL_HANDLE) {
+            vkDestroyImage(vkal_info.device, resource->image, NULL);
+            resource->image = VK_NULL_HANDLE;
+        }
+    }
+    if (graph->transient_memory != VK_NULL_HANDLE) {
+        vkFreeMemory(vkal_info.device, graph->transient_memory, NULL);
+        graph->transient_memory = VK_NULL_HANDLE;
+    }
+    graph->compiled = 0;
 }
 
-void vkal_bind_descriptor_set(
-	uint32_t image_id,
-	VkDescriptorSet * descriptor_set,
-	VkPipelineLayout pipeline_layout)
+uint32_t vkal_get_image(void)
 {
-    vkal_bind_descriptor_sets_from_to(image_id, descriptor_set, 0, 1, pipeline_layout);
+    timeline_wait(&vkal_info.graphics_timeline, vkal_info.in_flight_values[vkal_info.frames_rendered]);
+    
+    uint32_t image_index;
+    // don't actually wait for the semaphore here. just associate it with this operation.
+    // check when needed during vkQueueSubmit
+    VkResult result = vkAcquireNextImageKHR(vkal_info.device,
+					    vkal_info.swapchain,
+					    UINT64_MAX, vkal_info.image_available_semaphores[vkal_info.frames_rendered],
+					    VK_NULL_HANDLE, &image_index);
+    
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        vkal_info.should_recreate_swapchain = 0;
+        recreate_swapchain();
+        return 666; // TODO: return -1 here. This image is useless when too old. User has to check for this!
+    }
+
+    // The caller records into the default command buffer of the image, which is only guaranteed
+    // to be done if the last frame that used this image is, not the frame waited on above.
+    timeline_wait(&vkal_info.graphics_timeline, vkal_info.image_in_flight_values[image_index]);
+    
+    return image_index;
 }
 
-void vkal_bind_descriptor_sets_from_to(
-    uint32_t image_id,
-    VkDescriptorSet* descriptor_sets,
-    uint32_t first_set, uint32_t set_count,
-    VkPipelineLayout pipeline_layout)
+void create_compute_submits(void)
 {
-    vkCmdBindDescriptorSets(
-        vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipeline_layout, first_set, set_count, descriptor_sets, 0, 0);
+    VkCommandPoolCreateInfo cmdpool_info = { 0 };
+    cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdpool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    cmdpool_info.queueFamilyIndex = vkal_info.compute_queue != VK_NULL_HANDLE ?
+        vkal_info.queue_families.compute_family : vkal_info.queue_families.graphics_family;
+    for (uint32_t i = 0; i < VKAL_MAX_COMPUTE_SUBMITS; ++i) {
+        VkalComputeSubmit * submit = &vkal_info.compute_submits[i];
+        memset(submit, 0, sizeof(VkalComputeSubmit));
+        VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &submit->command_pool);
+        VKAL_ASSERT(result && "failed to create compute command pool");
+
+        VkCommandBufferAllocateInfo alloc_info = { 0 };
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = submit->command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &submit->command_buffer);
+        VKAL_ASSERT(result && "failed to allocate compute command buffer");
+    }
+    vkal_info.compute_submit_current = 0;
+    vkal_info.compute_wait_value = 0;
+    vkal_info.compute_wait_stages = 0;
+    vkal_info.compute_graphics_wait_value = 0;
+    vkal_info.compute_graphics_wait_stages = 0;
+    vkal_info.graphics_release_pending = 0;
 }
 
-void vkal_bind_descriptor_sets(
-	uint32_t image_id,
-	VkDescriptorSet * descriptor_sets, uint32_t descriptor_set_count,
-	uint32_t * dynamic_offsets, uint32_t dynamic_offset_count,
-	VkPipelineLayout pipeline_layout)
+/* Compute submits go to the graphics queue if there is no dedicated compute queue. */
+static VkalTimeline * compute_submit_timeline(void)
 {
-    vkCmdBindDescriptorSets(
-		vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipeline_layout, 0, descriptor_set_count, descriptor_sets,
-		dynamic_offset_count, dynamic_offsets);
+    return vkal_info.compute_queue != VK_NULL_HANDLE ? &vkal_info.compute_timeline : &vkal_info.graphics_timeline;
 }
 
-void vkal_bind_descriptor_set_dynamic(
-	uint32_t image_id,
-	VkDescriptorSet * descriptor_sets,
-	VkPipelineLayout pipeline_layout, uint32_t dynamic_offset)
+void destroy_compute_submits(void)
 {
-    vkCmdBindDescriptorSets(
-		vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipeline_layout, 0, 1, descriptor_sets, 1, &dynamic_offset);
+    if (vkal_info.compute_queue != VK_NULL_HANDLE) {
+        vkQueueWaitIdle(vkal_info.compute_queue);
+    }
+    for (uint32_t i = 0; i < VKAL_MAX_COMPUTE_SUBMITS; ++i) {
+        VkalComputeSubmit * submit = &vkal_info.compute_submits[i];
+        vkDestroyCommandPool(vkal_info.device, submit->command_pool, 0);
+    }
 }
 
-void vkal_bind_descriptor_set2(
-	VkCommandBuffer command_buffer,
-	uint32_t first_set, VkDescriptorSet * descriptor_sets, uint32_t descriptor_set_count,
-	VkPipelineLayout pipeline_layout)
+/* Begins a command buffer for compute work that runs next to the graphics work of the frame, on the dedicated
+   compute queue if there is one. Without one it goes to the graphics queue and simply runs before the frame.
+   Only one compute command buffer can be recorded at a time. */
+VkCommandBuffer vkal_begin_compute(void)
 {
-    vkCmdBindDescriptorSets(
-		command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, 
-        pipeline_layout, first_set, descriptor_set_count, descriptor_sets, 0, 0);
+    VkalComputeSubmit * submit = &vkal_info.compute_submits[vkal_info.compute_submit_current];
+    assert(!submit->recording && "vkal_begin_compute: already recording, call vkal_compute_submit first!");
+    timeline_wait(compute_submit_timeline(), submit->timeline_value);
+    vkResetCommandPool(vkal_info.device, submit->command_pool, 0);
+
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkResult result = vkBeginCommandBuffer(submit->command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin compute command buffer");
+    submit->recording = 1;
+    return submit->command_buffer;
+}
+
+/* Submits the compute work. The next graphics submit (vkal_queue_submit or vkal_submit_frame) waits for it in wait_stage,
+   eg. VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT for culling results, so graphics work in earlier stages still overlaps.
+   On a dedicated compute queue the compute work only waits for the last upload batch and the last graphics submit
+   with a vkal_graphics_release_buffer in it, so it can overlap the previous frame. Anything else on the graphics queue,
+   eg. the previous frame still reading a buffer the compute work overwrites, needs vkal_compute_wait_graphics.
+   Buffers written or read by both queues still need vkal_graphics_release_buffer / vkal_compute_acquire_buffer
+   (and the reverse pair) unless only one side needs the contents. */
+void vkal_compute_submit(VkCommandBuffer command_buffer, VkPipelineStageFlags wait_stage)
+{
+    VkalComputeSubmit * submit = &vkal_info.compute_submits[vkal_info.compute_submit_current];
+    assert(submit->recording && submit->command_buffer == command_buffer && "vkal_compute_submit: not from vkal_begin_compute!");
+    VkResult result = vkEndCommandBuffer(command_buffer);
+    VKAL_ASSERT(result && "failed to end compute command buffer");
+
+    // The uploads the compute work reads have to go first. Upload batches end on the graphics queue.
+    vkal_upload_flush();
+
+    VkQueue queue = vkal_info.graphics_queue;
+    uint32_t wait_count = 0;
+    if (vkal_info.compute_queue != VK_NULL_HANDLE) {
+        queue = vkal_info.compute_queue;
+        wait_count = vkal_info.compute_graphics_wait_stages ? 1 : 0;
+    }
+    submit->timeline_value = timeline_submit(compute_submit_timeline(), queue, &command_buffer, 1,
+        &vkal_info.graphics_timeline.semaphore, &vkal_info.compute_graphics_wait_value, &vkal_info.compute_graphics_wait_stages,
+        wait_count, VK_NULL_HANDLE);
+    vkal_info.compute_graphics_wait_stages = 0;
+    submit->recording = 0;
+    vkal_info.compute_wait_value = submit->timeline_value;
+    vkal_info.compute_wait_stages |= wait_stage;
+    vkal_info.compute_submit_current = (vkal_info.compute_submit_current + 1) % VKAL_MAX_COMPUTE_SUBMITS;
 }
 
-void vkal_viewport(VkCommandBuffer command_buffer, float x, float y, float width, float height)
+/* Makes the next vkal_compute_submit wait in wait_stage until the graphics timeline reaches value, eg. vkal_submitted_value()
+   after the frame that still reads what the compute work writes. Nothing to do without a dedicated compute queue. */
+void vkal_compute_wait_graphics(uint64_t value, VkPipelineStageFlags wait_stage)
 {
-    VkViewport viewport = { 0 };
-    viewport.x = x;
-    viewport.y = y;
-    viewport.width = width; // (float)vp_width;
-    viewport.height = height; // (float)vp_height;
-    viewport.minDepth = 0.f;
-    viewport.maxDepth = 1.f;
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkal_info.compute_graphics_wait_value = VKAL_MAX(vkal_info.compute_graphics_wait_value, value);
+    vkal_info.compute_graphics_wait_stages |= wait_stage;
 }
 
-void vkal_scissor(VkCommandBuffer command_buffer, float offset_x, float offset_y, float extent_x, float extent_y)
+/* Notes a graphics submit that may hold release barriers for the compute queue. */
+static void graphics_release_submitted(uint64_t value)
 {
-    VkRect2D scissor      = { 0 };
-    scissor.offset.x      = (int32_t)offset_x;
-    scissor.offset.y      = (int32_t)offset_y;
-    scissor.extent.width  = (uint32_t)extent_x;
-    scissor.extent.height = (uint32_t)extent_y;
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor); 
+    if (vkal_info.graphics_release_pending) {
+        vkal_compute_wait_graphics(value, VKAL_COMPUTE_CONSUME_STAGES);
+        vkal_info.graphics_release_pending = 0;
+    }
 }
 
-
-void vkal_draw_indexed(
-    uint32_t image_id, VkPipeline pipeline,
-    VkDeviceSize index_buffer_offset, uint32_t index_count,
-    VkDeviceSize vertex_buffer_offset, uint32_t instance_count)
+/* Adds a wait for the compute work the graphics queue has not waited on yet. Returns the new wait count. */
+static uint32_t add_compute_wait(VkSemaphore * wait_semaphores, uint64_t * wait_values, VkPipelineStageFlags * wait_stages, uint32_t wait_count)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdBindIndexBuffer(
-		vkal_info.default_command_buffers[image_id],
-		vkal_info.default_index_buffer.buffer, index_buffer_offset, VK_INDEX_TYPE_UINT16);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-	vertex_buffers[0] = vkal_info.default_vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDrawIndexed(vkal_info.default_command_buffers[image_id], index_count, instance_count, 0, 0, 0);
+    if (vkal_info.compute_wait_stages) {
+        wait_semaphores[wait_count] = compute_submit_timeline()->semaphore;
+        wait_values[wait_count] = vkal_info.compute_wait_value;
+        wait_stages[wait_count] = vkal_info.compute_wait_stages;
+        ++wait_count;
+        vkal_info.compute_wait_stages = 0;
+    }
+    return wait_count;
 }
 
-void vkal_draw_indexed_from_buffers(
-    VkalBuffer index_buffer, uint64_t index_buffer_offset, 
-	uint32_t index_count, 
-	VkalBuffer vertex_buffer, uint64_t vertex_buffer_offset,
-    uint32_t image_id, 
-	VkPipeline pipeline)
+/* Queue family ownership transfer of a buffer between the compute and the graphics family. Both halves are needed,
+   the release on the queue that owned the buffer and the acquire on the other one, after the semaphore.
+   Nothing to do without a dedicated compute queue. */
+static void buffer_ownership_barrier(VkCommandBuffer command_buffer, VkBuffer buffer, uint32_t src_family, uint32_t dst_family,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdBindIndexBuffer(vkal_info.default_command_buffers[image_id],
-			 index_buffer.buffer, index_buffer_offset, VK_INDEX_TYPE_UINT16);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDrawIndexed(vkal_info.default_command_buffers[image_id], index_count, 1, 0, 0, 0);
+    if (vkal_info.compute_queue == VK_NULL_HANDLE) {
+        return;
+    }
+    VkBufferMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = src_family;
+    barrier.dstQueueFamilyIndex = dst_family;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 1, &barrier, 0, NULL);
 }
 
-// TODO: Bind pipeline not here. Let it user do manually?
-void vkal_draw(
-    uint32_t image_id, VkPipeline pipeline,
-    VkDeviceSize vertex_buffer_offset, uint32_t vertex_count)
+void vkal_compute_release_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags src_stage, VkAccessFlags src_access)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vkal_info.default_vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDraw(vkal_info.default_command_buffers[image_id], vertex_count, 1, 0, 0);
+    buffer_ownership_barrier(command_buffer, buffer, vkal_info.queue_families.compute_family, vkal_info.queue_families.graphics_family,
+        src_stage, src_access, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
 }
 
-void vkal_draw_from_buffers(
-    VkalBuffer vertex_buffer,
-    uint32_t image_id, 
-	VkPipeline pipeline,
-    VkDeviceSize vertex_buffer_offset, uint32_t vertex_count)
+void vkal_graphics_acquire_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDraw(vkal_info.default_command_buffers[image_id], vertex_count, 1, 0, 0);
+    buffer_ownership_barrier(command_buffer, buffer, vkal_info.queue_families.compute_family, vkal_info.queue_families.graphics_family,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, dst_stage, dst_access);
 }
 
-void vkal_draw_indexed2(
-    VkCommandBuffer command_buffer, 
-	VkPipeline pipeline,
-    VkDeviceSize index_buffer_offset, uint32_t index_count,
-    VkDeviceSize vertex_buffer_offset)
+/* The next compute submit waits for the graphics submit after this (vkal_queue_submit or vkal_submit_frame). Command buffers
+   submitted some other way need vkal_compute_wait_graphics. */
+void vkal_graphics_release_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags src_stage, VkAccessFlags src_access)
 {
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    
-    VkViewport viewport = { 0 };
-    viewport.x = 0.f;
-    viewport.y = 0.f;
-    viewport.width = (float)vkal_info.swapchain_extent.width; // (float)vp_width;
-    viewport.height = (float)vkal_info.swapchain_extent.height; // (float)vp_height;
-    viewport.minDepth = 0.f;
-    viewport.maxDepth = 1.f;
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-    
-    VkRect2D scissor = { 0 };
-    scissor.offset = (VkOffset2D){ 0,0 };
-    scissor.extent = vkal_info.swapchain_extent;
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-    
-    vkCmdBindIndexBuffer(command_buffer,
-			 vkal_info.default_index_buffer.buffer, index_buffer_offset, VK_INDEX_TYPE_UINT16);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vkal_info.default_vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDrawIndexed(command_buffer, index_count, 1, 0, 0, 0);
+    vkal_info.graphics_release_pending = vkal_info.compute_queue != VK_NULL_HANDLE;
+    buffer_ownership_barrier(command_buffer, buffer, vkal_info.queue_families.graphics_family, vkal_info.queue_families.compute_family,
+        src_stage, src_access, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
 }
 
-uint32_t vkal_get_image(void)
+void vkal_compute_acquire_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
 {
-    vkWaitForFences(vkal_info.device, 1, &vkal_info.in_flight_fences[vkal_info.frames_rendered], VK_TRUE, UINT64_MAX);
-    vkResetFences(vkal_info.device, 1, &vkal_info.in_flight_fences[vkal_info.frames_rendered]);
-    
-    uint32_t image_index;
-    // don't actually wait for the semaphore here. just associate it with this operation.
-    // check when needed during vkQueueSubmit
-    VkResult result = vkAcquireNextImageKHR(vkal_info.device,
-					    vkal_info.swapchain,
-					    UINT64_MAX, vkal_info.image_available_semaphores[vkal_info.frames_rendered],
-					    VK_NULL_HANDLE, &image_index);
-    
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        vkal_info.should_recreate_swapchain = 0;
-        recreate_swapchain();
-        return 666; // TODO: return -1 here. This image is useless when too old. User has to check for this!
-    }
-    else {
-        // TODO
-    }
-    
-    return image_index;
+    buffer_ownership_barrier(command_buffer, buffer, vkal_info.queue_families.graphics_family, vkal_info.queue_families.compute_family,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, dst_stage, dst_access);
 }
 
 void vkal_queue_submit(VkCommandBuffer * command_buffers, uint32_t command_buffer_count)
 {
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkSemaphore wait_semaphores[1];
+    // Uploads recorded since the last frame go out in one batch ahead of the frame.
+    vkal_upload_flush();
+
+    // wait until image is available from swapchain ringbuffer
+    VkSemaphore wait_semaphores[2];
+    uint64_t wait_values[2] = { 0, 0 };
+    VkPipelineStageFlags wait_stages[2];
     wait_semaphores[0] = vkal_info.image_available_semaphores[vkal_info.frames_rendered];
-    VkPipelineStageFlags wait_stages[1];
     wait_stages[0] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = wait_semaphores; // wait until image is available from swapchain ringbuffer
-    submit_info.pWaitDstStageMask = wait_stages;
-    submit_info.commandBufferCount = command_buffer_count;
-    submit_info.pCommandBuffers = command_buffers;
-    VkSemaphore signal_semaphores[1];
-    signal_semaphores[0] = vkal_info.render_finished_semaphores[vkal_info.frames_rendered];
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = signal_semaphores;
-    VkResult result = vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info,
-				    vkal_info.in_flight_fences[vkal_info.frames_rendered]);
-    VKAL_ASSERT(result && "Failed to submit command buffer to queue!");
+    uint32_t wait_count = add_compute_wait(wait_semaphores, wait_values, wait_stages, 1);
+    vkal_info.in_flight_values[vkal_info.frames_rendered] = timeline_submit(&vkal_info.graphics_timeline, vkal_info.graphics_queue,
+        command_buffers, command_buffer_count, wait_semaphores, wait_values, wait_stages, wait_count,
+        vkal_info.render_finished_semaphores[vkal_info.frames_rendered]);
+    graphics_release_submitted(vkal_info.in_flight_values[vkal_info.frames_rendered]);
+    vkal_info.frame_submitted = 1;
+    vkal_info.frame_render_finished = vkal_info.render_finished_semaphores[vkal_info.frames_rendered];
 }
 
 void vkal_present(uint32_t image_id)
@@ -2907,6 +6308,8 @@ void vkal_present(uint32_t image_id)
     present_info.pSwapchains = swap_chains;
     present_info.pImageIndices = &image_id;
     VkResult result = vkQueuePresentKHR(vkal_info.present_queue, &present_info);
+    vkal_info.frame_submitted = 0;
+    vkal_info.image_in_flight_values[image_id] = vkal_info.in_flight_values[vkal_info.frames_rendered];
     
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || vkal_info.should_recreate_swapchain) {
 		vkal_info.should_recreate_swapchain = 0;
@@ -2923,12 +6326,7 @@ void vkal_present(uint32_t image_id)
 void create_default_semaphores(void)
 {
     for (int i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
-		VkFenceCreateInfo fenceInfo = { 0 };
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.pNext = NULL;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-		VkResult result = vkCreateFence(vkal_info.device, &fenceInfo, NULL, &vkal_info.in_flight_fences[i]);
-		VKAL_ASSERT(result && "failed to create draw-fence");
+		vkal_info.in_flight_values[i] = 0;
 
 		VkSemaphoreCreateInfo sem_info = (VkSemaphoreCreateInfo){ 0 };
 		sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -2936,7 +6334,270 @@ void create_default_semaphores(void)
 		vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.render_finished_semaphores[i]);
 
     }
-    //memset(vkal_info.image_in_flight_fences, VK_NULL_HANDLE, vkal_info.swapchain_image_count * sizeof(VkFence));
+    for (int i = 0; i < VKAL_MAX_SWAPCHAIN_IMAGES; ++i) {
+        VkSemaphoreCreateInfo sem_info = { 0 };
+        sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.present_semaphores[i]);
+    }
+}
+
+void create_frame_contexts(uint32_t count)
+{
+    assert(count > 0 && count <= VKAL_MAX_FRAMES_IN_FLIGHT && "create_frame_contexts: invalid number of frames in flight!");
+    VkBufferUsageFlags scratch_usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    for (uint32_t i = 0; i < count; ++i) {
+        VkalFrameContext * frame = &vkal_info.frames[i];
+        memset(frame, 0, sizeof(VkalFrameContext));
+
+        VkCommandPoolCreateInfo cmdpool_info = { 0 };
+        cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdpool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        cmdpool_info.queueFamilyIndex = vkal_info.queue_families.graphics_family;
+        VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &frame->command_pool);
+        VKAL_ASSERT(result && "failed to create frame command pool");
+
+        VkCommandBufferAllocateInfo alloc_info = { 0 };
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = frame->command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &frame->command_buffer);
+        VKAL_ASSERT(result && "failed to allocate frame command buffer");
+
+        for (uint32_t t = 0; t < VKAL_MAX_RECORD_THREADS; ++t) {
+            result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &frame->thread_command_pools[t]);
+            VKAL_ASSERT(result && "failed to create thread command pool");
+            alloc_info.commandPool = frame->thread_command_pools[t];
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &frame->thread_command_buffers[t]);
+            VKAL_ASSERT(result && "failed to allocate secondary command buffer");
+        }
+
+        VkSemaphoreCreateInfo sem_info = { 0 };
+        sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        vkCreateSemaphore(vkal_info.device, &sem_info, 0, &frame->image_available);
+
+        VkalBuffer scratch = create_buffer(VKAL_FRAME_SCRATCH_SIZE, scratch_usage);
+        VkMemoryRequirements memory_requirements = { 0 };
+        vkGetBufferMemoryRequirements(vkal_info.device, scratch.buffer, &memory_requirements);
+        uint32_t mem_type_index = find_memory_type_index(memory_requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0);
+        assert(mem_type_index != UINT32_MAX && "no host coherent memory for frame scratch!");
+        frame->scratch_buffer = scratch.buffer;
+        frame->scratch_memory = allocate_memory(memory_requirements.size, mem_type_index);
+        result = vkBindBufferMemory(vkal_info.device, frame->scratch_buffer, frame->scratch_memory, 0);
+        VKAL_ASSERT(result && "failed to bind frame scratch memory");
+        result = vkMapMemory(vkal_info.device, frame->scratch_memory, 0, VK_WHOLE_SIZE, 0, (void**)&frame->scratch_mapped);
+        VKAL_ASSERT(result && "failed to map frame scratch memory");
+        frame->scratch_size = VKAL_FRAME_SCRATCH_SIZE;
+    }
+    vkal_info.frame_count = count;
+    vkal_info.frame_index = 0;
+    vkal_info.frame_active = 0;
+}
+
+void destroy_frame_contexts(void)
+{
+    for (uint32_t i = 0; i < vkal_info.frame_count; ++i) {
+        VkalFrameContext * frame = &vkal_info.frames[i];
+        for (uint32_t t = 0; t < VKAL_MAX_RECORD_THREADS; ++t) {
+            if (frame->thread_command_pools[t] != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(vkal_info.device, frame->thread_command_pools[t], NULL);
+            }
+        }
+        vkDestroyBuffer(vkal_info.device, frame->scratch_buffer, NULL);
+        vkUnmapMemory(vkal_info.device, frame->scratch_memory);
+        vkFreeMemory(vkal_info.device, frame->scratch_memory, NULL);
+        vkDestroySemaphore(vkal_info.device, frame->image_available, NULL);
+        vkDestroyCommandPool(vkal_info.device, frame->command_pool, NULL);
+    }
+    vkal_info.frame_count = 0;
+}
+
+/* Two frames in flight let the CPU record a frame while the GPU renders the previous one. More only help
+   if the CPU time per frame varies a lot, and every additional frame adds a frame of latency. */
+void vkal_set_frames_in_flight(uint32_t count)
+{
+    assert(!vkal_info.frame_active && "vkal_set_frames_in_flight: called between vkal_begin_frame and vkal_end_frame!");
+    vkDeviceWaitIdle(vkal_info.device);
+    memset(vkal_info.image_in_flight_values, 0, sizeof(vkal_info.image_in_flight_values));
+    destroy_frame_contexts();
+    create_frame_contexts(count);
+}
+
+/* Waits until the next frame context is free, acquires a swapchain image and resets the context's command pool.
+   Record into frame->command_buffer, or use the image_id based helpers with frame->image_id, then hand the
+   frame to vkal_end_frame. The command buffer is not begun yet, vkal_begin or vkal_begin_command_buffer do that.
+   Returns NULL if the swapchain had to be recreated, skip the frame in that case. */
+VkalFrameContext * vkal_begin_frame(void)
+{
+    assert(!vkal_info.frame_active && "vkal_begin_frame: the previous frame was not ended!");
+    VkalFrameContext * frame = &vkal_info.frames[vkal_info.frame_index];
+    timeline_wait(&vkal_info.graphics_timeline, frame->timeline_value);
+
+    VkResult result = vkAcquireNextImageKHR(vkal_info.device, vkal_info.swapchain, UINT64_MAX,
+        frame->image_available, VK_NULL_HANDLE, &frame->image_id);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        vkal_info.should_recreate_swapchain = 0;
+        recreate_swapchain();
+        return NULL;
+    }
+
+    // With more frames in flight than swapchain images, the last frame that rendered to this image
+    // can still be pending even though this context is free.
+    timeline_wait(&vkal_info.graphics_timeline, vkal_info.image_in_flight_values[frame->image_id]);
+
+    result = vkResetCommandPool(vkal_info.device, frame->command_pool, 0);
+    VKAL_ASSERT(result && "failed to reset frame command pool");
+    for (uint32_t t = 0; t < VKAL_MAX_RECORD_THREADS; ++t) {
+        if (frame->thread_recorded[t]) {
+            result = vkResetCommandPool(vkal_info.device, frame->thread_command_pools[t], 0);
+            VKAL_ASSERT(result && "failed to reset thread command pool");
+        }
+        frame->thread_recorded[t] = 0;
+    }
+    memset(&frame->state, 0, sizeof(VkalCommandState));
+    memset(frame->thread_states, 0, sizeof(frame->thread_states));
+    frame->scratch_offset = 0;
+    vkal_info.frame_active = 1;
+    return frame;
+}
+
+/* Submits the frame's command buffer, which has to be ended already. The image is presented by vkal_present_frame,
+   readbacks issued in between run before the present (eg. to capture the swapchain image). */
+void vkal_submit_frame(VkalFrameContext * frame)
+{
+    assert(vkal_info.frame_active && frame == &vkal_info.frames[vkal_info.frame_index]);
+
+    // Uploads recorded during the frame go out in one batch ahead of it.
+    vkal_upload_flush();
+
+    VkSemaphore wait_semaphores[2];
+    uint64_t wait_values[2] = { 0, 0 };
+    VkPipelineStageFlags wait_stages[2];
+    wait_semaphores[0] = frame->image_available;
+    wait_stages[0] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    uint32_t wait_count = add_compute_wait(wait_semaphores, wait_values, wait_stages, 1);
+    // The present semaphore belongs to the image: the frame's timeline value being reached says nothing
+    // about the present having waited, but the image is only acquired again after its present.
+    VkSemaphore present_semaphore = vkal_info.present_semaphores[frame->image_id];
+    frame->timeline_value = timeline_submit(&vkal_info.graphics_timeline, vkal_info.graphics_queue, &frame->command_buffer, 1,
+        wait_semaphores, wait_values, wait_stages, wait_count, present_semaphore);
+    vkal_info.image_in_flight_values[frame->image_id] = frame->timeline_value;
+    graphics_release_submitted(frame->timeline_value);
+    vkal_info.frame_active = 0;
+    vkal_info.frame_submitted = 1;
+    vkal_info.frame_render_finished = present_semaphore;
+}
+
+/* Presents the image of the frame submitted by vkal_submit_frame. */
+void vkal_present_frame(VkalFrameContext * frame)
+{
+    assert(vkal_info.frame_submitted && frame == &vkal_info.frames[vkal_info.frame_index]);
+
+    VkPresentInfoKHR present_info = { 0 };
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.waitSemaphoreCount = 1;
+    present_info.pWaitSemaphores = &vkal_info.frame_render_finished;
+    present_info.swapchainCount = 1;
+    present_info.pSwapchains = &vkal_info.swapchain;
+    present_info.pImageIndices = &frame->image_id;
+    VkResult result = vkQueuePresentKHR(vkal_info.present_queue, &present_info);
+    vkal_info.frame_submitted = 0;
+    vkal_info.frame_index = (vkal_info.frame_index + 1) % vkal_info.frame_count;
+
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || vkal_info.should_recreate_swapchain) {
+        vkal_info.should_recreate_swapchain = 0;
+        recreate_swapchain();
+    }
+}
+
+/* Submits the frame's command buffer, which has to be ended already, and presents its image. */
+void vkal_end_frame(VkalFrameContext * frame)
+{
+    vkal_submit_frame(frame);
+    vkal_present_frame(frame);
+}
+
+/* Begins the secondary command buffer of thread_index for this frame. It continues subpass 0 of render_pass, which the
+   frame's primary begins with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS (see vkal_begin2). framebuffer may be
+   VK_NULL_HANDLE, passing it lets some drivers do better. Dynamic state like the viewport is not inherited from the
+   primary and has to be set in every secondary. Each thread_index must only be used by one thread at a time. */
+VkCommandBuffer vkal_begin_secondary(VkalFrameContext * frame, uint32_t thread_index, VkRenderPass render_pass, VkFramebuffer framebuffer)
+{
+    assert(thread_index < VKAL_MAX_RECORD_THREADS && "vkal_begin_secondary: thread_index out of range!");
+    assert(!frame->thread_recorded[thread_index] && "vkal_begin_secondary: thread already recorded this frame!");
+
+    VkCommandBufferInheritanceInfo inheritance_info = { 0 };
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = framebuffer;
+    // Dynamic rendering inherits the attachment formats of the default targets instead, framebuffer is ignored.
+    VkCommandBufferInheritanceRenderingInfo rendering_inheritance = { 0 };
+    if (vkal_info.dynamic_rendering && (render_pass == VK_NULL_HANDLE || render_pass == vkal_info.render_pass ||
+        render_pass == vkal_info.render_to_image_render_pass)) {
+        rendering_inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        rendering_inheritance.colorAttachmentCount = 1;
+        rendering_inheritance.pColorAttachmentFormats = &vkal_info.swapchain_image_format;
+        rendering_inheritance.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
+        rendering_inheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        inheritance_info.pNext = &rendering_inheritance;
+        inheritance_info.renderPass = VK_NULL_HANDLE;
+        inheritance_info.framebuffer = VK_NULL_HANDLE;
+    }
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+    VkCommandBuffer command_buffer = frame->thread_command_buffers[thread_index];
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin secondary command buffer");
+    memset(&frame->thread_states[thread_index], 0, sizeof(VkalCommandState));
+    frame->thread_recorded[thread_index] = 1;
+    return command_buffer;
+}
+
+void vkal_end_secondary(VkCommandBuffer command_buffer)
+{
+    VkResult result = vkEndCommandBuffer(command_buffer);
+    VKAL_ASSERT(result && "failed to end secondary command buffer");
+}
+
+/* Executes the secondaries recorded this frame in the frame's primary, ordered by thread_index. Call it
+   from the thread that records the primary after all threads ended their secondaries. */
+void vkal_execute_secondaries(VkalFrameContext * frame)
+{
+    VkCommandBuffer command_buffers[VKAL_MAX_RECORD_THREADS];
+    uint32_t count = 0;
+    for (uint32_t t = 0; t < VKAL_MAX_RECORD_THREADS; ++t) {
+        if (frame->thread_recorded[t]) {
+            command_buffers[count++] = frame->thread_command_buffers[t];
+        }
+    }
+    if (count > 0) {
+        vkCmdExecuteCommands(frame->command_buffer, count, command_buffers);
+        memset(&frame->state, 0, sizeof(VkalCommandState));
+    }
+}
+
+/* Bump allocates size bytes from the frame's scratch buffer and returns the offset into frame->scratch_buffer.
+   The memory is host coherent and stays valid until the context comes around again, which makes it the place
+   for per frame uniforms and dynamic geometry. alignment 0 aligns for uniform and storage buffer offsets. */
+VkDeviceSize vkal_frame_scratch_alloc(VkalFrameContext * frame, VkDeviceSize size, VkDeviceSize alignment, void ** out_mapped)
+{
+    if (alignment == 0) {
+        VkPhysicalDeviceLimits const * limits = &vkal_info.physical_device_properties.limits;
+        alignment = VKAL_MAX(limits->minUniformBufferOffsetAlignment, limits->minStorageBufferOffsetAlignment);
+    }
+    VkDeviceSize offset = (frame->scratch_offset + alignment - 1) / alignment * alignment;
+    assert(offset + size <= frame->scratch_size && "vkal_frame_scratch_alloc: out of frame scratch memory, increase VKAL_FRAME_SCRATCH_SIZE!");
+    frame->scratch_offset = offset + size;
+    if (out_mapped) {
+        *out_mapped = frame->scratch_mapped + offset;
+    }
+    return offset;
 }
 
 void allocate_default_device_memory_uniform(void)
@@ -3055,6 +6716,82 @@ uint32_t vkal_destroy_device_memory(uint32_t id)
     return is_destroyed;
 }
 
+/* Finds room for the image in an image heap of the right memory type and size class. A new heap is allocated
+   when none of the existing ones can hold it. Large images get a heap of their own. */
+void bind_image_memory(uint32_t image_id, VkMemoryPropertyFlags memory_property_flags)
+{
+    VkImage image = get_image(image_id);
+    VkMemoryRequirements image_memory_requirements = { 0 };
+    vkGetImageMemoryRequirements(vkal_info.device, image, &image_memory_requirements);
+    uint32_t mem_type_index = check_memory_type_index(image_memory_requirements.memoryTypeBits, memory_property_flags);
+
+    VkalImageHeapClass size_class = VKAL_IMAGE_HEAP_CLASS_DEDICATED;
+    VkDeviceSize heap_size = image_memory_requirements.size;
+    if (image_memory_requirements.size <= VKAL_IMAGE_HEAP_SMALL_LIMIT) {
+        size_class = VKAL_IMAGE_HEAP_CLASS_SMALL;
+        heap_size = VKAL_IMAGE_HEAP_SMALL_SIZE;
+    }
+    else if (image_memory_requirements.size <= VKAL_IMAGE_HEAP_LARGE_LIMIT) {
+        size_class = VKAL_IMAGE_HEAP_CLASS_LARGE;
+        heap_size = VKAL_IMAGE_HEAP_LARGE_SIZE;
+    }
+
+    uint32_t     heap_index = VKAL_INVALID_ID;
+    VkDeviceSize offset = 0;
+    if (size_class != VKAL_IMAGE_HEAP_CLASS_DEDICATED) {
+        for (uint32_t i = 0; i < VKAL_MAX_IMAGE_HEAPS; ++i) {
+            VkalImageHeap * heap = &vkal_info.image_heaps[i];
+            if (!heap->used || heap->size_class != size_class || heap->memory.mem_type_index != mem_type_index) {
+                continue;
+            }
+            if (vkal_device_memory_alloc(&heap->memory, image_memory_requirements.size, image_memory_requirements.alignment, 0, &offset)) {
+                heap_index = i;
+                break;
+            }
+        }
+    }
+
+    if (heap_index == VKAL_INVALID_ID) {
+        for (heap_index = 0; heap_index < VKAL_MAX_IMAGE_HEAPS; ++heap_index) {
+            if (!vkal_info.image_heaps[heap_index].used) {
+                break;
+            }
+        }
+        /* Every image above VKAL_IMAGE_HEAP_LARGE_LIMIT takes a slot of its own, so many large images can
+           exhaust the heap table even when the paged heaps still have room. */
+        if (heap_index == VKAL_MAX_IMAGE_HEAPS) {
+            printf("[VKAL] bind_image_memory: all %d image heaps are in use (images above %llu bytes take one each)!\n",
+                   VKAL_MAX_IMAGE_HEAPS, (unsigned long long)VKAL_IMAGE_HEAP_LARGE_LIMIT);
+            printf("[VKAL] bind_image_memory: raise VKAL_MAX_IMAGE_HEAPS or keep fewer large images alive.\n");
+            VKAL_ASSERT(VK_ERROR_TOO_MANY_OBJECTS);
+        }
+        VkalImageHeap * heap = &vkal_info.image_heaps[heap_index];
+        init_device_memory(&heap->memory, allocate_memory(heap_size, mem_type_index), heap_size, 1, mem_type_index);
+        heap->size_class = size_class;
+        heap->used = 1;
+        int allocated = vkal_device_memory_alloc(&heap->memory, image_memory_requirements.size, image_memory_requirements.alignment, 0, &offset);
+        assert(allocated && "bind_image_memory: image does not fit into a fresh heap!");
+    }
+
+    VkResult result = vkBindImageMemory(vkal_info.device, image, vkal_info.image_heaps[heap_index].memory.vk_device_memory, offset);
+    VKAL_ASSERT(result && "failed to bind image memory!");
+    vkal_info.user_images[image_id].heap = heap_index;
+    vkal_info.user_images[image_id].offset = offset;
+}
+
+/* Gives the range back to the heap. Dedicated heaps are released right away, paged heaps are kept for reuse. */
+void free_image_memory(uint32_t heap_index, VkDeviceSize offset)
+{
+    assert(heap_index < VKAL_MAX_IMAGE_HEAPS);
+    VkalImageHeap * heap = &vkal_info.image_heaps[heap_index];
+    assert(heap->used);
+    vkal_device_memory_free(&heap->memory, offset);
+    if (heap->size_class == VKAL_IMAGE_HEAP_CLASS_DEDICATED && heap->memory.free == heap->memory.size) {
+        vkal_free_devicememory(&heap->memory);
+        heap->used = 0;
+    }
+}
+
 VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t mem_type_bits)
 {
     VkDeviceMemory memory;
@@ -3088,8 +6825,6 @@ VkalBuffer create_buffer(uint32_t size, VkBufferUsageFlags usage)
     return buffer;
 }
 
-// TODO: Destroy Buffer
-
 void create_default_vertex_buffer(uint32_t size)
 {
     vkal_info.default_vertex_buffer = create_buffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
@@ -3176,31 +6911,17 @@ uint64_t vkal_vertex_buffer_add(void * vertices, uint32_t vertex_size, uint32_t
     uint32_t vertices_in_bytes = vertex_count * vertex_size;
     uint64_t size = (vertices_in_bytes + alignment - 1) & ~(alignment - 1);
     
-    // map staging memory and upload vertex data
-    void * staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, vertices, vertices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-    
-    // copy vertex buffer data from staging memory (host visible) to device local memory for every command buffer
-    uint64_t offset = vkal_info.default_vertex_buffer_offset;
-
-	VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-	VkBufferCopy buffer_copy = { 0 };
-	buffer_copy.dstOffset = offset;
-	buffer_copy.srcOffset = 0;
-	buffer_copy.size = vertices_in_bytes;
-	vkCmdCopyBuffer(cmd_buffer,
-			vkal_info.staging_buffer.buffer, vkal_info.default_vertex_buffer.buffer, 1, &buffer_copy);
-	vkEndCommandBuffer(cmd_buffer);
-    
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;// vkal_info.command_buffer_count;
-	submit_info.pCommandBuffers = &cmd_buffer;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    // copy vertex buffer data via staging memory (host visible) to device local memory. After a reset the
+    // range might still be in use by frames in flight, so it has to be ordered against graphics work.
+    // Start at a multiple of the vertex size, so that indirect draws can address the mesh by vertexOffset.
+    uint64_t offset = (vkal_info.default_vertex_buffer_offset + vertex_size - 1) / vertex_size * vertex_size;
+    vkal_info.default_vertex_buffer_offset = offset;
+    if (vkal_info.default_vertex_buffer_recycled) {
+        vkal_upload_buffer(vkal_info.default_vertex_buffer.buffer, offset, vertices, vertices_in_bytes);
+    }
+    else {
+        vkal_upload_buffer_async(vkal_info.default_vertex_buffer.buffer, offset, vertices, vertices_in_bytes);
+    }
     
     // When mapping memory later again to copy into it (see:fluch_to_memory) we must respect
     // the devices alignment.
@@ -3213,81 +6934,78 @@ uint64_t vkal_vertex_buffer_add(void * vertices, uint32_t vertex_size, uint32_t
 void vkal_vertex_buffer_reset(void)
 {
     vkal_info.default_vertex_buffer_offset = 0;
+    vkal_info.default_vertex_buffer_recycled = 1;
 }
 
 // NOTE: If vertex_count is higher than the current buffer, vertex data after offset+vertex_count (in bytes) will be overwritten!!!
 void vkal_vertex_buffer_update(void* vertices, uint32_t vertex_count, uint32_t vertex_size, VkDeviceSize offset)
 {
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
     uint32_t vertices_in_bytes = vertex_count * vertex_size;
-    uint64_t size = (vertices_in_bytes + alignment - 1) & ~(alignment - 1);
-
-    // map staging memory and upload vertex data
-    void* staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, vertices, vertices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-
-    // copy vertex buffer data from staging memory (host visible) to device local memory at offset position
-    VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VkBufferCopy buffer_copy = { 0 };
-    buffer_copy.dstOffset = offset;
-    buffer_copy.srcOffset = 0;
-    buffer_copy.size = vertices_in_bytes;
-    vkCmdCopyBuffer(cmd_buffer,
-        vkal_info.staging_buffer.buffer, vkal_info.default_vertex_buffer.buffer, 1, &buffer_copy);
-    vkEndCommandBuffer(cmd_buffer);
 
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;// vkal_info.command_buffer_count;
-    submit_info.pCommandBuffers = &cmd_buffer;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    // copy vertex buffer data via staging memory (host visible) to device local memory at offset position
+    vkal_upload_buffer(vkal_info.default_vertex_buffer.buffer, offset, vertices, vertices_in_bytes);
 }
 
-uint64_t vkal_index_buffer_add(uint16_t * indices, uint32_t index_count)
+static uint64_t index_buffer_add(void const * indices, uint32_t index_count, uint32_t index_size)
 {
     uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
-    uint32_t indices_in_bytes = index_count * sizeof(uint16_t);
+    uint32_t indices_in_bytes = index_count * index_size;
     uint64_t size = (indices_in_bytes + alignment - 1) & ~(alignment - 1);
     
-    // map staging memory and upload index data
-    void * staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, indices, indices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-    
-    // copy vertex index data from staging memory (host visible) to device local memory through a command buffer
-    uint64_t offset = vkal_info.default_index_buffer_offset;
-	VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-	VkBufferCopy buffer_copy = { 0 };
-	buffer_copy.dstOffset = offset;
-	buffer_copy.srcOffset = 0;
-	buffer_copy.size = indices_in_bytes;
-	vkCmdCopyBuffer(cmd_buffer, vkal_info.staging_buffer.buffer, vkal_info.default_index_buffer.buffer, 1, &buffer_copy);
-	vkEndCommandBuffer(cmd_buffer);
-    
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.commandBufferCount = 1; // vkal_info.default_command_buffer_count;
-	submit_info.pCommandBuffers = &cmd_buffer;  //vkal_info.default_command_buffers;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    // Index buffer offsets must be a multiple of the index size.
+    uint64_t offset = (vkal_info.default_index_buffer_offset + index_size - 1) / index_size * index_size;
+
+    // copy vertex index data via staging memory (host visible) to device local memory
+    if (vkal_info.default_index_buffer_recycled) {
+        vkal_upload_buffer(vkal_info.default_index_buffer.buffer, offset, indices, indices_in_bytes);
+    }
+    else {
+        vkal_upload_buffer_async(vkal_info.default_index_buffer.buffer, offset, indices, indices_in_bytes);
+    }
     
     // When mapping memory later again to copy into it (see:fluch_to_memory) we must respect
     // the devices alignment.
     // See: https://www.khronos.org/registry/vulkan/specs/1.2-extensions/man/html/VkMappedMemoryRange.html
-    vkal_info.default_index_buffer_offset += size;
+    vkal_info.default_index_buffer_offset = offset + size;
     
     return offset;
 }
 
+uint64_t vkal_index_buffer_add(uint16_t * indices, uint32_t index_count)
+{
+    return index_buffer_add(indices, index_count, sizeof(uint16_t));
+}
+
+/* With narrow set the indices are stored as uint16_t if the largest one fits, which halves their memory and
+   bandwidth. 0xFFFF is left out as it restarts primitives in 16 bit index buffers. All records of an indirect
+   buffer share one index type, so meshes that are batched with meshes of more than 64k vertices have to be
+   added without narrow. out_index_type is what the draw helpers have to be given for the returned offset. */
+uint64_t vkal_index_buffer_add32(uint32_t const * indices, uint32_t index_count, int narrow, VkIndexType * out_index_type)
+{
+    uint32_t max_index = 0;
+    for (uint32_t i = 0; i < index_count && narrow; ++i) {
+        max_index = VKAL_MAX(max_index, indices[i]);
+    }
+    if (!narrow || max_index >= 0xFFFF) {
+        *out_index_type = VK_INDEX_TYPE_UINT32;
+        return index_buffer_add(indices, index_count, sizeof(uint32_t));
+    }
+
+    uint16_t * narrow_indices = NULL;
+    VKAL_MALLOC(narrow_indices, index_count);
+    for (uint32_t i = 0; i < index_count; ++i) {
+        narrow_indices[i] = (uint16_t)indices[i];
+    }
+    uint64_t offset = index_buffer_add(narrow_indices, index_count, sizeof(uint16_t));
+    VKAL_FREE(narrow_indices);
+    *out_index_type = VK_INDEX_TYPE_UINT16;
+    return offset;
+}
+
 void vkal_index_buffer_reset(void)
 {
     vkal_info.default_index_buffer_offset = 0;
+    vkal_info.default_index_buffer_recycled = 1;
 }
 
 VkDeviceAddress vkal_get_buffer_device_address(VkBuffer buffer)
@@ -3306,6 +7024,11 @@ void vkal_cleanup(void) {
 
 
     vkQueueWaitIdle(vkal_info.graphics_queue);
+    destroy_compute_submits();
+    destroy_frame_contexts();
+    destroy_readback_slots();
+    destroy_upload_batches();
+    destroy_timelines();
     
     VKAL_FREE(vkal_info.available_instance_extensions);
     VKAL_FREE(vkal_info.available_instance_layers);
@@ -3333,10 +7056,12 @@ void vkal_cleanup(void) {
     vkFreeMemory(vkal_info.device, vkal_info.default_device_memory_vertex, 0);
     
     for (uint32_t i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
-		vkDestroyFence(vkal_info.device, vkal_info.in_flight_fences[i], NULL);
 		vkDestroySemaphore(vkal_info.device, vkal_info.render_finished_semaphores[i], NULL);
 		vkDestroySemaphore(vkal_info.device, vkal_info.image_available_semaphores[i], NULL);
     }
+    for (uint32_t i = 0; i < VKAL_MAX_SWAPCHAIN_IMAGES; ++i) {
+        vkDestroySemaphore(vkal_info.device, vkal_info.present_semaphores[i], NULL);
+    }
     
     vkDestroyBuffer(vkal_info.device, vkal_info.default_uniform_buffer.buffer, 0);
     vkDestroyBuffer(vkal_info.device, vkal_info.default_vertex_buffer.buffer, 0);
@@ -3349,6 +7074,12 @@ void vkal_cleanup(void) {
     for (uint32_t i = 0; i < VKAL_MAX_VKIMAGE; ++i) {
         vkal_destroy_image(i);
     }
+    for (uint32_t i = 0; i < VKAL_MAX_IMAGE_HEAPS; ++i) {
+        if (vkal_info.image_heaps[i].used) {
+            vkal_free_devicememory(&vkal_info.image_heaps[i].memory);
+            vkal_info.image_heaps[i].used = 0;
+        }
+    }
 
     for (uint32_t i = 0; i < VKAL_MAX_VKSHADERMODULE; ++i) {
 		destroy_shader_module(i);
@@ -3367,7 +7098,9 @@ void vkal_cleanup(void) {
     }
 
     for (uint32_t i = 0; i < VKAL_MAX_VKSAMPLER; ++i) {
-		destroy_sampler(i);
+		while (vkal_info.user_samplers[i].used) {
+			destroy_sampler(i);
+		}
     }
 
     for (uint32_t i = 0; i < VKAL_MAX_VKFRAMEBUFFER; ++i) {
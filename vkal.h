@@ -29,6 +29,8 @@
 //#include <vulkan/vk_enum_string_helper.h>
 
 #define VKAL_NULL                       0
+#define VKAL_INVALID_ID                 UINT32_MAX
+#define VKAL_MIP_LEVELS_ALL             UINT32_MAX /* mip_level_count: generate the full mip chain */
 
 #define VKAL_MB							(1024 * 1024)
 #define STAGING_BUFFER_SIZE				(64 * VKAL_MB)
@@ -38,11 +40,22 @@
 
 #define VKAL_MAX_SWAPCHAIN_IMAGES		4
 #define VKAL_MAX_IMAGES_IN_FLIGHT		4
+#define VKAL_MAX_FRAMES_IN_FLIGHT		4
+#define VKAL_DEFAULT_FRAMES_IN_FLIGHT	2
+#define VKAL_FRAME_SCRATCH_SIZE			(4 * VKAL_MB)
+#define VKAL_MAX_RECORD_THREADS			16
+#define VKAL_MAX_CACHED_DESCRIPTOR_SETS	4
 #define VKAL_MAX_DESCRIPTOR_SETS		10
 #define VKAL_MAX_COMMAND_POOLS			2
 #define VKAL_MAX_VKDEVICEMEMORY			128
-#define VKAL_MAX_VKIMAGE				128
-#define VKAL_MAX_VKIMAGEVIEW			128
+#define VKAL_MAX_DEVICEMEMORY_BLOCKS	256
+#define VKAL_MAX_VKIMAGE				4096
+#define VKAL_MAX_VKIMAGEVIEW			4096
+#define VKAL_MAX_IMAGE_HEAPS			64
+#define VKAL_IMAGE_HEAP_SMALL_LIMIT		(1 * VKAL_MB)	/* images up to this size go to small pages */
+#define VKAL_IMAGE_HEAP_SMALL_SIZE		(16 * VKAL_MB)
+#define VKAL_IMAGE_HEAP_LARGE_LIMIT		(32 * VKAL_MB)	/* images above this size get their own VkDeviceMemory */
+#define VKAL_IMAGE_HEAP_LARGE_SIZE		(64 * VKAL_MB)
 #define VKAL_MAX_VKSHADERMODULE			64
 #define VKAL_MAX_VKPIPELINELAYOUT		64
 #define VKAL_MAX_VKDESCRIPTORSETLAYOUT	128
@@ -50,6 +63,13 @@
 #define VKAL_MAX_VKSAMPLER				128
 #define VKAL_MAX_TEXTURES				10
 #define VKAL_MAX_VKFRAMEBUFFER			64
+#define VKAL_MAX_UPLOAD_BATCHES			4	/* upload batches that can be in flight at the same time */
+#define VKAL_MAX_COMPUTE_SUBMITS		4	/* vkal_compute_submit calls that can be in flight at the same time */
+#define VKAL_COMPUTE_CONSUME_STAGES		(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT) /* compute waits on uploads and releases here */
+#define VKAL_MAX_UPLOAD_RANGES			256	/* copy destinations tracked per batch to detect overlapping writes */
+#define VKAL_MAX_READBACKS				8	/* readbacks that can be alive at the same time */
+#define VKAL_MAX_UPLOAD_IMPORTS			16	/* imported host memory ranges per upload batch */
+#define VKAL_HOST_IMPORT_MIN_SIZE		(4 * VKAL_MB) /* smaller uploads are faster through the staging ring */
 #define VKAL_VSYNC_ON					1
 #define VKAL_SHADOW_MAP_DIMENSION		2048
 
@@ -94,9 +114,16 @@ extern "C" {
 #endif
 
 
+/* Size of a texel block. Uncompressed formats have 1x1 blocks of one texel. */
+typedef struct VkalFormatInfo
+{
+    uint32_t block_width;
+    uint32_t block_height;
+    uint32_t block_size;  /* bytes per block, 0 for formats vkal does not know */
+} VkalFormatInfo;
+
 typedef struct VkalTexture
 {
-    uint32_t  device_memory_id;
     VkSampler sampler;
     uint32_t  image;
     uint32_t  image_view;
@@ -104,16 +131,54 @@ typedef struct VkalTexture
     uint32_t  height;
     uint32_t  channels;
     uint32_t  binding;
+    VkFormat  format;
+    uint32_t  mip_level_count;
+    uint32_t  array_layer_count;
     char      texture_file[64];
 } VkalTexture;
 
+/* A range inside of a DeviceMemory. Blocks are kept sorted by offset and cover the whole
+   VkDeviceMemory without gaps. Neighbouring free blocks are always merged. */
+typedef struct DeviceMemoryBlock
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint8_t      used;
+    uint8_t      linear; /* buffers and linear images are 1, optimal images are 0 */
+} DeviceMemoryBlock;
+
+typedef struct DeviceMemoryStats
+{
+    VkDeviceSize size;
+    VkDeviceSize used;
+    VkDeviceSize free;
+    VkDeviceSize largest_free_block;
+    uint32_t     allocation_count;
+    uint32_t     free_block_count;
+    float        fragmentation; /* 0: all free memory is one contiguous block. Goes to 1 the more scattered it gets. */
+} DeviceMemoryStats;
+
+/* What a DeviceMemory is used for. vkal_allocate_devicememory2 picks the memory type from this. */
+typedef enum VkalMemoryUsage {
+    VKAL_MEMORY_USAGE_GPU_ONLY = 0, /* filled through uploads, only the GPU reads it */
+    VKAL_MEMORY_USAGE_DYNAMIC,      /* rewritten by the CPU every frame, read by the GPU */
+    VKAL_MEMORY_USAGE_READBACK      /* written by the GPU, read by the CPU */
+} VkalMemoryUsage;
+
 typedef struct DeviceMemory
 {
-    VkDeviceMemory vk_device_memory;
-    VkDeviceSize   size;
-    VkDeviceSize   alignment;
-    VkDeviceSize   free;
-    uint32_t       mem_type_index;
+    VkDeviceMemory    vk_device_memory;
+    VkDeviceSize      size;
+    VkDeviceSize      alignment;
+    VkDeviceSize      free;        /* bytes that are currently not sub-allocated */
+    VkDeviceSize      granularity; /* bufferImageGranularity */
+    uint32_t          mem_type_index;
+    VkMemoryPropertyFlags property_flags;
+    VkalMemoryUsage   usage;
+    void            * mapped;      /* the whole VkDeviceMemory, shared by all mapped buffers */
+    uint32_t          map_count;
+    DeviceMemoryBlock blocks[VKAL_MAX_DEVICEMEMORY_BLOCKS];
+    uint32_t          block_count;
 } DeviceMemory;
 
 typedef struct VkalBuffer
@@ -133,7 +198,6 @@ typedef struct VkalImage
     uint32_t      image;
     uint32_t      image_view;
     VkSampler     sampler;
-    uint32_t      device_memory;
     uint32_t      width, height;
 } VkalImage;
 
@@ -159,16 +223,293 @@ typedef struct DescriptorSetLayout
     VkDescriptorSetLayout	layout;
 } DescriptorSetLayout;
 
+/* Every upload request is recorded into the currently open batch. The ticket of that batch
+   can be waited on or polled. Tickets grow monotonically, so ticket N being complete means that
+   every ticket < N is complete as well. */
+typedef uint64_t VkalUploadTicket;
+
+typedef struct VkalUploadRange {
+    VkBuffer     buffer;
+    VkImage      image;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} VkalUploadRange;
+
+/* Host memory that was imported with VK_EXT_external_memory_host for the copies of a batch. */
+typedef struct VkalUploadImport {
+    VkBuffer       buffer;
+    VkDeviceMemory memory;
+} VkalUploadImport;
+
+/* A batch always has a graphics command buffer. If the device has a dedicated transfer family, copies into
+   resources that are not in use yet are recorded into the transfer command buffer instead and handed over to the
+   graphics family with queue family ownership barriers. The graphics submit waits for the transfer submit on the
+   transfer timeline, so the graphics timeline value of the batch covers both queues. */
+typedef struct VkalUploadBatch {
+    VkCommandBuffer  command_buffer;
+    VkCommandBuffer  transfer_command_buffer;
+    uint64_t         timeline_value; /* graphics timeline value of the submit */
+    VkalUploadTicket ticket;
+    uint64_t         staging_end;   /* ring head at submit time. Becomes the ring tail once the batch retires. */
+    VkalUploadRange  ranges[VKAL_MAX_UPLOAD_RANGES];
+    uint32_t         range_count;
+    VkalUploadImport imports[VKAL_MAX_UPLOAD_IMPORTS]; /* freed when the batch retires */
+    uint32_t         import_count;
+    uint8_t          recording;
+    uint8_t          transfer_recording;
+    uint8_t          in_flight;
+} VkalUploadBatch;
+
+/* The staging memory is mapped once and handed out as a ring. head and tail count bytes
+   and never wrap, the position inside of the buffer is head % size. */
+typedef struct VkalStagingRing {
+    uint8_t      * mapped;
+    VkDeviceSize size;
+    uint64_t     head;
+    uint64_t     tail;
+} VkalStagingRing;
+
+/* Readbacks copy GPU data into host cached memory. A readback is identified by a serial number, its slot
+   is serial % VKAL_MAX_READBACKS. At most VKAL_MAX_READBACKS readbacks can be alive, they have to be
+   released with vkal_readback_release before their slot is used again. 0 is never a valid readback. */
+typedef uint64_t VkalReadback;
+
+typedef struct VkalReadbackSlot {
+    VkBuffer        buffer;
+    VkDeviceMemory  memory;
+    VkDeviceSize    capacity;
+    uint8_t       * mapped;
+    VkCommandBuffer command_buffer;
+    uint64_t        timeline_value; /* graphics timeline value of the submit */
+    VkalReadback    readback;  /* 0 if the slot is free */
+    VkDeviceSize    size;
+    uint8_t         in_flight;
+    uint8_t         invalidated;
+} VkalReadbackSlot;
+
+/* A mesh in the default vertex and index buffers drawn with a range of instances, see vkal_update_indirect_buffer. */
+typedef struct VkalDrawRecord {
+    uint64_t    index_buffer_offset;  /* as returned by vkal_index_buffer_add(32) */
+    uint32_t    index_count;
+    VkIndexType index_type;           /* 0 is VK_INDEX_TYPE_UINT16, all records of an indirect buffer share one */
+    uint64_t    vertex_buffer_offset; /* as returned by vkal_vertex_buffer_add */
+    uint32_t    vertex_size;
+    uint32_t    first_instance;
+    uint32_t    instance_count;
+} VkalDrawRecord;
+
+/* GPU resident draw commands. The buffer starts with the uint32_t draw count read by vkal_draw_indirect_count,
+   followed by max_draw_count VkDrawIndexedIndirectCommands at VKAL_INDIRECT_COMMANDS_OFFSET. Shaders can write
+   both, the buffer is a storage buffer too. */
+#define VKAL_INDIRECT_COMMANDS_OFFSET 16
+typedef struct VkalIndirectBuffer {
+    VkalBuffer  buffer;
+    uint32_t    max_draw_count;
+    uint32_t    draw_count;     /* commands written by vkal_update_indirect_buffer */
+    VkIndexType index_type;     /* of the records written by vkal_update_indirect_buffer */
+} VkalIndirectBuffer;
+
+/* What the draw and bind helpers last bound in a command buffer, so that binding the same thing again can be skipped.
+   Only known command buffers have one: the default command buffers and those of the frame contexts. It is reset when
+   the command buffer is begun. Binding through vkCmd* directly has to be followed by vkal_invalidate_state. */
+typedef struct VkalCommandState {
+    VkPipeline       pipeline;
+    VkBuffer         index_buffer;
+    VkDeviceSize     index_offset;
+    VkIndexType      index_type;
+    VkBuffer         vertex_buffer;
+    VkDeviceSize     vertex_offset;
+    VkPipelineLayout pipeline_layout;
+    VkDescriptorSet  descriptor_sets[VKAL_MAX_CACHED_DESCRIPTOR_SETS]; /* bound without dynamic offsets */
+    VkViewport       viewport;
+    VkRect2D         scissor;
+    uint8_t          viewport_valid;
+    uint8_t          scissor_valid;
+} VkalCommandState;
+
+/* Everything the CPU touches while recording one frame. A context is only reused after its submit
+   completed, so nothing in it is pending on the GPU while the frame is recorded. The number of
+   contexts is independent of the number of swapchain images, see vkal_set_frames_in_flight. */
+typedef struct VkalFrameContext {
+    VkCommandPool   command_pool;    /* transient, reset as a whole in vkal_begin_frame */
+    VkCommandBuffer command_buffer;
+    uint64_t        timeline_value;  /* graphics timeline value of the frame's submit */
+    VkSemaphore     image_available;
+    VkBuffer        scratch_buffer;  /* host visible, see vkal_frame_scratch_alloc */
+    VkDeviceMemory  scratch_memory;
+    uint8_t       * scratch_mapped;
+    VkDeviceSize    scratch_size;
+    VkDeviceSize    scratch_offset;
+    uint32_t        image_id;        /* swapchain image acquired for this frame */
+
+    /* Secondary command buffers, one per recording thread. A pool is only ever used by its thread,
+       so threads can record without locking. They are all created with the context, so the handles
+       never change while threads record. */
+    VkCommandPool   thread_command_pools[VKAL_MAX_RECORD_THREADS];
+    VkCommandBuffer thread_command_buffers[VKAL_MAX_RECORD_THREADS];
+    uint8_t         thread_recorded[VKAL_MAX_RECORD_THREADS];
+
+    VkalCommandState state;
+    VkalCommandState thread_states[VKAL_MAX_RECORD_THREADS];
+} VkalFrameContext;
+
+/* Attachments of a dynamic rendering begun by vkal_begin*, vkal_end* moves them into their final layouts
+   like the finalLayout of the matching render pass would. */
+#define VKAL_MAX_RENDERING_SCOPES 8
+typedef struct VkalRenderingScope {
+    VkCommandBuffer      command_buffer; /* VK_NULL_HANDLE if the slot is free */
+    VkImage              images[2];      /* color, depth */
+    VkImageLayout        final_layouts[2];
+} VkalRenderingScope;
+
+/* A command buffer for vkal_begin_compute / vkal_compute_submit. It goes to the dedicated compute queue if the device
+   has one, the graphics queue otherwise. The next graphics submit waits for it, see vkal_compute_submit. */
+typedef struct VkalComputeSubmit {
+    VkCommandPool        command_pool;
+    VkCommandBuffer      command_buffer;
+    uint64_t             timeline_value; /* on the timeline of the queue it was submitted to */
+    uint8_t              recording;
+} VkalComputeSubmit;
+
+/* A timeline semaphore per queue. Every submit of vkal signals the next value of the queue's timeline, so all
+   work up to a value being done is a single counter query. completed caches the last value seen. */
+typedef struct VkalTimeline {
+    VkSemaphore semaphore;
+    uint64_t    submitted;
+    uint64_t    completed;
+} VkalTimeline;
+
+/* Render graph: passes declare how they use images and buffers, vkal_graph_compile culls passes whose results
+   are never used, places transient images with disjoint lifetimes into the same memory and derives batched
+   barriers with the stage and access masks of the actual uses. */
+#define VKAL_GRAPH_MAX_PASSES           32
+#define VKAL_GRAPH_MAX_RESOURCES        64
+#define VKAL_GRAPH_MAX_PASS_ACCESSES    16
+
+typedef enum VkalGraphUsage {
+    VKAL_GRAPH_USAGE_COLOR_ATTACHMENT,  /* write */
+    VKAL_GRAPH_USAGE_DEPTH_ATTACHMENT,  /* write, depth test and depth writes */
+    VKAL_GRAPH_USAGE_DEPTH_READ,        /* depth test without writes */
+    VKAL_GRAPH_USAGE_SAMPLED,           /* sampled image, uniform or storage buffer read in shaders */
+    VKAL_GRAPH_USAGE_STORAGE_READ,      /* storage image read in shaders */
+    VKAL_GRAPH_USAGE_STORAGE_WRITE,     /* write, storage image or buffer, may read as well */
+    VKAL_GRAPH_USAGE_TRANSFER_SRC,
+    VKAL_GRAPH_USAGE_TRANSFER_DST,      /* write */
+    VKAL_GRAPH_USAGE_INDIRECT,          /* indirect draw or dispatch arguments */
+    VKAL_GRAPH_USAGE_VERTEX_INPUT       /* vertex or index buffer */
+} VkalGraphUsage;
+
+typedef struct VkalGraph VkalGraph;
+typedef void (*VkalGraphExecute)(VkCommandBuffer command_buffer, VkalGraph * graph, void * user_data);
+
+typedef struct VkalGraphAccess {
+    uint32_t             resource;
+    VkPipelineStageFlags stages;
+    VkAccessFlags        access;
+    VkImageLayout        layout;
+    uint8_t              write;
+} VkalGraphAccess;
+
+/* One image or buffer barrier, the handles are looked up when the graph is executed. */
+typedef struct VkalGraphBarrier {
+    uint32_t             resource;
+    VkAccessFlags        src_access;
+    VkAccessFlags        dst_access;
+    VkImageLayout        old_layout;
+    VkImageLayout        new_layout;
+} VkalGraphBarrier;
+
+typedef struct VkalGraphPass {
+    char const *         name;
+    VkalGraphExecute     execute;
+    void *               user_data;
+    VkalGraphAccess      accesses[VKAL_GRAPH_MAX_PASS_ACCESSES];
+    uint32_t             access_count;
+    uint8_t              culled;
+    /* Barriers in front of the pass, recorded with a single vkCmdPipelineBarrier. */
+    VkalGraphBarrier     barriers[VKAL_GRAPH_MAX_PASS_ACCESSES];
+    uint32_t             barrier_count;
+    VkPipelineStageFlags src_stages; /* 0 if the pass needs no barrier */
+    VkPipelineStageFlags dst_stages;
+} VkalGraphPass;
+
+typedef struct VkalGraphResource {
+    uint8_t              is_image;
+    uint8_t              imported;
+    uint8_t              needed;
+    VkImage              image;
+    VkImageView          image_view;
+    VkFormat             format;
+    uint32_t             width;
+    uint32_t             height;
+    VkImageAspectFlags   aspect;
+    VkImageUsageFlags    usage;          /* transient images: collected from the accesses */
+    VkImageLayout        initial_layout; /* imported images */
+    VkImageLayout        final_layout;   /* imported images are left in this layout, UNDEFINED keeps the last one */
+    VkBuffer             buffer;
+    VkDeviceSize         offset;
+    VkDeviceSize         size;
+    VkDeviceSize         memory_offset;  /* transient images: placement inside of the graph's memory */
+    VkDeviceSize         memory_size;
+    uint32_t             first_pass;     /* lifetime, UINT32_MAX if no pass that is kept uses the resource */
+    uint32_t             last_pass;
+} VkalGraphResource;
+
+struct VkalGraph {
+    VkalGraphPass        passes[VKAL_GRAPH_MAX_PASSES];
+    uint32_t             pass_count;
+    VkalGraphResource    resources[VKAL_GRAPH_MAX_RESOURCES];
+    uint32_t             resource_count;
+    VkalGraphBarrier     final_barriers[VKAL_GRAPH_MAX_RESOURCES]; /* imported images into their final layout */
+    uint32_t             final_barrier_count;
+    VkPipelineStageFlags final_src_stages;
+    VkPipelineStageFlags final_dst_stages;
+    VkDeviceMemory       transient_memory;
+    uint8_t              compiled;
+    /* Filled by vkal_graph_compile. */
+    VkDeviceSize         transient_memory_size;  /* with aliasing */
+    VkDeviceSize         unaliased_memory_size;  /* what the transient images would take without aliasing */
+    uint32_t             barrier_count;          /* image and buffer barriers per execution */
+    uint32_t             barrier_batch_count;    /* vkCmdPipelineBarrier calls per execution */
+    uint32_t             culled_pass_count;
+};
+
+typedef struct QueueFamilyIndicies {
+    int has_graphics_family;
+    uint32_t graphics_family;
+    int has_present_family;
+    uint32_t present_family;
+    int has_transfer_family; /* transfer only family, usually backed by a DMA engine */
+    uint32_t transfer_family;
+    int has_compute_family;  /* compute family without graphics, for async compute */
+    uint32_t compute_family;
+} QueueFamilyIndicies;
+
 typedef struct VkalDeviceMemoryHandle {
     VkDeviceMemory device_memory;
     uint8_t        used;
 } VkalDeviceMemoryHandle;
 
 typedef struct VkalImageHandle {
-    VkImage image;
-    uint8_t used;
+    VkImage      image;
+    uint8_t      used;
+    uint32_t     heap;   /* index into image_heaps, VKAL_INVALID_ID if the image has no memory from a heap */
+    VkDeviceSize offset; /* bind offset inside of the heap */
 } VkalImageHandle;
 
+typedef enum VkalImageHeapClass {
+    VKAL_IMAGE_HEAP_CLASS_SMALL,
+    VKAL_IMAGE_HEAP_CLASS_LARGE,
+    VKAL_IMAGE_HEAP_CLASS_DEDICATED
+} VkalImageHeapClass;
+
+/* Images are sub-allocated from shared heaps that are keyed by memory type and size class. */
+typedef struct VkalImageHeap {
+    DeviceMemory       memory;
+    VkalImageHeapClass size_class;
+    uint8_t            used;
+} VkalImageHeap;
+
 typedef struct VkalImageViewHandle {
     VkImageView image_view;
     uint8_t     used;
@@ -195,9 +536,11 @@ typedef struct VkalPipelineHandle {
     uint8_t    used;
 } VkalPipelineHandle;
 
+/* Samplers with identical create infos are shared, used counts the references. */
 typedef struct VkalSamplerHandle {
-    VkSampler sampler;
-    uint8_t   used;
+    VkSampler           sampler;
+    VkSamplerCreateInfo create_info;
+    uint32_t            used;
 } VkalSamplerHandle;
 
 typedef struct VkalFramebufferHandle {
@@ -232,9 +575,21 @@ typedef struct VkalAccelerationStructure
     VkalBuffer buffer;
 } VkalAccelerationStructure;
 
+/* Pipeline state that vkal_create_graphics_pipeline2 leaves dynamic. It is set with the vkal_set_* helpers
+   after binding the pipeline, vkal_info.dynamic_state_support has the states the device can leave dynamic. */
+typedef enum VkalDynamicStateFlagBits {
+    VKAL_DYNAMIC_STATE_CULL_MODE          = 0x01,
+    VKAL_DYNAMIC_STATE_FRONT_FACE         = 0x02,
+    VKAL_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY = 0x04, /* within the topology class of the pipeline's topology */
+    VKAL_DYNAMIC_STATE_DEPTH_TEST         = 0x08, /* depth test enable, depth write enable and compare op */
+    VKAL_DYNAMIC_STATE_POLYGON_MODE       = 0x10  /* VK_EXT_extended_dynamic_state3 */
+} VkalDynamicStateFlagBits;
+typedef uint32_t VkalDynamicStateFlags;
+
 typedef struct VkalWantedFeatures {
     VkPhysicalDeviceVulkan11Features                    features11;
     VkPhysicalDeviceVulkan12Features                    features12;
+    VkPhysicalDeviceVulkan13Features                    features13; /* dynamicRendering: see vkal_begin_rendering */
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR       rayTracingPipelineFeatures;
     VkPhysicalDeviceAccelerationStructureFeaturesKHR    accelerationStructureFeatures;
     VkPhysicalDeviceFeatures2                           features2;
@@ -252,6 +607,7 @@ typedef struct VkalInfo
 #endif
 
     VkInstance instance;
+    uint32_t   instance_api_version; /* apiVersion the instance was created with */
 
     VkExtensionProperties			* available_instance_extensions;
     uint32_t						available_instance_extension_count;
@@ -269,11 +625,13 @@ typedef struct VkalInfo
     /* Active Physical Device */
     VkPhysicalDevice				physical_device;
     VkPhysicalDeviceProperties		physical_device_properties;
+    uint32_t                        api_version; /* lower of the instance and the device version, core features above it cannot be used */
     
     VkalDeviceMemoryHandle			user_device_memory[VKAL_MAX_VKDEVICEMEMORY];
 
     VkalImageHandle					user_images[VKAL_MAX_VKIMAGE];
     uint32_t						user_image_count;
+    VkalImageHeap					image_heaps[VKAL_MAX_IMAGE_HEAPS];
 
     VkalImageViewHandle				user_image_views[VKAL_MAX_VKIMAGEVIEW];
     VkalShaderModuleHandle			user_shader_modules[VKAL_MAX_VKSHADERMODULE];
@@ -286,6 +644,11 @@ typedef struct VkalInfo
     VkDevice	 device; 
     VkQueue		 graphics_queue;
     VkQueue      present_queue;
+    VkQueue      transfer_queue; /* VK_NULL_HANDLE if there is no dedicated transfer family */
+    VkQueue      compute_queue;  /* VK_NULL_HANDLE if there is no dedicated compute family */
+    QueueFamilyIndicies queue_families;
+    VkExtent3D   transfer_image_granularity;
+    VkDeviceSize host_import_alignment; /* 0 if VK_EXT_external_memory_host is not enabled */
     VkSurfaceKHR surface;
 
     VkSwapchainKHR	swapchain;
@@ -297,10 +660,24 @@ typedef struct VkalInfo
     VkImageView		swapchain_image_views[VKAL_MAX_SWAPCHAIN_IMAGES];
     uint32_t		depth_stencil_image;
     uint32_t		depth_stencil_image_view;
-    uint32_t		device_memory_depth_stencil;
 
     VkDeviceMemory	    device_memory_staging;
     VkalBuffer			staging_buffer;
+    VkalStagingRing     staging_ring;
+
+    VkCommandPool       upload_command_pool;
+    VkCommandPool       upload_transfer_command_pool;
+    VkalUploadBatch     upload_batches[VKAL_MAX_UPLOAD_BATCHES];
+    uint32_t            upload_batch_current;
+    VkDeviceSize        upload_chunk_size;
+    VkalUploadTicket    upload_ticket_submitted;
+    VkalUploadTicket    upload_ticket_completed;
+
+    VkalReadbackSlot    readback_slots[VKAL_MAX_READBACKS];
+    VkalReadback        readback_serial;
+    VkDeviceSize        dynamic_device_local_bytes; /* VKAL_MEMORY_USAGE_DYNAMIC memory in host visible VRAM */
+    uint32_t            readback_memory_type;
+    uint8_t             readback_memory_coherent;
 
     VkRenderPass		render_pass;
     VkRenderPass		render_to_image_render_pass;
@@ -314,11 +691,40 @@ typedef struct VkalInfo
     uint32_t			default_commandpool_count;
     VkCommandBuffer		* default_command_buffers;
     uint32_t			default_command_buffer_count;
+    VkalCommandState    default_command_states[VKAL_MAX_SWAPCHAIN_IMAGES];
+    uint8_t             state_cache_enabled;
+    uint8_t             multi_draw_indirect_supported;
+    uint8_t             draw_indirect_count_supported;
+    uint8_t             draw_indirect_first_instance_supported;
+    uint8_t             dynamic_rendering; /* requested through features13.dynamicRendering, no default framebuffers */
+    VkalDynamicStateFlags dynamic_state_support;
+    VkalRenderingScope  rendering_scopes[VKAL_MAX_RENDERING_SCOPES];
     
     VkSemaphore			image_available_semaphores[VKAL_MAX_IMAGES_IN_FLIGHT];
     VkSemaphore			render_finished_semaphores[VKAL_MAX_IMAGES_IN_FLIGHT];
-    VkFence				in_flight_fences[VKAL_MAX_IMAGES_IN_FLIGHT];
+    uint64_t			in_flight_values[VKAL_MAX_IMAGES_IN_FLIGHT]; /* graphics timeline values of the frames of vkal_queue_submit */
     uint32_t			frames_rendered;
+    uint8_t				frame_submitted; /* set between vkal_queue_submit and vkal_present, or vkal_submit_frame and vkal_present_frame */
+    VkSemaphore         frame_render_finished; /* what the present of the submitted frame waits on */
+    VkSemaphore         present_semaphores[VKAL_MAX_SWAPCHAIN_IMAGES]; /* per image, a frame context's one could still be waited on by its last present */
+    uint64_t            image_in_flight_values[VKAL_MAX_SWAPCHAIN_IMAGES]; /* graphics timeline value of the last frame that rendered to the image */
+
+    VkalFrameContext    frames[VKAL_MAX_FRAMES_IN_FLIGHT];
+    uint32_t            frame_count;
+    uint32_t            frame_index;
+    uint8_t             frame_active; /* set between vkal_begin_frame and vkal_end_frame */
+
+    VkalComputeSubmit   compute_submits[VKAL_MAX_COMPUTE_SUBMITS];
+    uint32_t            compute_submit_current;
+    uint64_t            compute_wait_value;  /* compute work the next graphics submit has to wait for */
+    VkPipelineStageFlags compute_wait_stages;
+    uint64_t            compute_graphics_wait_value;  /* graphics work the next compute submit has to wait for */
+    VkPipelineStageFlags compute_graphics_wait_stages;
+    uint8_t             graphics_release_pending;     /* a vkal_graphics_release_buffer waits for the next graphics submit */
+
+    VkalTimeline        graphics_timeline;
+    VkalTimeline        compute_timeline;    /* only used with a dedicated compute queue */
+    VkalTimeline        transfer_timeline;   /* only used with a dedicated transfer queue */
     //uint32_t current_frame;
     
 	VkalBuffer			default_uniform_buffer;
@@ -330,19 +736,16 @@ typedef struct VkalInfo
     uint64_t		default_uniform_buffer_offset;
     uint64_t		default_vertex_buffer_offset;
     uint64_t		default_index_buffer_offset;
+    uint32_t        default_vertex_buffer_recycled; /* set by reset, ranges might still be in use by the GPU */
+    uint32_t        default_index_buffer_recycled;
 
     VkDescriptorPool default_descriptor_pool;
 
     uint32_t        raytracing_enabled;
+    uint32_t        host_image_copy_supported; /* VK_EXT_host_image_copy is enabled and can write SHADER_READ_ONLY_OPTIMAL images */
+    uint32_t        host_image_copy_active;    /* textures are written from the CPU instead of through staging */
 } VkalInfo;
 
-typedef struct QueueFamilyIndicies {
-    int has_graphics_family;
-    uint32_t graphics_family;
-    int has_present_family;
-    uint32_t present_family;
-} QueueFamilyIndicies;
-
 typedef struct ShaderStageSetup
 {
     VkPipelineShaderStageCreateInfo vertex_shader_create_info;
@@ -438,9 +841,34 @@ VkPipeline vkal_create_graphics_pipeline(
     VkPrimitiveTopology primitive_topology,
     VkFrontFace face_winding, VkRenderPass render_pass,
 	VkPipelineLayout pipeline_layout);
+VkPipeline vkal_create_graphics_pipeline2(
+	VkVertexInputBindingDescription * vertex_input_bindings,
+	uint32_t vertex_input_binding_count,
+	VkVertexInputAttributeDescription * vertex_attributes,
+	uint32_t vertex_attribute_count,
+	ShaderStageSetup shader_setup,
+	VkBool32 depth_test_enable,
+	VkCompareOp depth_compare_op,
+	VkCullModeFlags cull_mode,
+	VkPolygonMode polygon_mode,
+	VkPrimitiveTopology primitive_topology,
+	VkFrontFace face_winding,
+	VkRenderPass render_pass,
+	VkPipelineLayout pipeline_layout,
+	VkalDynamicStateFlags dynamic_states);
+void vkal_set_cull_mode(VkCommandBuffer command_buffer, VkCullModeFlags cull_mode);
+void vkal_set_front_face(VkCommandBuffer command_buffer, VkFrontFace face_winding);
+void vkal_set_primitive_topology(VkCommandBuffer command_buffer, VkPrimitiveTopology primitive_topology);
+void vkal_set_depth_test(VkCommandBuffer command_buffer, VkBool32 depth_test_enable, VkBool32 depth_write_enable, VkCompareOp depth_compare_op);
+void vkal_set_polygon_mode(VkCommandBuffer command_buffer, VkPolygonMode polygon_mode);
 void create_graphics_pipeline(VkGraphicsPipelineCreateInfo create_info, uint32_t * out_graphics_pipeline);
 VkPipeline get_graphics_pipeline(uint32_t id);
 void destroy_graphics_pipeline(uint32_t id);
+VkPipeline vkal_create_compute_pipeline(SingleShaderStageSetup shader_setup, VkPipelineLayout pipeline_layout);
+void create_compute_pipeline(VkComputePipelineCreateInfo create_info, uint32_t * out_compute_pipeline);
+VkPipeline get_compute_pipeline(uint32_t id);
+void destroy_compute_pipeline(uint32_t id);
+void vkal_destroy_compute_pipeline(VkPipeline pipeline);
     
 void create_default_depth_buffer(void);
 void create_default_descriptor_pool(void);
@@ -448,17 +876,36 @@ void create_default_command_pool(void);
 void allocate_default_device_memory_uniform(void);
 void allocate_default_device_memory_vertex(void);
 void allocate_default_device_memory_index(void);
-DeviceMemory vkal_allocate_devicememory(uint32_t size, VkBufferUsageFlags buffer_usage_flags, VkMemoryPropertyFlags memory_property_flags, VkFlags mem_alloc_flags);
+DeviceMemory vkal_allocate_devicememory(VkDeviceSize size, VkBufferUsageFlags buffer_usage_flags, VkMemoryPropertyFlags memory_property_flags, VkFlags mem_alloc_flags);
+DeviceMemory vkal_allocate_devicememory2(VkDeviceSize size, VkBufferUsageFlags buffer_usage_flags, VkalMemoryUsage memory_usage, VkFlags mem_alloc_flags);
+int vkal_buffer_is_host_visible(VkalBuffer * buffer);
+void vkal_free_devicememory(DeviceMemory * device_memory);
+void init_device_memory(DeviceMemory * device_memory, VkDeviceMemory memory, VkDeviceSize size, VkDeviceSize alignment, uint32_t mem_type_index);
+int vkal_device_memory_alloc(DeviceMemory * device_memory, VkDeviceSize size, VkDeviceSize alignment, uint32_t linear, VkDeviceSize * out_offset);
+void vkal_device_memory_free(DeviceMemory * device_memory, VkDeviceSize offset);
+DeviceMemoryStats vkal_device_memory_stats(DeviceMemory const * device_memory);
 void create_default_uniform_buffer(uint32_t size);
 void create_default_vertex_buffer(uint32_t size);
 void create_default_index_buffer(uint32_t size);
 void create_default_semaphores(void);
+void create_frame_contexts(uint32_t count);
+void destroy_frame_contexts(void);
+void vkal_set_frames_in_flight(uint32_t count);
+VkalFrameContext * vkal_begin_frame(void);
+void vkal_end_frame(VkalFrameContext * frame);
+void vkal_submit_frame(VkalFrameContext * frame);
+void vkal_present_frame(VkalFrameContext * frame);
+VkDeviceSize vkal_frame_scratch_alloc(VkalFrameContext * frame, VkDeviceSize size, VkDeviceSize alignment, void ** out_mapped);
+VkCommandBuffer vkal_begin_secondary(VkalFrameContext * frame, uint32_t thread_index, VkRenderPass render_pass, VkFramebuffer framebuffer);
+void vkal_end_secondary(VkCommandBuffer command_buffer);
+void vkal_execute_secondaries(VkalFrameContext * frame);
 void vkal_cleanup(void);
 void flush_to_memory(VkDeviceMemory device_memory, void * dst_memory, void * src_memory, uint32_t size, uint32_t offset);
 uint64_t vkal_vertex_buffer_add(void * vertices, uint32_t vertex_size, uint32_t vertex_count);
 void vkal_vertex_buffer_reset(void);
 void vkal_vertex_buffer_update(void* vertices, uint32_t vertex_count, uint32_t vertex_size, VkDeviceSize offset);
 uint64_t vkal_index_buffer_add(uint16_t * indices, uint32_t index_count);
+uint64_t vkal_index_buffer_add32(uint32_t const * indices, uint32_t index_count, int narrow, VkIndexType * out_index_type);
 void vkal_index_buffer_reset(void);
 
 #if defined (VKAL_GLFW)
@@ -480,10 +927,39 @@ void vkal_update_descriptor_set_texturearray(
 	uint32_t array_element, VkalTexture texture);
 void vkal_update_uniform(UniformBuffer * uniform_buffer, void * data);
 uint32_t check_memory_type_index(uint32_t const memory_requirement_bits, VkMemoryPropertyFlags const wanted_property);
-void upload_texture(VkImage const image, uint32_t w, uint32_t h, uint32_t n, uint32_t array_layer_count, unsigned char * texture_data);
+uint32_t find_memory_type_index(uint32_t memory_requirement_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+VkalUploadTicket upload_texture(VkImage const image, uint32_t w, uint32_t h, uint32_t n, uint32_t array_layer_count, unsigned char * texture_data);
+VkalUploadTicket upload_texture_levels(VkImage const image, uint32_t w, uint32_t h, VkalFormatInfo format_info,
+    uint32_t array_layer_count, uint32_t mip_level_count, unsigned char * texture_data, VkDeviceSize const * level_offsets);
+int texture_use_host_image_copy(VkFormat format);
+void upload_texture_levels_host(VkImage const image, uint32_t w, uint32_t h, VkalFormatInfo format_info,
+    uint32_t array_layer_count, uint32_t mip_level_count, unsigned char * texture_data, VkDeviceSize const * level_offsets);
+void vkal_use_host_image_copy(int enable);
+VkalUploadTicket generate_mipmaps(VkImage const image, uint32_t w, uint32_t h, uint32_t array_layer_count, uint32_t mip_level_count, VkFilter filter);
+uint32_t vkal_mip_level_count(uint32_t width, uint32_t height);
 void create_staging_buffer(uint32_t size);
+void create_upload_batches(void);
+void destroy_upload_batches(void);
+VkalUploadTicket vkal_upload_buffer(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size);
+VkalUploadTicket vkal_upload_buffer_async(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size);
+VkalUploadTicket vkal_upload_buffer_host(VkBuffer buffer, VkDeviceSize offset, void const * data, VkDeviceSize size);
+VkalUploadTicket vkal_upload_flush(void);
+void vkal_set_upload_chunk_size(VkDeviceSize chunk_size);
+VkalUploadTicket vkal_upload_current_ticket(void);
+void vkal_upload_wait(VkalUploadTicket ticket);
+int vkal_upload_is_complete(VkalUploadTicket ticket);
+void create_readback_slots(void);
+void destroy_readback_slots(void);
+VkalReadback vkal_readback_image(VkImage image, VkImageLayout layout, VkImageAspectFlags aspect, VkFormat format,
+    int32_t x, int32_t y, uint32_t width, uint32_t height);
+VkalReadback vkal_readback_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+int vkal_readback_is_ready(VkalReadback readback);
+void vkal_readback_wait(VkalReadback readback);
+void const * vkal_readback_map(VkalReadback readback, VkDeviceSize * out_size);
+void vkal_readback_release(VkalReadback readback);
 VkalBuffer create_buffer(uint32_t size, VkBufferUsageFlags usage);
 VkalBuffer vkal_create_buffer(VkDeviceSize size, DeviceMemory * device_memory, VkBufferUsageFlags buffer_usage_flags);
+void vkal_destroy_buffer(VkalBuffer * buffer);
 void vkal_map_buffer(VkalBuffer* buffer);
 void vkal_unmap_buffer(VkalBuffer * buffer);
 void vkal_update_buffer_offset(VkalBuffer * buffer, uint8_t* data, uint32_t byte_count, uint32_t offset);
@@ -504,6 +980,10 @@ VkImageView get_image_view(uint32_t id);
 VkSampler create_sampler(
 	VkFilter min_filter, VkFilter mag_filter, VkSamplerAddressMode u,
 	VkSamplerAddressMode v, VkSamplerAddressMode w);
+VkSampler create_sampler2(
+	VkFilter min_filter, VkFilter mag_filter, VkSamplerAddressMode u,
+	VkSamplerAddressMode v, VkSamplerAddressMode w,
+	VkSamplerMipmapMode mipmap_mode, float max_lod);
 static void internal_create_sampler(VkSamplerCreateInfo create_info, uint32_t * out_sampler);
 VkSampler get_sampler(uint32_t id);
 void destroy_sampler(uint32_t id);
@@ -519,6 +999,8 @@ VkPipelineLayout get_pipeline_layout(uint32_t id);
 VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t mem_type_bits);
 void create_device_memory(VkDeviceSize size, uint32_t mem_type_bits, uint32_t * out_memory_id);
 uint32_t vkal_destroy_device_memory(uint32_t id);
+void bind_image_memory(uint32_t image_id, VkMemoryPropertyFlags memory_property_flags);
+void free_image_memory(uint32_t heap_index, VkDeviceSize offset);
 VkDeviceMemory get_device_memory(uint32_t id);
 VkWriteDescriptorSet create_write_descriptor_set_image(
 	VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
@@ -545,6 +1027,20 @@ VkalTexture vkal_create_texture(
 	uint32_t base_array_layer, uint32_t array_layer_count,
     VkFilter min_filter, VkFilter mag_filter,
 	VkSamplerAddressMode sampler_u, VkSamplerAddressMode sampler_v, VkSamplerAddressMode sampler_w);
+VkalTexture vkal_create_texture_from_levels(
+	uint32_t binding,
+    unsigned char * texture_data, VkDeviceSize const * level_offsets,
+	uint32_t width, uint32_t height, VkFormat format,
+	uint32_t mip_level_count, uint32_t array_layer_count,
+	VkImageCreateFlags flags, VkImageViewType view_type,
+    VkFilter min_filter, VkFilter mag_filter,
+	VkSamplerAddressMode sampler_u, VkSamplerAddressMode sampler_v, VkSamplerAddressMode sampler_w);
+void vkal_destroy_texture(VkalTexture * texture);
+VkalUploadTicket vkal_update_texture_region(VkalTexture * texture,
+    int32_t x, int32_t y, uint32_t width, uint32_t height,
+    uint32_t array_layer, uint32_t mip_level, unsigned char * data);
+VkalFormatInfo vkal_format_info(VkFormat format);
+VkDeviceSize vkal_image_level_size(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
 RenderImage create_render_image(uint32_t width, uint32_t height);
 void vkal_update_descriptor_set_texture(VkDescriptorSet descriptor_set, VkalTexture texture);
 void vkal_update_descriptor_set_render_image(
@@ -560,15 +1056,25 @@ void create_shader_module(uint8_t const * shader_byte_code, int size, uint32_t *
 VkShaderModule get_shader_module(uint32_t id);
 void destroy_shader_module(uint32_t id);
 uint32_t vkal_get_image(void);
+void vkal_use_state_cache(int enable);
+void vkal_invalidate_state(VkCommandBuffer command_buffer);
 void vkal_viewport(VkCommandBuffer command_buffer, float x, float y, float width, float height);
 void vkal_scissor(VkCommandBuffer command_buffer, float offset_x, float offset_y, float extent_x, float extent_y);
 void vkal_draw_indexed(
     uint32_t image_id, VkPipeline pipeline,
     VkDeviceSize index_buffer_offset, uint32_t index_count,
     VkDeviceSize vertex_buffer_offset, uint32_t instance_count);
+void vkal_draw_indexed_typed(
+    uint32_t image_id, VkPipeline pipeline,
+    VkDeviceSize index_buffer_offset, uint32_t index_count, VkIndexType index_type,
+    VkDeviceSize vertex_buffer_offset, uint32_t instance_count);
 void vkal_draw_indexed_from_buffers(
     VkalBuffer index_buffer, uint64_t index_buffer_offset, uint32_t index_count, VkalBuffer vertex_buffer, uint64_t vertex_buffer_offset,
     uint32_t image_id, VkPipeline pipeline);
+void vkal_draw_indexed_from_buffers_typed(
+    VkalBuffer index_buffer, uint64_t index_buffer_offset, uint32_t index_count, VkIndexType index_type,
+    VkalBuffer vertex_buffer, uint64_t vertex_buffer_offset,
+    uint32_t image_id, VkPipeline pipeline);
 void vkal_draw(
     uint32_t image_id, VkPipeline pipeline,
     VkDeviceSize vertex_buffer_offset, uint32_t vertex_count);
@@ -580,6 +1086,27 @@ void vkal_draw_indexed2(
     VkCommandBuffer command_buffer, VkPipeline pipeline,
     VkDeviceSize index_buffer_offset, uint32_t index_count,
     VkDeviceSize vertex_buffer_offset);
+void vkal_draw_indexed2_typed(
+    VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkDeviceSize index_buffer_offset, uint32_t index_count, VkIndexType index_type,
+    VkDeviceSize vertex_buffer_offset);
+VkDeviceSize vkal_indirect_buffer_size(uint32_t max_draw_count);
+VkalIndirectBuffer vkal_create_indirect_buffer(DeviceMemory * device_memory, uint32_t max_draw_count);
+void vkal_destroy_indirect_buffer(VkalIndirectBuffer * indirect_buffer);
+VkalUploadTicket vkal_update_indirect_buffer(VkalIndirectBuffer * indirect_buffer, VkalDrawRecord const * records, uint32_t record_count);
+void vkal_draw_indexed_indirect(uint32_t image_id, VkPipeline pipeline,
+    VkalIndirectBuffer * indirect_buffer, uint32_t first_draw, uint32_t draw_count);
+void vkal_draw_indirect_count(uint32_t image_id, VkPipeline pipeline, VkalIndirectBuffer * indirect_buffer);
+void vkal_bind_compute_descriptor_sets(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout,
+    uint32_t first_set, VkDescriptorSet const * descriptor_sets, uint32_t descriptor_set_count);
+void vkal_dispatch(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
+void vkal_dispatch_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline, VkBuffer buffer, VkDeviceSize offset);
+void vkal_buffer_barrier(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
+void vkal_image_barrier(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+    VkImageSubresourceRange subresource_range,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
 void vkal_bind_descriptor_set(
 	uint32_t image_id,
 	VkDescriptorSet * descriptor_set,
@@ -604,6 +1131,7 @@ void vkal_bind_descriptor_set2(
 	VkPipelineLayout pipeline_layout);
 void vkal_begin_command_buffer(uint32_t image_id);
 void vkal_begin(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass render_pass);
+void vkal_begin2(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass render_pass, VkSubpassContents contents);
 void vkal_begin_render_to_image_render_pass(
 	uint32_t image_id, VkCommandBuffer command_buffer,
 	VkRenderPass render_pass, RenderImage render_image);
@@ -611,6 +1139,36 @@ void vkal_begin_render_pass(uint32_t image_id, VkRenderPass render_pass);
 void vkal_end(VkCommandBuffer command_buffer);
 void vkal_end_command_buffer(uint32_t image_id);
 void vkal_end_renderpass(uint32_t image_id);
+void vkal_begin_rendering(VkCommandBuffer command_buffer, VkImageView * color_views, uint32_t color_view_count, VkImageView depth_view,
+    VkExtent2D extent, VkAttachmentLoadOp load_op);
+void vkal_end_rendering(VkCommandBuffer command_buffer);
+void create_timelines(void);
+void destroy_timelines(void);
+uint64_t vkal_submitted_value(void);
+int vkal_is_complete(uint64_t value);
+void vkal_wait(uint64_t value);
+void create_compute_submits(void);
+void destroy_compute_submits(void);
+VkCommandBuffer vkal_begin_compute(void);
+void vkal_compute_submit(VkCommandBuffer command_buffer, VkPipelineStageFlags wait_stage);
+void vkal_compute_wait_graphics(uint64_t value, VkPipelineStageFlags wait_stage);
+void vkal_compute_release_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags src_stage, VkAccessFlags src_access);
+void vkal_graphics_acquire_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
+void vkal_graphics_release_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags src_stage, VkAccessFlags src_access);
+void vkal_compute_acquire_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
+void vkal_graph_begin(VkalGraph * graph);
+uint32_t vkal_graph_create_image(VkalGraph * graph, uint32_t width, uint32_t height, VkFormat format, VkImageAspectFlags aspect);
+uint32_t vkal_graph_import_image(VkalGraph * graph, VkImage image, VkImageView image_view, VkImageAspectFlags aspect,
+    VkImageLayout initial_layout, VkImageLayout final_layout);
+uint32_t vkal_graph_import_buffer(VkalGraph * graph, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+void vkal_graph_set_image(VkalGraph * graph, uint32_t resource, VkImage image, VkImageView image_view);
+uint32_t vkal_graph_add_pass(VkalGraph * graph, char const * name, VkalGraphExecute execute, void * user_data);
+void vkal_graph_use(VkalGraph * graph, uint32_t pass, uint32_t resource, VkalGraphUsage usage, VkPipelineStageFlags shader_stages);
+void vkal_graph_compile(VkalGraph * graph);
+void vkal_graph_execute(VkalGraph * graph, VkCommandBuffer command_buffer);
+VkImage vkal_graph_get_image(VkalGraph * graph, uint32_t resource);
+VkImageView vkal_graph_get_image_view(VkalGraph * graph, uint32_t resource);
+void vkal_graph_destroy(VkalGraph * graph);
 void vkal_queue_submit(VkCommandBuffer * command_buffers, uint32_t command_buffer_count);
 void vkal_present(uint32_t image_id);
 VkDescriptorSetLayout vkal_create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count);